@@ -5,8 +5,12 @@ Integrates YOLO leaf detection with EfficientNet disease classification
 import os
 import io
 import json
+import math
+import struct
+import time
 import uuid
 from datetime import datetime
+from functools import lru_cache
 from typing import List, Tuple
 import numpy as np
 import torch
@@ -14,6 +18,7 @@ import torch.nn.functional as F
 from PIL import Image, ImageDraw, ImageFont
 from flask import Flask, request, render_template_string, send_from_directory, jsonify
 from flask_cors import CORS
+from werkzeug.serving import WSGIRequestHandler
 import requests
 import base64
 
@@ -24,6 +29,11 @@ except Exception as e:
 
 import timm
 
+try:
+    import plant_native  # Native image paths, built from native/ (see setup_guide.md)
+except ImportError:
+    plant_native = None
+
 # --------------------------- Config ---------------------------
 YOLO_WEIGHTS = "yolo11_leaves.pt"
 EFFNET_WEIGHTS = "efficientnet_b0_leaves.pth"
@@ -34,12 +44,16 @@ CONF_THRESH = 0.25
 NMS_IOU = 0.45
 MAX_UPLOAD_MB = 30
 CLS_IMG_SIZE = 224
+YOLO_IMG_SIZE = 640  # Long side YOLO resizes its input to
+ESP32_DEFAULT_IP = "192.168.4.1"
 
 FONT_PATHS = [
     "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf",
     "/System/Library/Fonts/Supplemental/Arial Unicode.ttf",
     "C:/Windows/Fonts/arial.ttf",
 ]
+FONT_SIZE = 18
+RESULT_QUALITY = 95
 
 # --------------------------- Utilities ---------------------------
 
@@ -76,7 +90,8 @@ def get_device() -> torch.device:
     return torch.device("cuda" if torch.cuda.is_available() else "cpu")
 
 def preprocess_for_effnet(pil_img: Image.Image) -> torch.Tensor:
-    img = pil_img.convert("RGB").resize((CLS_IMG_SIZE, CLS_IMG_SIZE))
+    # Bilinear, as torchvision's Resize applied it to the training images
+    img = pil_img.convert("RGB").resize((CLS_IMG_SIZE, CLS_IMG_SIZE), Image.BILINEAR)
     arr = np.array(img).astype(np.float32) / 255.0
     mean = np.array([0.485, 0.456, 0.406], dtype=np.float32)
     std = np.array([0.229, 0.224, 0.225], dtype=np.float32)
@@ -85,29 +100,128 @@ def preprocess_for_effnet(pil_img: Image.Image) -> torch.Tensor:
     tensor = torch.from_numpy(arr)
     return tensor
 
+def preprocess_batch(image, boxes: List[Tuple[float, float, float, float]]) -> torch.Tensor:
+    """Classifier input for each box of an H x W x 3 uint8 image, N x 3 x CLS_IMG_SIZE x CLS_IMG_SIZE"""
+    batch = torch.empty((len(boxes), 3, CLS_IMG_SIZE, CLS_IMG_SIZE), dtype=torch.float32)
+    if plant_native is not None:
+        # Crops, resizes and normalizes straight into the batch, crops in parallel
+        plant_native.preprocess(image, boxes, batch.numpy(), size=CLS_IMG_SIZE)
+    else:
+        pil_img = Image.fromarray(np.asarray(image))
+        for i, box in enumerate(boxes):
+            batch[i] = preprocess_for_effnet(pil_img.crop(tuple(map(int, box))))
+    return batch
+
+def decode_upload(data: bytes) -> Tuple[np.ndarray, float]:
+    """RGB pixels for the detector and the full resolution pixels per pixel. JPEGs
+    are decoded by plant_native at the coarsest DCT scale that still leaves YOLO's
+    input size on the long side; anything else is decoded in full by PIL."""
+    if plant_native is not None and data[:2] == b"\xff\xd8":
+        width, height = plant_native.jpeg_size(data)
+        side = min(YOLO_IMG_SIZE, max(width, height))
+        decoded = plant_native.decode_jpeg(data, side if width >= height else 0, side if height > width else 0)
+        return np.asarray(decoded), width / decoded.width
+    return np.array(Image.open(io.BytesIO(data)).convert("RGB")), 1.0
+
+def full_resolution(data: bytes, pixels: np.ndarray, scale: float) -> np.ndarray:
+    """The upload's pixels at full resolution, for the annotated result: the detector's
+    when decode_upload() left them there, otherwise the JPEG decoded again at full scale"""
+    return pixels if scale == 1 else np.asarray(plant_native.decode_jpeg(data))
+
+def classifier_source(data: bytes, pixels: np.ndarray, scale: float, boxes: List[Tuple[float, float, float, float]]):
+    """Image to crop the classifier input from, and the boxes (full resolution) in
+    its pixels. The detector's pixels do when every box still spans CLS_IMG_SIZE of
+    them; otherwise just the boxes' region is decoded again, as fine as the
+    smallest box needs."""
+    need = min(max(CLS_IMG_SIZE / max(min(x2 - x1, y2 - y1), 1) for x1, y1, x2, y2 in boxes), 1.0)
+    if scale * need <= 1:
+        return pixels, [(x1 / scale, y1 / scale, x2 / scale, y2 / scale) for x1, y1, x2, y2 in boxes]
+    region = (int(min(b[0] for b in boxes)), int(min(b[1] for b in boxes)),
+              math.ceil(max(b[2] for b in boxes)), math.ceil(max(b[3] for b in boxes)))
+    crop = plant_native.decode_jpeg(data, math.ceil((region[2] - region[0]) * need), region=region)
+    s = crop.scale
+    return crop, [(x1 / s - crop.x, y1 / s - crop.y, x2 / s - crop.x, y2 / s - crop.y) for x1, y1, x2, y2 in boxes]
+
+def read_latency_marker(data: bytes):
+    """Frame sequence and device timestamps from the COM segment the ESP32 adds in latency mode"""
+    if len(data) < 30 or data[:2] != b"\xff\xd8" or data[2:10] != b"\xff\xfe\x00\x1aPLAT":
+        return None
+    seq, grab_us, send_us = struct.unpack(">IQQ", data[10:30])
+    return {"seq": seq, "grab_us": grab_us, "send_us": send_us}
+
+def parse_snapshot(content_type: str, body: bytes) -> Tuple[dict, bytes]:
+    """State JSON and JPEG from the ESP32's multipart/mixed /snapshot response"""
+    if "boundary=" not in content_type:
+        raise ValueError("not a multipart response")
+    delim = b"--" + content_type.split("boundary=", 1)[1].split(";")[0].strip().strip('"').encode()
+    state, jpeg = None, None
+    pos = body.find(delim)
+    while pos >= 0 and body[pos + len(delim):pos + len(delim) + 2] == b"\r\n":
+        head_end = body.find(b"\r\n\r\n", pos)
+        if head_end < 0:
+            break
+        headers = {}
+        for line in body[pos + len(delim) + 2:head_end].split(b"\r\n"):
+            k, _, v = line.partition(b":")
+            headers[k.strip().lower()] = v.strip()
+        start = head_end + 4
+        end = start + int(headers.get(b"content-length", b"-1"))
+        if end < start or end > len(body):
+            raise ValueError("snapshot part without a valid Content-Length")
+        if headers.get(b"content-type") == b"application/json":
+            state = json.loads(body[start:end])
+        elif headers.get(b"content-type") == b"image/jpeg":
+            jpeg = body[start:end]
+        pos = body.find(delim, end)
+    if state is None or jpeg is None:
+        raise ValueError("snapshot is missing its JSON or JPEG part")
+    return state, jpeg
+
+def find_font():
+    """First of FONT_PATHS that exists, None without any"""
+    return next((p for p in FONT_PATHS if os.path.exists(p)), None)
+
+@lru_cache(maxsize=1)
+def label_font():
+    path = find_font()
+    if path is not None:
+        try:
+            return ImageFont.truetype(path, FONT_SIZE)
+        except Exception:
+            pass
+    return ImageFont.load_default()
+
+def label_colors(label: str):
+    """Box and text colors: green for healthy, orange for disease"""
+    if "Healthy" in label:
+        return (0, 255, 0), (0, 0, 0)
+    return (255, 165, 0), (255, 255, 255)
+
 def draw_box_and_label(draw: ImageDraw.ImageDraw, xyxy: Tuple[int, int, int, int], label: str):
     x1, y1, x2, y2 = map(int, xyxy)
-    # Use different colors based on detection
-    color = (0, 255, 0) if "Healthy" in label else (255, 165, 0)  # Green for healthy, orange for disease
+    color, text_color = label_colors(label)
     draw.rectangle([(x1, y1), (x2, y2)], outline=color, width=3)
     
-    font = None
-    for p in FONT_PATHS:
-        if os.path.exists(p):
-            try:
-                font = ImageFont.truetype(p, 18)
-                break
-            except Exception:
-                continue
-    if font is None:
-        font = ImageFont.load_default()
-    
+    font = label_font()
     text_w, text_h = draw.textbbox((0, 0), label, font=font)[2:]
     pad = 4
     draw.rectangle([(x1, max(y1 - text_h - pad * 2, 0)), (x1 + text_w + pad * 2, y1)], fill=color)
-    text_color = (0, 0, 0) if "Healthy" in label else (255, 255, 255)
     draw.text((x1 + pad, y1 - text_h - pad), label, fill=text_color, font=font)
 
+def save_annotated(pixels: np.ndarray, annotations: List[Tuple[Tuple[float, float, float, float], str]], path: str):
+    """Draws every (box, label) onto the pixels and writes them as a JPEG"""
+    if annotator is not None:
+        # All boxes in one call from the glyph atlas, drawn in place, encoded by libjpeg-turbo
+        annotator.draw(pixels, [(box, label, *label_colors(label)) for box, label in annotations])
+        with open(path, "wb") as f:
+            f.write(plant_native.encode_jpeg(pixels, quality=RESULT_QUALITY))
+        return
+    annotated = Image.fromarray(pixels)
+    draw = ImageDraw.Draw(annotated)
+    for box, label in annotations:
+        draw_box_and_label(draw, box, label)
+    annotated.save(path, quality=RESULT_QUALITY)
+
 # --------------------------- Model Loading ---------------------------
 
 ensure_dirs()
@@ -140,6 +254,14 @@ except Exception as e:
 
 cls_model.eval().to(device)
 
+# Native annotator with the label font rasterized once
+annotator = None
+if plant_native is not None and find_font() is not None:
+    try:
+        annotator = plant_native.Annotator(find_font(), FONT_SIZE)
+    except OSError as e:
+        print(f"⚠️  Could not load label font: {e}. Drawing labels with PIL.")
+
 # --------------------------- Flask App ---------------------------
 
 app = Flask(__name__)
@@ -495,79 +617,114 @@ DASHBOARD_HTML = """
 def index():
     return render_template_string(DASHBOARD_HTML, device=str(device), num_classes=num_classes)
 
-@app.route("/predict", methods=["POST"])
 @torch.inference_mode()
-def predict():
-    files = request.files.getlist("images")
-    results = []
-
-    for file in files:
-        uid = uuid.uuid4().hex
-        stem = datetime.now().strftime("%Y%m%d_%H%M%S_") + uid
-        upload_path = os.path.join(UPLOAD_DIR, stem + os.path.splitext(file.filename)[1].lower())
+def analyze_image(data: bytes, filename: str) -> dict:
+    """Leaf detection and disease classification for one encoded image"""
+    t_start = time.perf_counter()
+    uid = uuid.uuid4().hex
+    stem = datetime.now().strftime("%Y%m%d_%H%M%S_") + uid
+    upload_path = os.path.join(UPLOAD_DIR, stem + os.path.splitext(filename)[1].lower())
+    
+    # Save uploaded file as it came
+    with open(upload_path, "wb") as f:
+        f.write(data)
+    pixels, scale = decode_upload(data)
+    marker = read_latency_marker(data)
+    t_decoded = time.perf_counter()
+
+    # YOLO detection
+    yolo_results = yolo_model.predict(
+        source=pixels, conf=CONF_THRESH, iou=NMS_IOU, verbose=False,
+        device=0 if device.type == "cuda" else "cpu",
+    )
+
+    boxes, confs, classes = [], [], []
+    if len(yolo_results) > 0:
+        r = yolo_results[0]
+        if r.boxes is not None and len(r.boxes) > 0:
+            xyxy = r.boxes.xyxy.cpu().numpy()
+            conf = r.boxes.conf.cpu().numpy()
+            cls = r.boxes.cls.cpu().numpy()
+            for bb, cc, cl in zip(xyxy, conf, cls):
+                boxes.append(tuple(float(v) * scale for v in bb))
+                confs.append(float(cc))
+                classes.append(int(cl))
+
+    t_detected = time.perf_counter()
+    detections = []
+    annotations = []
+
+    # If no YOLO detections, analyze the whole image
+    if not boxes:
+        boxes = [(0, 0, pixels.shape[1] * scale, pixels.shape[0] * scale)]
+        confs = [1.0]
+        classes = [0]
+
+    # All the crops through the classifier as one batch
+    crop_image, crop_boxes = classifier_source(data, pixels, scale, boxes)
+    batch_probs = F.softmax(cls_model(preprocess_batch(crop_image, crop_boxes).to(device)), dim=1)
+
+    for (x1, y1, x2, y2), yconf, ycls, probs in zip(boxes, confs, classes, batch_probs):
+        cls_conf, cls_idx = torch.max(probs, dim=0)
+        label = labels[int(cls_idx)] if int(cls_idx) < len(labels) else f"cls_{cls_idx}"
         
-        # Save uploaded file
-        img = Image.open(file.stream).convert("RGB")
-        img.save(upload_path)
-
-        # YOLO detection
-        yolo_results = yolo_model.predict(
-            source=np.array(img), conf=CONF_THRESH, iou=NMS_IOU, verbose=False,
-            device=0 if device.type == "cuda" else "cpu",
-        )
-
-        boxes, confs, classes = [], [], []
-        if len(yolo_results) > 0:
-            r = yolo_results[0]
-            if r.boxes is not None and len(r.boxes) > 0:
-                xyxy = r.boxes.xyxy.cpu().numpy()
-                conf = r.boxes.conf.cpu().numpy()
-                cls = r.boxes.cls.cpu().numpy()
-                for bb, cc, cl in zip(xyxy, conf, cls):
-                    boxes.append(tuple(map(float, bb)))
-                    confs.append(float(cc))
-                    classes.append(int(cl))
-
-        detections = []
-        annotated = img.copy()
-        draw = ImageDraw.Draw(annotated)
-
-        # If no YOLO detections, analyze the whole image
-        if not boxes:
-            boxes = [(0, 0, img.width, img.height)]
-            confs = [1.0]
-            classes = [0]
-
-        for (x1, y1, x2, y2), yconf, ycls in zip(boxes, confs, classes):
-            crop = img.crop((int(x1), int(y1), int(x2), int(y2)))
-            inp = preprocess_for_effnet(crop).unsqueeze(0).to(device)
-            logits = cls_model(inp)
-            probs = F.softmax(logits, dim=1)[0]
-            cls_conf, cls_idx = torch.max(probs, dim=0)
-            label = labels[int(cls_idx)] if int(cls_idx) < len(labels) else f"cls_{cls_idx}"
-            
-            draw_box_and_label(draw, (x1, y1, x2, y2), f"{label} ({cls_conf:.2f})")
-            detections.append({
-                "box": tuple(map(int, (x1, y1, x2, y2))),
-                "yolo_conf": yconf,
-                "yolo_class": str(yolo_model.names.get(ycls, f"cls_{ycls}")) if hasattr(yolo_model, 'names') else "leaf",
-                "label": label,
-                "prob": float(cls_conf),
-            })
-
-        # Save annotated result
-        out_rel = os.path.join("static", "results", stem + "_annotated.jpg")
-        out_abs = os.path.join(RESULT_DIR, stem + "_annotated.jpg")
-        annotated.save(out_abs, quality=95)
-
-        results.append({
-            "filename": file.filename,
-            "image_url": "/" + out_rel.replace("\\", "/"),
-            "detections": detections,
+        annotations.append(((x1, y1, x2, y2), f"{label} ({cls_conf:.2f})"))
+        detections.append({
+            "box": tuple(map(int, (x1, y1, x2, y2))),
+            "yolo_conf": yconf,
+            "yolo_class": str(yolo_model.names.get(ycls, f"cls_{ycls}")) if hasattr(yolo_model, 'names') else "leaf",
+            "label": label,
+            "prob": float(cls_conf),
         })
 
+    t_classified = time.perf_counter()
+
+    # Save annotated result at the upload's resolution; the classifier is done with the pixels
+    out_rel = os.path.join("static", "results", stem + "_annotated.jpg")
+    out_abs = os.path.join(RESULT_DIR, stem + "_annotated.jpg")
+    save_annotated(full_resolution(data, pixels, scale), annotations, out_abs)
+
+    t_end = time.perf_counter()
+    result = {
+        "filename": filename,
+        "image_url": "/" + out_rel.replace("\\", "/"),
+        "detections": detections,
+        "timing": {
+            "decode_ms": round((t_decoded - t_start) * 1000, 2),
+            "detect_ms": round((t_detected - t_decoded) * 1000, 2),
+            "classify_ms": round((t_classified - t_detected) * 1000, 2),
+            "total_ms": round((t_end - t_start) * 1000, 2),
+        },
+    }
+    if marker:
+        result["frame"] = marker
+    return result
+
+@app.route("/predict", methods=["POST"])
+def predict():
+    files = request.files.getlist("images")
+    results = [analyze_image(file.read(), file.filename) for file in files]
     return jsonify({"results": results})
 
+@app.route('/api/snapshot')
+def analyze_snapshot():
+    """Analyzes a frame from the ESP32's /snapshot together with the sensor readings taken with it.
+    Frames the ESP32's triage found clean are not classified unless ?force=1."""
+    ip = request.args.get("ip", ESP32_DEFAULT_IP)
+    try:
+        resp = requests.get(f"http://{ip}/snapshot", timeout=10)
+        resp.raise_for_status()
+        state, jpeg = parse_snapshot(resp.headers.get("Content-Type", ""), resp.content)
+    except (requests.RequestException, ValueError) as e:
+        return jsonify({"error": f"snapshot from {ip} failed: {e}"}), 502
+    triage = state.get("triage")
+    if triage is not None and triage.get("blobs") == 0 and request.args.get("force") != "1":
+        # The ESP32 found no lesion colored spots on the leaves: nothing for the classifier
+        return jsonify({"filename": "snapshot.jpg", "detections": [], "skipped": "clean", "state": state})
+    result = analyze_image(jpeg, "snapshot.jpg")
+    result["state"] = state
+    return jsonify(result)
+
 @app.route('/static/<path:filename>')
 def serve_static(filename):
     return send_from_directory('static', filename)
@@ -597,6 +754,9 @@ if __name__ == "__main__":
     print(f"📱 Device: {device}")
     print(f"🤖 Model Classes: {num_classes}")
     print(f"🔗 Access dashboard at: http://localhost:5000")
-    print(f"📡 ESP32 Camera should be accessible at: http://192.168.4.1")
+    print(f"📡 ESP32 Camera should be accessible at: http://{ESP32_DEFAULT_IP}")
     
+    # HTTP/1.1 keeps connections open, so an ESP32 pushing frames to /predict
+    # sends its batches over one connection
+    WSGIRequestHandler.protocol_version = "HTTP/1.1"
     app.run(host="0.0.0.0", port=5000, debug=True)
\ No newline at end of file
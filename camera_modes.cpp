@@ -0,0 +1,658 @@
+/*
+  Smart Plant Vision - Camera Mode Scheduler
+  A mutex owns the sensor and the driver's frame queue: whoever holds it
+  programs the sensor for its mode and pulls frames until one fits. Still
+  requests go ahead of the preview, which waits on a one-frame mailbox for
+  the preview frames a still request pulls out of the queue.
+
+  The OV2640 has three readout modes (CIF, SVGA, UXGA) and scales a window
+  of the readout down to the output size in the DSP. The driver sizes and
+  centres that window (and sets the pixel clock) from the framesize's aspect
+  ratio, so at init it programs one framesize of each readout mode and
+  aspect ratio pair and the registers are read back; every framesize's
+  table is its pair's set with its own output size patched in. A framesize
+  change then writes only the registers that differ from what the sensor
+  holds.
+
+  The same lock makes the frame buffer pipeline reconfigurable at runtime:
+  with every frame back from the clients the driver is deinitialised and
+  brought up with the new fb_count, fb_location and grab mode. The register
+  tables survive, and only the sensor settings that differ from the driver's
+  reset state are written back.
+*/
+
+#include "camera_modes.h"
+#include <string.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "plant_log.h"
+
+#define GRAB_TRIES       8   // Frames pulled before giving up on one of the right size
+#define PREVIEW_WAIT_MS  20  // Mailbox poll while a still request holds the sensor
+#define DRAIN_TIMEOUT_MS 2000 // Wait for clients to return their frames before a reinit
+#define FB_COUNT_MAX     4
+
+// Registers the OV2640 driver rewrites on a framesize change (bank in bit 8,
+// 1 = sensor bank): the readout mode table, then the DSP output window.
+// DSP_RESET brackets the window writes and is not part of the set.
+#define REG_COM7   0x112
+#define DSP_ZMOW   0x5A
+#define DSP_ZMOH   0x5B
+#define DSP_ZMHH   0x5C
+#define DSP_RESET  0xE0
+static const uint16_t mode_regs[] = {
+    0x112, 0x111, 0x103, 0x106, 0x10D, 0x10E, 0x117, 0x118, 0x119, 0x11A, 0x122, 0x132, 0x134,
+    0x135, 0x137, 0x139, 0x13D, 0x142, 0x146, 0x147, 0x148, 0x14C, 0x14F, 0x150, 0x15A, 0x16D,
+    0x171, 0x172,
+    0x2C, 0x33, 0x3C, 0x90, 0x91, 0xC2, 0xC3, 0xDA, 0xE5, 0xF0,
+    0xC0, 0xC1, 0x8C, 0x86, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x57, 0x5A, 0x5B, 0x5C, 0xD3,
+};
+#define MODE_REGS (sizeof(mode_regs) / sizeof(mode_regs[0]))
+
+typedef struct {
+    camera_fb_t *fb;
+    cam_frame_info_t info;
+} boxed_frame_t;
+
+static SemaphoreHandle_t modes_lock = NULL;
+static camera_config_t cam_config;           // What the driver runs with now, under modes_lock
+static QueueHandle_t preview_box = NULL;     // Preview frames handed over by a still request
+static framesize_t mode_framesize[CAM_MODE_MAX];
+static framesize_t max_framesize;
+static bool settling = false;                // Next frame at the new size is under-exposed
+static std::atomic<int> stills_waiting(0);
+static std::atomic<int> preview_waiting(0);
+static std::atomic<int> preview_readers(0);   // Clients in cam_modes_fb_get() for a preview frame
+static std::atomic<int> frames_out(0);       // Taken from the driver and not returned yet
+static std::atomic<cam_frame_tap_t> preview_tap(NULL);
+
+// Register tables, under modes_lock
+static bool have_tables = false;
+static uint8_t fs_regs[FRAMESIZE_INVALID][MODE_REGS];
+static bool fs_ready[FRAMESIZE_INVALID];
+static uint8_t sensor_regs[MODE_REGS];       // What the sensor holds for current_fs
+static int current_fs = -1;
+
+// Frame sequence per mode; a framesize change starts a new epoch, and the
+// first frame delivered in it is marked
+static std::atomic<uint32_t> mode_seq[CAM_MODE_MAX];
+static std::atomic<uint32_t> mode_epoch[CAM_MODE_MAX];
+static std::atomic<uint32_t> delivered_epoch[CAM_MODE_MAX];
+static std::atomic<uint32_t> mode_flushed[CAM_MODE_MAX];
+static std::atomic<int64_t> resize_start_us[CAM_MODE_MAX];
+
+static std::atomic<uint32_t> stat_switches(0);
+static std::atomic<uint32_t> stat_reg_writes(0);
+static std::atomic<uint32_t> stat_discarded(0);
+static std::atomic<uint32_t> stat_handed_over(0);
+static std::atomic<uint32_t> stat_stills(0);
+static std::atomic<uint32_t> stat_last_switch_us(0);
+static std::atomic<uint32_t> stat_last_still_ms(0);
+static std::atomic<uint32_t> stat_last_resize_ms(0);
+static std::atomic<uint32_t> stat_last_resize_flushed(0);
+
+// Preview delivery since the pipeline was last set up, and the pipeline before it
+static std::atomic<uint32_t> pipe_frames(0);
+static std::atomic<uint64_t> pipe_age_us(0);
+static std::atomic<int64_t> pipe_start_us(0);
+static cam_pipeline_report_t pipe_now, pipe_before;   // Under modes_lock
+
+static size_t reg_index(uint16_t reg){
+    for(size_t i = 0; i < MODE_REGS; i++){
+        if(mode_regs[i] == reg){
+            return i;
+        }
+    }
+    return 0;
+}
+
+// The driver's rule for which readout mode a framesize uses, -1 when it has none
+static int readout_of(framesize_t fs){
+    int w = resolution[fs].width, h = resolution[fs].height;
+    if(w > 1600 || h > 1200){
+        return -1;
+    }
+    return (w <= 400 && h <= 296) ? 0 : (w <= 800 && h <= 600) ? 1 : 2;
+}
+
+static void read_regs(sensor_t *s, uint8_t *regs){
+    for(size_t i = 0; i < MODE_REGS; i++){
+        regs[i] = (uint8_t)s->get_reg(s, mode_regs[i], 0xFF);
+    }
+}
+
+// Reads back each readout mode and aspect ratio pair as the driver programs
+// it and derives every framesize's table from those; modes_lock held
+static bool build_tables(sensor_t *s){
+    if(s->id.PID != OV2640_PID){
+        PLOGW("No register tables for sensor PID 0x%02x, framesize changes go through the driver", s->id.PID);
+        return false;
+    }
+    static uint8_t readback[MODE_REGS];
+    int64_t start = esp_timer_get_time();
+    size_t zmow = reg_index(DSP_ZMOW), zmoh = reg_index(DSP_ZMOH), zmhh = reg_index(DSP_ZMHH);
+    int tables = 0, reads = 0, last = -1;
+    memset(fs_ready, 0, sizeof(fs_ready));
+    for(int fs = 0; fs < FRAMESIZE_INVALID; fs++){
+        int m = readout_of((framesize_t)fs);
+        if(m < 0 || fs_ready[fs]){
+            continue;
+        }
+        // First framesize of its pair: its window is the one the whole pair shares
+        if(s->set_framesize(s, (framesize_t)fs) != 0){
+            PLOGW("Framesize %d rejected, framesize changes go through the driver", fs);
+            return false;
+        }
+        read_regs(s, readback);
+        reads++;
+        last = fs;
+        for(int g = fs; g < FRAMESIZE_INVALID; g++){
+            if(readout_of((framesize_t)g) != m || resolution[g].aspect_ratio != resolution[fs].aspect_ratio){
+                continue;
+            }
+            // Output size in 4 pixel units: ZMOW/ZMOH low bits, ZMHH [1:0] width, [2] height
+            int ow = resolution[g].width >> 2, oh = resolution[g].height >> 2;
+            memcpy(fs_regs[g], readback, MODE_REGS);
+            fs_regs[g][zmow] = ow & 0xFF;
+            fs_regs[g][zmoh] = oh & 0xFF;
+            fs_regs[g][zmhh] = ((oh >> 8) << 2) | (ow >> 8);
+            fs_ready[g] = true;
+            tables++;
+        }
+    }
+    if(last < 0){
+        return false;
+    }
+    memcpy(sensor_regs, fs_regs[last], MODE_REGS);
+    current_fs = last;
+    PLOGI("Camera register tables: %d framesizes from %d read-backs in %ums", tables, reads,
+          (unsigned)((esp_timer_get_time() - start) / 1000));
+    return true;
+}
+
+// Programs fs, writing only the registers that differ; modes_lock held
+static void apply_framesize(framesize_t fs){
+    if((int)fs == current_fs){
+        return;
+    }
+    sensor_t *s = esp_camera_sensor_get();
+    int64_t start = esp_timer_get_time();
+    uint32_t writes = 0;
+
+    if(have_tables && current_fs >= 0 && fs_ready[fs]){
+        const uint8_t *to = fs_regs[fs];
+        size_t com7 = reg_index(REG_COM7);
+        settling = sensor_regs[com7] != to[com7];
+        // Readout mode first, then the window with the DSP held in reset
+        size_t dsp = 0;
+        while(dsp < MODE_REGS && (mode_regs[dsp] & 0x100)){
+            dsp++;
+        }
+        for(size_t i = 0; i < dsp; i++){
+            if(sensor_regs[i] != to[i]){
+                s->set_reg(s, mode_regs[i], 0xFF, to[i]);
+                writes++;
+            }
+        }
+        s->set_reg(s, DSP_RESET, 0xFF, 0x04);
+        for(size_t i = dsp; i < MODE_REGS; i++){
+            if(sensor_regs[i] != to[i]){
+                s->set_reg(s, mode_regs[i], 0xFF, to[i]);
+                writes++;
+            }
+        }
+        s->set_reg(s, DSP_RESET, 0xFF, 0x00);
+        writes += 2;
+        memcpy(sensor_regs, to, MODE_REGS);
+        s->status.framesize = fs;
+    } else {
+        // No table: the driver rewrites everything, and the readout mode may have changed
+        s->set_framesize(s, fs);
+        writes = MODE_REGS + 2;
+        settling = true;
+    }
+
+    current_fs = fs;
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    stat_switches.fetch_add(1, std::memory_order_relaxed);
+    stat_reg_writes.fetch_add(writes, std::memory_order_relaxed);
+    stat_last_switch_us.store(us, std::memory_order_relaxed);
+    PLOGD("Framesize %d: %u registers in %uus%s", (int)fs, writes, us, settling ? ", settling" : "");
+}
+
+static void drop(camera_fb_t *fb, cam_mode_t mode){
+    esp_camera_fb_return(fb);
+    frames_out--;
+    stat_discarded.fetch_add(1, std::memory_order_relaxed);
+    mode_flushed[mode].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Numbers a frame on its way to a client, marking the first one since a
+// framesize change; modes_lock held, so the frame and the epoch agree
+static void tag(cam_mode_t mode, const camera_fb_t *fb, cam_frame_info_t *info){
+    if(mode == CAM_MODE_PREVIEW){
+        int64_t grabbed = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        pipe_frames.fetch_add(1, std::memory_order_relaxed);
+        pipe_age_us.fetch_add((uint64_t)(esp_timer_get_time() - grabbed), std::memory_order_relaxed);
+    }
+    uint32_t seq = mode_seq[mode].fetch_add(1, std::memory_order_relaxed) + 1;
+    uint32_t epoch = mode_epoch[mode].load(std::memory_order_acquire);
+    bool first = delivered_epoch[mode].exchange(epoch) != epoch;
+    if(first){
+        uint32_t ms = (uint32_t)((esp_timer_get_time() - resize_start_us[mode]) / 1000);
+        uint32_t flushed = mode_flushed[mode].exchange(0);
+        stat_last_resize_ms.store(ms, std::memory_order_relaxed);
+        stat_last_resize_flushed.store(flushed, std::memory_order_relaxed);
+        PLOGI("Mode %d at framesize %d: first frame #%u after %ums, %u flushed",
+              (int)mode, (int)mode_framesize[mode], seq, ms, flushed);
+    }
+    info->seq = seq;
+    info->first_at_size = first;
+}
+
+static void clear_preview_box(void){
+    boxed_frame_t old;
+    if(xQueueReceive(preview_box, &old, 0) == pdTRUE){
+        drop(old.fb, CAM_MODE_PREVIEW);
+        if(old.info.first_at_size){
+            delivered_epoch[CAM_MODE_PREVIEW].fetch_sub(1);   // Mark the next one instead
+        }
+    }
+}
+
+// Leaves a tagged preview frame for the next preview caller, replacing one it didn't pick up
+static void box(camera_fb_t *fb, const cam_frame_info_t *info){
+    clear_preview_box();
+    boxed_frame_t b;
+    b.fb = fb;
+    b.info = *info;
+    xQueueSend(preview_box, &b, 0);
+}
+
+// Hands a preview size frame to the waiting preview
+static void hand_over(camera_fb_t *fb){
+    cam_frame_info_t info;
+    tag(CAM_MODE_PREVIEW, fb, &info);
+    box(fb, &info);
+    stat_handed_over.fetch_add(1, std::memory_order_relaxed);
+}
+
+static bool fb_is(const camera_fb_t *fb, framesize_t fs){
+    return fb->width == resolution[fs].width && fb->height == resolution[fs].height;
+}
+
+// Pulls frames until one fits mode; modes_lock held. Whatever was queued or
+// in flight when the registers changed is at the old size and goes first;
+// the first frame at the new size is dropped too when the readout mode changed.
+static camera_fb_t *grab(cam_mode_t mode, cam_frame_info_t *info){
+    framesize_t fs = mode_framesize[mode];
+    framesize_t preview_fs = mode_framesize[CAM_MODE_PREVIEW];
+    apply_framesize(fs);
+    for(int tries = 0; tries < GRAB_TRIES; tries++){
+        if(mode == CAM_MODE_STILL && !preview_waiting.load()){
+            // The preview went away with a frame still in the box, with one
+            // frame buffer that would leave the driver nothing to fill
+            clear_preview_box();
+        }
+        camera_fb_t *fb = esp_camera_fb_get();
+        if(!fb){
+            return NULL;
+        }
+        frames_out++;
+        if(fb_is(fb, fs)){
+            if(!settling){
+                tag(mode, fb, info);
+                return fb;
+            }
+            settling = false;
+            drop(fb, mode);
+        } else if(mode == CAM_MODE_STILL && preview_waiting.load() && fb_is(fb, preview_fs)){
+            hand_over(fb);
+        } else {
+            drop(fb, mode);
+        }
+    }
+    PLOG_LIMITED(PLOG_WARN, 2, "No frame at mode %d size after %d tries", (int)mode, GRAB_TRIES);
+    return NULL;
+}
+
+static camera_fb_t *preview_get(cam_frame_info_t *info){
+    boxed_frame_t b;
+    for(;;){
+        if(xQueueReceive(preview_box, &b, 0) == pdTRUE){
+            *info = b.info;
+            return b.fb;
+        }
+        if(stills_waiting.load()){
+            preview_waiting++;
+            BaseType_t got = pdFALSE;
+            while(stills_waiting.load() && got != pdTRUE){
+                got = xQueueReceive(preview_box, &b, pdMS_TO_TICKS(PREVIEW_WAIT_MS));
+            }
+            preview_waiting--;
+            if(got == pdTRUE){
+                *info = b.info;
+                return b.fb;
+            }
+            continue;
+        }
+        xSemaphoreTake(modes_lock, portMAX_DELAY);
+        if(stills_waiting.load()){
+            xSemaphoreGive(modes_lock);
+            continue;
+        }
+        // Left by an idle reader that held the lock while this caller came along
+        if(xQueueReceive(preview_box, &b, 0) == pdTRUE){
+            xSemaphoreGive(modes_lock);
+            *info = b.info;
+            return b.fb;
+        }
+        camera_fb_t *fb = grab(CAM_MODE_PREVIEW, info);
+        xSemaphoreGive(modes_lock);
+        return fb;
+    }
+}
+
+static camera_fb_t *still_get(cam_frame_info_t *info){
+    int64_t start = esp_timer_get_time();
+    stills_waiting++;
+    xSemaphoreTake(modes_lock, portMAX_DELAY);
+    camera_fb_t *fb = grab(CAM_MODE_STILL, info);
+    if(stills_waiting.load() == 1){
+        // Switch back while this still is on its way out, not on the next preview frame
+        apply_framesize(mode_framesize[CAM_MODE_PREVIEW]);
+    }
+    stills_waiting--;
+    xSemaphoreGive(modes_lock);
+    if(fb){
+        stat_stills.fetch_add(1, std::memory_order_relaxed);
+        stat_last_still_ms.store((uint32_t)((esp_timer_get_time() - start) / 1000), std::memory_order_relaxed);
+    }
+    return fb;
+}
+
+// Frame buffer size the driver allocates for a config, for the pipeline setup() made
+static size_t nominal_fb_bytes(const camera_config_t *c){
+    size_t px = (size_t)resolution[c->frame_size].width * resolution[c->frame_size].height;
+    switch(c->pixel_format){
+        case PIXFORMAT_JPEG: return c->fb_count * (px / 5);
+        case PIXFORMAT_GRAYSCALE: return c->fb_count * px;
+        case PIXFORMAT_RGB888: return c->fb_count * px * 3;
+        default: return c->fb_count * px * 2;
+    }
+}
+
+static uint32_t fb_caps(camera_fb_location_t loc){
+    return loc == CAMERA_FB_IN_DRAM ? MALLOC_CAP_INTERNAL : MALLOC_CAP_SPIRAM;
+}
+
+// Live numbers for the running pipeline; modes_lock held
+static void pipeline_now(cam_pipeline_report_t *r){
+    *r = pipe_now;
+    uint32_t n = pipe_frames.load(std::memory_order_relaxed);
+    int64_t elapsed = esp_timer_get_time() - pipe_start_us.load(std::memory_order_relaxed);
+    r->frames = n;
+    r->fps = elapsed > 0 ? n * 1e6f / elapsed : 0;
+    r->frame_age_ms = n ? pipe_age_us.load(std::memory_order_relaxed) / 1000.0f / n : 0;
+}
+
+static void pipeline_start(const camera_config_t *c, uint32_t reinit_ms, size_t fb_bytes){
+    memset(&pipe_now, 0, sizeof(pipe_now));
+    pipe_now.pipeline.fb_count = c->fb_count;
+    pipe_now.pipeline.fb_location = c->fb_location;
+    pipe_now.pipeline.grab_mode = c->grab_mode;
+    pipe_now.reinit_ms = reinit_ms;
+    pipe_now.fb_bytes = fb_bytes;
+    pipe_frames.store(0);
+    pipe_age_us.store(0);
+    pipe_start_us.store(esp_timer_get_time());
+}
+
+// Writes back what differs from the driver's reset state, in the order
+// esp32-camera's own settings loader uses
+static uint32_t restore_settings(sensor_t *s, const camera_status_t *st){
+    camera_status_t now = s->status;
+    uint32_t writes = 0;
+#define RESTORE(field, call) if(now.field != st->field){ s->call; writes++; }
+    RESTORE(quality, set_quality(s, st->quality));
+    RESTORE(brightness, set_brightness(s, st->brightness));
+    RESTORE(contrast, set_contrast(s, st->contrast));
+    RESTORE(saturation, set_saturation(s, st->saturation));
+    RESTORE(sharpness, set_sharpness(s, st->sharpness));
+    RESTORE(denoise, set_denoise(s, st->denoise));
+    RESTORE(gainceiling, set_gainceiling(s, (gainceiling_t)st->gainceiling));
+    RESTORE(colorbar, set_colorbar(s, st->colorbar));
+    RESTORE(awb, set_whitebal(s, st->awb));
+    RESTORE(agc, set_gain_ctrl(s, st->agc));
+    RESTORE(aec, set_exposure_ctrl(s, st->aec));
+    RESTORE(hmirror, set_hmirror(s, st->hmirror));
+    RESTORE(vflip, set_vflip(s, st->vflip));
+    RESTORE(awb_gain, set_awb_gain(s, st->awb_gain));
+    RESTORE(agc_gain, set_agc_gain(s, st->agc_gain));
+    RESTORE(aec_value, set_aec_value(s, st->aec_value));
+    RESTORE(special_effect, set_special_effect(s, st->special_effect));
+    RESTORE(wb_mode, set_wb_mode(s, st->wb_mode));
+    RESTORE(ae_level, set_ae_level(s, st->ae_level));
+    RESTORE(aec2, set_aec2(s, st->aec2));
+    RESTORE(dcw, set_dcw(s, st->dcw));
+    RESTORE(bpc, set_bpc(s, st->bpc));
+    RESTORE(wpc, set_wpc(s, st->wpc));
+    RESTORE(raw_gma, set_raw_gma(s, st->raw_gma));
+    RESTORE(lenc, set_lenc(s, st->lenc));
+#undef RESTORE
+    return writes;
+}
+
+bool cam_modes_init(const camera_config_t *config, framesize_t preview){
+    if(modes_lock){
+        return true;
+    }
+    modes_lock = xSemaphoreCreateMutex();
+    preview_box = xQueueCreate(1, sizeof(boxed_frame_t));
+    if(!modes_lock || !preview_box){
+        PLOGE("Camera mode scheduler: out of memory");
+        return false;
+    }
+    cam_config = *config;
+    max_framesize = config->frame_size;
+    mode_framesize[CAM_MODE_PREVIEW] = preview;
+    mode_framesize[CAM_MODE_STILL] = config->frame_size;
+    xSemaphoreTake(modes_lock, portMAX_DELAY);
+    have_tables = build_tables(esp_camera_sensor_get());
+    apply_framesize(preview);
+    settling = true;    // Whatever the sensor was doing before init, don't trust the first frame
+    pipeline_start(&cam_config, 0, nominal_fb_bytes(&cam_config));
+    xSemaphoreGive(modes_lock);
+    return true;
+}
+
+int cam_modes_set_framesize(cam_mode_t mode, framesize_t fs){
+    if(!modes_lock || mode >= CAM_MODE_MAX || fs >= FRAMESIZE_INVALID){
+        return -1;
+    }
+    if(have_tables && !fs_ready[fs]){
+        return -1;
+    }
+    // The frame buffers were sized for max at init
+    if(mode == CAM_MODE_STILL &&
+       resolution[fs].width * resolution[fs].height > resolution[max_framesize].width * resolution[max_framesize].height){
+        return -1;
+    }
+    xSemaphoreTake(modes_lock, portMAX_DELAY);
+    if(mode_framesize[mode] != fs){
+        mode_framesize[mode] = fs;
+        resize_start_us[mode] = esp_timer_get_time();
+        mode_flushed[mode].store(0, std::memory_order_relaxed);
+        mode_epoch[mode].fetch_add(1, std::memory_order_release);
+        if(mode == CAM_MODE_PREVIEW){
+            clear_preview_box();
+        }
+        // Reprogram now when this mode is running, so the flush starts with the next grab
+        if(mode == CAM_MODE_PREVIEW && !stills_waiting.load()){
+            apply_framesize(fs);
+        }
+    }
+    xSemaphoreGive(modes_lock);
+    return 0;
+}
+
+framesize_t cam_modes_get_framesize(cam_mode_t mode){
+    return mode_framesize[mode < CAM_MODE_MAX ? mode : CAM_MODE_PREVIEW];
+}
+
+void cam_modes_fb_return(camera_fb_t *fb){
+    if(fb){
+        esp_camera_fb_return(fb);
+        frames_out--;
+    }
+}
+
+camera_fb_t *cam_modes_fb_get(cam_mode_t mode, cam_frame_info_t *info){
+    if(!modes_lock){
+        return NULL;
+    }
+    cam_frame_info_t unused;
+    if(!info){
+        info = &unused;
+    }
+    if(mode == CAM_MODE_STILL){
+        return still_get(info);
+    }
+    preview_readers++;
+    camera_fb_t *fb = preview_get(info);
+    preview_readers--;
+    cam_frame_tap_t tap = preview_tap.load();
+    if(fb && tap){
+        tap(fb, info);
+    }
+    return fb;
+}
+
+camera_fb_t *cam_modes_fb_get_idle(cam_frame_info_t *info){
+    if(!modes_lock || preview_readers.load() || stills_waiting.load()){
+        return NULL;
+    }
+    xSemaphoreTake(modes_lock, portMAX_DELAY);
+    if(preview_readers.load() || stills_waiting.load()){
+        xSemaphoreGive(modes_lock);
+        return NULL;
+    }
+    camera_fb_t *fb = grab(CAM_MODE_PREVIEW, info);
+    if(fb && preview_readers.load()){
+        // A client started waiting during the grab: the frame is its
+        box(fb, info);
+        fb = NULL;
+    }
+    xSemaphoreGive(modes_lock);
+    return fb;
+}
+
+void cam_modes_set_preview_tap(cam_frame_tap_t tap){
+    preview_tap.store(tap);
+}
+
+void cam_modes_get_stats(cam_modes_stats_t *out){
+    out->switches = stat_switches.load(std::memory_order_relaxed);
+    out->reg_writes = stat_reg_writes.load(std::memory_order_relaxed);
+    out->discarded = stat_discarded.load(std::memory_order_relaxed);
+    out->handed_over = stat_handed_over.load(std::memory_order_relaxed);
+    out->stills = stat_stills.load(std::memory_order_relaxed);
+    out->last_switch_us = stat_last_switch_us.load(std::memory_order_relaxed);
+    out->last_still_ms = stat_last_still_ms.load(std::memory_order_relaxed);
+    out->last_resize_ms = stat_last_resize_ms.load(std::memory_order_relaxed);
+    out->last_resize_flushed = stat_last_resize_flushed.load(std::memory_order_relaxed);
+    out->register_tables = have_tables;
+}
+
+esp_err_t cam_modes_set_pipeline(const cam_pipeline_t *p){
+    if(!modes_lock){
+        return ESP_ERR_INVALID_STATE;
+    }
+    if(p->fb_count < 1 || p->fb_count > FB_COUNT_MAX ||
+       (p->fb_location != CAMERA_FB_IN_PSRAM && p->fb_location != CAMERA_FB_IN_DRAM) ||
+       (p->grab_mode != CAMERA_GRAB_WHEN_EMPTY && p->grab_mode != CAMERA_GRAB_LATEST)){
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(modes_lock, portMAX_DELAY);
+    if(p->fb_count == cam_config.fb_count && p->fb_location == cam_config.fb_location &&
+       p->grab_mode == cam_config.grab_mode){
+        xSemaphoreGive(modes_lock);
+        return ESP_OK;
+    }
+
+    // Nothing new gets handed out while the lock is held; wait for what is out
+    clear_preview_box();
+    TickType_t waited = 0;
+    while(frames_out.load() > 0 && waited < pdMS_TO_TICKS(DRAIN_TIMEOUT_MS)){
+        vTaskDelay(pdMS_TO_TICKS(5));
+        waited += pdMS_TO_TICKS(5);
+    }
+    if(frames_out.load() > 0){
+        xSemaphoreGive(modes_lock);
+        PLOGW("Pipeline change refused: %d frames still out", frames_out.load());
+        return ESP_ERR_TIMEOUT;
+    }
+
+    int64_t start = esp_timer_get_time();
+    camera_status_t saved = esp_camera_sensor_get()->status;
+    size_t free_before = heap_caps_get_free_size(fb_caps(cam_config.fb_location));
+    esp_camera_deinit();
+    size_t old_bytes = heap_caps_get_free_size(fb_caps(cam_config.fb_location)) - free_before;
+
+    camera_config_t next = cam_config;
+    next.fb_count = p->fb_count;
+    next.fb_location = p->fb_location;
+    next.grab_mode = p->grab_mode;
+    size_t free_next = heap_caps_get_free_size(fb_caps(next.fb_location));
+    esp_err_t err = esp_camera_init(&next);
+    size_t new_bytes = free_next - heap_caps_get_free_size(fb_caps(next.fb_location));
+    if(err != ESP_OK){
+        PLOGW("Pipeline fb_count=%u location=%d grab=%d failed (%s), restoring the previous one",
+              (unsigned)next.fb_count, (int)next.fb_location, (int)next.grab_mode, esp_err_to_name(err));
+        if(esp_camera_init(&cam_config) != ESP_OK){
+            PLOGE("Camera reinit failed, no frames until restart");
+        }
+    }
+
+    sensor_t *s = esp_camera_sensor_get();
+    uint32_t restored = 0;
+    if(s){
+        restored = restore_settings(s, &saved);
+        // The driver programmed its init framesize from scratch; the tables still hold
+        current_fs = cam_config.frame_size;
+        if(have_tables && fs_ready[current_fs]){
+            memcpy(sensor_regs, fs_regs[current_fs], MODE_REGS);
+        }
+        apply_framesize(mode_framesize[CAM_MODE_PREVIEW]);
+        settling = true;
+    }
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+    if(err == ESP_OK){
+        pipeline_now(&pipe_before);
+        pipe_before.fb_bytes = old_bytes;
+        cam_config = next;
+        pipeline_start(&cam_config, ms, new_bytes);
+        PLOGI("Pipeline fb_count=%u location=%d grab=%d: %u bytes of frame buffers, reinit %ums, %u settings restored",
+              (unsigned)next.fb_count, (int)next.fb_location, (int)next.grab_mode, (unsigned)new_bytes, ms, restored);
+    }
+    xSemaphoreGive(modes_lock);
+    return err;
+}
+
+void cam_modes_get_pipeline(cam_pipeline_report_t *now, cam_pipeline_report_t *before){
+    if(!modes_lock){
+        memset(now, 0, sizeof(*now));
+        memset(before, 0, sizeof(*before));
+        return;
+    }
+    xSemaphoreTake(modes_lock, portMAX_DELAY);
+    pipeline_now(now);
+    *before = pipe_before;
+    xSemaphoreGive(modes_lock);
+}
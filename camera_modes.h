@@ -0,0 +1,105 @@
+/*
+  Smart Plant Vision - Camera Mode Scheduler
+  One sensor shared by two clients: the live preview at a small framesize
+  and occasional full resolution stills. A still request reprograms the
+  sensor between two preview frames, takes the first good frame at the still
+  size and switches back; a frame only ever goes to a client whose size it
+  matches.
+
+  Every framesize the OV2640 supports has a register table, built at init
+  from one read-back per sensor readout mode and aspect ratio, so a
+  framesize change writes only the registers that differ. Frames are
+  dropped only when they are at the wrong size (queued or in flight when
+  the registers changed) or are the first, under-exposed frame after the
+  sensor changed its readout mode; the first frame that is good at a new
+  size is marked.
+*/
+
+#ifndef CAMERA_MODES_H
+#define CAMERA_MODES_H
+
+#include <stdint.h>
+#include "esp_camera.h"
+
+typedef enum {
+    CAM_MODE_PREVIEW = 0,   // /stream, /capture
+    CAM_MODE_STILL,         // /capture?mode=still, /snapshot?mode=still
+    CAM_MODE_MAX
+} cam_mode_t;
+
+typedef struct {
+    uint32_t switches;        // Sensor reprogrammed, for a mode switch or a framesize change
+    uint32_t reg_writes;      // SCCB writes those switches took
+    uint32_t discarded;       // Frames at the wrong size, or settling after a readout mode change
+    uint32_t handed_over;     // Preview frames a still request passed on to the waiting preview
+    uint32_t stills;          // Full resolution frames delivered
+    uint32_t last_switch_us;  // Register writes of the most recent switch
+    uint32_t last_still_ms;   // Most recent still, from request to frame
+    uint32_t last_resize_ms;  // Most recent framesize change, from the call to its first good frame
+    uint32_t last_resize_flushed; // Frames dropped on the way there
+    bool register_tables;     // False on sensors without tables: changes go through set_framesize
+} cam_modes_stats_t;
+
+typedef struct {
+    uint32_t seq;             // Frames delivered in this mode, from 1
+    bool first_at_size;       // First good frame since the mode's framesize changed
+} cam_frame_info_t;
+
+typedef struct {
+    size_t fb_count;
+    camera_fb_location_t fb_location;
+    camera_grab_mode_t grab_mode;    // CAMERA_GRAB_LATEST: newest frame, CAMERA_GRAB_WHEN_EMPTY: queued
+} cam_pipeline_t;
+
+typedef struct {
+    cam_pipeline_t pipeline;
+    uint32_t reinit_ms;       // Deinit, init and sensor settings restored; 0 for the one setup() made
+    size_t fb_bytes;          // Frame buffer memory, measured from the heap (setup()'s is the driver's formula)
+    uint32_t frames;          // Preview frames delivered on this pipeline
+    float fps;                // ... per second while it ran
+    float frame_age_ms;       // Mean age of those frames when handed out
+} cam_pipeline_report_t;
+
+// Call once after esp_camera_init() with the config it was given. Stills
+// default to config->frame_size and can't be larger: the frame buffers were
+// sized for it.
+bool cam_modes_init(const camera_config_t *config, framesize_t preview);
+
+// Changes one mode's framesize; the sensor is reprogrammed right away when
+// that mode is the one running. Returns -1 for sizes the mode can't take.
+int cam_modes_set_framesize(cam_mode_t mode, framesize_t fs);
+framesize_t cam_modes_get_framesize(cam_mode_t mode);
+
+// Next frame at the mode's size, NULL on a capture timeout. Give it back
+// with cam_modes_fb_return(). A preview caller waits out a still
+// request and is handed the preview frames it displaced. info may be NULL.
+camera_fb_t *cam_modes_fb_get(cam_mode_t mode, cam_frame_info_t *info);
+
+// A preview frame for a task that looks at frames only while no client is
+// fetching them. NULL when one is, or when one starts waiting during the
+// grab: that client gets the frame instead, and the tap sees it on its way.
+camera_fb_t *cam_modes_fb_get_idle(cam_frame_info_t *info);
+
+// Returns a frame from cam_modes_fb_get() or cam_modes_fb_get_idle() to the driver
+void cam_modes_fb_return(camera_fb_t *fb);
+
+void cam_modes_get_stats(cam_modes_stats_t *out);
+
+// Sees every preview frame on its way to a client, in the client's task. It
+// must not keep fb and should return quickly: copy what it needs and leave
+// the work to a task of its own. NULL removes it.
+typedef void (*cam_frame_tap_t)(const camera_fb_t *fb, const cam_frame_info_t *info);
+void cam_modes_set_preview_tap(cam_frame_tap_t tap);
+
+// Brings the driver back up with a different frame buffer pipeline once every
+// frame handed out has been returned, keeping the sensor settings, framesizes
+// and register tables. On failure the previous pipeline is restored and the
+// error is returned (ESP_ERR_NO_MEM when the buffers don't fit, ESP_ERR_TIMEOUT
+// when a client held on to a frame).
+esp_err_t cam_modes_set_pipeline(const cam_pipeline_t *p);
+
+// The running pipeline with its numbers so far, and the one it replaced
+// (all zero before the first change)
+void cam_modes_get_pipeline(cam_pipeline_report_t *now, cam_pipeline_report_t *before);
+
+#endif
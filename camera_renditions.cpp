@@ -0,0 +1,243 @@
+/*
+  Smart Plant Vision - Scaled Renditions
+  One lock guards the slot table, a second one serializes transcoding: it
+  shares one decode buffer, and a viewer queued behind a transcode of its
+  own key finds the result when it gets the lock. Buffers are allocated in
+  PSRAM the first time a slot needs them and kept; a slot only grows when a
+  larger rendition lands in it.
+*/
+
+#include "camera_renditions.h"
+#include <string.h>
+#include "camera_modes.h"
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "plant_log.h"
+
+#define REND_SLOTS 4
+
+typedef struct {
+    rendition_t r;            // First, so a rendition_t * is its slot
+    uint8_t *buf;
+    size_t cap;
+    int refs;                 // Viewers sending it
+    bool ready;               // Holds a rendition that can be handed out
+    bool busy;                // Being transcoded into
+    int64_t used_us;          // Last handed out, to pick the slot to reuse
+} rend_slot_t;
+
+typedef struct {
+    rend_slot_t *slot;
+    size_t len;
+} rend_out_t;
+
+static SemaphoreHandle_t slots_lock = NULL;
+static SemaphoreHandle_t build_lock = NULL;
+static rend_slot_t slots[REND_SLOTS];        // Under slots_lock
+static uint8_t *decode_buf = NULL;           // RGB565, under build_lock
+static size_t decode_cap = 0;
+static rend_stats_t stats;                   // Under slots_lock
+
+static int scale_shift(int scale){
+    return scale == 2 ? 1 : scale == 4 ? 2 : scale == 8 ? 3 : -1;
+}
+
+bool rend_valid(int scale, int quality){
+    return scale_shift(scale) > 0 && quality >= 1 && quality <= 100;
+}
+
+bool rend_init(void){
+    slots_lock = xSemaphoreCreateMutex();
+    build_lock = xSemaphoreCreateMutex();
+    return slots_lock && build_lock;
+}
+
+// Newest ready rendition of the key that satisfies the request, under slots_lock
+static rend_slot_t *find(uint8_t scale, uint8_t quality, uint32_t after_seq, int64_t now){
+    rend_slot_t *best = NULL;
+    for(int i = 0; i < REND_SLOTS; i++){
+        rend_slot_t *s = &slots[i];
+        if(s->ready && s->r.scale == scale && s->r.quality == quality && s->r.seq > after_seq &&
+           now - s->r.grab_us <= (int64_t)REND_MAX_AGE_MS * 1000 && (!best || s->r.seq > best->r.seq)){
+            best = s;
+        }
+    }
+    return best;
+}
+
+// Slot for a new rendition, under slots_lock: the key's old one if nobody is
+// sending it, else an empty one, else the least recently used idle one
+static rend_slot_t *victim(uint8_t scale, uint8_t quality){
+    rend_slot_t *pick = NULL;
+    for(int i = 0; i < REND_SLOTS; i++){
+        rend_slot_t *s = &slots[i];
+        if(s->refs || s->busy){
+            continue;
+        }
+        if(s->ready && s->r.scale == scale && s->r.quality == quality){
+            return s;
+        }
+        if(!pick || (pick->ready && (!s->ready || s->used_us < pick->used_us))){
+            pick = s;
+        }
+    }
+    return pick;
+}
+
+static size_t rend_write(void *arg, size_t index, const void *data, size_t len){
+    rend_out_t *o = (rend_out_t *)arg;
+    rend_slot_t *s = o->slot;
+    if(!len){
+        return 0;
+    }
+    if(index + len > s->cap){
+        size_t cap = s->cap ? s->cap : 4096;
+        while(cap < index + len){
+            cap *= 2;
+        }
+        uint8_t *b = (uint8_t *)heap_caps_realloc(s->buf, cap, MALLOC_CAP_SPIRAM);
+        if(!b){
+            return 0;
+        }
+        xSemaphoreTake(slots_lock, portMAX_DELAY);
+        stats.pool_bytes += cap - s->cap;
+        xSemaphoreGive(slots_lock);
+        s->buf = b;
+        s->cap = cap;
+    }
+    memcpy(s->buf + index, data, len);
+    o->len = index + len;
+    return len;
+}
+
+// Transcodes the next preview frame into a slot, under build_lock
+static rend_slot_t *build(uint8_t scale, uint8_t quality){
+    cam_frame_info_t fi;
+    camera_fb_t *fb = cam_modes_fb_get(CAM_MODE_PREVIEW, &fi);
+    if(!fb){
+        return NULL;
+    }
+    int64_t start = esp_timer_get_time();
+    int64_t grab_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    uint16_t w = fb->width / scale, h = fb->height / scale;
+    size_t src_len = fb->len;
+    size_t need = (size_t)w * h * 2;
+    if(fb->format != PIXFORMAT_JPEG || !w || !h){
+        cam_modes_fb_return(fb);
+        return NULL;
+    }
+    if(need > decode_cap){
+        uint8_t *b = (uint8_t *)heap_caps_realloc(decode_buf, need, MALLOC_CAP_SPIRAM);
+        if(!b){
+            cam_modes_fb_return(fb);
+            PLOG_LIMITED(PLOG_ERROR, 2, "No memory to decode a %ux%u rendition", w, h);
+            return NULL;
+        }
+        xSemaphoreTake(slots_lock, portMAX_DELAY);
+        stats.pool_bytes += need - decode_cap;
+        xSemaphoreGive(slots_lock);
+        decode_buf = b;
+        decode_cap = need;
+    }
+    bool decoded = jpg2rgb565(fb->buf, fb->len, decode_buf, (jpg_scale_t)scale_shift(scale));
+    // The decoded picture is all that's needed from here on
+    cam_modes_fb_return(fb);
+    if(!decoded){
+        PLOG_LIMITED(PLOG_WARN, 2, "Preview frame %u did not decode", fi.seq);
+        return NULL;
+    }
+
+    xSemaphoreTake(slots_lock, portMAX_DELAY);
+    rend_slot_t *s = victim(scale, quality);
+    if(s){
+        s->ready = false;
+        s->busy = true;
+    }
+    xSemaphoreGive(slots_lock);
+    if(!s){
+        PLOG_LIMITED(PLOG_WARN, 2, "All %d rendition slots are being sent", REND_SLOTS);
+        return NULL;
+    }
+
+    rend_out_t out = {s, 0};
+    bool encoded = fmt2jpg_cb(decode_buf, need, w, h, PIXFORMAT_RGB565, quality, rend_write, &out);
+    xSemaphoreTake(slots_lock, portMAX_DELAY);
+    s->busy = false;
+    if(encoded){
+        s->r.scale = scale;
+        s->r.quality = quality;
+        s->r.width = w;
+        s->r.height = h;
+        s->r.seq = fi.seq;
+        s->r.grab_us = grab_us;
+        s->r.buf = s->buf;
+        s->r.len = out.len;
+        s->ready = true;
+        stats.built++;
+        stats.last_build_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+        stats.last_src_len = src_len;
+        stats.last_len = out.len;
+    }
+    xSemaphoreGive(slots_lock);
+    return encoded ? s : NULL;
+}
+
+const rendition_t *rend_get(uint8_t scale, uint8_t quality, uint32_t after_seq){
+    if(!rend_valid(scale, quality)){
+        return NULL;
+    }
+    xSemaphoreTake(slots_lock, portMAX_DELAY);
+    stats.requests++;
+    rend_slot_t *s = find(scale, quality, after_seq, esp_timer_get_time());
+    if(s){
+        s->refs++;
+        s->used_us = esp_timer_get_time();
+        stats.shared++;
+        xSemaphoreGive(slots_lock);
+        return &s->r;
+    }
+    xSemaphoreGive(slots_lock);
+
+    xSemaphoreTake(build_lock, portMAX_DELAY);
+    // Whoever held the lock may have just made this one
+    xSemaphoreTake(slots_lock, portMAX_DELAY);
+    s = find(scale, quality, after_seq, esp_timer_get_time());
+    if(s){
+        s->refs++;
+        s->used_us = esp_timer_get_time();
+        stats.shared++;
+    }
+    xSemaphoreGive(slots_lock);
+    if(!s){
+        s = build(scale, quality);
+        xSemaphoreTake(slots_lock, portMAX_DELAY);
+        if(s){
+            s->refs++;
+            s->used_us = esp_timer_get_time();
+        } else {
+            stats.failed++;
+        }
+        xSemaphoreGive(slots_lock);
+    }
+    xSemaphoreGive(build_lock);
+    return s ? &s->r : NULL;
+}
+
+void rend_release(const rendition_t *r){
+    if(!r){
+        return;
+    }
+    xSemaphoreTake(slots_lock, portMAX_DELAY);
+    ((rend_slot_t *)r)->refs--;
+    xSemaphoreGive(slots_lock);
+}
+
+void rend_get_stats(rend_stats_t *out){
+    xSemaphoreTake(slots_lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(slots_lock);
+}
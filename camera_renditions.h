@@ -0,0 +1,62 @@
+/*
+  Smart Plant Vision - Scaled Renditions
+  Preview frames transcoded for viewers on slow links: the camera JPEG is
+  decoded at 1/2, 1/4 or 1/8 scale (the decoder drops the DCT coefficients
+  it doesn't need, so a smaller picture also decodes faster) and encoded
+  again at the viewer's quality. The sensor keeps running at the framesize
+  the local clients asked for.
+
+  Renditions are kept in a small pool of slots, one picture each, keyed by
+  scale and quality. A viewer that asks for a key whose newest rendition is
+  fresh enough, and newer than the last one it got, is handed that one
+  instead of transcoding a frame of its own; a viewer that arrives while the
+  same key is being transcoded waits for it.
+*/
+
+#ifndef CAMERA_RENDITIONS_H
+#define CAMERA_RENDITIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REND_MAX_AGE_MS 250   // Oldest rendition handed to a viewer that didn't make it
+#define REND_DEFAULT_QUALITY 40
+
+typedef struct {
+    uint8_t scale;            // 2, 4 or 8
+    uint8_t quality;          // JPEG quality, 1 (smallest) to 100
+    uint16_t width;
+    uint16_t height;
+    uint32_t seq;             // Preview frame it was made from, cam_frame_info_t.seq
+    int64_t grab_us;          // ... and when the sensor captured it
+    const uint8_t *buf;       // JPEG
+    size_t len;
+} rendition_t;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t shared;          // Served from a rendition another request made
+    uint32_t built;           // Preview frames transcoded
+    uint32_t failed;          // No frame, no free slot, or the frame didn't transcode
+    uint32_t last_build_ms;   // Decode plus encode of the most recent one
+    uint32_t last_src_len;    // ... the camera JPEG it started from
+    uint32_t last_len;        // ... and what came out
+    size_t pool_bytes;        // Slot and decode buffers held by the pool
+} rend_stats_t;
+
+// Call once after cam_modes_init()
+bool rend_init(void);
+
+// True for the scales and qualities rend_get() takes
+bool rend_valid(int scale, int quality);
+
+// A rendition newer than after_seq (0 for any) and at most REND_MAX_AGE_MS
+// old, transcoding the next preview frame when there is none. NULL when no
+// frame could be had or transcoded. Give it back with rend_release(); the
+// slot is not reused while anyone is still sending it.
+const rendition_t *rend_get(uint8_t scale, uint8_t quality, uint32_t after_seq);
+void rend_release(const rendition_t *r);
+
+void rend_get_stats(rend_stats_t *out);
+
+#endif
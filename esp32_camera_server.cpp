@@ -7,24 +7,117 @@
 #include <esp32-hal-ledc.h>
 #include "esp_http_server.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_camera.h"
 #include "img_converters.h"
 #include "Arduino.h"
 #include <ArduinoJson.h>
+#include "plant_log.h"
+#include "camera_modes.h"
+#include "camera_renditions.h"
+#include "tile_stream.h"
+#include "pixel_capture.h"
+#include "plant_events.h"
+#include "motion_engine.h"
+#include "lesion_scan.h"
+#include "soil_watch.h"
+#include "sensor_rate.h"
+#include "mqtt_telemetry.h"
+#include "frame_upload.h"
+#include "plant_status.h"
 
 extern int gpLed;
 extern float temperature, humidity;
 extern int soilMoisture;
+extern unsigned long lastSensorRead;
 extern String getSensorJson();
 
 #define PART_BOUNDARY "123456789000000000000987654321"
 static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
 static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Frame-Seq: %u\r\n%s\r\n";
+static const char* _FIRST_AT_SIZE = "X-First-At-Size: 1\r\n";
+static const char* _TILE_PART = "Content-Type: application/x-plant-tiles\r\nContent-Length: %u\r\nX-Frame-Seq: %u\r\n\r\n";
+static const char* _SNAPSHOT_CONTENT_TYPE = "multipart/mixed;boundary=" PART_BOUNDARY;
+static const char* _SNAPSHOT_END = "\r\n--" PART_BOUNDARY "--\r\n";
 
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
+// Latency test mode (/control?var=latency&val=1): every JPEG sent gets a COM
+// segment right after SOI with a sequence number, the frame's grab time and
+// the time the handler sent it, in esp_timer microseconds, big endian:
+//   FF FE 00 1A 'P' 'L' 'A' 'T' seq[4] grab_us[8] send_us[8]
+// /clock reports the same clock so a receiver can map these to its own.
+#define LATENCY_PREFIX_LEN (2 + 28)
+static bool latency_mode = false;
+static uint32_t latency_seq = 0;
+
+static void put_be(uint8_t *p, uint64_t v, int n){
+    for(int i = n - 1; i >= 0; i--){
+        p[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+// SOI plus the latency COM segment, sent in place of the frame's own SOI
+static void latency_prefix(uint8_t *p, int64_t grab_us){
+    static const uint8_t head[] = {0xFF, 0xD8, 0xFF, 0xFE, 0x00, 0x1A, 'P', 'L', 'A', 'T'};
+    memcpy(p, head, sizeof(head));
+    put_be(p + 10, __atomic_add_fetch(&latency_seq, 1, __ATOMIC_RELAXED), 4);
+    put_be(p + 14, (uint64_t)grab_us, 8);
+    put_be(p + 22, (uint64_t)esp_timer_get_time(), 8);
+}
+
+static bool latency_applies(const uint8_t *buf, size_t len){
+    return latency_mode && len > 2 && buf[0] == 0xFF && buf[1] == 0xD8;
+}
+
+static int64_t fb_grab_us(const camera_fb_t *fb){
+    return (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+}
+
+// ?mode=still asks for a full resolution frame, anything else gets the preview
+static cam_mode_t req_mode(httpd_req_t *req){
+    char query[32];
+    char mode[8];
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+       httpd_query_key_value(query, "mode", mode, sizeof(mode)) == ESP_OK && !strcmp(mode, "still")){
+        return CAM_MODE_STILL;
+    }
+    return CAM_MODE_PREVIEW;
+}
+
+// ?scale=2|4|8&quality=1..100 asks for a scaled rendition of the preview
+// (quality on the encoder's scale, higher is better). Returns 1 with the
+// key filled in, 0 when neither is given, -1 when they are out of range.
+static int req_rendition(httpd_req_t *req, uint8_t *scale, uint8_t *quality){
+    char query[64];
+    char value[8];
+    int sc = 0, q = REND_DEFAULT_QUALITY;
+    bool asked = false;
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK){
+        return 0;
+    }
+    if(httpd_query_key_value(query, "scale", value, sizeof(value)) == ESP_OK){
+        sc = atoi(value);
+        asked = true;
+    }
+    if(httpd_query_key_value(query, "quality", value, sizeof(value)) == ESP_OK){
+        q = atoi(value);
+        asked = true;
+    }
+    if(!asked){
+        return 0;
+    }
+    if(!rend_valid(sc, q)){
+        return -1;
+    }
+    *scale = sc;
+    *quality = q;
+    return 1;
+}
+
 typedef struct {
     httpd_req_t *req;
     size_t len;
@@ -42,15 +135,114 @@ static size_t jpg_encode_stream(void * arg, size_t index, const void* data, size
     return len;
 }
 
+// A JPEG as the whole response body, behind the latency mark when that's on
+static esp_err_t send_jpeg(httpd_req_t *req, const uint8_t *buf, size_t len, int64_t grab_us){
+    if(!latency_applies(buf, len)){
+        return httpd_resp_send(req, (const char *)buf, len);
+    }
+    uint8_t prefix[LATENCY_PREFIX_LEN];
+    latency_prefix(prefix, grab_us);
+    esp_err_t res = httpd_resp_send_chunk(req, (const char *)prefix, LATENCY_PREFIX_LEN);
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, (const char *)buf + 2, len - 2);
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+
+// /capture?scale=&quality=: a rendition another viewer made a moment ago, or a new one
+static esp_err_t capture_rendition(httpd_req_t *req, uint8_t scale, uint8_t quality){
+    char seq_hdr[12];
+    const rendition_t *r = rend_get(scale, quality, 0);
+    if(!r){
+        PLOG_LIMITED(PLOG_ERROR, 2, "No 1/%u rendition", scale);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    snprintf(seq_hdr, sizeof(seq_hdr), "%u", r->seq);
+    httpd_resp_set_hdr(req, "X-Frame-Seq", seq_hdr);
+    esp_err_t res = send_jpeg(req, r->buf, r->len, r->grab_us);
+    PLOGI("JPG: %uB 1/%u q%u", (uint32_t)r->len, scale, quality);
+    rend_release(r);
+    return res;
+}
+
+// /capture?format=gray|rgb565|rgb888&scale=1|2|4|8: uncompressed pixels behind
+// a small header, see pixel_capture.h
+static esp_err_t capture_pixels(httpd_req_t *req, const char *query, const char *format){
+    char value[8];
+    char seq_hdr[12];
+    cam_frame_info_t fi;
+    int scale = 1;
+    pix_format_t f = pix_format_from_name(format);
+    if(httpd_query_key_value(query, "scale", value, sizeof(value)) == ESP_OK){
+        scale = atoi(value);
+    }
+    if(!f || !pix_valid_scale(scale)){
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "format is gray, rgb565 or rgb888 and scale 1, 2, 4 or 8");
+    }
+
+    int64_t fr_start = esp_timer_get_time();
+    camera_fb_t * fb = cam_modes_fb_get(req_mode(req), &fi);
+    if (!fb) {
+        PLOG_LIMITED(PLOG_ERROR, 2, "Camera capture failed");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.raw");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    snprintf(seq_hdr, sizeof(seq_hdr), "%u", fi.seq);
+    httpd_resp_set_hdr(req, "X-Frame-Seq", seq_hdr);
+
+    jpg_chunking_t jchunk = {req, 0};
+    bool sent = pix_send(fb, f, scale, fi.seq, jpg_encode_stream, &jchunk);
+    cam_modes_fb_return(fb);
+    if(!sent && !jchunk.len){
+        PLOG_LIMITED(PLOG_ERROR, 2, "Raw %s capture failed", format);
+        return httpd_resp_send_500(req);
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    PLOGI("RAW: %uB %ums", (uint32_t)jchunk.len, (uint32_t)((esp_timer_get_time() - fr_start) / 1000));
+    return sent ? ESP_OK : ESP_FAIL;
+}
+
 // Image capture handler
 static esp_err_t capture_handler(httpd_req_t *req){
     camera_fb_t * fb = NULL;
     esp_err_t res = ESP_OK;
     int64_t fr_start = esp_timer_get_time();
+    cam_frame_info_t fi;
+    char seq_hdr[12];
+    uint8_t scale, quality;
+    char query[64];
+    char format[8];
+    char triage[4];
+    char score_hdr[4], blobs_hdr[6], lesion_hdr[6];
+    bool with_triage = false;
+
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK){
+        if(httpd_query_key_value(query, "format", format, sizeof(format)) == ESP_OK){
+            return capture_pixels(req, query, format);
+        }
+        with_triage = httpd_query_key_value(query, "triage", triage, sizeof(triage)) == ESP_OK && atoi(triage);
+    }
+    int rendition = req_rendition(req, &scale, &quality);
+    if(rendition < 0){
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "scale is 2, 4 or 8 and quality 1 to 100");
+    }
+    if(rendition){
+        return capture_rendition(req, scale, quality);
+    }
 
-    fb = esp_camera_fb_get();
+    fb = cam_modes_fb_get(req_mode(req), &fi);
     if (!fb) {
-        Serial.println("Camera capture failed");
+        PLOG_LIMITED(PLOG_ERROR, 2, "Camera capture failed");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -58,20 +250,68 @@ static esp_err_t capture_handler(httpd_req_t *req){
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    snprintf(seq_hdr, sizeof(seq_hdr), "%u", fi.seq);
+    httpd_resp_set_hdr(req, "X-Frame-Seq", seq_hdr);
+    if(fi.first_at_size){
+        httpd_resp_set_hdr(req, "X-First-At-Size", "1");
+    }
+    lesion_result_t lr;
+    if(with_triage && lesion_scan(fb, fi.seq, &lr)){
+        snprintf(score_hdr, sizeof(score_hdr), "%u", lr.score);
+        snprintf(blobs_hdr, sizeof(blobs_hdr), "%u", lr.blobs);
+        snprintf(lesion_hdr, sizeof(lesion_hdr), "%u", lr.lesion_pm);
+        httpd_resp_set_hdr(req, "X-Triage-Score", score_hdr);
+        httpd_resp_set_hdr(req, "X-Lesion-Blobs", blobs_hdr);
+        httpd_resp_set_hdr(req, "X-Lesion-Permille", lesion_hdr);
+    }
 
     size_t fb_len = 0;
     if(fb->format == PIXFORMAT_JPEG){
         fb_len = fb->len;
-        res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
+        res = send_jpeg(req, fb->buf, fb->len, fb_grab_us(fb));
     } else {
         jpg_chunking_t jchunk = {req, 0};
         res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk)?ESP_OK:ESP_FAIL;
         httpd_resp_send_chunk(req, NULL, 0);
         fb_len = jchunk.len;
     }
-    esp_camera_fb_return(fb);
+    cam_modes_fb_return(fb);
     int64_t fr_end = esp_timer_get_time();
-    Serial.printf("JPG: %uB %ums\n", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start)/1000));
+    PLOGI("JPG: %uB %ums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start)/1000));
+    return res;
+}
+
+// /stream?tiles=1: keyframes and changed tiles for the page's canvas compositor
+static esp_err_t tile_stream_handler(httpd_req_t *req){
+    char part_buf[128];
+    tile_update_t u;
+    tile_stream_t *t = tile_stream_new();
+    if(!t){
+        return httpd_resp_send_500(req);
+    }
+
+    esp_err_t res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    while(res == ESP_OK){
+        if(!tile_stream_next(t, &u)){
+            PLOG_LIMITED(PLOG_ERROR, 2, "Tile stream frame failed");
+            res = ESP_FAIL;
+            break;
+        }
+        size_t hlen = snprintf(part_buf, sizeof(part_buf), _TILE_PART, (unsigned)(u.head_len + u.jpg_len), u.seq);
+        res = httpd_resp_send_chunk(req, part_buf, hlen);
+        if(res == ESP_OK){
+            res = httpd_resp_send_chunk(req, (const char *)u.head, u.head_len);
+        }
+        if(res == ESP_OK){
+            res = httpd_resp_send_chunk(req, (const char *)u.jpg, u.jpg_len);
+        }
+        if(res == ESP_OK){
+            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+        }
+        tile_stream_done(t, &u);
+    }
+    tile_stream_free(t);
     return res;
 }
 
@@ -81,7 +321,24 @@ static esp_err_t stream_handler(httpd_req_t *req){
     esp_err_t res = ESP_OK;
     size_t _jpg_buf_len = 0;
     uint8_t * _jpg_buf = NULL;
-    char * part_buf[64];
+    char part_buf[128];
+    cam_frame_info_t fi;
+    uint8_t prefix[LATENCY_PREFIX_LEN];
+    int64_t grab_us = 0;
+    uint8_t scale = 0, quality = 0;
+    const rendition_t *rend = NULL;
+    uint32_t rend_seq = 0;
+    char query[64];
+    char value[4];
+
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+       httpd_query_key_value(query, "tiles", value, sizeof(value)) == ESP_OK && atoi(value)){
+        return tile_stream_handler(req);
+    }
+    int rendition = req_rendition(req, &scale, &quality);
+    if(rendition < 0){
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "scale is 2, 4 or 8 and quality 1 to 100");
+    }
 
     res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
     if(res != ESP_OK){
@@ -91,17 +348,30 @@ static esp_err_t stream_handler(httpd_req_t *req){
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
     while(true){
-        fb = esp_camera_fb_get();
-        if (!fb) {
-            Serial.println("Camera capture failed");
+        if(rendition){
+            // Never the same picture twice: each part is newer than the last one sent
+            rend = rend_get(scale, quality, rend_seq);
+            if(!rend){
+                PLOG_LIMITED(PLOG_ERROR, 2, "No 1/%u rendition", scale);
+                res = ESP_FAIL;
+            } else {
+                rend_seq = fi.seq = rend->seq;
+                fi.first_at_size = false;
+                grab_us = rend->grab_us;
+                _jpg_buf = (uint8_t *)rend->buf;
+                _jpg_buf_len = rend->len;
+            }
+        } else if (!(fb = cam_modes_fb_get(CAM_MODE_PREVIEW, &fi))) {
+            PLOG_LIMITED(PLOG_ERROR, 2, "Camera capture failed");
             res = ESP_FAIL;
         } else {
+            grab_us = fb_grab_us(fb);
             if(fb->format != PIXFORMAT_JPEG){
                 bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                esp_camera_fb_return(fb);
+                cam_modes_fb_return(fb);
                 fb = NULL;
                 if(!jpeg_converted){
-                    Serial.println("JPEG compression failed");
+                    PLOG_LIMITED(PLOG_ERROR, 2, "JPEG compression failed");
                     res = ESP_FAIL;
                 }
             } else {
@@ -109,18 +379,31 @@ static esp_err_t stream_handler(httpd_req_t *req){
                 _jpg_buf = fb->buf;
             }
         }
+        bool marked = res == ESP_OK && latency_applies(_jpg_buf, _jpg_buf_len);
         if(res == ESP_OK){
-            size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
+            size_t part_len = marked ? _jpg_buf_len + LATENCY_PREFIX_LEN - 2 : _jpg_buf_len;
+            size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, part_len, fi.seq,
+                                   fi.first_at_size ? _FIRST_AT_SIZE : "");
             res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
         }
-        if(res == ESP_OK){
+        if(res == ESP_OK && marked){
+            latency_prefix(prefix, grab_us);
+            res = httpd_resp_send_chunk(req, (const char *)prefix, LATENCY_PREFIX_LEN);
+            if(res == ESP_OK){
+                res = httpd_resp_send_chunk(req, (const char *)_jpg_buf + 2, _jpg_buf_len - 2);
+            }
+        } else if(res == ESP_OK){
             res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
         }
         if(res == ESP_OK){
             res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
         }
-        if(fb){
-            esp_camera_fb_return(fb);
+        if(rend){
+            rend_release(rend);
+            rend = NULL;
+            _jpg_buf = NULL;
+        } else if(fb){
+            cam_modes_fb_return(fb);
             fb = NULL;
             _jpg_buf = NULL;
         } else if(_jpg_buf){
@@ -134,6 +417,81 @@ static esp_err_t stream_handler(httpd_req_t *req){
     return res;
 }
 
+// Frame plus the sensor and camera state at the moment it was taken, as one
+// multipart/mixed response: a JSON part, then the JPEG part. The sensor values
+// are the ones loop() last read, the JPEG goes out straight from the frame buffer.
+static esp_err_t snapshot_handler(httpd_req_t *req){
+    static char head[896];
+    cam_mode_t mode = req_mode(req);
+    cam_frame_info_t fi;
+    camera_fb_t * fb = cam_modes_fb_get(mode, &fi);
+    if (!fb) {
+        PLOG_LIMITED(PLOG_ERROR, 2, "Camera capture failed");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    int64_t grab_us = fb_grab_us(fb);
+    unsigned long now_ms = millis();
+    sensor_t * s = esp_camera_sensor_get();
+
+    uint8_t * jpg_buf = fb->buf;
+    size_t jpg_len = fb->len;
+    bool converted = false;
+    if(fb->format != PIXFORMAT_JPEG){
+        converted = frame2jpg(fb, 80, &jpg_buf, &jpg_len);
+        if(!converted){
+            cam_modes_fb_return(fb);
+            PLOG_LIMITED(PLOG_ERROR, 2, "JPEG compression failed");
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+    }
+
+    // Frames that are not JPEG go without triage; so does one the scan failed on
+    char triage[144] = "null";
+    char members[128];
+    lesion_result_t lr;
+    if(lesion_scan(fb, fi.seq, &lr)){
+        lesion_json(&lr, members, sizeof(members));
+        snprintf(triage, sizeof(triage), "{%s}", members);
+    }
+
+    char json[640];
+    int jlen = snprintf(json, sizeof(json),
+                        "{\"t_us\":%lld,"
+                        "\"frame\":{\"width\":%u,\"height\":%u,\"len\":%u,\"grab_us\":%lld,\"seq\":%u},"
+                        "\"camera\":{\"framesize\":%u,\"quality\":%u,\"brightness\":%d,\"contrast\":%d},"
+                        "\"sensors\":{\"temperature\":%.1f,\"humidity\":%.1f,\"soilMoisture\":%d,\"age_ms\":%lu},"
+                        "\"triage\":%s}",
+                        (long long)esp_timer_get_time(), (unsigned)fb->width, (unsigned)fb->height,
+                        (unsigned)jpg_len, (long long)grab_us, fi.seq, cam_modes_get_framesize(mode), s->status.quality,
+                        s->status.brightness, s->status.contrast, temperature, humidity, soilMoisture,
+                        now_ms - lastSensorRead, triage);
+    size_t hlen = snprintf(head, sizeof(head),
+                           "--" PART_BOUNDARY "\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s"
+                           "\r\n--" PART_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+                           jlen, json, (unsigned)jpg_len);
+
+    httpd_resp_set_type(req, _SNAPSHOT_CONTENT_TYPE);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    esp_err_t res = httpd_resp_send_chunk(req, head, hlen);
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, (const char *)jpg_buf, jpg_len);
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, _SNAPSHOT_END, strlen(_SNAPSHOT_END));
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    if(converted){
+        free(jpg_buf);
+    }
+    cam_modes_fb_return(fb);
+    return res;
+}
+
 // Sensor data API endpoint
 static esp_err_t sensors_handler(httpd_req_t *req){
     String sensorData = getSensorJson();
@@ -183,7 +541,13 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     int res = 0;
 
     if(!strcmp(variable, "framesize")) {
-        if(s->pixformat == PIXFORMAT_JPEG) res = s->set_framesize(s, (framesize_t)val);
+        // The driver only rejects sizes past the end of its table
+        if(val < 0 || val >= FRAMESIZE_INVALID) res = -1;
+        else if(s->pixformat == PIXFORMAT_JPEG) res = cam_modes_set_framesize(CAM_MODE_PREVIEW, (framesize_t)val);
+    }
+    else if(!strcmp(variable, "stillsize")) {
+        if(val < 0 || val >= FRAMESIZE_INVALID) res = -1;
+        else if(s->pixformat == PIXFORMAT_JPEG) res = cam_modes_set_framesize(CAM_MODE_STILL, (framesize_t)val);
     }
     else if(!strcmp(variable, "quality")) {
         res = s->set_quality(s, val);
@@ -197,6 +561,36 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     else if(!strcmp(variable, "flash")) {
         ledcWrite(7, val);
     }
+    else if(!strcmp(variable, "latency")) {
+        latency_mode = val != 0;
+    }
+    else if(!strcmp(variable, "motion")) {
+        motion_enable(val != 0);
+    }
+    else if(!strcmp(variable, "motion_still")) {
+        motion_set_still(val != 0);
+    }
+    else if(!strcmp(variable, "soil_still")) {
+        soil_watch_set_still(val != 0);
+    }
+    else if(!strcmp(variable, "upload_every")) {
+        res = upload_set_every(val) ? 0 : -1;
+    }
+    else if(!strcmp(variable, "upload_triage")) {
+        res = upload_set_triage(val) ? 0 : -1;
+    }
+    else if(!strcmp(variable, "upload_events")) {
+        upload_set_events(val != 0);
+    }
+    else if(!strcmp(variable, "upload_now")) {
+        upload_now();
+    }
+    else if(!strcmp(variable, "sensor_min_ms")) {
+        res = sensor_rate_set_bounds(val, sensor_rate_max()) ? 0 : -1;
+    }
+    else if(!strcmp(variable, "sensor_max_ms")) {
+        res = sensor_rate_set_bounds(sensor_rate_min(), val) ? 0 : -1;
+    }
     else {
         res = -1;
     }
@@ -209,26 +603,262 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     return httpd_resp_send(req, NULL, 0);
 }
 
+static void status_u32(status_field_t *f, size_t *n, size_t max, const char *key, uint32_t v){
+    if(*n < max){
+        f[*n].key = key;
+        f[*n].kind = STATUS_U32;
+        f[(*n)++].u32 = v;
+    }
+}
+
+static void status_u64(status_field_t *f, size_t *n, size_t max, const char *key, uint64_t v){
+    if(*n < max){
+        f[*n].key = key;
+        f[*n].kind = STATUS_U64;
+        f[(*n)++].u64 = v;
+    }
+}
+
+static void status_i32(status_field_t *f, size_t *n, size_t max, const char *key, int32_t v){
+    if(*n < max){
+        f[*n].key = key;
+        f[*n].kind = STATUS_I32;
+        f[(*n)++].i32 = v;
+    }
+}
+
+static void status_f32(status_field_t *f, size_t *n, size_t max, const char *key, float v){
+    if(*n < max){
+        f[*n].key = key;
+        f[*n].kind = STATUS_F32;
+        f[(*n)++].f32 = v;
+    }
+}
+
+size_t status_collect(status_field_t *f, size_t max){
+    size_t n = 0;
+    sensor_t * s = esp_camera_sensor_get();
+    status_u32(f, &n, max, "framesize", cam_modes_get_framesize(CAM_MODE_PREVIEW));
+    status_u32(f, &n, max, "stillsize", cam_modes_get_framesize(CAM_MODE_STILL));
+    status_u32(f, &n, max, "quality", s->status.quality);
+    status_i32(f, &n, max, "brightness", s->status.brightness);
+    status_i32(f, &n, max, "contrast", s->status.contrast);
+    status_f32(f, &n, max, "temperature", temperature);
+    status_f32(f, &n, max, "humidity", humidity);
+    status_i32(f, &n, max, "soilMoisture", soilMoisture);
+    plog_stats_t ls;
+    plog_get_stats(&ls);
+    status_u32(f, &n, max, "log_written", ls.written);
+    status_u32(f, &n, max, "log_dropped", ls.dropped);
+    status_u32(f, &n, max, "log_suppressed", ls.suppressed);
+    status_u32(f, &n, max, "latency_mode", latency_mode ? 1 : 0);
+    cam_modes_stats_t ms;
+    cam_modes_get_stats(&ms);
+    status_u32(f, &n, max, "mode_switches", ms.switches);
+    status_u32(f, &n, max, "mode_discarded", ms.discarded);
+    status_u32(f, &n, max, "still_ms", ms.last_still_ms);
+    status_u32(f, &n, max, "switch_us", ms.last_switch_us);
+    status_u32(f, &n, max, "resize_ms", ms.last_resize_ms);
+    status_u32(f, &n, max, "resize_flushed", ms.last_resize_flushed);
+    rend_stats_t rs;
+    rend_get_stats(&rs);
+    status_u32(f, &n, max, "rend_built", rs.built);
+    status_u32(f, &n, max, "rend_shared", rs.shared);
+    status_u32(f, &n, max, "rend_ms", rs.last_build_ms);
+    status_u32(f, &n, max, "rend_pool", (uint32_t)rs.pool_bytes);
+    tile_stats_t ts;
+    tile_get_stats(&ts);
+    status_u32(f, &n, max, "tile_keys", ts.keys);
+    status_u32(f, &n, max, "tile_updates", ts.updates);
+    status_u64(f, &n, max, "tile_bytes", ts.bytes);
+    status_u64(f, &n, max, "tile_frame_bytes", ts.frame_bytes);
+    motion_stats_t mo;
+    motion_get_stats(&mo);
+    status_u32(f, &n, max, "motion_on", motion_enabled() ? 1 : 0);
+    status_f32(f, &n, max, "motion_fps", mo.fps);
+    status_u32(f, &n, max, "motion_ms", mo.last_ms);
+    status_u32(f, &n, max, "motion_events", mo.events);
+    lesion_stats_t le;
+    lesion_get_stats(&le);
+    status_u32(f, &n, max, "lesion_scans", le.scans);
+    status_u32(f, &n, max, "lesion_clean", le.clean);
+    status_u32(f, &n, max, "lesion_ms", le.last_ms);
+    status_u32(f, &n, max, "sensor_min_ms", sensor_rate_min());
+    status_u32(f, &n, max, "sensor_max_ms", sensor_rate_max());
+    telemetry_stats_t tm;
+    telemetry_get_stats(&tm);
+    status_u32(f, &n, max, "mqtt_up", tm.connected ? 1 : 0);
+    status_u32(f, &n, max, "mqtt_queue", tm.depth);
+    status_u32(f, &n, max, "mqtt_dropped", tm.dropped);
+    upload_stats_t up;
+    upload_get_stats(&up);
+    status_u32(f, &n, max, "upload_every", upload_every());
+    status_u32(f, &n, max, "upload_triage", upload_triage());
+    status_u32(f, &n, max, "upload_events", upload_events() ? 1 : 0);
+    status_u32(f, &n, max, "upload_queue", up.depth);
+    status_u32(f, &n, max, "upload_sent", up.sent);
+    status_u32(f, &n, max, "upload_failed", up.failed);
+    return n;
+}
+
 // Status API endpoint
 static esp_err_t status_handler(httpd_req_t *req){
-    static char json_response[1024];
-    sensor_t * s = esp_camera_sensor_get();
-    char * p = json_response;
-    *p++ = '{';
-
-    p+=sprintf(p, "\"framesize\":%u,", s->status.framesize);
-    p+=sprintf(p, "\"quality\":%u,", s->status.quality);
-    p+=sprintf(p, "\"brightness\":%d,", s->status.brightness);
-    p+=sprintf(p, "\"contrast\":%d,", s->status.contrast);
-    p+=sprintf(p, "\"temperature\":%.1f,", temperature);
-    p+=sprintf(p, "\"humidity\":%.1f,", humidity);
-    p+=sprintf(p, "\"soilMoisture\":%d", soilMoisture);
-    *p++ = '}';
-    *p++ = 0;
-    
+    static char json_response[STATUS_JSON_MAX];
+    static status_field_t fields[STATUS_FIELDS_MAX];
+    size_t n = status_collect(fields, STATUS_FIELDS_MAX);
+    int len = n < STATUS_FIELDS_MAX ? status_format(fields, n, json_response, sizeof(json_response)) : -1;
+    if(len < 0){
+        PLOG_LIMITED(PLOG_ERROR, 1, "status: reply does not fit (%u fields, %u bytes)", (unsigned)n, (unsigned)sizeof(json_response));
+        return httpd_resp_send_500(req);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json_response, len);
+}
+
+// Device clock for latency mode: the receiver brackets this request with its
+// own clock to find the offset, so the timestamp is taken as late as possible
+static esp_err_t clock_handler(httpd_req_t *req){
+    char json[64];
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    int n = snprintf(json, sizeof(json), "{\"t_us\":%lld}", (long long)esp_timer_get_time());
+    return httpd_resp_send(req, json, n);
+}
+
+static int pipeline_json(char *p, size_t n, const cam_pipeline_report_t *r){
+    return snprintf(p, n, "\"fb_count\":%u,\"fb_location\":\"%s\",\"grab_mode\":\"%s\",\"fb_bytes\":%u,"
+                          "\"reinit_ms\":%u,\"frames\":%u,\"fps\":%.1f,\"frame_age_ms\":%.1f",
+                    (unsigned)r->pipeline.fb_count, r->pipeline.fb_location == CAMERA_FB_IN_DRAM ? "dram" : "psram",
+                    r->pipeline.grab_mode == CAMERA_GRAB_LATEST ? "latest" : "queued", (unsigned)r->fb_bytes,
+                    r->reinit_ms, r->frames, r->fps, r->frame_age_ms);
+}
+
+// Moves *p past what a snprintf() at *p wrote; false when it didn't fit, as status_format()
+static bool advance(char **p, const char *end, int w){
+    if(w < 0 || w >= end - *p){
+        return false;
+    }
+    *p += w;
+    return true;
+}
+
+// Frame buffer pipeline: reports the running one next to the one it replaced,
+// ?fb_count=N&fb_location=psram|dram&grab=latest|queued changes it. Latest
+// with 2 buffers gives the freshest frames, queued with 3 the steadiest rate.
+static esp_err_t pipeline_handler(httpd_req_t *req){
+    static char json[640];
+    char query[96];
+    char value[16];
+    cam_pipeline_report_t now, before;
+    cam_modes_get_pipeline(&now, &before);
+    cam_pipeline_t want = now.pipeline;
+    bool change = false;
+    esp_err_t err = ESP_OK;
+
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK){
+        if(httpd_query_key_value(query, "fb_count", value, sizeof(value)) == ESP_OK){
+            int n = atoi(value);
+            want.fb_count = n > 0 ? n : 0;
+            change = true;
+        }
+        if(httpd_query_key_value(query, "fb_location", value, sizeof(value)) == ESP_OK){
+            if(!strcmp(value, "psram")) want.fb_location = CAMERA_FB_IN_PSRAM;
+            else if(!strcmp(value, "dram")) want.fb_location = CAMERA_FB_IN_DRAM;
+            else err = ESP_ERR_INVALID_ARG;
+            change = true;
+        }
+        if(httpd_query_key_value(query, "grab", value, sizeof(value)) == ESP_OK){
+            if(!strcmp(value, "latest")) want.grab_mode = CAMERA_GRAB_LATEST;
+            else if(!strcmp(value, "queued")) want.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+            else err = ESP_ERR_INVALID_ARG;
+            change = true;
+        }
+    }
+    if(change && err == ESP_OK){
+        err = cam_modes_set_pipeline(&want);
+        cam_modes_get_pipeline(&now, &before);
+    }
+
+    char * p = json;
+    char * end = json + sizeof(json);
+    bool fits = advance(&p, end, snprintf(p, end - p, "{")) &&
+                advance(&p, end, pipeline_json(p, end - p, &now)) &&
+                advance(&p, end, snprintf(p, end - p, ",\"psram_free\":%u,\"dram_free\":%u,\"previous\":{",
+                                          (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+                                          (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL))) &&
+                advance(&p, end, pipeline_json(p, end - p, &before)) &&
+                advance(&p, end, snprintf(p, end - p, "}")) &&
+                (err == ESP_OK || advance(&p, end, snprintf(p, end - p, ",\"error\":\"%s\"", esp_err_to_name(err)))) &&
+                advance(&p, end, snprintf(p, end - p, "}"));
+    if(!fits){
+        PLOG_LIMITED(PLOG_ERROR, 1, "pipeline: reply does not fit in %u bytes", (unsigned)sizeof(json));
+        return httpd_resp_send_500(req);
+    }
+    if(err != ESP_OK){
+        httpd_resp_set_status(req, err == ESP_ERR_INVALID_ARG ? HTTPD_400 : HTTPD_500);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, json, p - json);
+}
+
+// Events after ?since=<id> (all still held without it), oldest first:
+// {"last":N,"events":[{"id":..,"t_ms":..,"type":"motion",...}]}. A client
+// polls with the last id it got; "last" below its own id means a reboot.
+static esp_err_t events_handler(httpd_req_t *req){
+    char query[32];
+    char value[12];
+    char line[PEV_DATA_LEN + 96];
+    uint32_t cursor = 0;
+    plant_event_t e;
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+       httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK){
+        cursor = strtoul(value, NULL, 10);
+    }
+
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, json_response, strlen(json_response));
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    int n = snprintf(line, sizeof(line), "{\"last\":%u,\"events\":[", pev_last_id());
+    esp_err_t res = httpd_resp_send_chunk(req, line, n);
+    bool first = true;
+    while(res == ESP_OK && pev_next(&cursor, &e)){
+        line[0] = ',';
+        n = 1 + pev_json(&e, line + 1, sizeof(line) - 1);
+        res = httpd_resp_send_chunk(req, first ? line + 1 : line, first ? n - 1 : n);
+        first = false;
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, "]}", 2);
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+
+// Full resolution still the latest event took, if motion_still or soil_still is on
+static esp_err_t event_still_handler(httpd_req_t *req){
+    const uint8_t *buf;
+    size_t len;
+    uint32_t id;
+    char id_hdr[12];
+    pev_still_t *still = pev_still_get(&buf, &len, &id);
+    if(!still){
+        return httpd_resp_send_404(req);
+    }
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    snprintf(id_hdr, sizeof(id_hdr), "%u", id);
+    httpd_resp_set_hdr(req, "X-Event-Id", id_hdr);
+    esp_err_t res = httpd_resp_send(req, (const char *)buf, len);
+    pev_still_release(still);
+    return res;
 }
 
 // Modern HTML interface
@@ -274,17 +904,24 @@ static const char PROGMEM INDEX_HTML[] = R"rawliteral(
             <h3 class="text-xl font-semibold mb-4 text-black">📷 Live Camera Feed</h3>
             <div class="bg-black rounded-lg overflow-hidden">
                 <img id="stream" src="" class="w-full h-auto" style="max-height: 500px; object-fit: contain;">
+                <canvas id="tiles" class="w-full h-auto hidden" style="max-height: 500px; object-fit: contain;"></canvas>
             </div>
             <div class="flex gap-4 mt-4">
                 <button onclick="startStream()" class="bg-green-500 hover:bg-green-600 text-white px-4 py-2 rounded-lg font-semibold">
                     ▶️ Start Stream
                 </button>
+                <button onclick="startTileStream()" class="bg-teal-500 hover:bg-teal-600 text-white px-4 py-2 rounded-lg font-semibold">
+                    🧩 Low-bandwidth Stream
+                </button>
                 <button onclick="stopStream()" class="bg-red-500 hover:bg-red-600 text-white px-4 py-2 rounded-lg font-semibold">
                     ⏹️ Stop Stream
                 </button>
                 <button onclick="captureImage()" class="bg-blue-500 hover:bg-blue-600 text-white px-4 py-2 rounded-lg font-semibold">
                     📸 Capture
                 </button>
+                <button onclick="captureStill()" class="bg-indigo-500 hover:bg-indigo-600 text-white px-4 py-2 rounded-lg font-semibold">
+                    🖼️ Full-res Still
+                </button>
             </div>
         </div>
 
@@ -336,20 +973,109 @@ static const char PROGMEM INDEX_HTML[] = R"rawliteral(
 
     <script>
         let isStreaming = false;
+        let tileAbort = null;
         
         function startStream() {
+            stopStream();
             document.getElementById('stream').src = window.location.origin + ':81/stream';
             isStreaming = true;
         }
         
         function stopStream() {
             document.getElementById('stream').src = '';
+            if (tileAbort) {
+                tileAbort.abort();
+                tileAbort = null;
+            }
+            document.getElementById('stream').classList.remove('hidden');
+            document.getElementById('tiles').classList.add('hidden');
             isStreaming = false;
         }
+
+        function indexOf(buf, text, from) {
+            const pat = new TextEncoder().encode(text);
+            outer: for (let i = from; i + pat.length <= buf.length; i++) {
+                for (let j = 0; j < pat.length; j++) {
+                    if (buf[i + j] !== pat[j]) continue outer;
+                }
+                return i;
+            }
+            return -1;
+        }
+
+        // Next complete multipart body at the start of buf, or null
+        function nextPart(buf) {
+            const cl = indexOf(buf, 'Content-Length: ', 0);
+            const head = cl < 0 ? -1 : indexOf(buf, '\r\n\r\n', cl);
+            if (head < 0) return null;
+            const len = parseInt(new TextDecoder().decode(buf.subarray(cl + 16, cl + 26)));
+            if (buf.length < head + 4 + len) return null;
+            return { body: buf.subarray(head + 4, head + 4 + len), end: head + 4 + len };
+        }
+
+        // A keyframe replaces the canvas; a tile update draws each tile of the
+        // atlas JPEG where its index in the frame's tile grid says
+        async function drawTiles(canvas, ctx, p) {
+            const v = new DataView(p.buffer, p.byteOffset, p.byteLength);
+            const ts = p[3], w = v.getUint16(4, true), h = v.getUint16(6, true);
+            const n = v.getUint16(8, true), atlasCols = v.getUint16(10, true);
+            const bmp = await createImageBitmap(new Blob([p.subarray(12 + n * 2)], { type: 'image/jpeg' }));
+            if (p[2] === 0) {
+                if (canvas.width !== w || canvas.height !== h) {
+                    canvas.width = w;
+                    canvas.height = h;
+                }
+                ctx.drawImage(bmp, 0, 0);
+            } else {
+                const cols = Math.ceil(w / ts);
+                for (let i = 0; i < n; i++) {
+                    const idx = v.getUint16(12 + i * 2, true);
+                    ctx.drawImage(bmp, (i % atlasCols) * ts, Math.floor(i / atlasCols) * ts, ts, ts,
+                                  (idx % cols) * ts, Math.floor(idx / cols) * ts, ts, ts);
+                }
+            }
+            bmp.close();
+        }
+
+        // Only the parts of the picture that changed are sent, for slow links
+        async function startTileStream() {
+            stopStream();
+            const canvas = document.getElementById('tiles');
+            const ctx = canvas.getContext('2d');
+            document.getElementById('stream').classList.add('hidden');
+            canvas.classList.remove('hidden');
+            tileAbort = new AbortController();
+            isStreaming = true;
+            try {
+                const res = await fetch(window.location.origin + ':81/stream?tiles=1', { signal: tileAbort.signal });
+                const reader = res.body.getReader();
+                let buf = new Uint8Array(0);
+                for (;;) {
+                    const { done, value } = await reader.read();
+                    if (done) break;
+                    const joined = new Uint8Array(buf.length + value.length);
+                    joined.set(buf);
+                    joined.set(value, buf.length);
+                    buf = joined;
+                    let part;
+                    while ((part = nextPart(buf))) {
+                        await drawTiles(canvas, ctx, part.body);
+                        buf = buf.subarray(part.end);
+                    }
+                }
+            } catch (error) {
+                if (error.name !== 'AbortError') console.error('Tile stream error:', error);
+            }
+        }
         
         function captureImage() {
             window.open(window.location.origin + '/capture', '_blank');
         }
+
+        // The preview keeps running; the camera fits the still in between two frames
+        function captureStill() {
+            window.open(window.location.origin + '/capture?mode=still', '_blank');
+        }
         
         function updateSetting(setting, value) {
             fetch(`/control?var=${setting}&val=${value}`)
@@ -403,6 +1129,7 @@ static esp_err_t index_handler(httpd_req_t *req){
 void startCameraServer(){
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
+    config.max_uri_handlers = 12;   // The default 8 is taken
 
     httpd_uri_t index_uri = {
         .uri       = "/",
@@ -439,19 +1166,59 @@ void startCameraServer(){
         .user_ctx  = NULL
     };
 
-    Serial.printf("Starting web server on port: '%d'\n", config.server_port);
+    httpd_uri_t snapshot_uri = {
+        .uri       = "/snapshot",
+        .method    = HTTP_GET,
+        .handler   = snapshot_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t clock_uri = {
+        .uri       = "/clock",
+        .method    = HTTP_GET,
+        .handler   = clock_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t pipeline_uri = {
+        .uri       = "/pipeline",
+        .method    = HTTP_GET,
+        .handler   = pipeline_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t events_uri = {
+        .uri       = "/events",
+        .method    = HTTP_GET,
+        .handler   = events_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t event_still_uri = {
+        .uri       = "/events/still",
+        .method    = HTTP_GET,
+        .handler   = event_still_handler,
+        .user_ctx  = NULL
+    };
+
+    PLOGI("Starting web server on port: '%d'", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK) {
         httpd_register_uri_handler(camera_httpd, &index_uri);
         httpd_register_uri_handler(camera_httpd, &cmd_uri);
         httpd_register_uri_handler(camera_httpd, &status_uri);
         httpd_register_uri_handler(camera_httpd, &capture_uri);
         httpd_register_uri_handler(camera_httpd, &sensors_uri);
+        httpd_register_uri_handler(camera_httpd, &snapshot_uri);
+        httpd_register_uri_handler(camera_httpd, &clock_uri);
+        httpd_register_uri_handler(camera_httpd, &pipeline_uri);
+        httpd_register_uri_handler(camera_httpd, &events_uri);
+        httpd_register_uri_handler(camera_httpd, &event_still_uri);
     }
 
     // Stream server on port 81
     config.server_port += 1;
     config.ctrl_port += 1;
-    Serial.printf("Starting stream server on port: '%d'\n", config.server_port);
+    PLOGI("Starting stream server on port: '%d'", config.server_port);
     if (httpd_start(&stream_httpd, &config) == ESP_OK) {
         httpd_uri_t stream_uri = {
             .uri       = "/stream",
@@ -10,6 +10,9 @@
 
 const char* ssid = "YOUR_WIFI_NAME";     // Change this!
 const char* password = "YOUR_WIFI_PASSWORD"; // Change this!
+const char* mqttBroker = "";                         // Telemetry off; set e.g. "mqtt://192.168.1.10:1883"
+const char* mqttTopic = "plants/plant-1";            // Change this! One prefix per device
+const char* uploadUrl = "";                          // Uploads off; set e.g. "http://192.168.1.20:5000/predict"
 
 #include "esp_wifi.h"
 #include "esp_camera.h"
@@ -18,6 +21,16 @@ const char* password = "YOUR_WIFI_PASSWORD"; // Change this!
 #include "soc/rtc_cntl_reg.h"
 #include <DHT.h>
 #include <ArduinoJson.h>
+#include "plant_log.h"
+#include "camera_modes.h"
+#include "camera_renditions.h"
+#include "plant_events.h"
+#include "motion_engine.h"
+#include "lesion_scan.h"
+#include "soil_watch.h"
+#include "sensor_rate.h"
+#include "mqtt_telemetry.h"
+#include "frame_upload.h"
 
 #define CAMERA_MODEL_AI_THINKER
 
@@ -52,16 +65,18 @@ float temperature = 0.0;
 float humidity = 0.0;
 int soilMoisture = 0;
 unsigned long lastSensorRead = 0;
-const unsigned long sensorInterval = 5000; // Read sensors every 5 seconds
+unsigned long sensorInterval = SENSOR_START_MS; // Follows the readings, see sensor_rate.h
 
 void startCameraServer();
+void readSensors();
 extern int gpLed = 4;
 
 void setup() {
   WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0); // Prevent brownouts
   
   Serial.begin(115200);
-  Serial.setDebugOutput(true);
+  Serial.setDebugOutput(false); // Core/IDF logs go through plog instead of blocking on the UART
+  plog_init(PLOG_INFO, 64);
   Serial.println();
   Serial.println("🌱 Smart Plant Vision Starting...");
 
@@ -70,7 +85,7 @@ void setup() {
   Serial.println("📊 DHT22 sensor initialized");
 
   // Camera configuration
-  camera_config_t config;
+  camera_config_t config = {}; // Unset fields (fb_location, grab_mode, sccb port) default to zero
   config.ledc_channel = LEDC_CHANNEL_0;
   config.ledc_timer = LEDC_TIMER_0;
   config.pin_d0 = Y2_GPIO_NUM;
@@ -102,7 +117,7 @@ void setup() {
     config.fb_count = 1;
   }
 
-  // Camera init
+  // Camera init (fb_count, fb_location and grab_mode can be changed later through /pipeline)
   esp_err_t err = esp_camera_init(&config);
   if (err != ESP_OK) {
     Serial.printf("❌ Camera init failed with error 0x%x", err);
@@ -111,10 +126,16 @@ void setup() {
 
   // Camera settings
   sensor_t * s = esp_camera_sensor_get();
-  s->set_framesize(s, FRAMESIZE_XGA); // Good balance of quality/speed
   s->set_vflip(s, 1);    // Flip vertically
   s->set_hmirror(s, 1);  // Mirror horizontally - adjust as needed
 
+  // Preview at XGA (good balance of quality/speed), stills at the size the frame buffers were made for
+  cam_modes_init(&config, FRAMESIZE_XGA);
+  rend_init();  // Scaled renditions for /stream?scale= and /capture?scale=
+  pev_init();
+  motion_init();  // Pest watch on the preview frames, events at /events
+  lesion_init();  // Disease triage for /snapshot and /capture?triage=1
+
   // LED setup
   pinMode(gpLed, OUTPUT);
   ledcSetup(7, 5000, 8);
@@ -151,6 +172,12 @@ void setup() {
   // Start camera server
   startCameraServer();
 
+  // Readings and events to the broker; queued while it is out of reach
+  telemetry_start(mqttBroker, mqttTopic);
+
+  // Frames to the inference server: scheduled, suspicious or for events
+  upload_start(uploadUrl);
+
   // Success indicator - flash LED
   for (int i = 0; i < 5; i++) {
     ledcWrite(7, 50);
@@ -187,10 +214,18 @@ void readSensors() {
   int rawSoil = analogRead(SOIL_MOISTURE_PIN);
   soilMoisture = map(rawSoil, 4095, 0, 0, 100); // Invert and convert to %
   soilMoisture = constrain(soilMoisture, 0, 100);
+
+  // Watering and drying events, from the unrounded percentage
+  float soilPercent = (4095 - rawSoil) * 100.0f / 4095;
+  soil_watch_sample(soilPercent, millis());
+
+  // Read again sooner while the readings move, later while they are flat
+  sensorInterval = sensor_rate_update(newTemperature, newHumidity, soilPercent);
+  telemetry_sample(newTemperature, newHumidity, soilPercent, sensorInterval);
   
-  // Print to serial
-  Serial.printf("🌡️  Temp: %.1f°C | 💧 Humidity: %.1f%% | 🌱 Soil: %d%%\n", 
-                temperature, humidity, soilMoisture);
+  // Queue for the log drain task
+  PLOGI("🌡️  Temp: %.1f°C | 💧 Humidity: %.1f%% | 🌱 Soil: %d%% | ⏱️  Next in %lus",
+        temperature, humidity, soilMoisture, sensorInterval / 1000);
 }
 
 // Function to get sensor data as JSON
@@ -199,6 +234,7 @@ String getSensorJson() {
   doc["temperature"] = temperature;
   doc["humidity"] = humidity;
   doc["soilMoisture"] = soilMoisture;
+  doc["interval_ms"] = sensorInterval;
   doc["timestamp"] = millis();
   doc["status"] = "online";
   
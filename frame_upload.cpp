@@ -0,0 +1,411 @@
+/*
+  Smart Plant Vision - Frame Upload
+  Two tasks around one queue: the picking task takes the stills (and runs
+  the lesion scan on preview frames) and the sending task posts them. A
+  batch is copied out of the queue into one request body under the lock,
+  and its frames leave the queue only once the server has answered, so
+  frames queued or dropped meanwhile don't disturb it.
+*/
+
+#include "frame_upload.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "camera_modes.h"
+#include "lesion_scan.h"
+#include "plant_events.h"
+#include "plant_log.h"
+
+#define UPLOAD_BOUNDARY     "plantvision-frame-boundary"
+#define PART_HEAD_MAX       192     // Boundary and part headers of one frame
+#define PICK_TICK_MS        1000
+#define SUSPECT_REPEAT_MS   900000  // The same suspicious leaf goes again at most this often,
+#define SUSPECT_RISE        10      // ... unless its score rose by this much
+
+typedef struct {
+    uint32_t id;              // Order in which frames were queued
+    uint8_t reason;
+    uint32_t seq;             // Camera frame sequence number
+    uint32_t t_ms;
+    uint8_t *buf;
+    size_t len;
+} upload_item_t;
+
+static const char *reason_names[] = {"scheduled", "suspicious", "event", "manual"};
+
+static esp_http_client_handle_t client = NULL;
+static TaskHandle_t pick_task = NULL;
+static TaskHandle_t send_task = NULL;
+static std::atomic<uint32_t> every_s(UPLOAD_EVERY_S);
+static std::atomic<uint32_t> triage_s(UPLOAD_TRIAGE_S);
+static std::atomic<bool> events_on(false);
+static std::atomic<bool> manual(false);
+
+// Under queue_lock
+static SemaphoreHandle_t queue_lock = NULL;
+static upload_item_t items[UPLOAD_QUEUE];
+static uint32_t tail = 0, count = 0;
+static uint32_t next_id = 1;
+static size_t queue_bytes = 0;
+
+// Sending task only
+static char *body = NULL;
+static size_t body_cap = 0;
+static uint32_t connections = 0;
+
+static std::atomic<uint32_t> stat_queued(0);
+static std::atomic<uint32_t> stat_sent(0);
+static std::atomic<uint32_t> stat_batches(0);
+static std::atomic<uint32_t> stat_failed(0);
+static std::atomic<uint32_t> stat_rejected(0);
+static std::atomic<uint32_t> stat_dropped(0);
+static std::atomic<uint32_t> stat_reused(0);
+static std::atomic<uint32_t> stat_last_ms(0);
+static std::atomic<int> stat_last_status(0);
+
+static uint32_t now_ms(void){
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void pop_locked(void){
+    upload_item_t *it = &items[tail];
+    heap_caps_free(it->buf);
+    it->buf = NULL;
+    queue_bytes -= it->len;
+    tail = (tail + 1) % UPLOAD_QUEUE;
+    count--;
+}
+
+bool upload_frame(const camera_fb_t *fb, upload_reason_t reason, uint32_t seq){
+    if(!queue_lock || fb->format != PIXFORMAT_JPEG || fb->len > UPLOAD_QUEUE_BYTES){
+        return false;
+    }
+    uint8_t *copy = (uint8_t *)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM);
+    if(!copy){
+        PLOG_LIMITED(PLOG_WARN, 1, "No memory to queue a %u byte frame for upload", (unsigned)fb->len);
+        stat_dropped++;
+        return false;
+    }
+    memcpy(copy, fb->buf, fb->len);
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    while(count && (count == UPLOAD_QUEUE || queue_bytes + fb->len > UPLOAD_QUEUE_BYTES)){
+        pop_locked();
+        stat_dropped++;
+    }
+    upload_item_t *it = &items[(tail + count) % UPLOAD_QUEUE];
+    it->id = next_id++;
+    it->reason = (uint8_t)reason;
+    it->seq = seq;
+    it->t_ms = now_ms();
+    it->buf = copy;
+    it->len = fb->len;
+    queue_bytes += fb->len;
+    count++;
+    xSemaphoreGive(queue_lock);
+
+    stat_queued++;
+    xTaskNotifyGive(send_task);
+    return true;
+}
+
+// The oldest frames, up to UPLOAD_BATCH, as a multipart body. Returns its
+// length and the id of the last frame in it, 0 when there is no memory.
+static size_t build_batch_locked(uint32_t *last_id, uint32_t *frames){
+    uint32_t n = count < UPLOAD_BATCH ? count : UPLOAD_BATCH;
+    size_t need = PART_HEAD_MAX;
+    for(uint32_t i = 0; i < n; i++){
+        need += PART_HEAD_MAX + items[(tail + i) % UPLOAD_QUEUE].len;
+    }
+    if(need > body_cap){
+        char *b = (char *)heap_caps_realloc(body, need, MALLOC_CAP_SPIRAM);
+        if(!b){
+            return 0;
+        }
+        body = b;
+        body_cap = need;
+    }
+    size_t len = 0;
+    for(uint32_t i = 0; i < n; i++){
+        const upload_item_t *it = &items[(tail + i) % UPLOAD_QUEUE];
+        len += snprintf(body + len, PART_HEAD_MAX,
+                        "--" UPLOAD_BOUNDARY "\r\n"
+                        "Content-Disposition: form-data; name=\"images\"; filename=\"%s_%u_%u.jpg\"\r\n"
+                        "Content-Type: image/jpeg\r\n\r\n",
+                        reason_names[it->reason], it->seq, it->t_ms);
+        memcpy(body + len, it->buf, it->len);
+        len += it->len;
+        body[len++] = '\r';
+        body[len++] = '\n';
+        *last_id = it->id;
+    }
+    len += snprintf(body + len, PART_HEAD_MAX, "--" UPLOAD_BOUNDARY "--\r\n");
+    *frames = n;
+    return len;
+}
+
+static void remove_through_locked(uint32_t last_id){
+    while(count && items[tail].id <= last_id){
+        pop_locked();
+    }
+}
+
+static esp_err_t http_event(esp_http_client_event_t *evt){
+    if(evt->event_id == HTTP_EVENT_ON_CONNECTED){
+        connections++;
+    }
+    return ESP_OK;              // The response (detections) is for the server's dashboard
+}
+
+static void send_task_fn(void *arg){
+    uint32_t backoff_ms = 0;
+    uint32_t retry_at = 0;
+    TickType_t wait = portMAX_DELAY;
+    for(;;){
+        ulTaskNotifyTake(pdTRUE, wait);
+        uint32_t now = now_ms();
+
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+        if(!count){
+            xSemaphoreGive(queue_lock);
+            wait = portMAX_DELAY;
+            continue;
+        }
+        uint32_t age = now - items[tail].t_ms;
+        if(backoff_ms && (int32_t)(retry_at - now) > 0){
+            xSemaphoreGive(queue_lock);
+            wait = pdMS_TO_TICKS(retry_at - now);
+            continue;
+        }
+        if(count < UPLOAD_BATCH && age < UPLOAD_BATCH_MS){
+            xSemaphoreGive(queue_lock);
+            wait = pdMS_TO_TICKS(UPLOAD_BATCH_MS - age);
+            continue;
+        }
+        uint32_t last_id = 0, frames = 0;
+        size_t len = build_batch_locked(&last_id, &frames);
+        xSemaphoreGive(queue_lock);
+        if(!len){
+            PLOG_LIMITED(PLOG_WARN, 1, "No memory for an upload batch");
+            wait = pdMS_TO_TICKS(UPLOAD_BACKOFF_MIN_MS);
+            continue;
+        }
+
+        // A kept-alive connection the server has since closed fails the
+        // first request on it; that one is retried straight away
+        esp_err_t err;
+        int status;
+        bool reused;
+        uint32_t t0;
+        for(int attempt = 0; ; attempt++){
+            uint32_t before = connections;
+            t0 = now_ms();
+            esp_http_client_set_post_field(client, body, (int)len);
+            err = esp_http_client_perform(client);
+            status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+            reused = connections == before;
+            if(err == ESP_OK || err == ESP_ERR_HTTP_CONNECT || !reused || attempt){
+                break;
+            }
+        }
+        stat_last_ms = now_ms() - t0;
+        stat_last_status = status;
+
+        if(status >= 200 && status < 300){
+            if(reused){
+                stat_reused++;
+            }
+            stat_batches++;
+            stat_sent += frames;
+            backoff_ms = 0;
+        } else if(status >= 400 && status < 500 && status != 408 && status != 429){
+            PLOGW("Upload of %u frames refused: HTTP %d", frames, status);
+            stat_rejected += frames;
+            backoff_ms = 0;
+        } else {
+            backoff_ms = backoff_ms ? backoff_ms * 2 : UPLOAD_BACKOFF_MIN_MS;
+            backoff_ms = backoff_ms > UPLOAD_BACKOFF_MAX_MS ? UPLOAD_BACKOFF_MAX_MS : backoff_ms;
+            retry_at = now_ms() + backoff_ms;
+            stat_failed++;
+            if(status){
+                PLOG_LIMITED(PLOG_WARN, 1, "Upload failed: HTTP %d, retry in %us", status, backoff_ms / 1000);
+            } else {
+                PLOG_LIMITED(PLOG_WARN, 1, "Upload failed: error 0x%x, retry in %us", err, backoff_ms / 1000);
+            }
+            wait = pdMS_TO_TICKS(backoff_ms);
+            continue;
+        }
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+        remove_through_locked(last_id);
+        xSemaphoreGive(queue_lock);
+        wait = 0;
+    }
+}
+
+static void take_still(upload_reason_t reason){
+    cam_frame_info_t fi;
+    camera_fb_t *fb = cam_modes_fb_get(CAM_MODE_STILL, &fi);
+    if(!fb){
+        return;
+    }
+    upload_frame(fb, reason, fi.seq);
+    cam_modes_fb_return(fb);
+}
+
+// Lesion scan of a preview frame; true when it is worth a still
+static bool suspicious(uint32_t now){
+    static uint32_t last_ms = 0;
+    static uint8_t last_score = 0;
+    cam_frame_info_t fi;
+    camera_fb_t *fb = cam_modes_fb_get(CAM_MODE_PREVIEW, &fi);
+    if(!fb){
+        return false;
+    }
+    lesion_result_t r;
+    bool found = lesion_scan(fb, fi.seq, &r) && r.blobs;
+    cam_modes_fb_return(fb);
+    if(!found){
+        last_score = 0;
+        return false;
+    }
+    if(last_score && r.score < last_score + SUSPECT_RISE && now - last_ms < SUSPECT_REPEAT_MS){
+        return false;
+    }
+    last_ms = now;
+    last_score = r.score;
+    return true;
+}
+
+static void pick_task_fn(void *arg){
+    uint32_t cursor = pev_last_id();
+    uint32_t last_event = now_ms() - UPLOAD_EVENT_MS;
+    uint32_t seen_every = 0, seen_triage = 0;
+    uint32_t next_every = 0, next_triage = 0;
+    for(;;){
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PICK_TICK_MS));
+        uint32_t now = now_ms();
+        uint32_t every = every_s.load(), triage = triage_s.load();
+        if(every != seen_every){
+            seen_every = every;
+            next_every = now + every * 1000;
+        }
+        if(triage != seen_triage){
+            seen_triage = triage;
+            next_triage = now + triage * 1000;
+        }
+
+        // Events are read either way, so turning them on doesn't upload old ones
+        plant_event_t e;
+        bool event = false;
+        while(pev_next(&cursor, &e)){
+            event = true;
+        }
+
+        if(manual.exchange(false)){
+            take_still(UPLOAD_MANUAL);
+        } else if(event && events_on.load() && now - last_event >= UPLOAD_EVENT_MS){
+            last_event = now;
+            take_still(UPLOAD_EVENT);
+        } else if(every && (int32_t)(now - next_every) >= 0){
+            next_every = now + every * 1000;
+            take_still(UPLOAD_SCHEDULED);
+        } else if(triage && (int32_t)(now - next_triage) >= 0){
+            next_triage = now + triage * 1000;
+            if(suspicious(now)){
+                take_still(UPLOAD_SUSPICIOUS);
+            }
+        }
+    }
+}
+
+bool upload_start(const char *url){
+    if(!url || !url[0] || client){
+        return false;
+    }
+    queue_lock = xSemaphoreCreateMutex();
+    if(!queue_lock){
+        return false;
+    }
+    esp_http_client_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.url = url;
+    cfg.method = HTTP_METHOD_POST;
+    cfg.timeout_ms = UPLOAD_TIMEOUT_MS;
+    cfg.event_handler = http_event;
+    cfg.keep_alive_enable = true;
+    client = esp_http_client_init(&cfg);
+    if(!client){
+        return false;
+    }
+    esp_http_client_set_header(client, "Content-Type", "multipart/form-data; boundary=" UPLOAD_BOUNDARY);
+    if(xTaskCreate(send_task_fn, "upload", 6144, NULL, tskIDLE_PRIORITY + 1, &send_task) != pdPASS ||
+       xTaskCreate(pick_task_fn, "upload_pick", 4096, NULL, tskIDLE_PRIORITY + 1, &pick_task) != pdPASS){
+        PLOGE("Upload tasks failed to start");
+        return false;
+    }
+    return true;
+}
+
+void upload_now(void){
+    if(pick_task){
+        manual.store(true);
+        xTaskNotifyGive(pick_task);
+    }
+}
+
+bool upload_set_every(uint32_t s){
+    if(s > UPLOAD_PERIOD_MAX_S){
+        return false;
+    }
+    every_s.store(s);
+    return true;
+}
+
+uint32_t upload_every(void){
+    return every_s.load();
+}
+
+bool upload_set_triage(uint32_t s){
+    if(s > UPLOAD_PERIOD_MAX_S){
+        return false;
+    }
+    triage_s.store(s);
+    return true;
+}
+
+uint32_t upload_triage(void){
+    return triage_s.load();
+}
+
+void upload_set_events(bool on){
+    events_on.store(on);
+}
+
+bool upload_events(void){
+    return events_on.load();
+}
+
+void upload_get_stats(upload_stats_t *out){
+    out->queued = stat_queued.load();
+    out->sent = stat_sent.load();
+    out->batches = stat_batches.load();
+    out->failed = stat_failed.load();
+    out->rejected = stat_rejected.load();
+    out->dropped = stat_dropped.load();
+    out->reused = stat_reused.load();
+    out->last_ms = stat_last_ms.load();
+    out->last_status = stat_last_status.load();
+    if(queue_lock){
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+        out->depth = count;
+        xSemaphoreGive(queue_lock);
+    } else {
+        out->depth = 0;
+    }
+}
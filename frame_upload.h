@@ -0,0 +1,85 @@
+/*
+  Smart Plant Vision - Frame Upload
+  Pushes frames to the inference server instead of waiting to be asked:
+  a POST to a /predict-compatible endpoint, with several JPEGs per request
+  as "images" parts of a multipart form. Frames are picked
+
+    scheduled   a full resolution still every upload_every seconds
+    suspicious  a still whenever the lesion scan of a preview frame, taken
+                every upload_triage seconds, finds lesion blobs
+    event       a still for an event on the event channel (motion,
+                watering), when upload_events is on
+    manual      a still on request (/control?var=upload_now)
+
+  and copied into a queue in PSRAM, so the camera pipeline never waits on
+  the network. A task of its own sends the queue in batches over one
+  kept-alive connection. A failed POST is retried with exponential backoff;
+  a batch the server rejects (4xx) is dropped. When the queue is full the
+  oldest frames make room.
+
+  Each part's filename says why and when the frame was taken:
+  <reason>_<frame seq>_<ms since boot>.jpg
+*/
+
+#ifndef FRAME_UPLOAD_H
+#define FRAME_UPLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_camera.h"
+
+#define UPLOAD_BATCH            4       // Frames per POST at most
+#define UPLOAD_BATCH_MS         5000    // A batch goes out when its oldest frame has waited this long, full or not
+#define UPLOAD_QUEUE            12      // Frames waiting, at most
+#define UPLOAD_QUEUE_BYTES      (1024 * 1024)
+#define UPLOAD_TIMEOUT_MS       30000   // Per POST, inference included
+#define UPLOAD_BACKOFF_MIN_MS   2000    // First retry after a failed POST; doubles with each failure
+#define UPLOAD_BACKOFF_MAX_MS   300000
+#define UPLOAD_EVERY_S          3600    // Default for the scheduled still, 0 is off
+#define UPLOAD_TRIAGE_S         60      // Default for the lesion scan, 0 is off
+#define UPLOAD_EVENT_MS         10000   // Closest two event stills
+#define UPLOAD_PERIOD_MAX_S     86400
+
+typedef enum {
+    UPLOAD_SCHEDULED = 0,
+    UPLOAD_SUSPICIOUS,
+    UPLOAD_EVENT,
+    UPLOAD_MANUAL,
+} upload_reason_t;
+
+typedef struct {
+    uint32_t queued;          // Frames taken
+    uint32_t sent;            // Frames the server accepted
+    uint32_t batches;         // Successful POSTs
+    uint32_t failed;          // POSTs that failed and were retried
+    uint32_t rejected;        // Frames in batches the server refused
+    uint32_t dropped;         // Pushed out of a full queue
+    uint32_t reused;          // POSTs on an already open connection
+    uint32_t depth;           // In the queue now
+    uint32_t last_ms;         // Most recent POST, request to response
+    int last_status;          // Its HTTP status, 0 when it got none
+} upload_stats_t;
+
+// Starts the picking and sending tasks; url is the endpoint
+// ("http://192.168.1.20:5000/predict"). An empty url leaves uploads off.
+// Call after cam_modes_init() and pev_init().
+bool upload_start(const char *url);
+
+// Queues a copy of a JPEG frame
+bool upload_frame(const camera_fb_t *fb, upload_reason_t reason, uint32_t seq);
+
+// Takes a still and queues it, from the picking task
+void upload_now(void);
+
+// Periods in seconds, 0 turns them off; false above UPLOAD_PERIOD_MAX_S
+bool upload_set_every(uint32_t s);
+uint32_t upload_every(void);
+bool upload_set_triage(uint32_t s);
+uint32_t upload_triage(void);
+
+void upload_set_events(bool on);
+bool upload_events(void);
+
+void upload_get_stats(upload_stats_t *out);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+  Smart Plant Vision - indexed capture file
+*/
+
+#include "capture_file.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define CAPTURE_MAGIC       "PLNTCAP1"
+#define CAPTURE_IDX_MAGIC   "PLNTIDX1"
+#define CAPTURE_VERSION     1
+#define CAPTURE_MAX_RECORD  (64 * 1024 * 1024)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    int64_t start_unix_ms;
+    char source[40];
+} capture_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+    int64_t t_us;
+} record_header_t;
+
+typedef struct {
+    char magic[8];
+    uint64_t index_offset;
+    uint64_t count;
+} capture_trailer_t;
+
+static_assert(sizeof(capture_header_t) == 64, "capture header size");
+static_assert(sizeof(capture_entry_t) == 24, "capture index entry size");
+
+static size_t pad8(size_t n){
+    return (8 - (n & 7)) & 7;
+}
+
+capture_writer::~capture_writer(){
+    close();
+}
+
+bool capture_writer::open(const char *path, const char *source, int64_t start_unix_ms){
+    f_ = fopen(path, "wb");
+    if(!f_){
+        return false;
+    }
+    capture_header_t h = {};
+    memcpy(h.magic, CAPTURE_MAGIC, 8);
+    h.version = CAPTURE_VERSION;
+    h.header_size = sizeof(h);
+    h.start_unix_ms = start_unix_ms;
+    snprintf(h.source, sizeof(h.source), "%s", source);
+    ok_ = fwrite(&h, sizeof(h), 1, f_) == 1;
+    offset_ = sizeof(h);
+    index_.clear();
+    return ok_;
+}
+
+bool capture_writer::write(uint32_t type, int64_t t_us, const void *data, size_t len){
+    if(!f_ || len > CAPTURE_MAX_RECORD){
+        return false;
+    }
+    static const uint8_t zero[8] = {0};
+    record_header_t r = {type, (uint32_t)len, t_us};
+    size_t pad = pad8(len);
+    bool ok = fwrite(&r, sizeof(r), 1, f_) == 1 && (!len || fwrite(data, len, 1, f_) == 1) &&
+              (!pad || fwrite(zero, pad, 1, f_) == 1);
+    if(!ok){
+        ok_ = false;
+        return false;
+    }
+    capture_entry_t e = {type, (uint32_t)len, t_us, offset_ + sizeof(r)};
+    index_.push_back(e);
+    offset_ += sizeof(r) + len + pad;
+    return true;
+}
+
+bool capture_writer::close(){
+    if(!f_){
+        return ok_;
+    }
+    capture_trailer_t t = {};
+    memcpy(t.magic, CAPTURE_IDX_MAGIC, 8);
+    t.index_offset = offset_;
+    t.count = index_.size();
+    if(ok_){
+        ok_ = (index_.empty() || fwrite(index_.data(), sizeof(capture_entry_t), index_.size(), f_) == index_.size()) &&
+              fwrite(&t, sizeof(t), 1, f_) == 1;
+    }
+    if(fclose(f_) != 0){
+        ok_ = false;
+    }
+    f_ = NULL;
+    return ok_;
+}
+
+capture_reader::~capture_reader(){
+    if(base_){
+        munmap(base_, size_);
+    }
+}
+
+void capture_reader::add(const capture_entry_t &e){
+    if(e.type < 4){
+        by_type_[e.type].push_back(e);
+    }
+    duration_us_ = std::max(duration_us_, e.t_us);
+}
+
+bool capture_reader::load_index(const uint8_t *idx, uint64_t count){
+    for(uint64_t i = 0; i < count; i++){
+        capture_entry_t e;
+        memcpy(&e, idx + i * sizeof(e), sizeof(e));
+        if(e.offset < sizeof(capture_header_t) || e.offset > size_ || e.len > size_ - e.offset){
+            return false;
+        }
+        add(e);
+    }
+    return true;
+}
+
+void capture_reader::scan_records(){
+    recovered_ = true;
+    for(auto &v : by_type_){
+        v.clear();
+    }
+    duration_us_ = 0;
+    size_t off = sizeof(capture_header_t);
+    while(off + sizeof(record_header_t) <= size_){
+        record_header_t r;
+        memcpy(&r, base_ + off, sizeof(r));
+        size_t end = off + sizeof(r) + r.len;
+        if(r.type == 0 || r.len > CAPTURE_MAX_RECORD || end > size_){
+            break;
+        }
+        capture_entry_t e = {r.type, r.len, r.t_us, off + sizeof(r)};
+        add(e);
+        off = end + pad8(r.len);
+    }
+}
+
+bool capture_reader::open(const char *path){
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(capture_header_t)){
+        ::close(fd);
+        return false;
+    }
+    size_ = st.st_size;
+    void *m = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(m == MAP_FAILED){
+        return false;
+    }
+    base_ = (uint8_t *)m;
+
+    capture_header_t h;
+    memcpy(&h, base_, sizeof(h));
+    if(memcmp(h.magic, CAPTURE_MAGIC, 8) || h.version != CAPTURE_VERSION){
+        return false;
+    }
+    start_unix_ms_ = h.start_unix_ms;
+    source_.assign(h.source, strnlen(h.source, sizeof(h.source)));
+
+    capture_trailer_t t;
+    bool indexed = false;
+    if(size_ >= sizeof(h) + sizeof(t)){
+        memcpy(&t, base_ + size_ - sizeof(t), sizeof(t));
+        indexed = !memcmp(t.magic, CAPTURE_IDX_MAGIC, 8) && t.index_offset >= sizeof(h) &&
+                  t.index_offset + t.count * sizeof(capture_entry_t) == size_ - sizeof(t) &&
+                  load_index(base_ + t.index_offset, t.count);
+    }
+    if(!indexed){
+        scan_records();
+    }
+    // Records are written in arrival order, but keep lookups safe for any writer
+    for(auto &v : by_type_){
+        std::stable_sort(v.begin(), v.end(), [](const capture_entry_t &a, const capture_entry_t &b){
+            return a.t_us < b.t_us;
+        });
+    }
+    return true;
+}
+
+const std::vector<capture_entry_t> &capture_reader::entries(uint32_t type) const {
+    return by_type_[type < 4 ? type : 0];
+}
+
+const capture_entry_t *capture_reader::at(uint32_t type, int64_t t_us) const {
+    const std::vector<capture_entry_t> &v = entries(type);
+    auto it = std::upper_bound(v.begin(), v.end(), t_us, [](int64_t t, const capture_entry_t &e){
+        return t < e.t_us;
+    });
+    return it == v.begin() ? NULL : &*(it - 1);
+}
@@ -0,0 +1,85 @@
+/*
+  Smart Plant Vision - indexed capture file
+
+  Layout: a 64 byte header, then records (16 byte record header, payload,
+  padding to 8 bytes) in arrival order, then an index of every record and a
+  trailer pointing at it. Timestamps are microseconds since the recording
+  started; the header holds the wall clock time of that start.
+
+  The index is only written on a clean close. A file cut short by a crash or
+  a full disk is still readable: the reader rebuilds the index by walking the
+  records and drops a torn last one.
+*/
+#ifndef HOST_CAPTURE_FILE_H
+#define HOST_CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+enum {
+    CAPTURE_FRAME = 1,      // One JPEG from /stream
+    CAPTURE_SENSORS = 2,    // /sensors response body
+    CAPTURE_STATUS = 3      // /status response body
+};
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+    int64_t t_us;
+    uint64_t offset;        // Of the payload
+} capture_entry_t;
+
+class capture_writer {
+public:
+    ~capture_writer();
+
+    bool open(const char *path, const char *source, int64_t start_unix_ms);
+    bool write(uint32_t type, int64_t t_us, const void *data, size_t len);
+    // Writes the index; returns false if anything failed along the way
+    bool close();
+
+    uint64_t records() const { return index_.size(); }
+    uint64_t bytes() const { return offset_; }
+
+private:
+    FILE *f_ = NULL;
+    uint64_t offset_ = 0;
+    bool ok_ = true;
+    std::vector<capture_entry_t> index_;
+};
+
+class capture_reader {
+public:
+    ~capture_reader();
+
+    bool open(const char *path);
+
+    const std::vector<capture_entry_t> &entries(uint32_t type) const;
+    const uint8_t *payload(const capture_entry_t &e) const { return base_ + e.offset; }
+
+    // Last entry of type at or before t_us, NULL when there is none
+    const capture_entry_t *at(uint32_t type, int64_t t_us) const;
+
+    int64_t start_unix_ms() const { return start_unix_ms_; }
+    int64_t duration_us() const { return duration_us_; }
+    const std::string &source() const { return source_; }
+    bool recovered() const { return recovered_; }
+
+private:
+    bool load_index(const uint8_t *idx, uint64_t count);
+    void scan_records();
+    void add(const capture_entry_t &e);
+
+    uint8_t *base_ = NULL;
+    size_t size_ = 0;
+    int64_t start_unix_ms_ = 0;
+    int64_t duration_us_ = 0;
+    std::string source_;
+    bool recovered_ = false;
+    std::vector<capture_entry_t> by_type_[4];
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+  Smart Plant Vision - fuzz target for /control and /status
+
+  The input is the query string of a /control request, the way the UI's
+  updateSetting() builds it ("var=quality&val=10"). Each input is sent as
+  "GET /control?<input>", then "GET /status" is sent on a new connection,
+  so the input goes through the request line parser, the query helpers and
+  cmd_handler's fixed size variable/value buffers, and then status_handler
+  serializes whatever state that left behind.
+
+  Checks: both responses are well formed, /status is a flat JSON object of
+  numbers that fits its buffer, and a setting /control accepted with 200 is
+  what /status reports back. The counters are all small this soon after
+  boot, so the snapshot status_handler formats is also formatted with
+  every field at its widest (counters at their maximum, -FLT_MAX for
+  floats), which must still fit STATUS_JSON_MAX whole.
+*/
+
+#include "firmware_fuzz.h"
+#include "esp_http_server.h"
+#include "plant_shim.h"
+#include "plant_status.h"
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+
+// Flat object of numbers, as status_handler writes it; false on anything else
+static bool parse_status_json(const std::string &s, std::map<std::string, double> *out){
+    const char *p = s.c_str();
+    const char *end = p + s.size();
+    if(p == end || *p++ != '{'){
+        return false;
+    }
+    while(p < end && *p != '}'){
+        if(*p++ != '"'){
+            return false;
+        }
+        const char *k = p;
+        while(p < end && *p != '"'){
+            if(!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))){
+                return false;
+            }
+            p++;
+        }
+        if(p == end || p == k){
+            return false;
+        }
+        std::string key(k, p - k);
+        if(++p == end || *p++ != ':'){
+            return false;
+        }
+        // JSON numbers only: no nan/inf, no leading '+', no bare '.'
+        const char *n = p;
+        if(p < end && *p == '-'){
+            p++;
+        }
+        if(p == end || *p < '0' || *p > '9'){
+            return false;
+        }
+        while(p < end && ((*p >= '0' && *p <= '9') || *p == '.')){
+            p++;
+        }
+        (*out)[key] = strtod(n, NULL);
+        if(p < end && *p == ','){
+            p++;
+        }
+    }
+    return p + 1 == end && *p == '}';
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    void *server = fuzz_firmware();
+    std::string query((const char *)data, size);
+    std::string req = "GET /control?" + query + " HTTP/1.1\r\nHost: plant\r\n\r\n";
+    std::string out;
+    plant_httpd_dispatch(server, req.data(), req.size(), &out);
+    std::vector<fuzz_response_t> r = fuzz_split_responses(out);
+    // A query with spaces or line breaks ends the request line early, which
+    // may leave a bad request or none at all; only the framing is checked then
+    if(query.find_first_of(" \r\n") != std::string::npos || query.find('\0') != std::string::npos){
+        return 0;
+    }
+    int code = r.size() == 1 ? r[0].status : 0;
+    if(code != 200 && code != 404 && code != 414 && code != 431 && code != 500){
+        abort();
+    }
+    if(code == 414 || code == 431){
+        return 0;
+    }
+
+    // A new connection, since cmd_handler closes this one after a 404
+    static const char status_req[] = "GET /status HTTP/1.1\r\nHost: plant\r\n\r\n";
+    out.clear();
+    plant_httpd_dispatch(server, status_req, sizeof(status_req) - 1, &out);
+    r = fuzz_split_responses(out);
+    std::map<std::string, double> st;
+    if(r.size() != 1 || r[0].status != 200 || r[0].body.size() >= STATUS_JSON_MAX || !parse_status_json(r[0].body, &st)){
+        abort();
+    }
+
+    // The same fields with the longest values they can take
+    status_field_t wide[STATUS_FIELDS_MAX];
+    size_t n = status_collect(wide, STATUS_FIELDS_MAX);
+    if(n == 0 || n >= STATUS_FIELDS_MAX || n != st.size()){
+        abort();
+    }
+    for(size_t i = 0; i < n; i++){
+        switch(wide[i].kind){
+        case STATUS_U64: wide[i].u64 = UINT64_MAX; break;
+        case STATUS_I32: wide[i].i32 = INT32_MIN; break;
+        case STATUS_F32: wide[i].f32 = -FLT_MAX; break;
+        default: wide[i].u32 = UINT32_MAX; break;
+        }
+    }
+    static char wide_json[STATUS_JSON_MAX];
+    int wide_len = status_format(wide, n, wide_json, sizeof(wide_json));
+    std::map<std::string, double> wide_st;
+    if(wide_len < 0 || !parse_status_json(std::string(wide_json, wide_len), &wide_st) || wide_st.size() != n){
+        abort();
+    }
+    static const char *const fields[] = {"framesize", "quality", "brightness", "contrast", "temperature",
+                                         "humidity", "soilMoisture", "log_written", "log_dropped", "log_suppressed",
+                                         "latency_mode"};
+    for(const char *f : fields){
+        if(!st.count(f)){
+            abort();
+        }
+    }
+
+    // The same extraction cmd_handler does, to know what it should have applied
+    std::string q = query.substr(0, query.find('#'));
+    char variable[32], value[32];
+    if(code == 200 &&
+       httpd_query_key_value(q.c_str(), "var", variable, sizeof(variable)) == ESP_OK &&
+       httpd_query_key_value(q.c_str(), "val", value, sizeof(value)) == ESP_OK){
+        int val = atoi(value);
+        if(st.count(variable) && strcmp(variable, "temperature") && strcmp(variable, "humidity") && st[variable] != val){
+            abort();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+  Smart Plant Vision - shared pieces of the firmware fuzz targets
+*/
+
+#include "firmware_fuzz.h"
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include "plant_shim.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void setup();
+extern httpd_handle_t camera_httpd;
+
+// The sensor task is a joinable thread; exiting with it running would abort
+static void stop_camera(void){
+    esp_camera_deinit();
+}
+
+void *fuzz_firmware(void){
+    static bool started = false;
+    if(!started){
+        plant_shim_config_t *cfg = plant_shim_config();
+        cfg->httpd_detached = true;
+        cfg->sccb_write_us = 0;     // Framesize changes would otherwise cost milliseconds per input
+        cfg->fps = 2;
+        setup();
+        // These block for the next sensor frame; the camera path is not what these targets are after
+        httpd_unregister_uri_handler(camera_httpd, "/capture", HTTP_GET);
+        httpd_unregister_uri_handler(camera_httpd, "/snapshot", HTTP_GET);
+        atexit(stop_camera);
+        started = true;
+    }
+    if(!camera_httpd){
+        fprintf(stderr, "fuzz: the sketch did not start camera_httpd\n");
+        abort();
+    }
+    return camera_httpd;
+}
+
+std::string fuzz_header(const fuzz_response_t &r, const char *name){
+    size_t n = strlen(name);
+    size_t pos = r.head.find("\r\n");
+    while(pos != std::string::npos && pos + 2 < r.head.size()){
+        const char *l = r.head.c_str() + pos + 2;
+        size_t next = r.head.find("\r\n", pos + 2);
+        if(!strncasecmp(l, name, n) && l[n] == ':'){
+            const char *v = l + n + 1;
+            while(*v == ' '){
+                v++;
+            }
+            return r.head.substr(v - r.head.c_str(), next - (v - r.head.c_str()));
+        }
+        pos = next;
+    }
+    return std::string();
+}
+
+static size_t parse_hex(const std::string &s, size_t pos, size_t *end){
+    size_t v = 0, i = pos;
+    for(; i < s.size() && s[i] && strchr("0123456789abcdefABCDEF", s[i]); i++){
+        v = v * 16 + (s[i] <= '9' ? s[i] - '0' : (s[i] | 0x20) - 'a' + 10);
+    }
+    if(i == pos){
+        abort();
+    }
+    *end = i;
+    return v;
+}
+
+std::vector<fuzz_response_t> fuzz_split_responses(const std::string &out){
+    std::vector<fuzz_response_t> v;
+    size_t pos = 0;
+    while(pos < out.size()){
+        size_t head_end = out.find("\r\n\r\n", pos);
+        if(head_end == std::string::npos || out.compare(pos, 9, "HTTP/1.1 ")){
+            abort();
+        }
+        fuzz_response_t r;
+        r.head = out.substr(pos, head_end + 2 - pos);
+        r.status = atoi(r.head.c_str() + 9);
+        if(r.status < 100 || r.status > 599){
+            abort();
+        }
+        pos = head_end + 4;
+        std::string cl = fuzz_header(r, "Content-Length");
+        if(!cl.empty()){
+            size_t len = strtoul(cl.c_str(), NULL, 10);
+            if(len > out.size() - pos){
+                abort();
+            }
+            r.body = out.substr(pos, len);
+            pos += len;
+        } else if(fuzz_header(r, "Transfer-Encoding") == "chunked"){
+            for(;;){
+                size_t end;
+                size_t len = parse_hex(out, pos, &end);
+                if(out.compare(end, 2, "\r\n") || len > out.size() - end - 2 ||
+                   out.compare(end + 2 + len, 2, "\r\n")){
+                    abort();
+                }
+                r.body.append(out, end + 2, len);
+                pos = end + 4 + len;
+                if(!len){
+                    break;
+                }
+            }
+        } else {
+            abort();
+        }
+        v.push_back(r);
+    }
+    return v;
+}
+
+#ifdef FUZZ_REPLAY
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Runs saved inputs (crash artifacts, corpus files) without libFuzzer
+int main(int argc, char **argv){
+    setvbuf(stdout, NULL, _IOLBF, 0);  // The last "ok" line names the input before a crash
+    for(int i = 1; i < argc; i++){
+        FILE *f = fopen(argv[i], "rb");
+        if(!f){
+            perror(argv[i]);
+            return 1;
+        }
+        std::string buf;
+        char tmp[65536];
+        size_t n;
+        while((n = fread(tmp, 1, sizeof(tmp), f)) > 0){
+            buf.append(tmp, n);
+        }
+        fclose(f);
+        LLVMFuzzerTestOneInput((const uint8_t *)buf.data(), buf.size());
+        printf("%s: ok (%zu bytes)\n", argv[i], buf.size());
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,33 @@
+/*
+  Smart Plant Vision - shared pieces of the firmware fuzz targets
+
+  The targets run the sketch's own setup() once with the httpd shim
+  detached, then push requests through camera_httpd with
+  plant_httpd_dispatch(): the handlers in esp32_camera_server.cpp run
+  unmodified on the fuzzer's thread and their responses come back as bytes.
+*/
+#ifndef HOST_FUZZ_FIRMWARE_FUZZ_H
+#define HOST_FUZZ_FIRMWARE_FUZZ_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+    int status;
+    std::string head;
+    std::string body;
+} fuzz_response_t;
+
+// Runs setup() on first use; returns camera_httpd (port 80)
+void *fuzz_firmware(void);
+
+// Splits what one connection received into responses, aborting on anything
+// that is not a well formed HTTP/1.1 response (bad status line, missing
+// terminator, body not matching Content-Length or the chunked framing)
+std::vector<fuzz_response_t> fuzz_split_responses(const std::string &out);
+
+// Value of a response header, empty when absent
+std::string fuzz_header(const fuzz_response_t &r, const char *name);
+
+#endif
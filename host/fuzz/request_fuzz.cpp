@@ -0,0 +1,27 @@
+/*
+  Smart Plant Vision - fuzz target for raw requests to the camera server
+
+  The input is everything a client sends on one connection: request lines,
+  headers, bodies, pipelined requests. It is dispatched to camera_httpd as
+  the sketch registers it (/, /control, /status, /sensors) and every byte
+  the server sends back must split into well formed HTTP/1.1 responses.
+*/
+
+#include "firmware_fuzz.h"
+#include "plant_shim.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    void *server = fuzz_firmware();
+    std::string out;
+    plant_httpd_dispatch(server, (const char *)data, size, &out);
+    std::vector<fuzz_response_t> r = fuzz_split_responses(out);
+    for(const fuzz_response_t &x : r){
+        if(x.status == 200 && fuzz_header(x, "Content-Type").empty()){
+            abort();
+        }
+    }
+    return 0;
+}
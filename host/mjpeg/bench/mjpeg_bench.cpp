@@ -0,0 +1,143 @@
+/*
+  Smart Plant Vision - multipart parser throughput benchmark
+
+  Builds a synthetic /stream body in memory (random JPEG-sized parts framed
+  exactly like stream_handler does) and measures how fast it parses when fed
+  in TCP-segment, 16 KB and 64 KB pieces, with and without Content-Length
+  headers. Also compares the raw boundary search against a scalar memchr
+  loop and std::search.
+
+  Usage: plant_mjpeg_bench [--mb 256] [--part-kb 60]
+*/
+
+#include "mjpeg_parser.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Same framing as stream_handler: part header, JPEG, then the delimiter line
+static std::vector<uint8_t> make_stream(size_t total, size_t part_size, bool with_length, size_t *parts){
+    std::vector<uint8_t> out;
+    out.reserve(total + part_size * 2);
+    uint32_t x = 12345;
+    *parts = 0;
+    while(out.size() < total){
+        size_t len = part_size / 2 + (x % part_size);
+        char head[128];
+        int hl = with_length
+            ? snprintf(head, sizeof(head), "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", len)
+            : snprintf(head, sizeof(head), "Content-Type: image/jpeg\r\n\r\n");
+        out.insert(out.end(), head, head + hl);
+        // Entropy-coded data is close to uniform, with the occasional CR
+        out.push_back(0xFF);
+        out.push_back(0xD8);
+        for(size_t i = 2; i < len; i++){
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            out.push_back((uint8_t)x);
+        }
+        static const char delim[] = "\r\n--" PART_BOUNDARY "\r\n";
+        out.insert(out.end(), delim, delim + sizeof(delim) - 1);
+        (*parts)++;
+    }
+    return out;
+}
+
+static int count_end(void *user, const mjpeg_part_t *part){
+    (void)part;
+    (*(uint64_t *)user)++;
+    return 0;
+}
+
+static void bench_parse(const std::vector<uint8_t> &s, size_t parts, size_t chunk, const char *label){
+    mjpeg_callbacks_t cb = {};
+    cb.on_part_end = count_end;
+    uint64_t seen = 0;
+    mjpeg_parser_t p;
+    mjpeg_parser_init(&p, PART_BOUNDARY, &cb, &seen);
+    double t0 = now_s();
+    for(size_t off = 0; off < s.size(); off += chunk){
+        mjpeg_parser_feed(&p, s.data() + off, std::min(chunk, s.size() - off));
+    }
+    double dt = now_s() - t0;
+    printf("  %-22s chunk %6zu: %7.2f GB/s  %8.0f parts/s  %s\n", label, chunk, s.size() / dt / 1e9, seen / dt,
+           seen == parts ? "" : "PART COUNT MISMATCH");
+}
+
+typedef const uint8_t *(*find_fn)(const uint8_t *, size_t, const uint8_t *, size_t);
+
+static const uint8_t *find_std(const uint8_t *hay, size_t hay_len, const uint8_t *needle, size_t needle_len){
+    const uint8_t *r = std::search(hay, hay + hay_len, needle, needle + needle_len);
+    return r == hay + hay_len ? NULL : r;
+}
+
+static void bench_find(const std::vector<uint8_t> &s, find_fn fn, const char *label){
+    static const uint8_t delim[] = "\r\n--" PART_BOUNDARY;
+    size_t dl = sizeof(delim) - 1, found = 0;
+    double t0 = now_s();
+    const uint8_t *p = s.data(), *end = s.data() + s.size();
+    while(p < end){
+        const uint8_t *hit = fn(p, end - p, delim, dl);
+        if(!hit){
+            break;
+        }
+        found++;
+        p = hit + dl;
+    }
+    double dt = now_s() - t0;
+    printf("  %-22s %7.2f GB/s  (%zu delimiters)\n", label, s.size() / dt / 1e9, found);
+}
+
+int main(int argc, char **argv){
+    size_t mb = 256, part_kb = 60;
+    static const struct option options[] = {
+        {"mb", required_argument, NULL, 'm'},
+        {"part-kb", required_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while((c = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch(c){
+            case 'm': mb = strtoul(optarg, NULL, 10); break;
+            case 'k': part_kb = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s [--mb N] [--part-kb N]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(!mb || !part_kb){
+        fprintf(stderr, "--mb and --part-kb must be positive\n");
+        return 2;
+    }
+
+    static const size_t chunks[] = {1460, 16384, 65536};
+    for(int with_length = 1; with_length >= 0; with_length--){
+        size_t parts;
+        std::vector<uint8_t> s = make_stream(mb << 20, part_kb << 10, with_length, &parts);
+        printf("%s Content-Length, %zu MB, %zu parts:\n", with_length ? "With" : "Without", s.size() >> 20, parts);
+        for(size_t chunk : chunks){
+            bench_parse(s, parts, chunk, with_length ? "length-framed" : "boundary search");
+        }
+        if(!with_length){
+            printf("Boundary search only:\n");
+            bench_find(s, mjpeg_find, "mjpeg_find");
+            bench_find(s, mjpeg_find_scalar, "memchr + memcmp");
+            bench_find(s, find_std, "std::search");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,440 @@
+/*
+  Smart Plant Vision - streaming multipart/x-mixed-replace parser
+*/
+
+#include "mjpeg_parser.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+    ST_START,       // Nothing seen yet: headers, or a leading boundary line
+    ST_HEAD,        // Collecting a part header block
+    ST_BODY_LEN,    // Skipping Content-Length bytes of part data
+    ST_BODY_SCAN,   // Part data up to the next delimiter
+    ST_DELIM,       // Expecting the delimiter right after a Content-Length body
+    ST_AFTER,       // Two bytes after a delimiter: CRLF or the closing "--"
+    ST_RESYNC,      // Discarding until the next delimiter
+    ST_END
+};
+
+const uint8_t *mjpeg_find_scalar(const uint8_t *hay, size_t hay_len, const uint8_t *needle, size_t needle_len){
+    if(needle_len == 0 || hay_len < needle_len){
+        return needle_len == 0 ? hay : NULL;
+    }
+    const uint8_t *p = hay, *last = hay + hay_len - needle_len;
+    while(p <= last){
+        p = (const uint8_t *)memchr(p, needle[0], last - p + 1);
+        if(!p){
+            return NULL;
+        }
+        if(!memcmp(p + 1, needle + 1, needle_len - 1)){
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// Compares the first and last needle byte 16 positions at a time and only
+// verifies positions where both match. The delimiter starts with "\r", which
+// is rare in JPEG data, and ends with a digit, so verification is rare too.
+const uint8_t *mjpeg_find(const uint8_t *hay, size_t hay_len, const uint8_t *needle, size_t needle_len){
+#ifdef __SSE2__
+    if(needle_len < 2 || hay_len < needle_len + 16){
+        return mjpeg_find_scalar(hay, hay_len, needle, needle_len);
+    }
+    const __m128i first = _mm_set1_epi8((char)needle[0]);
+    const __m128i last = _mm_set1_epi8((char)needle[needle_len - 1]);
+    const uint8_t *tail = hay + needle_len - 1;
+    size_t i = 0;
+    // Two blocks per iteration; matches are rare enough that one combined test usually skips both
+    for(; i + needle_len + 31 <= hay_len; i += 32){
+        __m128i m0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(hay + i)), first),
+                                   _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(tail + i)), last));
+        __m128i m1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(hay + i + 16)), first),
+                                   _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(tail + i + 16)), last));
+        if(!_mm_movemask_epi8(_mm_or_si128(m0, m1))){
+            continue;
+        }
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(m0) | ((uint32_t)_mm_movemask_epi8(m1) << 16);
+        while(mask){
+            unsigned bit = __builtin_ctz(mask);
+            if(!memcmp(hay + i + bit + 1, needle + 1, needle_len - 2)){
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    for(; i + needle_len + 15 <= hay_len; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(tail + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while(mask){
+            unsigned bit = __builtin_ctz(mask);
+            if(!memcmp(hay + i + bit + 1, needle + 1, needle_len - 2)){
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return mjpeg_find_scalar(hay + i, hay_len - i, needle, needle_len);
+#else
+    return mjpeg_find_scalar(hay, hay_len, needle, needle_len);
+#endif
+}
+
+// Longest proper suffix of buf that is a prefix of the delimiter
+static size_t partial_suffix(const uint8_t *buf, size_t len, const uint8_t *delim, size_t dlen){
+    size_t max = len < dlen - 1 ? len : dlen - 1;
+    for(size_t k = max; k > 0; k--){
+        if(buf[len - k] == delim[0] && !memcmp(buf + len - k, delim, k)){
+            return k;
+        }
+    }
+    return 0;
+}
+
+static int emit_data(mjpeg_parser_t *p, const uint8_t *data, size_t len){
+    if(!len){
+        return 0;
+    }
+    p->stats.bytes += len;
+    return p->cb.on_part_data ? p->cb.on_part_data(p->user, data, len) : 0;
+}
+
+static int part_end(mjpeg_parser_t *p){
+    p->stats.parts++;
+    int rc = p->cb.on_part_end ? p->cb.on_part_end(p->user, &p->part) : 0;
+    p->part.index++;
+    return rc;
+}
+
+static void start_head(mjpeg_parser_t *p){
+    // The CRLF that ended the delimiter line also starts the header block, so
+    // an empty block is found by the same "\r\n\r\n" search
+    p->head[0] = '\r';
+    p->head[1] = '\n';
+    p->head_len = 2;
+    p->state = ST_HEAD;
+}
+
+static void start_resync(mjpeg_parser_t *p, bool count){
+    if(count){
+        p->stats.resyncs++;
+    }
+    p->carry_len = 0;
+    p->state = ST_RESYNC;
+}
+
+// Fills p->part from the header block in head[0, end). Returns false when the
+// block cannot be a part header.
+static bool parse_head(mjpeg_parser_t *p, size_t end){
+    const char *h = p->head + 2;
+    const char *e = p->head + end;
+    const char *dash = (const char *)p->delim + 2;
+    size_t dash_len = p->delim_len - 2;
+
+    // A leading "--boundary" line, when the stream starts the standard way
+    if((size_t)(e - h) >= dash_len && !memcmp(h, dash, dash_len)){
+        const char *nl = (const char *)memchr(h, '\n', e - h);
+        h = nl ? nl + 1 : e;
+    }
+    p->part.content_length = -1;
+    p->part.content_type = NULL;
+    p->part.content_type_len = 0;
+    p->part.headers = h;
+    p->part.headers_len = e - h;
+    while(h < e){
+        const char *nl = (const char *)memchr(h, '\n', e - h);
+        const char *le = nl ? nl : e;
+        size_t ll = le - h;
+        if(ll && h[ll - 1] == '\r'){
+            ll--;
+        }
+        if(ll > 15 && !strncasecmp(h, "Content-Length:", 15)){
+            char *endp = NULL;
+            unsigned long long v = strtoull(h + 15, &endp, 10);
+            if(endp != h + 15 && v <= MJPEG_MAX_PART){
+                p->part.content_length = (int64_t)v;
+            }
+        } else if(ll > 13 && !strncasecmp(h, "Content-Type:", 13)){
+            const char *v = h + 13;
+            while(v < h + ll && (*v == ' ' || *v == '\t')){
+                v++;
+            }
+            p->part.content_type = v;
+            p->part.content_type_len = h + ll - v;
+        } else if(ll && !memchr(h, ':', ll)){
+            return false;
+        }
+        h = nl ? nl + 1 : e;
+    }
+    return true;
+}
+
+// Boundary search over [carry | data]. Bytes before the delimiter are part
+// data when emit is set, otherwise dropped. Returns bytes of data consumed,
+// or -1 when a callback aborted; *found tells whether the delimiter ended it.
+static ssize_t scan(mjpeg_parser_t *p, const uint8_t *d, size_t n, bool emit, bool *found){
+    const size_t dl = p->delim_len;
+    *found = false;
+    size_t used = 0;
+
+    if(p->carry_len){
+        // Does a delimiter start in the carried bytes (or right after them)?
+        uint8_t tmp[2 * (MJPEG_MAX_BOUNDARY + 4)];
+        size_t k = n < dl - 1 ? n : dl - 1;
+        memcpy(tmp, p->carry, p->carry_len);
+        memcpy(tmp + p->carry_len, d, k);
+        size_t tl = p->carry_len + k;
+        const uint8_t *hit = mjpeg_find_scalar(tmp, tl, p->delim, dl);
+        if(hit){
+            size_t at = hit - tmp;
+            size_t from_carry = at < p->carry_len ? at : p->carry_len;
+            if(emit){
+                if(emit_data(p, p->carry, from_carry) || emit_data(p, d, at - from_carry)){
+                    return -1;
+                }
+                p->stats.scanned += at;
+            }
+            used = at + dl - p->carry_len;
+            p->carry_len = 0;
+            *found = true;
+            return (ssize_t)used;
+        }
+        if(k == n){
+            // Everything so far fits in tmp; keep whatever could still start a delimiter
+            size_t keep = partial_suffix(tmp, tl, p->delim, dl);
+            size_t out = tl - keep;
+            size_t from_carry = out < p->carry_len ? out : p->carry_len;
+            if(emit){
+                if(emit_data(p, p->carry, from_carry) || emit_data(p, d, out - from_carry)){
+                    return -1;
+                }
+                p->stats.scanned += out;
+            }
+            memmove(p->carry, tmp + out, keep);
+            p->carry_len = keep;
+            return (ssize_t)n;
+        }
+        if(emit){
+            if(emit_data(p, p->carry, p->carry_len)){
+                return -1;
+            }
+            p->stats.scanned += p->carry_len;
+        }
+        p->carry_len = 0;
+    }
+
+    const uint8_t *hit = mjpeg_find(d, n, p->delim, dl);
+    if(hit){
+        size_t at = hit - d;
+        if(emit){
+            if(emit_data(p, d, at)){
+                return -1;
+            }
+            p->stats.scanned += at;
+        }
+        *found = true;
+        return (ssize_t)(at + dl);
+    }
+    size_t keep = partial_suffix(d, n, p->delim, dl);
+    if(emit){
+        if(emit_data(p, d, n - keep)){
+            return -1;
+        }
+        p->stats.scanned += n - keep;
+    }
+    memcpy(p->carry, d + n - keep, keep);
+    p->carry_len = keep;
+    return (ssize_t)n;
+}
+
+bool mjpeg_parser_init(mjpeg_parser_t *p, const char *boundary, const mjpeg_callbacks_t *cb, void *user){
+    size_t bl = strlen(boundary);
+    if(bl == 0 || bl > MJPEG_MAX_BOUNDARY){
+        return false;
+    }
+    memset(p, 0, sizeof(*p));
+    memcpy(p->delim, "\r\n--", 4);
+    memcpy(p->delim + 4, boundary, bl);
+    p->delim_len = bl + 4;
+    p->state = ST_START;
+    if(cb){
+        p->cb = *cb;
+    }
+    p->user = user;
+    return true;
+}
+
+bool mjpeg_parser_done(const mjpeg_parser_t *p){
+    return p->state == ST_END;
+}
+
+ssize_t mjpeg_parser_feed(mjpeg_parser_t *p, const uint8_t *data, size_t len){
+    const uint8_t *d = data, *end = data + len;
+    while(d < end){
+        size_t avail = end - d;
+        switch(p->state){
+            case ST_START:
+                if(*d == '-' || *d == '\r'){
+                    // Leading boundary: search for it as if a CRLF preceded the stream
+                    start_resync(p, false);
+                    p->carry[0] = '\r';
+                    p->carry[1] = '\n';
+                    p->carry_len = 2;
+                } else {
+                    start_head(p);
+                }
+                break;
+
+            case ST_HEAD: {
+                size_t old = p->head_len;
+                size_t n = avail < MJPEG_MAX_HEADER - old ? avail : MJPEG_MAX_HEADER - old;
+                memcpy(p->head + old, d, n);
+                p->head_len += n;
+                size_t from = old >= 3 ? old - 3 : 0;
+                const uint8_t *hit = mjpeg_find_scalar((const uint8_t *)p->head + from, p->head_len - from,
+                                                       (const uint8_t *)"\r\n\r\n", 4);
+                if(!hit){
+                    d += n;
+                    if(p->head_len == MJPEG_MAX_HEADER){
+                        p->stats.bad_headers++;
+                        start_resync(p, true);
+                    }
+                    break;
+                }
+                size_t hend = (const char *)hit - p->head + 4;
+                d += hend - old;
+                if(!parse_head(p, hend - 2)){
+                    p->stats.bad_headers++;
+                    start_resync(p, true);
+                    break;
+                }
+                if(p->cb.on_part_begin && p->cb.on_part_begin(p->user, &p->part)){
+                    return -1;
+                }
+                if(p->part.content_length >= 0){
+                    p->remaining = (uint64_t)p->part.content_length;
+                    p->state = ST_BODY_LEN;
+                    if(!p->remaining){
+                        if(part_end(p)){
+                            return -1;
+                        }
+                        p->match = 0;
+                        p->state = ST_DELIM;
+                    }
+                } else {
+                    p->carry_len = 0;
+                    p->state = ST_BODY_SCAN;
+                }
+                break;
+            }
+
+            case ST_BODY_LEN: {
+                size_t n = avail < p->remaining ? avail : (size_t)p->remaining;
+                if(emit_data(p, d, n)){
+                    return -1;
+                }
+                d += n;
+                p->remaining -= n;
+                if(!p->remaining){
+                    if(part_end(p)){
+                        return -1;
+                    }
+                    p->match = 0;
+                    p->state = ST_DELIM;
+                }
+                break;
+            }
+
+            case ST_DELIM: {
+                size_t n = p->delim_len - p->match;
+                if(n > avail){
+                    n = avail;
+                }
+                if(memcmp(d, p->delim + p->match, n)){
+                    // Content-Length was wrong; find the real delimiter, which
+                    // may start inside the bytes matched in earlier feeds
+                    start_resync(p, true);
+                    memcpy(p->carry, p->delim, p->match);
+                    p->carry_len = p->match;
+                    break;
+                }
+                d += n;
+                p->match += n;
+                if(p->match == p->delim_len){
+                    p->after_len = 0;
+                    p->state = ST_AFTER;
+                }
+                break;
+            }
+
+            case ST_AFTER:
+                p->after[p->after_len++] = *d++;
+                if(p->after_len == 2){
+                    if(p->after[0] == '-' && p->after[1] == '-'){
+                        p->state = ST_END;
+                    } else {
+                        start_head(p);
+                        if(!(p->after[0] == '\r' && p->after[1] == '\n')){
+                            // Tolerate junk after the boundary; it becomes part of the header block
+                            memcpy(p->head + 2, p->after, 2);
+                            p->head_len = 4;
+                        }
+                    }
+                }
+                break;
+
+            case ST_BODY_SCAN:
+            case ST_RESYNC: {
+                bool found;
+                bool body = p->state == ST_BODY_SCAN;
+                ssize_t used = scan(p, d, avail, body, &found);
+                if(used < 0){
+                    return -1;
+                }
+                d += used;
+                if(found){
+                    if(body && part_end(p)){
+                        return -1;
+                    }
+                    p->after_len = 0;
+                    p->state = ST_AFTER;
+                }
+                break;
+            }
+
+            case ST_END:
+                d = end;
+                break;
+        }
+    }
+    return (ssize_t)len;
+}
+
+bool mjpeg_boundary_from_content_type(const char *content_type, char *out, size_t out_size){
+    const char *b = strcasestr(content_type, "boundary=");
+    if(!b || out_size == 0){
+        return false;
+    }
+    b += 9;
+    bool quoted = *b == '"';
+    if(quoted){
+        b++;
+    }
+    size_t n = 0;
+    while(b[n] && (quoted ? b[n] != '"' : (b[n] != ';' && b[n] != ' ' && b[n] != '\t' && b[n] != '\r'))){
+        n++;
+    }
+    if(n == 0 || n >= out_size || n > MJPEG_MAX_BOUNDARY){
+        return false;
+    }
+    memcpy(out, b, n);
+    out[n] = 0;
+    return true;
+}
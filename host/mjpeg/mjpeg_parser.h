@@ -0,0 +1,86 @@
+/*
+  Smart Plant Vision - streaming multipart/x-mixed-replace parser
+
+  Parses the body of the device's /stream response (PART_BOUNDARY with a
+  "Content-Type / Content-Length" header per part) as it arrives, without
+  buffering frames. Part data is reported as spans into the buffer passed to
+  mjpeg_parser_feed(); a part that arrives in one feed is reported as one
+  span. Content-Length is trusted when present, so the body is skipped over
+  rather than searched; parts without it are delimited by a boundary search
+  (SSE2 when available, memchr otherwise).
+
+  Spans are only valid during the callback. The one exception to "points into
+  the caller's buffer" is up to boundary-length bytes held back across feeds
+  while searching for a boundary, which are reported from parser storage.
+*/
+#ifndef HOST_MJPEG_PARSER_H
+#define HOST_MJPEG_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define MJPEG_MAX_BOUNDARY  70      // RFC 2046 limit
+#define MJPEG_MAX_HEADER    1024    // Part header block, larger ones force a resync
+#define MJPEG_MAX_PART      (32 * 1024 * 1024)  // Larger Content-Length values are not trusted
+
+typedef struct {
+    uint32_t index;             // Part number, from 0
+    int64_t content_length;     // -1 when the part had no Content-Length
+    const char *content_type;   // Not NUL terminated, NULL when absent
+    size_t content_type_len;
+    const char *headers;        // Raw header block, for anything else
+    size_t headers_len;
+} mjpeg_part_t;
+
+// Returning non-zero from a callback stops the parser; feed() then returns -1.
+typedef struct {
+    int (*on_part_begin)(void *user, const mjpeg_part_t *part);
+    int (*on_part_data)(void *user, const uint8_t *data, size_t len);
+    int (*on_part_end)(void *user, const mjpeg_part_t *part);
+} mjpeg_callbacks_t;
+
+typedef struct {
+    uint64_t parts;
+    uint64_t bytes;             // Part data bytes
+    uint64_t scanned;           // Part data bytes located by boundary search
+    uint64_t resyncs;           // Times the stream had to be searched for the next boundary
+    uint64_t bad_headers;       // Header blocks too long or unparsable
+} mjpeg_stats_t;
+
+typedef struct {
+    uint8_t delim[MJPEG_MAX_BOUNDARY + 4];   // "\r\n--" boundary
+    size_t delim_len;
+    int state;
+    size_t match;               // Delimiter bytes matched so far
+    uint8_t after[2];
+    size_t after_len;
+    char head[MJPEG_MAX_HEADER];
+    size_t head_len;
+    uint8_t carry[MJPEG_MAX_BOUNDARY + 4];   // Possible delimiter prefix from the previous feed
+    size_t carry_len;
+    uint64_t remaining;
+    mjpeg_part_t part;
+    mjpeg_callbacks_t cb;
+    void *user;
+    mjpeg_stats_t stats;
+} mjpeg_parser_t;
+
+// boundary is the bare token from the Content-Type (without leading dashes)
+bool mjpeg_parser_init(mjpeg_parser_t *p, const char *boundary, const mjpeg_callbacks_t *cb, void *user);
+
+// Returns len, or -1 when a callback aborted. Malformed input never fails the
+// parser; it resynchronises on the next boundary and counts it in stats.
+ssize_t mjpeg_parser_feed(mjpeg_parser_t *p, const uint8_t *data, size_t len);
+
+// True after the closing "--boundary--" was seen
+bool mjpeg_parser_done(const mjpeg_parser_t *p);
+
+// Extracts boundary=... from a Content-Type value into out (NUL terminated)
+bool mjpeg_boundary_from_content_type(const char *content_type, char *out, size_t out_size);
+
+// First occurrence of needle in hay, or NULL. Exposed for the benchmark.
+const uint8_t *mjpeg_find(const uint8_t *hay, size_t hay_len, const uint8_t *needle, size_t needle_len);
+const uint8_t *mjpeg_find_scalar(const uint8_t *hay, size_t hay_len, const uint8_t *needle, size_t needle_len);
+
+#endif
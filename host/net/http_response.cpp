@@ -0,0 +1,236 @@
+/*
+  Smart Plant Vision - incremental HTTP/1.1 response parser
+*/
+
+#include "http_response.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+http_response::http_response(){
+    reset();
+}
+
+void http_response::reset(bool head_request){
+    state_ = ST_HEAD;
+    head_request_ = head_request;
+    head_.clear();
+    line_.clear();
+    headers_.clear();
+    status_ = 0;
+    content_length_ = -1;
+    remaining_ = 0;
+    body_bytes_ = 0;
+    chunked_ = false;
+    keep_alive_ = true;
+}
+
+const std::string *http_response::header(const char *name) const {
+    for(const auto &h : headers_){
+        if(!strcasecmp(h.first.c_str(), name)){
+            return &h.second;
+        }
+    }
+    return NULL;
+}
+
+std::string http_response::header_param(const std::string &value, const char *param){
+    size_t plen = strlen(param);
+    size_t pos = 0;
+    while((pos = value.find(';', pos)) != std::string::npos){
+        pos++;
+        while(pos < value.size() && value[pos] == ' '){
+            pos++;
+        }
+        if(!strncasecmp(value.c_str() + pos, param, plen) && value[pos + plen] == '='){
+            size_t start = pos + plen + 1;
+            size_t end = value.find(';', start);
+            std::string v = value.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            while(!v.empty() && (v.back() == ' ' || v.back() == '\t')){
+                v.pop_back();
+            }
+            if(v.size() >= 2 && v.front() == '"' && v.back() == '"'){
+                v = v.substr(1, v.size() - 2);
+            }
+            return v;
+        }
+    }
+    return std::string();
+}
+
+bool http_response::parse_head(){
+    size_t eol = head_.find("\r\n");
+    if(eol == std::string::npos || head_.compare(0, 5, "HTTP/") != 0){
+        return false;
+    }
+    bool http10 = head_.compare(0, 8, "HTTP/1.0") == 0;
+    size_t sp = head_.find(' ');
+    if(sp == std::string::npos || sp > eol){
+        return false;
+    }
+    status_ = atoi(head_.c_str() + sp + 1);
+    if(status_ < 100 || status_ > 999){
+        return false;
+    }
+    keep_alive_ = !http10;
+
+    size_t pos = eol + 2;
+    while(pos < head_.size()){
+        size_t end = head_.find("\r\n", pos);
+        if(end == std::string::npos || end == pos){
+            break;
+        }
+        size_t colon = head_.find(':', pos);
+        if(colon == std::string::npos || colon > end){
+            return false;
+        }
+        size_t vs = colon + 1;
+        while(vs < end && (head_[vs] == ' ' || head_[vs] == '\t')){
+            vs++;
+        }
+        size_t ve = end;
+        while(ve > vs && (head_[ve - 1] == ' ' || head_[ve - 1] == '\t')){
+            ve--;
+        }
+        headers_.emplace_back(head_.substr(pos, colon - pos), head_.substr(vs, ve - vs));
+        pos = end + 2;
+    }
+
+    const std::string *v;
+    if((v = header("Transfer-Encoding")) && strcasestr(v->c_str(), "chunked")){
+        chunked_ = true;
+    } else if((v = header("Content-Length"))){
+        char *endp = NULL;
+        long long n = strtoll(v->c_str(), &endp, 10);
+        if(endp == v->c_str() || n < 0){
+            return false;
+        }
+        content_length_ = n;
+    }
+    if((v = header("Connection"))){
+        if(!strcasecmp(v->c_str(), "close")){
+            keep_alive_ = false;
+        } else if(!strcasecmp(v->c_str(), "keep-alive")){
+            keep_alive_ = true;
+        }
+    }
+
+    if(head_request_ || status_ == 204 || status_ == 304 || (status_ >= 100 && status_ < 200)){
+        state_ = ST_DONE;
+    } else if(chunked_){
+        state_ = ST_CHUNK_SIZE;
+    } else if(content_length_ >= 0){
+        remaining_ = (uint64_t)content_length_;
+        state_ = remaining_ ? ST_BODY_LENGTH : ST_DONE;
+    } else {
+        keep_alive_ = false;
+        state_ = ST_BODY_EOF;
+    }
+    return true;
+}
+
+void http_response::emit(const char *data, size_t len){
+    body_bytes_ += len;
+    if(on_body && len){
+        on_body(data, len);
+    }
+}
+
+ssize_t http_response::feed(const char *data, size_t len){
+    size_t used = 0;
+    while(used < len && state_ != ST_DONE){
+        const char *p = data + used;
+        size_t avail = len - used;
+        switch(state_){
+            case ST_HEAD: {
+                size_t old = head_.size();
+                head_.append(p, avail);
+                size_t from = old >= 3 ? old - 3 : 0;
+                size_t end = head_.find("\r\n\r\n", from);
+                if(end == std::string::npos){
+                    if(head_.size() > HTTP_RESPONSE_MAX_HEAD){
+                        return -1;
+                    }
+                    used = len;
+                    break;
+                }
+                head_.resize(end + 4);
+                used += end + 4 - old;
+                if(!parse_head()){
+                    return -1;
+                }
+                break;
+            }
+            case ST_BODY_LENGTH: {
+                size_t n = avail < remaining_ ? avail : (size_t)remaining_;
+                emit(p, n);
+                remaining_ -= n;
+                used += n;
+                if(!remaining_){
+                    state_ = ST_DONE;
+                }
+                break;
+            }
+            case ST_BODY_EOF:
+                emit(p, avail);
+                used = len;
+                break;
+            case ST_CHUNK_DATA: {
+                size_t n = avail < remaining_ ? avail : (size_t)remaining_;
+                emit(p, n);
+                remaining_ -= n;
+                used += n;
+                if(!remaining_){
+                    state_ = ST_CHUNK_CRLF;
+                }
+                break;
+            }
+            case ST_CHUNK_SIZE:
+            case ST_CHUNK_CRLF:
+            case ST_TRAILER: {
+                const char *nl = (const char *)memchr(p, '\n', avail);
+                size_t n = nl ? (size_t)(nl - p) + 1 : avail;
+                line_.append(p, n);
+                used += n;
+                if(line_.size() > 256){
+                    return -1;
+                }
+                if(!nl){
+                    break;
+                }
+                while(!line_.empty() && (line_.back() == '\n' || line_.back() == '\r')){
+                    line_.pop_back();
+                }
+                if(state_ == ST_CHUNK_SIZE){
+                    char *endp = NULL;
+                    unsigned long long size = strtoull(line_.c_str(), &endp, 16);
+                    if(endp == line_.c_str() || (*endp && *endp != ';' && *endp != ' ')){
+                        return -1;
+                    }
+                    remaining_ = size;
+                    state_ = size ? ST_CHUNK_DATA : ST_TRAILER;
+                } else if(state_ == ST_CHUNK_CRLF){
+                    if(!line_.empty()){
+                        return -1;
+                    }
+                    state_ = ST_CHUNK_SIZE;
+                } else if(line_.empty()){
+                    state_ = ST_DONE;
+                }
+                line_.clear();
+                break;
+            }
+            case ST_DONE:
+                break;
+        }
+    }
+    return (ssize_t)used;
+}
+
+bool http_response::feed_eof(){
+    if(state_ == ST_BODY_EOF){
+        state_ = ST_DONE;
+    }
+    keep_alive_ = false;
+    return state_ == ST_DONE;
+}
@@ -0,0 +1,81 @@
+/*
+  Smart Plant Vision - incremental HTTP/1.1 response parser
+  Fed with whatever recv() returned; handles Content-Length, chunked and
+  close-delimited bodies. Body bytes are handed to on_body as they arrive, so
+  an endless multipart stream never has to be buffered.
+*/
+#ifndef HOST_NET_HTTP_RESPONSE_H
+#define HOST_NET_HTTP_RESPONSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define HTTP_RESPONSE_MAX_HEAD 16384
+
+class http_response {
+public:
+    typedef std::function<void(const char *data, size_t len)> body_cb_t;
+
+    http_response();
+
+    // Ready for the next response on the same connection; on_body is kept
+    void reset(bool head_request = false);
+
+    // Consumes up to len bytes and returns how many were used (fewer than len
+    // only once the response is complete), or -1 on a malformed response.
+    ssize_t feed(const char *data, size_t len);
+
+    // Peer closed the connection; completes a close-delimited body.
+    // Returns false when the response was cut short.
+    bool feed_eof();
+
+    bool headers_done() const { return state_ > ST_HEAD; }
+    bool done() const { return state_ == ST_DONE; }
+    bool keep_alive() const { return keep_alive_; }
+    int status() const { return status_; }
+    int64_t content_length() const { return content_length_; }
+    bool chunked() const { return chunked_; }
+    uint64_t body_bytes() const { return body_bytes_; }
+
+    // Case-insensitive lookup, NULL when absent
+    const std::string *header(const char *name) const;
+
+    // Value of a parameter inside a header, e.g. boundary from Content-Type
+    static std::string header_param(const std::string &value, const char *param);
+
+    body_cb_t on_body;
+
+private:
+    enum state_t {
+        ST_HEAD,
+        ST_BODY_LENGTH,
+        ST_BODY_EOF,
+        ST_CHUNK_SIZE,
+        ST_CHUNK_DATA,
+        ST_CHUNK_CRLF,
+        ST_TRAILER,
+        ST_DONE
+    };
+
+    bool parse_head();
+    void emit(const char *data, size_t len);
+
+    state_t state_;
+    bool head_request_;
+    std::string head_;
+    std::string line_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+    int status_;
+    int64_t content_length_;
+    uint64_t remaining_;
+    uint64_t body_bytes_;
+    bool chunked_;
+    bool keep_alive_;
+};
+
+#endif
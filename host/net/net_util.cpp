@@ -0,0 +1,108 @@
+/*
+  Smart Plant Vision - host tools socket helpers
+*/
+
+#include "net_util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+int64_t net_now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool net_set_nonblock(int fd){
+    int fl = fcntl(fd, F_GETFL, 0);
+    return fl >= 0 && fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0;
+}
+
+void net_set_nodelay(int fd){
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int net_connect(const char *host, int port, bool nonblock){
+    struct addrinfo hints = {}, *res = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char portstr[8];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    int rc = getaddrinfo(host, portstr, &hints, &res);
+    if(rc != 0 || !res){
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        freeaddrinfo(res);
+        return -1;
+    }
+    if(nonblock){
+        net_set_nonblock(fd);
+    }
+    net_set_nodelay(fd);
+    if(connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS){
+        int e = errno;
+        close(fd);
+        freeaddrinfo(res);
+        errno = e;
+        return -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int net_connect_result(int fd){
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0){
+        return errno;
+    }
+    return err;
+}
+
+int net_listen(const char *addr, int port, int backlog){
+    struct addrinfo hints = {}, *res = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    char portstr[8];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    if(getaddrinfo(addr, portstr, &hints, &res) != 0 || !res){
+        return -1;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        freeaddrinfo(res);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, backlog) < 0){
+        close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+std::string net_split_host(const char *spec, int *port){
+    std::string s = spec;
+    size_t colon = s.rfind(':');
+    if(colon != std::string::npos && s.find(':') == colon){
+        *port = atoi(s.c_str() + colon + 1);
+        s.resize(colon);
+    }
+    return s;
+}
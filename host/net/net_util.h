@@ -0,0 +1,28 @@
+/*
+  Smart Plant Vision - host tools socket helpers
+*/
+#ifndef HOST_NET_UTIL_H
+#define HOST_NET_UTIL_H
+
+#include <stdint.h>
+#include <string>
+
+// Monotonic clock in microseconds
+int64_t net_now_us(void);
+
+// Starts a TCP connect to host:port. With nonblock the connect may still be in
+// progress when this returns (wait for EPOLLOUT, then net_connect_result()).
+// Returns the socket or -1 with errno set.
+int net_connect(const char *host, int port, bool nonblock);
+int net_connect_result(int fd);
+
+// Listening socket on addr:port (addr NULL for any), -1 on failure
+int net_listen(const char *addr, int port, int backlog);
+
+bool net_set_nonblock(int fd);
+void net_set_nodelay(int fd);
+
+// Splits "host[:port]" and overrides *port when a port is present
+std::string net_split_host(const char *spec, int *port);
+
+#endif
@@ -0,0 +1,74 @@
+/*
+  Smart Plant Vision - host runner
+  Runs the unmodified sketch (setup() then loop() forever) against the shims
+  in host/shim, so the camera server can be exercised from a workstation.
+
+  Usage: plant_host [--port-offset N] [--frames DIR] [--fps F]
+                    [--sccb-us N] [--sim-speed X] [--no-psram] [--seed N]
+                    [--mqtt URI] [--upload URL]
+*/
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "plant_shim.h"
+
+void setup();
+void loop();
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --port-offset N   added to every server port (default 8000, so 80 -> 8080)\n"
+            "  --frames DIR      replay the JPEGs in DIR instead of the synthetic scene\n"
+            "  --fps F           sensor frame rate (default 15, halved in UXGA mode)\n"
+            "  --sccb-us N       cost of one sensor register write in microseconds (default 120)\n"
+            "  --sim-speed X     environment simulation time multiplier (default 1)\n"
+            "  --no-psram        emulate a board without PSRAM\n"
+            "  --seed N          seed for sensor noise\n"
+            "  --mqtt URI        MQTT broker for the telemetry, e.g. mqtt://localhost:1883 (default none)\n"
+            "  --upload URL      where frame uploads go, e.g. http://localhost:5000/predict (default none)\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"port-offset", required_argument, NULL, 'p'},
+        {"frames",      required_argument, NULL, 'f'},
+        {"fps",         required_argument, NULL, 'r'},
+        {"sccb-us",     required_argument, NULL, 'c'},
+        {"sim-speed",   required_argument, NULL, 's'},
+        {"no-psram",    no_argument,       NULL, 'n'},
+        {"seed",        required_argument, NULL, 'S'},
+        {"mqtt",        required_argument, NULL, 'm'},
+        {"upload",      required_argument, NULL, 'u'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    plant_shim_config_t *cfg = plant_shim_config();
+    int opt;
+    while((opt = getopt_long(argc, argv, "p:f:r:c:s:nS:m:u:h", options, NULL)) != -1){
+        switch(opt){
+            case 'p': cfg->port_offset = atoi(optarg); break;
+            case 'f': cfg->frames_dir = optarg; break;
+            case 'r': cfg->fps = (float)atof(optarg); break;
+            case 'c': cfg->sccb_write_us = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 's': cfg->sim_speed = (float)atof(optarg); break;
+            case 'n': cfg->psram = false; break;
+            case 'S': cfg->seed = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'm': cfg->mqtt_uri = optarg; break;
+            case 'u': cfg->upload_url = optarg; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);  // Serial output stays readable when piped
+
+    setup();
+    for(;;){
+        loop();
+    }
+    return 0;
+}
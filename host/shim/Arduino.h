@@ -0,0 +1,164 @@
+/*
+  Host shim - Arduino core surface used by the sketch
+  Serial writes to stdout; analogRead() and the DHT readings come from the
+  environment simulation in sim_env.cpp.
+*/
+#ifndef HOST_SHIM_ARDUINO_H
+#define HOST_SHIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp32-hal-ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+
+#define LOW     0x0
+#define HIGH    0x1
+#define INPUT   0x01
+#define OUTPUT  0x03
+
+#define DEC 10
+#define HEX 16
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield(void);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint16_t analogRead(uint8_t pin);
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+bool psramFound(void);
+void *ps_malloc(size_t size);
+void *ps_calloc(size_t n, size_t size);
+void *ps_realloc(void *ptr, size_t size);
+
+class String {
+public:
+    String() {}
+    String(const char *s) : s_(s ? s : "") {}
+    String(const std::string &s) : s_(s) {}
+    String(char c) : s_(1, c) {}
+    String(int v, unsigned char base = DEC);
+    String(unsigned int v, unsigned char base = DEC);
+    String(long v, unsigned char base = DEC);
+    String(unsigned long v, unsigned char base = DEC);
+    String(float v, unsigned int decimals = 2);
+    String(double v, unsigned int decimals = 2);
+
+    const char *c_str() const { return s_.c_str(); }
+    unsigned int length() const { return s_.length(); }
+    bool isEmpty() const { return s_.empty(); }
+    bool reserve(unsigned int size) { s_.reserve(size); return true; }
+    char charAt(unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const String &s, unsigned int from = 0) const;
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+    long toInt() const { return strtol(s_.c_str(), NULL, 10); }
+    float toFloat() const { return strtof(s_.c_str(), NULL); }
+    bool equals(const String &o) const { return s_ == o.s_; }
+    bool startsWith(const String &o) const { return s_.compare(0, o.s_.size(), o.s_) == 0; }
+    void trim();
+
+    bool concat(const String &o) { s_ += o.s_; return true; }
+    bool concat(const char *o) { s_ += o ? o : ""; return true; }
+    bool concat(char c) { s_ += c; return true; }
+    template<typename T> bool concat(T v) { return concat(String(v)); }
+    template<typename T> String &operator+=(const T &v) { concat(v); return *this; }
+
+    bool operator==(const String &o) const { return s_ == o.s_; }
+    bool operator==(const char *o) const { return s_ == (o ? o : ""); }
+    bool operator!=(const String &o) const { return s_ != o.s_; }
+    bool operator<(const String &o) const { return s_ < o.s_; }
+
+    const std::string &str() const { return s_; }
+
+private:
+    std::string s_;
+};
+
+String operator+(const String &a, const String &b);
+String operator+(const String &a, const char *b);
+String operator+(const char *a, const String &b);
+
+class IPAddress {
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : o_{a, b, c, d} {}
+    String toString() const;
+    uint8_t operator[](int i) const { return o_[i & 3]; }
+private:
+    uint8_t o_[4];
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+    virtual size_t write(const uint8_t *buf, size_t len) = 0;
+    size_t write(const char *s) { return s ? write((const uint8_t *)s, strlen(s)) : 0; }
+    size_t write(const char *buf, size_t len) { return write((const uint8_t *)buf, len); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned int v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(double v, int digits = 2) { return print(String(v, (unsigned int)digits)); }
+    size_t print(const IPAddress &ip) { return print(ip.toString()); }
+
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    template<typename T> size_t println(const T &v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+    void setDebugOutput(bool on) { (void)on; }
+    void flush();
+    int available() { return 0; }
+    int read() { return -1; }
+    using Print::write;
+    size_t write(const uint8_t *buf, size_t len) override;
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
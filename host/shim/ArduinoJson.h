@@ -0,0 +1,54 @@
+/*
+  Host shim - the small part of ArduinoJson 6 the sketch uses: a flat object
+  document with scalar members and serializeJson() into a String.
+*/
+#ifndef HOST_SHIM_ARDUINOJSON_H
+#define HOST_SHIM_ARDUINOJSON_H
+
+#include "Arduino.h"
+#include <utility>
+#include <vector>
+
+class DynamicJsonDocument {
+public:
+    class Member {
+    public:
+        Member(DynamicJsonDocument *doc, const char *key) : doc_(doc), key_(key) {}
+        Member &operator=(const char *v);
+        Member &operator=(const String &v) { return *this = v.c_str(); }
+        Member &operator=(bool v) { set(v ? "true" : "false"); return *this; }
+        Member &operator=(int v) { return setf("%d", v); }
+        Member &operator=(unsigned int v) { return setf("%u", v); }
+        Member &operator=(long v) { return setf("%ld", v); }
+        Member &operator=(unsigned long v) { return setf("%lu", v); }
+        Member &operator=(long long v) { return setf("%lld", v); }
+        Member &operator=(unsigned long long v) { return setf("%llu", v); }
+        Member &operator=(float v) { return setf("%.7g", (double)v); }
+        Member &operator=(double v) { return setf("%.15g", v); }
+    private:
+        template<typename T> Member &setf(const char *fmt, T v) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), fmt, v);
+            set(buf);
+            return *this;
+        }
+        void set(const std::string &raw);
+        DynamicJsonDocument *doc_;
+        const char *key_;
+    };
+
+    explicit DynamicJsonDocument(size_t capacity) : capacity_(capacity) {}
+    Member operator[](const char *key) { return Member(this, key); }
+    void clear() { members_.clear(); }
+    size_t capacity() const { return capacity_; }
+
+private:
+    friend class Member;
+    friend size_t serializeJson(const DynamicJsonDocument &doc, String &out);
+    size_t capacity_;
+    std::vector<std::pair<std::string, std::string>> members_;   // key, raw JSON value
+};
+
+size_t serializeJson(const DynamicJsonDocument &doc, String &out);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+  Host shim - Adafruit DHT library surface, readings come from sim_env.cpp
+*/
+#ifndef HOST_SHIM_DHT_H
+#define HOST_SHIM_DHT_H
+
+#include "Arduino.h"
+
+#define DHT11 11
+#define DHT22 22
+
+class DHT {
+public:
+    DHT(uint8_t pin, uint8_t type, uint8_t count = 6) { (void)pin; (void)type; (void)count; }
+    void begin(uint8_t usec = 55) { (void)usec; }
+    float readTemperature(bool fahrenheit = false, bool force = false);
+    float readHumidity(bool force = false);
+};
+
+#endif
@@ -0,0 +1,31 @@
+/*
+  Host shim - WiFi.h
+  The host is always "connected"; localIP() reports the loopback address.
+*/
+#ifndef HOST_SHIM_WIFI_H
+#define HOST_SHIM_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class WiFiClass {
+public:
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL);
+    wl_status_t status() { return status_; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    int8_t RSSI() { return -55; }
+    bool setSleep(bool enabled) { (void)enabled; return true; }
+private:
+    wl_status_t status_ = WL_IDLE_STATUS;
+};
+
+extern WiFiClass WiFi;
+
+#endif
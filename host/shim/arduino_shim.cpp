@@ -0,0 +1,286 @@
+/*
+  Host shim - Arduino core, Serial, String, LEDC, WiFi and the JSON subset
+*/
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "ArduinoJson.h"
+#include "plant_shim.h"
+#include <unistd.h>
+#include <mutex>
+#include <random>
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+
+static std::mutex serial_lock;
+
+// Timing
+
+unsigned long millis(void){
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros(void){
+    return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ms){
+    vTaskDelay(ms);
+}
+
+void delayMicroseconds(uint32_t us){
+    usleep(us);
+}
+
+void yield(void){
+}
+
+// GPIO
+
+static uint8_t pin_levels[64];
+
+void pinMode(uint8_t pin, uint8_t mode){
+    (void)pin; (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val){
+    pin_levels[pin & 63] = val;
+}
+
+int digitalRead(uint8_t pin){
+    return pin_levels[pin & 63];
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max){
+    const long dividend = out_max - out_min;
+    const long divisor = in_max - in_min;
+    const long delta = x - in_min;
+    if(divisor == 0){
+        return -1;
+    }
+    return (delta * dividend + (divisor / 2)) / divisor + out_min;
+}
+
+static std::mt19937 &rng(){
+    static std::mt19937 gen(plant_shim_config()->seed);
+    return gen;
+}
+
+long random(long howbig){
+    if(howbig <= 0){
+        return 0;
+    }
+    return (long)(rng()() % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig){
+    if(howsmall >= howbig){
+        return howsmall;
+    }
+    return random(howbig - howsmall) + howsmall;
+}
+
+// PSRAM
+
+bool psramFound(void){
+    return plant_shim_config()->psram;
+}
+
+void *ps_malloc(size_t size){
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+}
+
+void *ps_calloc(size_t n, size_t size){
+    return heap_caps_calloc(n, size, MALLOC_CAP_SPIRAM);
+}
+
+void *ps_realloc(void *ptr, size_t size){
+    return heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM);
+}
+
+// LEDC, duty is remembered so the flash state can be inspected
+
+static uint32_t ledc_duty[16];
+
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution_bits){
+    (void)channel; (void)resolution_bits;
+    return freq;
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty){
+    ledc_duty[channel & 15] = duty;
+}
+
+uint32_t ledcRead(uint8_t channel){
+    return ledc_duty[channel & 15];
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel){
+    (void)pin; (void)channel;
+}
+
+void ledcDetachPin(uint8_t pin){
+    (void)pin;
+}
+
+// String
+
+static std::string fmt_integer(unsigned long long v, bool neg, unsigned char base){
+    char buf[72];
+    char *p = buf + sizeof(buf);
+    *--p = 0;
+    if(base < 2){
+        base = 10;
+    }
+    do {
+        int d = (int)(v % base);
+        *--p = (char)(d < 10 ? '0' + d : 'A' + d - 10);
+        v /= base;
+    } while(v);
+    if(neg){
+        *--p = '-';
+    }
+    return p;
+}
+
+String::String(int v, unsigned char base) : s_(fmt_integer(v < 0 && base == DEC ? -(long long)v : (unsigned)v, v < 0 && base == DEC, base)) {}
+String::String(unsigned int v, unsigned char base) : s_(fmt_integer(v, false, base)) {}
+String::String(long v, unsigned char base) : s_(fmt_integer(v < 0 && base == DEC ? -(long long)v : (unsigned long)v, v < 0 && base == DEC, base)) {}
+String::String(unsigned long v, unsigned char base) : s_(fmt_integer(v, false, base)) {}
+
+String::String(float v, unsigned int decimals) : String((double)v, decimals) {}
+
+String::String(double v, unsigned int decimals){
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+    s_ = buf;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+    size_t p = s_.find(c, from);
+    return p == std::string::npos ? -1 : (int)p;
+}
+
+int String::indexOf(const String &s, unsigned int from) const {
+    size_t p = s_.find(s.s_, from);
+    return p == std::string::npos ? -1 : (int)p;
+}
+
+String String::substring(unsigned int from) const {
+    return from < s_.size() ? String(s_.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if(from > to){
+        std::swap(from, to);
+    }
+    return from < s_.size() ? String(s_.substr(from, to - from)) : String();
+}
+
+void String::trim(){
+    size_t b = s_.find_first_not_of(" \t\r\n");
+    size_t e = s_.find_last_not_of(" \t\r\n");
+    s_ = b == std::string::npos ? std::string() : s_.substr(b, e - b + 1);
+}
+
+String operator+(const String &a, const String &b){ String r(a); r.concat(b); return r; }
+String operator+(const String &a, const char *b){ String r(a); r.concat(b); return r; }
+String operator+(const char *a, const String &b){ String r(a); r.concat(b); return r; }
+
+String IPAddress::toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", o_[0], o_[1], o_[2], o_[3]);
+    return String(buf);
+}
+
+// Serial
+
+size_t Print::printf(const char *format, ...){
+    char small[256];
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(small, sizeof(small), format, ap);
+    va_end(ap);
+    if(n < 0){
+        return 0;
+    }
+    if((size_t)n < sizeof(small)){
+        return write((const uint8_t *)small, n);
+    }
+    std::string big(n + 1, 0);
+    va_start(ap, format);
+    vsnprintf(&big[0], big.size(), format, ap);
+    va_end(ap);
+    return write((const uint8_t *)big.data(), n);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len){
+    std::lock_guard<std::mutex> lk(serial_lock);
+    return fwrite(buf, 1, len, stdout);
+}
+
+void HardwareSerial::flush(){
+    std::lock_guard<std::mutex> lk(serial_lock);
+    fflush(stdout);
+}
+
+// WiFi
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase){
+    (void)ssid; (void)passphrase;
+    status_ = WL_CONNECTED;
+    return status_;
+}
+
+// JSON
+
+static void json_escape(std::string &out, const char *s){
+    out += '"';
+    for(; *s; s++){
+        unsigned char c = (unsigned char)*s;
+        if(c == '"' || c == '\\'){
+            out += '\\';
+            out += (char)c;
+        } else if(c < 0x20){
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+void DynamicJsonDocument::Member::set(const std::string &raw){
+    for(auto &m : doc_->members_){
+        if(m.first == key_){
+            m.second = raw;
+            return;
+        }
+    }
+    doc_->members_.emplace_back(key_, raw);
+}
+
+DynamicJsonDocument::Member &DynamicJsonDocument::Member::operator=(const char *v){
+    std::string raw;
+    json_escape(raw, v ? v : "");
+    set(raw);
+    return *this;
+}
+
+size_t serializeJson(const DynamicJsonDocument &doc, String &out){
+    std::string s = "{";
+    for(size_t i = 0; i < doc.members_.size(); i++){
+        if(i){
+            s += ',';
+        }
+        json_escape(s, doc.members_[i].first.c_str());
+        s += ':';
+        s += doc.members_[i].second;
+    }
+    s += '}';
+    out = String(s);
+    return s.size();
+}
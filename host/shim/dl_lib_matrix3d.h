@@ -0,0 +1,7 @@
+/*
+  Host shim - dl_lib_matrix3d.h
+  Included by the camera server but nothing from it is used.
+*/
+#ifndef HOST_SHIM_DL_LIB_MATRIX3D_H
+#define HOST_SHIM_DL_LIB_MATRIX3D_H
+#endif
@@ -0,0 +1,21 @@
+/*
+  Host shim - esp32-hal-ledc.h
+*/
+#ifndef HOST_SHIM_ESP32_HAL_LEDC_H
+#define HOST_SHIM_ESP32_HAL_LEDC_H
+
+#include <stdint.h>
+
+typedef enum { LEDC_TIMER_0 = 0, LEDC_TIMER_1, LEDC_TIMER_2, LEDC_TIMER_3 } ledc_timer_t;
+typedef enum {
+    LEDC_CHANNEL_0 = 0, LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3,
+    LEDC_CHANNEL_4, LEDC_CHANNEL_5, LEDC_CHANNEL_6, LEDC_CHANNEL_7
+} ledc_channel_t;
+
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution_bits);
+void ledcWrite(uint8_t channel, uint32_t duty);
+uint32_t ledcRead(uint8_t channel);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcDetachPin(uint8_t pin);
+
+#endif
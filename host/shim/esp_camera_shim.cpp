@@ -0,0 +1,918 @@
+/*
+  Host shim - esp32-camera driver emulation
+
+  The emulated OV2640 keeps a two-bank register file. set_framesize()
+  programs a mode table plus the DSP window registers, one SCCB write at a
+  time (plant_shim_config()->sccb_write_us each), and the frame producer
+  derives the output size from ZMOW/ZMOH/ZMHH when each frame starts. Frames
+  already queued or in flight keep their old size, and the first frame after
+  a sensor mode change is under-exposed, which is what the real part does.
+
+  Frame buffers are sized at init like the driver (width * height / 5 for
+  JPEG), allocated from the emulated PSRAM or DRAM pool, and handed out with
+  CAMERA_GRAB_WHEN_EMPTY / CAMERA_GRAB_LATEST semantics.
+*/
+
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "plant_shim.h"
+#include "shim_jpeg.h"
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+static const char *TAG = "cam_hal";
+
+const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+    {   96,   96, ASPECT_RATIO_1X1   },
+    {  160,  120, ASPECT_RATIO_4X3   },
+    {  176,  144, ASPECT_RATIO_5X4   },
+    {  240,  176, ASPECT_RATIO_3X2   },
+    {  240,  240, ASPECT_RATIO_1X1   },
+    {  320,  240, ASPECT_RATIO_4X3   },
+    {  400,  296, ASPECT_RATIO_4X3   },
+    {  480,  320, ASPECT_RATIO_3X2   },
+    {  640,  480, ASPECT_RATIO_4X3   },
+    {  800,  600, ASPECT_RATIO_4X3   },
+    { 1024,  768, ASPECT_RATIO_4X3   },
+    { 1280,  720, ASPECT_RATIO_16X9  },
+    { 1280, 1024, ASPECT_RATIO_5X4   },
+    { 1600, 1200, ASPECT_RATIO_4X3   },
+    { 1920, 1080, ASPECT_RATIO_16X9  },
+    {  720, 1280, ASPECT_RATIO_9X16  },
+    {  864, 1536, ASPECT_RATIO_9X16  },
+    { 2048, 1536, ASPECT_RATIO_4X3   },
+    { 2560, 1440, ASPECT_RATIO_16X9  },
+    { 2560, 1600, ASPECT_RATIO_16X10 },
+    { 1080, 1920, ASPECT_RATIO_9X16  },
+    { 2560, 1920, ASPECT_RATIO_4X3   },
+};
+
+// Window the driver centres on the UXGA readout for each aspect ratio
+typedef struct {
+    int max_x;
+    int max_y;
+    int offset_x;
+    int offset_y;
+} ratio_settings_t;
+
+static const ratio_settings_t ratio_table[] = {
+    { 1600, 1200,   0,   0 },   // 4:3
+    { 1600, 1066,   0,  67 },   // 3:2
+    { 1600, 1000,   0, 100 },   // 16:10
+    { 1600,  960,   0, 120 },   // 5:3
+    { 1600,  900,   0, 150 },   // 16:9
+    { 1600,  686,   0, 257 },   // 21:9
+    { 1500, 1200,  50,   0 },   // 5:4
+    { 1200, 1200, 200,   0 },   // 1:1
+    {  864, 1536, 368,   0 },   // 9:16
+};
+
+// OV2640 register addresses used by the emulation (bank in bit 8, 1 = sensor)
+#define BANK_SENSOR   0x100
+#define REG_CLKRC     (BANK_SENSOR | 0x11)
+#define REG_COM7      (BANK_SENSOR | 0x12)
+#define REG_REG04     (BANK_SENSOR | 0x04)
+#define DSP_QS        0x44
+#define DSP_CTRLI     0x50
+#define DSP_HSIZE     0x51
+#define DSP_VSIZE     0x52
+#define DSP_XOFFL     0x53
+#define DSP_YOFFL     0x54
+#define DSP_VHYX      0x55
+#define DSP_TEST      0x57
+#define DSP_ZMOW      0x5A
+#define DSP_ZMOH      0x5B
+#define DSP_ZMHH      0x5C
+#define DSP_CTRL2     0x86
+#define DSP_SIZEL     0x8C
+#define DSP_HSIZE8    0xC0
+#define DSP_VSIZE8    0xC1
+#define DSP_R_DVP_SP  0xD3
+#define DSP_RESET     0xE0
+#define DSP_BPADDR    0x7C
+#define DSP_BPDATA    0x7D
+
+#define COM7_UXGA     0x00
+#define COM7_SVGA     0x40
+#define COM7_CIF      0x20
+
+enum { SLOT_FREE, SLOT_READY, SLOT_HELD };
+
+typedef struct {
+    camera_fb_t fb;
+    size_t cap;
+    int state;
+} shim_slot_t;
+
+// Readout size and the window of it the DSP scales to the output, in pixels
+typedef struct {
+    int readout_w;
+    int readout_h;
+    int x;
+    int y;
+    int w;
+    int h;
+} sensor_window_t;
+
+typedef struct {
+    int width;
+    int height;
+    int com7;
+    pixformat_t format;
+    int quality;
+    int brightness;
+    sensor_window_t win;
+} frame_geom_t;
+
+static std::mutex cam_lock;
+static std::condition_variable cam_ready_cv;
+static std::mutex sccb_lock;
+
+static bool cam_inited = false;
+static camera_config_t cam_config;
+static sensor_t cam_sensor;
+static uint8_t cam_regs[2][256];
+static std::vector<shim_slot_t> cam_slots;
+static std::deque<int> cam_ready;
+static std::thread cam_task;
+static std::atomic<bool> cam_stop(false);
+static std::atomic<uint32_t> cam_dropped(0);
+
+// Frame sources
+
+typedef struct {
+    std::vector<uint8_t> rgb;
+    int width;
+    int height;
+} source_image_t;
+
+// (source, output size, window, readout size)
+typedef std::tuple<int, int, int, int, int, int, int, int, int> scale_key_t;
+
+static std::vector<source_image_t> sources;
+static std::map<scale_key_t, std::vector<uint8_t>> scaled_cache;   // -> RGB
+static std::map<std::tuple<scale_key_t, int, int, int>, std::vector<uint8_t>> jpeg_cache;
+
+static void load_sources(void){
+    sources.clear();
+    scaled_cache.clear();
+    jpeg_cache.clear();
+    const char *dir = plant_shim_config()->frames_dir;
+    if(!dir){
+        return;
+    }
+    DIR *d = opendir(dir);
+    if(!d){
+        ESP_LOGE(TAG, "cannot open frames directory %s", dir);
+        return;
+    }
+    std::vector<std::string> names;
+    while(struct dirent *e = readdir(d)){
+        std::string n = e->d_name;
+        std::string lower = n;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if(lower.size() > 4 && (lower.compare(lower.size() - 4, 4, ".jpg") == 0 ||
+                                (lower.size() > 5 && lower.compare(lower.size() - 5, 5, ".jpeg") == 0))){
+            names.push_back(n);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    for(const auto &n : names){
+        std::string path = std::string(dir) + "/" + n;
+        FILE *f = fopen(path.c_str(), "rb");
+        if(!f){
+            continue;
+        }
+        std::vector<uint8_t> data;
+        uint8_t buf[65536];
+        size_t r;
+        while((r = fread(buf, 1, sizeof(buf), f)) > 0){
+            data.insert(data.end(), buf, buf + r);
+        }
+        fclose(f);
+        source_image_t img;
+        if(shim_jpeg_decode(data.data(), data.size(), 1, img.rgb, &img.width, &img.height)){
+            sources.push_back(std::move(img));
+        }
+    }
+    ESP_LOGI(TAG, "loaded %u frames from %s", (unsigned)sources.size(), dir);
+}
+
+static scale_key_t scale_key(int idx, const frame_geom_t &g){
+    return std::make_tuple(idx, g.width, g.height, g.win.x, g.win.y, g.win.w, g.win.h, g.win.readout_w, g.win.readout_h);
+}
+
+// Source stretched over the readout, with the window the DSP takes of it
+// scaled to the output
+static const std::vector<uint8_t> &scaled_source(int idx, const frame_geom_t &g){
+    scale_key_t key = scale_key(idx, g);
+    auto it = scaled_cache.find(key);
+    if(it != scaled_cache.end()){
+        return it->second;
+    }
+    const source_image_t &src = sources[idx];
+    int w = g.width, h = g.height;
+    std::vector<uint8_t> out((size_t)w * h * 3);
+    for(int y = 0; y < h; y++){
+        int sy = (int)((((int64_t)g.win.y * h + (int64_t)y * g.win.h) * src.height) / ((int64_t)g.win.readout_h * h));
+        sy = std::min(sy, src.height - 1);
+        for(int x = 0; x < w; x++){
+            int sx = (int)((((int64_t)g.win.x * w + (int64_t)x * g.win.w) * src.width) / ((int64_t)g.win.readout_w * w));
+            sx = std::min(sx, src.width - 1);
+            memcpy(&out[((size_t)y * w + x) * 3], &src.rgb[((size_t)sy * src.width + sx) * 3], 3);
+        }
+    }
+    return scaled_cache.emplace(key, std::move(out)).first->second;
+}
+
+// Synthetic scene: a leaf with a few lesions on soil, swaying slightly, with
+// an insect crossing now and then.
+static void render_synthetic(std::vector<uint8_t> &rgb, int w, int h, double t){
+    rgb.resize((size_t)w * h * 3);
+    double sway = 0.01 * sin(t * 0.7);
+    double cx = 0.5 + sway, cy = 0.52, rx = 0.32, ry = 0.22;
+    static const double spots[][3] = {
+        {0.42, 0.47, 0.025}, {0.58, 0.55, 0.018}, {0.50, 0.60, 0.012}, {0.63, 0.45, 0.02},
+    };
+    double bug_phase = fmod(t, 20.0);
+    bool bug = bug_phase < 3.0;
+    double bx = 0.1 + 0.8 * bug_phase / 3.0, by = 0.3 + 0.1 * sin(bug_phase * 3);
+
+    for(int y = 0; y < h; y++){
+        double ny = (y + 0.5) / h;
+        uint8_t *row = &rgb[(size_t)y * w * 3];
+        for(int x = 0; x < w; x++){
+            double nx = (x + 0.5) / w;
+            double dx = (nx - cx) / rx, dy = (ny - cy) / ry;
+            double r2 = dx * dx + dy * dy;
+            int r, g, b;
+            if(r2 < 1.0){
+                double vein = fabs(dy) < 0.03 || fabs(fmod(dx * 4 + fabs(dy) * 2, 1.0)) < 0.05 ? 20 : 0;
+                r = 40 + (int)(20 * r2);
+                g = 120 + (int)(60 * (1 - r2)) + (int)vein;
+                b = 40;
+                for(const auto &s : spots){
+                    double sx = nx - (s[0] + sway), sy = ny - s[1];
+                    if(sx * sx + sy * sy < s[2] * s[2]){
+                        r = 130; g = 90; b = 35;
+                    }
+                }
+            } else {
+                int grain = ((x * 7 + y * 13) ^ (x * y)) & 15;
+                r = 95 + grain;
+                g = 70 + grain;
+                b = 50 + grain / 2;
+            }
+            if(bug){
+                double ddx = nx - bx, ddy = (ny - by) * h / w;
+                if(ddx * ddx + ddy * ddy < 0.012 * 0.012){
+                    r = 20; g = 15; b = 10;
+                }
+            }
+            row[x * 3 + 0] = (uint8_t)std::min(r, 255);
+            row[x * 3 + 1] = (uint8_t)std::min(g, 255);
+            row[x * 3 + 2] = (uint8_t)std::min(b, 255);
+        }
+    }
+}
+
+static void adjust_brightness(std::vector<uint8_t> &rgb, int offset, double gain){
+    for(auto &v : rgb){
+        int x = (int)(v * gain) + offset;
+        v = (uint8_t)(x < 0 ? 0 : x > 255 ? 255 : x);
+    }
+}
+
+static int quality_to_libjpeg(int q){
+    int lq = 100 - (q * 14) / 10;
+    return lq < 5 ? 5 : lq > 95 ? 95 : lq;
+}
+
+static bool pack_frame(const std::vector<uint8_t> &rgb, const frame_geom_t &g, std::vector<uint8_t> &out){
+    size_t n = (size_t)g.width * g.height;
+    switch(g.format){
+        case PIXFORMAT_JPEG:
+            return shim_jpeg_encode(rgb.data(), g.width, g.height, 3, quality_to_libjpeg(g.quality), out);
+        case PIXFORMAT_GRAYSCALE:
+            out.resize(n);
+            for(size_t i = 0; i < n; i++){
+                const uint8_t *p = &rgb[i * 3];
+                out[i] = (uint8_t)((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+            }
+            return true;
+        case PIXFORMAT_RGB565:
+            out.resize(n * 2);
+            for(size_t i = 0; i < n; i++){
+                const uint8_t *p = &rgb[i * 3];
+                uint16_t v = ((p[0] & 0xF8) << 8) | ((p[1] & 0xFC) << 3) | (p[2] >> 3);
+                out[i * 2] = v >> 8;
+                out[i * 2 + 1] = v & 0xFF;
+            }
+            return true;
+        case PIXFORMAT_RGB888:
+            out.resize(n * 3);
+            for(size_t i = 0; i < n; i++){
+                out[i * 3 + 0] = rgb[i * 3 + 2];
+                out[i * 3 + 1] = rgb[i * 3 + 1];
+                out[i * 3 + 2] = rgb[i * 3 + 0];
+            }
+            return true;
+        case PIXFORMAT_YUV422:
+            out.resize(n * 2);
+            for(size_t i = 0; i + 1 < n; i += 2){
+                const uint8_t *a = &rgb[i * 3], *b = &rgb[(i + 1) * 3];
+                int y0 = (a[0] * 77 + a[1] * 150 + a[2] * 29) >> 8;
+                int y1 = (b[0] * 77 + b[1] * 150 + b[2] * 29) >> 8;
+                int u = ((-43 * a[0] - 85 * a[1] + 128 * a[2]) >> 8) + 128;
+                int v = ((128 * a[0] - 107 * a[1] - 21 * a[2]) >> 8) + 128;
+                out[i * 2 + 0] = y0; out[i * 2 + 1] = u;
+                out[i * 2 + 2] = y1; out[i * 2 + 3] = v;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void render_frame(const frame_geom_t &g, uint64_t seq, bool settling, std::vector<uint8_t> &out){
+    int offset = g.brightness * 12;
+    if(!sources.empty()){
+        int idx = (int)(seq % sources.size());
+        if(!settling && g.format == PIXFORMAT_JPEG){
+            auto key = std::make_tuple(scale_key(idx, g), g.quality, g.brightness, (int)g.format);
+            auto it = jpeg_cache.find(key);
+            if(it == jpeg_cache.end()){
+                std::vector<uint8_t> rgb = scaled_source(idx, g);
+                if(offset){
+                    adjust_brightness(rgb, offset, 1.0);
+                }
+                std::vector<uint8_t> jpg;
+                pack_frame(rgb, g, jpg);
+                it = jpeg_cache.emplace(key, std::move(jpg)).first;
+            }
+            out = it->second;
+            return;
+        }
+        std::vector<uint8_t> rgb = scaled_source(idx, g);
+        if(offset || settling){
+            adjust_brightness(rgb, offset, settling ? 0.35 : 1.0);
+        }
+        pack_frame(rgb, g, out);
+        return;
+    }
+    // The scene covers the readout; the window is cut out of it
+    int fw = std::max(g.width, (int)((int64_t)g.width * g.win.readout_w / g.win.w));
+    int fh = std::max(g.height, (int)((int64_t)g.height * g.win.readout_h / g.win.h));
+    int fx = std::min(fw - g.width, (int)((int64_t)g.win.x * fw / g.win.readout_w));
+    int fy = std::min(fh - g.height, (int)((int64_t)g.win.y * fh / g.win.readout_h));
+    std::vector<uint8_t> scene, rgb((size_t)g.width * g.height * 3);
+    render_synthetic(scene, fw, fh, esp_timer_get_time() / 1e6);
+    for(int y = 0; y < g.height; y++){
+        memcpy(&rgb[(size_t)y * g.width * 3], &scene[((size_t)(fy + y) * fw + fx) * 3], (size_t)g.width * 3);
+    }
+    if(offset || settling){
+        adjust_brightness(rgb, offset, settling ? 0.35 : 1.0);
+    }
+    pack_frame(rgb, g, out);
+}
+
+// Register file
+
+static int reg_read(int reg){
+    return cam_regs[(reg >> 8) & 1][reg & 0xFF];
+}
+
+static void reg_write(int reg, int value){
+    uint32_t cost = plant_shim_config()->sccb_write_us;
+    if(cost){
+        usleep(cost);
+    }
+    std::lock_guard<std::mutex> lk(cam_lock);
+    cam_regs[(reg >> 8) & 1][reg & 0xFF] = (uint8_t)value;
+}
+
+static frame_geom_t snapshot_geometry(void){
+    std::lock_guard<std::mutex> lk(cam_lock);
+    frame_geom_t g;
+    int zmhh = cam_regs[0][DSP_ZMHH];
+    g.width = (((zmhh & 0x03) << 8) | cam_regs[0][DSP_ZMOW]) * 4;
+    g.height = ((((zmhh >> 2) & 0x01) << 8) | cam_regs[0][DSP_ZMOH]) * 4;
+    g.com7 = cam_regs[1][0x12] & 0x70;
+    g.format = cam_sensor.pixformat;
+    g.quality = cam_regs[0][DSP_QS];
+    g.brightness = cam_sensor.status.brightness;
+
+    // Readout in HSIZE8/VSIZE8 [10:3] and SIZEL; window size in 4 pixel units
+    // with VHYX/TEST holding the high bits, offsets in pixels
+    const uint8_t *dsp = cam_regs[0];
+    int vhyx = dsp[DSP_VHYX];
+    g.win.readout_w = (dsp[DSP_HSIZE8] << 3) | ((dsp[DSP_SIZEL] >> 3) & 0x07);
+    g.win.readout_h = (dsp[DSP_VSIZE8] << 3) | (dsp[DSP_SIZEL] & 0x07);
+    g.win.w = (((dsp[DSP_TEST] >> 7) << 9) | (((vhyx >> 3) & 0x01) << 8) | dsp[DSP_HSIZE]) * 4;
+    g.win.h = (((vhyx >> 7) << 8) | dsp[DSP_VSIZE]) * 4;
+    g.win.x = ((vhyx & 0x07) << 8) | dsp[DSP_XOFFL];
+    g.win.y = (((vhyx >> 4) & 0x07) << 8) | dsp[DSP_YOFFL];
+    if(g.win.readout_w <= 0 || g.win.readout_h <= 0 || g.win.w <= 0 || g.win.h <= 0){
+        g.win.readout_w = g.win.w = 1;
+        g.win.readout_h = g.win.h = 1;
+        g.win.x = g.win.y = 0;
+    }
+    return g;
+}
+
+static int readout_com7(int w, int h){
+    return (w <= 400 && h <= 296) ? COM7_CIF : (w <= 800 && h <= 600) ? COM7_SVGA : COM7_UXGA;
+}
+
+// Window the driver's set_framesize programs: the aspect ratio's window on
+// UXGA, scaled to the readout mode
+static sensor_window_t driver_window(framesize_t fs){
+    int w = resolution[fs].width, h = resolution[fs].height;
+    const ratio_settings_t &r = ratio_table[resolution[fs].aspect_ratio];
+    int com7 = readout_com7(w, h);
+    int div = com7 == COM7_CIF ? 4 : com7 == COM7_SVGA ? 2 : 1;
+    sensor_window_t win;
+    win.readout_w = 1600 / div;
+    win.readout_h = com7 == COM7_CIF ? 296 : 1200 / div;
+    win.x = r.offset_x / div;
+    win.y = r.offset_y / div;
+    win.w = r.max_x / div;
+    win.h = std::min(r.max_y / div, com7 == COM7_CIF ? 296 : r.max_y);
+    // Window size goes out in 4 pixel units
+    win.w &= ~3;
+    win.h &= ~3;
+    return win;
+}
+
+// Compares the window the registers hold with what the driver programs for
+// the output size, so a framesize change that leaves another aspect ratio's
+// window behind is reported; warns once per output size and window
+static void check_window(const frame_geom_t &g){
+    static std::set<scale_key_t> reported;
+    for(int fs = 0; fs < FRAMESIZE_INVALID; fs++){
+        if(resolution[fs].width != g.width || resolution[fs].height != g.height ||
+           readout_com7(g.width, g.height) != g.com7){
+            continue;
+        }
+        sensor_window_t want = driver_window((framesize_t)fs);
+        const sensor_window_t &have = g.win;
+        if(want.readout_w == have.readout_w && want.readout_h == have.readout_h && want.x == have.x &&
+           want.y == have.y && want.w == have.w && want.h == have.h){
+            return;
+        }
+        if(reported.insert(scale_key(0, g)).second){
+            ESP_LOGW(TAG, "%dx%d: window %dx%d+%d+%d of %dx%d, driver sets %dx%d+%d+%d of %dx%d",
+                     g.width, g.height, have.w, have.h, have.x, have.y, have.readout_w, have.readout_h,
+                     want.w, want.h, want.x, want.y, want.readout_w, want.readout_h);
+        }
+        return;
+    }
+}
+
+// Mode tables: register count matches what the driver writes per mode switch
+static void write_mode_table(int com7){
+    static const uint16_t sensor_regs[] = {
+        0x03, 0x06, 0x0D, 0x0E, 0x17, 0x18, 0x19, 0x1A, 0x22, 0x32, 0x34, 0x35, 0x37,
+        0x39, 0x3D, 0x42, 0x46, 0x47, 0x48, 0x4C, 0x4F, 0x50, 0x5A, 0x6D, 0x71, 0x72,
+    };
+    static const uint16_t dsp_regs[] = {
+        0x2C, 0x33, 0x3C, 0x7C, 0x7D, 0x90, 0x91, 0xC2, 0xC3, 0xDA, 0xE5, 0xF0,
+    };
+    int salt = com7 == COM7_UXGA ? 0x11 : com7 == COM7_SVGA ? 0x22 : 0x33;
+    reg_write(REG_COM7, com7);
+    reg_write(REG_CLKRC, com7 == COM7_UXGA ? 0x80 : 0x81);
+    for(uint16_t r : sensor_regs){
+        reg_write(BANK_SENSOR | r, (r * 7 + salt) & 0xFF);
+    }
+    for(uint16_t r : dsp_regs){
+        reg_write(r, (r * 5 + salt) & 0xFF);
+    }
+}
+
+// Readout size from the mode, window in 4 pixel units with offsets in pixels (set_window)
+static void write_window(const sensor_window_t &win, int w, int h, int com7){
+    int ww = win.w >> 2, wh = win.h >> 2;
+    reg_write(DSP_RESET, 0x04);
+    reg_write(DSP_HSIZE8, win.readout_w >> 3);
+    reg_write(DSP_VSIZE8, win.readout_h >> 3);
+    reg_write(DSP_SIZEL, ((win.readout_w & 7) << 3) | (win.readout_h & 7));
+    reg_write(DSP_CTRL2, 0x3D);
+    reg_write(DSP_CTRLI, 0x80);
+    reg_write(DSP_HSIZE, ww & 0xFF);
+    reg_write(DSP_VSIZE, wh & 0xFF);
+    reg_write(DSP_XOFFL, win.x & 0xFF);
+    reg_write(DSP_YOFFL, win.y & 0xFF);
+    reg_write(DSP_VHYX, ((wh >> 1) & 0x80) | ((win.y >> 4) & 0x70) | ((ww >> 5) & 0x08) | ((win.x >> 8) & 0x07));
+    reg_write(DSP_TEST, (ww >> 2) & 0x80);
+    reg_write(DSP_ZMOW, (w >> 2) & 0xFF);
+    reg_write(DSP_ZMOH, (h >> 2) & 0xFF);
+    reg_write(DSP_ZMHH, (((h >> 2) >> 8) << 2) | ((w >> 2) >> 8));
+    reg_write(DSP_R_DVP_SP, com7 == COM7_UXGA ? 0x04 : 0x02);
+    reg_write(DSP_RESET, 0x00);
+}
+
+// Sensor callbacks
+
+static int s_set_framesize(sensor_t *s, framesize_t fs){
+    if(fs >= FRAMESIZE_INVALID || resolution[fs].width > 1600 || resolution[fs].height > 1200){
+        return -1;
+    }
+    int com7 = readout_com7(resolution[fs].width, resolution[fs].height);
+    std::lock_guard<std::mutex> lk(sccb_lock);
+    write_mode_table(com7);
+    write_window(driver_window(fs), resolution[fs].width, resolution[fs].height, com7);
+    s->status.framesize = fs;
+    return 0;
+}
+
+static int s_set_quality(sensor_t *s, int q){
+    if(q < 0 || q > 63){
+        return -1;
+    }
+    std::lock_guard<std::mutex> lk(sccb_lock);
+    reg_write(DSP_QS, q);
+    s->status.quality = q;
+    return 0;
+}
+
+static int s_set_level(int8_t *field, int level, int bp_addr){
+    if(level < -2 || level > 2){
+        return -1;
+    }
+    std::lock_guard<std::mutex> lk(sccb_lock);
+    reg_write(DSP_BPADDR, bp_addr);
+    reg_write(DSP_BPDATA, (level + 2) * 0x10);
+    *field = level;
+    return 0;
+}
+
+static int s_set_contrast(sensor_t *s, int level){ return s_set_level(&s->status.contrast, level, 0x07); }
+static int s_set_brightness(sensor_t *s, int level){ return s_set_level(&s->status.brightness, level, 0x09); }
+static int s_set_saturation(sensor_t *s, int level){ return s_set_level(&s->status.saturation, level, 0x03); }
+static int s_set_ae_level(sensor_t *s, int level){ return s_set_level(&s->status.ae_level, level, 0x24); }
+
+static int s_set_flag(uint8_t *field, int value){
+    std::lock_guard<std::mutex> lk(sccb_lock);
+    reg_write(REG_REG04, value ? 0xC0 : 0x00);
+    *field = value ? 1 : 0;
+    return 0;
+}
+
+static int s_set_hmirror(sensor_t *s, int e){ return s_set_flag(&s->status.hmirror, e); }
+static int s_set_vflip(sensor_t *s, int e){ return s_set_flag(&s->status.vflip, e); }
+static int s_set_whitebal(sensor_t *s, int e){ return s_set_flag(&s->status.awb, e); }
+static int s_set_awb_gain(sensor_t *s, int e){ return s_set_flag(&s->status.awb_gain, e); }
+static int s_set_gain_ctrl(sensor_t *s, int e){ return s_set_flag(&s->status.agc, e); }
+static int s_set_exposure_ctrl(sensor_t *s, int e){ return s_set_flag(&s->status.aec, e); }
+static int s_set_aec2(sensor_t *s, int e){ return s_set_flag(&s->status.aec2, e); }
+static int s_set_dcw(sensor_t *s, int e){ return s_set_flag(&s->status.dcw, e); }
+static int s_set_bpc(sensor_t *s, int e){ return s_set_flag(&s->status.bpc, e); }
+static int s_set_wpc(sensor_t *s, int e){ return s_set_flag(&s->status.wpc, e); }
+static int s_set_raw_gma(sensor_t *s, int e){ return s_set_flag(&s->status.raw_gma, e); }
+static int s_set_lenc(sensor_t *s, int e){ return s_set_flag(&s->status.lenc, e); }
+static int s_set_colorbar(sensor_t *s, int e){ return s_set_flag(&s->status.colorbar, e); }
+
+static int s_set_sharpness(sensor_t *s, int level){ s->status.sharpness = level; return 0; }
+static int s_set_denoise(sensor_t *s, int level){ s->status.denoise = level; return 0; }
+static int s_set_gainceiling(sensor_t *s, gainceiling_t g){ s->status.gainceiling = g; return 0; }
+static int s_set_agc_gain(sensor_t *s, int g){ s->status.agc_gain = g; return 0; }
+static int s_set_aec_value(sensor_t *s, int v){ s->status.aec_value = v; return 0; }
+static int s_set_special_effect(sensor_t *s, int e){ s->status.special_effect = e; return 0; }
+static int s_set_wb_mode(sensor_t *s, int m){ s->status.wb_mode = m; return 0; }
+
+static int s_set_pixformat(sensor_t *s, pixformat_t f){
+    if(f != PIXFORMAT_JPEG && f != PIXFORMAT_RGB565 && f != PIXFORMAT_GRAYSCALE &&
+       f != PIXFORMAT_YUV422 && f != PIXFORMAT_RGB888){
+        return -1;
+    }
+    std::lock_guard<std::mutex> lk(cam_lock);
+    s->pixformat = f;
+    return 0;
+}
+
+static int s_get_reg(sensor_t *s, int reg, int mask){
+    (void)s;
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if(mask > 0xFF){
+        return ((reg_read(reg) << 8) | reg_read(reg + 1)) & mask;
+    }
+    return reg_read(reg) & mask;
+}
+
+static int s_set_reg(sensor_t *s, int reg, int mask, int value){
+    (void)s;
+    std::lock_guard<std::mutex> lk(sccb_lock);
+    int old;
+    {
+        std::lock_guard<std::mutex> lk2(cam_lock);
+        old = reg_read(reg);
+    }
+    reg_write(reg, (old & ~mask) | (value & mask));
+    return 0;
+}
+
+static int s_set_res_raw(sensor_t *s, int startX, int startY, int endX, int endY, int offsetX, int offsetY,
+                         int totalX, int totalY, int outputX, int outputY, bool scale, bool binning){
+    (void)startX; (void)startY; (void)endX; (void)endY; (void)scale; (void)binning; (void)s;
+    std::lock_guard<std::mutex> lk(sccb_lock);
+    int com7 = reg_read(REG_COM7) & 0x70;
+    sensor_window_t win;
+    win.readout_w = com7 == COM7_UXGA ? 1600 : com7 == COM7_SVGA ? 800 : 400;
+    win.readout_h = com7 == COM7_UXGA ? 1200 : com7 == COM7_SVGA ? 600 : 296;
+    win.x = offsetX;
+    win.y = offsetY;
+    win.w = totalX & ~3;
+    win.h = totalY & ~3;
+    write_window(win, outputX, outputY, com7);
+    return 0;
+}
+
+static int s_set_pll(sensor_t *s, int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk){
+    (void)s; (void)bypass; (void)mul; (void)sys; (void)root; (void)pre; (void)seld5; (void)pclken; (void)pclk;
+    return 0;
+}
+
+static int s_set_xclk(sensor_t *s, int timer, int xclk){
+    (void)timer;
+    s->xclk_freq_hz = xclk * 1000000;
+    return 0;
+}
+
+static int s_init_status(sensor_t *s){
+    (void)s;
+    return 0;
+}
+
+static int s_reset(sensor_t *s){
+    std::lock_guard<std::mutex> lk(cam_lock);
+    memset(cam_regs, 0, sizeof(cam_regs));
+    memset(&s->status, 0, sizeof(s->status));
+    s->status.awb = s->status.awb_gain = s->status.aec = s->status.agc = 1;
+    s->status.bpc = 0;
+    s->status.wpc = s->status.raw_gma = s->status.lenc = s->status.dcw = 1;
+    return 0;
+}
+
+static void sensor_setup(void){
+    memset(&cam_sensor, 0, sizeof(cam_sensor));
+    cam_sensor.id.MIDH = 0x7F;
+    cam_sensor.id.MIDL = 0xA2;
+    cam_sensor.id.PID = OV2640_PID;
+    cam_sensor.id.VER = 0x42;
+    cam_sensor.slv_addr = 0x30;
+    cam_sensor.init_status = s_init_status;
+    cam_sensor.reset = s_reset;
+    cam_sensor.set_pixformat = s_set_pixformat;
+    cam_sensor.set_framesize = s_set_framesize;
+    cam_sensor.set_contrast = s_set_contrast;
+    cam_sensor.set_brightness = s_set_brightness;
+    cam_sensor.set_saturation = s_set_saturation;
+    cam_sensor.set_sharpness = s_set_sharpness;
+    cam_sensor.set_denoise = s_set_denoise;
+    cam_sensor.set_gainceiling = s_set_gainceiling;
+    cam_sensor.set_quality = s_set_quality;
+    cam_sensor.set_colorbar = s_set_colorbar;
+    cam_sensor.set_whitebal = s_set_whitebal;
+    cam_sensor.set_gain_ctrl = s_set_gain_ctrl;
+    cam_sensor.set_exposure_ctrl = s_set_exposure_ctrl;
+    cam_sensor.set_hmirror = s_set_hmirror;
+    cam_sensor.set_vflip = s_set_vflip;
+    cam_sensor.set_aec2 = s_set_aec2;
+    cam_sensor.set_awb_gain = s_set_awb_gain;
+    cam_sensor.set_agc_gain = s_set_agc_gain;
+    cam_sensor.set_aec_value = s_set_aec_value;
+    cam_sensor.set_special_effect = s_set_special_effect;
+    cam_sensor.set_wb_mode = s_set_wb_mode;
+    cam_sensor.set_ae_level = s_set_ae_level;
+    cam_sensor.set_dcw = s_set_dcw;
+    cam_sensor.set_bpc = s_set_bpc;
+    cam_sensor.set_wpc = s_set_wpc;
+    cam_sensor.set_raw_gma = s_set_raw_gma;
+    cam_sensor.set_lenc = s_set_lenc;
+    cam_sensor.get_reg = s_get_reg;
+    cam_sensor.set_reg = s_set_reg;
+    cam_sensor.set_res_raw = s_set_res_raw;
+    cam_sensor.set_pll = s_set_pll;
+    cam_sensor.set_xclk = s_set_xclk;
+}
+
+// Frame producer, stands in for the DMA/VSYNC interrupt path
+
+static void deliver(const frame_geom_t &g, const std::vector<uint8_t> &data){
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if(cam_config.grab_mode == CAMERA_GRAB_LATEST){
+        while(!cam_ready.empty()){
+            cam_slots[cam_ready.front()].state = SLOT_FREE;
+            cam_ready.pop_front();
+            cam_dropped++;
+        }
+    }
+    int slot = -1;
+    for(size_t i = 0; i < cam_slots.size(); i++){
+        if(cam_slots[i].state == SLOT_FREE){
+            slot = (int)i;
+            break;
+        }
+    }
+    if(slot < 0){
+        cam_dropped++;
+        return;
+    }
+    shim_slot_t &s = cam_slots[slot];
+    if(data.size() > s.cap){
+        ESP_LOGW(TAG, "FB-OVF");
+        cam_dropped++;
+        return;
+    }
+    memcpy(s.fb.buf, data.data(), data.size());
+    s.fb.len = data.size();
+    s.fb.width = g.width;
+    s.fb.height = g.height;
+    s.fb.format = g.format;
+    int64_t us = esp_timer_get_time();
+    s.fb.timestamp.tv_sec = us / 1000000;
+    s.fb.timestamp.tv_usec = us % 1000000;
+    s.state = SLOT_READY;
+    cam_ready.push_back(slot);
+    cam_ready_cv.notify_one();
+}
+
+static void producer_task(void){
+    pthread_setname_np(pthread_self(), "cam_task");
+    uint64_t seq = 0;
+    int last_com7 = -1;
+    scale_key_t checked;
+    int64_t next = esp_timer_get_time();
+    std::vector<uint8_t> data;
+    while(!cam_stop.load()){
+        frame_geom_t g = snapshot_geometry();
+        bool settling = last_com7 >= 0 && g.com7 != last_com7;
+        last_com7 = g.com7;
+        // Window and output size, with the readout mode in the source slot
+        if(scale_key(g.com7, g) != checked){
+            // Checked between register writes, not halfway through a change
+            std::lock_guard<std::mutex> lk(sccb_lock);
+            frame_geom_t settled = snapshot_geometry();
+            checked = scale_key(settled.com7, settled);
+            check_window(settled);
+        }
+
+        float fps = plant_shim_config()->fps;
+        if(g.com7 == COM7_UXGA){
+            fps *= 0.5f;
+        }
+        next += (int64_t)(1e6 / (fps > 0.1f ? fps : 0.1f));
+        int64_t wait = next - esp_timer_get_time();
+        if(wait > 0){
+            usleep(wait);
+        } else if(wait < -1000000){
+            next = esp_timer_get_time();
+        }
+        if(cam_stop.load()){
+            break;
+        }
+        if(g.width <= 0 || g.height <= 0){
+            continue;
+        }
+        render_frame(g, seq++, settling, data);
+        deliver(g, data);
+    }
+}
+
+// Driver API
+
+esp_err_t esp_camera_init(const camera_config_t *config){
+    if(cam_inited){
+        return ESP_ERR_INVALID_STATE;
+    }
+    cam_config = *config;
+    if(cam_config.grab_mode != CAMERA_GRAB_LATEST){
+        cam_config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+    }
+    if(cam_config.fb_location != CAMERA_FB_IN_DRAM){
+        cam_config.fb_location = CAMERA_FB_IN_PSRAM;
+    }
+    if(cam_config.fb_count < 1){
+        cam_config.fb_count = 1;
+    }
+    if(cam_config.fb_location == CAMERA_FB_IN_PSRAM && !plant_shim_config()->psram){
+        ESP_LOGE(TAG, "PSRAM not found");
+        return ESP_ERR_NO_MEM;
+    }
+    if(cam_config.frame_size >= FRAMESIZE_INVALID || resolution[cam_config.frame_size].width > 1600){
+        return ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE;
+    }
+
+    // Sensor probe and reset take a while on the real part
+    usleep(120000);
+    if(sources.empty()){
+        load_sources();
+    }
+    sensor_setup();
+    s_reset(&cam_sensor);
+    cam_sensor.xclk_freq_hz = config->xclk_freq_hz;
+    if(s_set_pixformat(&cam_sensor, config->pixel_format) != 0){
+        return ESP_ERR_CAMERA_FAILED_TO_SET_OUT_FORMAT;
+    }
+    s_set_framesize(&cam_sensor, cam_config.frame_size);
+    s_set_quality(&cam_sensor, cam_config.jpeg_quality);
+
+    size_t w = resolution[cam_config.frame_size].width, h = resolution[cam_config.frame_size].height;
+    size_t cap;
+    switch(cam_config.pixel_format){
+        case PIXFORMAT_JPEG: cap = w * h / 5; break;
+        case PIXFORMAT_GRAYSCALE: cap = w * h; break;
+        case PIXFORMAT_RGB888: cap = w * h * 3; break;
+        default: cap = w * h * 2; break;
+    }
+    uint32_t caps = cam_config.fb_location == CAMERA_FB_IN_PSRAM ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    cam_slots.assign(cam_config.fb_count, shim_slot_t());
+    for(auto &s : cam_slots){
+        s.fb.buf = (uint8_t *)heap_caps_malloc(cap, caps);
+        s.cap = cap;
+        s.state = SLOT_FREE;
+        if(!s.fb.buf){
+            ESP_LOGE(TAG, "Allocating %u KB frame buffer failed", (unsigned)(cap / 1024));
+            for(auto &f : cam_slots){
+                heap_caps_free(f.fb.buf);
+            }
+            cam_slots.clear();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    cam_ready.clear();
+    cam_stop = false;
+    cam_task = std::thread(producer_task);
+    cam_inited = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit(void){
+    if(!cam_inited){
+        return ESP_ERR_INVALID_STATE;
+    }
+    cam_stop = true;
+    if(cam_task.joinable()){
+        cam_task.join();
+    }
+    std::lock_guard<std::mutex> lk(cam_lock);
+    for(auto &s : cam_slots){
+        heap_caps_free(s.fb.buf);
+    }
+    cam_slots.clear();
+    cam_ready.clear();
+    cam_inited = false;
+    cam_ready_cv.notify_all();
+    return ESP_OK;
+}
+
+camera_fb_t *esp_camera_fb_get(void){
+    std::unique_lock<std::mutex> lk(cam_lock);
+    if(!cam_inited){
+        return NULL;
+    }
+    if(!cam_ready_cv.wait_for(lk, std::chrono::milliseconds(4000), []{ return !cam_ready.empty() || !cam_inited; }) ||
+       cam_ready.empty()){
+        ESP_LOGW(TAG, "Failed to get the frame on time!");
+        return NULL;
+    }
+    int slot = cam_ready.front();
+    cam_ready.pop_front();
+    cam_slots[slot].state = SLOT_HELD;
+    return &cam_slots[slot].fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb){
+    if(!fb){
+        return;
+    }
+    std::lock_guard<std::mutex> lk(cam_lock);
+    for(auto &s : cam_slots){
+        if(&s.fb == fb){
+            s.state = SLOT_FREE;
+            return;
+        }
+    }
+}
+
+sensor_t *esp_camera_sensor_get(void){
+    return cam_inited ? &cam_sensor : NULL;
+}
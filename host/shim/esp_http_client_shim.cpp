@@ -0,0 +1,346 @@
+/*
+  Host shim - esp_http_client over POSIX sockets
+  perform() sends the request and reads the whole response (Content-Length,
+  chunked, or until close), dispatching events to the handler on the
+  caller's thread like the IDF client. The connection stays open for the
+  next request unless the server asked to close it. As on the board, a
+  connection the server dropped while idle is only noticed on the next
+  request, which fails; the one after that connects again.
+
+  The board has no network here: requests go to plant_shim_config()->upload_url
+  when one is set, in place of the sketch's URL, and otherwise fail to connect.
+*/
+
+#include "esp_http_client.h"
+#include "plant_shim.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct esp_http_client {
+    std::string url;
+    esp_http_client_method_t method;
+    int timeout_ms;
+    bool tcp_keepalive;
+    http_event_handle_cb handler;
+    void *user_data;
+    std::vector<std::pair<std::string, std::string>> headers;
+    const char *post_data = NULL;
+    int post_len = 0;
+
+    int fd = -1;
+    std::string fd_host, fd_port;   // What fd is connected to
+    std::string rx;                 // Received and not yet parsed
+    int status = 0;
+    int content_length = -1;
+};
+
+static const char *method_names[] = {"GET", "POST", "PUT", "PATCH", "DELETE", "HEAD"};
+
+static void dispatch(esp_http_client *c, esp_http_client_event_id_t id, const void *data, int len,
+                     const char *key = NULL, const char *value = NULL){
+    if(!c->handler){
+        return;
+    }
+    esp_http_client_event_t e;
+    memset(&e, 0, sizeof(e));
+    e.event_id = id;
+    e.client = c;
+    e.data = (void *)data;
+    e.data_len = len;
+    e.user_data = c->user_data;
+    e.header_key = (char *)key;
+    e.header_value = (char *)value;
+    c->handler(&e);
+}
+
+// Splits http://host[:port]/path
+static bool parse_url(const std::string &url, std::string *host, std::string *port, std::string *path){
+    if(url.compare(0, 7, "http://")){
+        return false;
+    }
+    size_t slash = url.find('/', 7);
+    std::string hp = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+    *path = slash == std::string::npos ? "/" : url.substr(slash);
+    size_t colon = hp.rfind(':');
+    *host = colon == std::string::npos ? hp : hp.substr(0, colon);
+    *port = colon == std::string::npos ? "80" : hp.substr(colon + 1);
+    return !host->empty();
+}
+
+static void drop_connection(esp_http_client *c){
+    if(c->fd >= 0){
+        close(c->fd);
+        c->fd = -1;
+        c->rx.clear();
+        dispatch(c, HTTP_EVENT_DISCONNECTED, NULL, 0);
+    }
+}
+
+static bool connect_to(esp_http_client *c, const std::string &host, const std::string &port){
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0){
+        return false;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if(fd >= 0){
+        struct timeval tv = {c->timeout_ms / 1000, (c->timeout_ms % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(c->tcp_keepalive){
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+        }
+        if(connect(fd, res->ai_addr, res->ai_addrlen) != 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if(fd < 0){
+        return false;
+    }
+    c->fd = fd;
+    c->fd_host = host;
+    c->fd_port = port;
+    c->rx.clear();
+    dispatch(c, HTTP_EVENT_ON_CONNECTED, NULL, 0);
+    return true;
+}
+
+static bool send_all(int fd, const char *p, size_t len){
+    while(len){
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads more into rx; false on timeout, error or close
+static bool fill(esp_http_client *c){
+    struct pollfd p = {c->fd, POLLIN, 0};
+    if(poll(&p, 1, c->timeout_ms) <= 0){
+        return false;
+    }
+    char buf[4096];
+    ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+    if(n <= 0){
+        return false;
+    }
+    c->rx.append(buf, n);
+    return true;
+}
+
+static bool read_line(esp_http_client *c, std::string *line){
+    size_t eol;
+    while((eol = c->rx.find("\r\n")) == std::string::npos){
+        if(!fill(c)){
+            return false;
+        }
+    }
+    *line = c->rx.substr(0, eol);
+    c->rx.erase(0, eol + 2);
+    return true;
+}
+
+// Hands len bytes of body to the handler; len < 0 reads until close
+static bool read_body(esp_http_client *c, long len){
+    while(len != 0){
+        if(c->rx.empty() && !fill(c)){
+            return len < 0;
+        }
+        size_t n = len < 0 ? c->rx.size() : std::min((size_t)len, c->rx.size());
+        dispatch(c, HTTP_EVENT_ON_DATA, c->rx.data(), (int)n);
+        c->rx.erase(0, n);
+        if(len > 0){
+            len -= n;
+        }
+    }
+    return true;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config){
+    esp_http_client *c = new esp_http_client();
+    c->url = config->url ? config->url : "";
+    c->method = config->method;
+    c->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : 5000;
+    c->tcp_keepalive = config->keep_alive_enable;
+    c->handler = config->event_handler;
+    c->user_data = config->user_data;
+    return c;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client){
+    esp_http_client_close(client);
+    delete client;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url){
+    client->url = url;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method){
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value){
+    for(auto &h : client->headers){
+        if(!strcasecmp(h.first.c_str(), key)){
+            h.second = value;
+            return ESP_OK;
+        }
+    }
+    client->headers.emplace_back(key, value);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len){
+    client->post_data = data;
+    client->post_len = data ? len : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t c){
+    std::string host, port, path;
+    if(!parse_url(c->url, &host, &port, &path)){
+        return ESP_ERR_HTTP_INVALID_TRANSPORT;
+    }
+    const char *url = plant_shim_config()->upload_url;
+    if(!url || !parse_url(url, &host, &port, &path)){
+        dispatch(c, HTTP_EVENT_ERROR, NULL, 0);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    if(c->fd >= 0 && (c->fd_host != host || c->fd_port != port)){
+        drop_connection(c);
+    }
+    if(c->fd < 0 && !connect_to(c, host, port)){
+        dispatch(c, HTTP_EVENT_ERROR, NULL, 0);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+
+    std::string req = std::string(method_names[c->method]) + " " + path + " HTTP/1.1\r\n";
+    req += "Host: " + host + ":" + port + "\r\n";
+    req += "User-Agent: ESP32 HTTP Client/1.0\r\n";
+    for(auto &hd : c->headers){
+        req += hd.first + ": " + hd.second + "\r\n";
+    }
+    if(c->post_data){
+        req += "Content-Length: " + std::to_string(c->post_len) + "\r\n";
+    }
+    req += "\r\n";
+    if(!send_all(c->fd, req.data(), req.size()) ||
+       (c->post_data && !send_all(c->fd, c->post_data, c->post_len))){
+        dispatch(c, HTTP_EVENT_ERROR, NULL, 0);
+        drop_connection(c);
+        return ESP_ERR_HTTP_WRITE_DATA;
+    }
+    dispatch(c, HTTP_EVENT_HEADERS_SENT, NULL, 0);
+
+    std::string line;
+    int major = 0, minor = 0;
+    if(!read_line(c, &line) || sscanf(line.c_str(), "HTTP/%d.%d %d", &major, &minor, &c->status) != 3){
+        dispatch(c, HTTP_EVENT_ERROR, NULL, 0);
+        drop_connection(c);
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    bool keep = minor >= 1, chunked = false;
+    c->content_length = -1;
+    for(;;){
+        if(!read_line(c, &line)){
+            dispatch(c, HTTP_EVENT_ERROR, NULL, 0);
+            drop_connection(c);
+            return ESP_ERR_HTTP_FETCH_HEADER;
+        }
+        if(line.empty()){
+            break;
+        }
+        size_t colon = line.find(':');
+        if(colon == std::string::npos){
+            continue;
+        }
+        std::string key = line.substr(0, colon);
+        size_t start = line.find_first_not_of(' ', colon + 1);
+        std::string value = start == std::string::npos ? "" : line.substr(start);
+        dispatch(c, HTTP_EVENT_ON_HEADER, NULL, 0, key.c_str(), value.c_str());
+        if(!strcasecmp(key.c_str(), "Content-Length")){
+            c->content_length = atoi(value.c_str());
+        } else if(!strcasecmp(key.c_str(), "Transfer-Encoding") && strcasestr(value.c_str(), "chunked")){
+            chunked = true;
+        } else if(!strcasecmp(key.c_str(), "Connection")){
+            keep = !strcasestr(value.c_str(), "close") && (minor >= 1 || strcasestr(value.c_str(), "keep-alive"));
+        }
+    }
+
+    bool ok = true;
+    if(c->method == HTTP_METHOD_HEAD || c->status == 204 || c->status == 304){
+        // No body
+    } else if(chunked){
+        for(;;){
+            long n;
+            if(!read_line(c, &line) || sscanf(line.c_str(), "%lx", &n) != 1 || n < 0){
+                ok = false;
+                break;
+            }
+            if(n == 0){
+                while(read_line(c, &line) && !line.empty()){}
+                break;
+            }
+            if(!read_body(c, n) || !read_line(c, &line)){
+                ok = false;
+                break;
+            }
+        }
+    } else if(c->content_length >= 0){
+        ok = read_body(c, c->content_length);
+    } else {
+        read_body(c, -1);
+        keep = false;
+    }
+    if(!ok){
+        dispatch(c, HTTP_EVENT_ERROR, NULL, 0);
+        drop_connection(c);
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    dispatch(c, HTTP_EVENT_ON_FINISH, NULL, 0);
+    if(!keep){
+        drop_connection(c);
+    }
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client){
+    return client->status;
+}
+
+int esp_http_client_get_content_length(esp_http_client_handle_t client){
+    return client->content_length;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client){
+    drop_connection(client);
+    return ESP_OK;
+}
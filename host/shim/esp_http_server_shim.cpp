@@ -0,0 +1,810 @@
+/*
+  Host shim - esp_http_server over POSIX sockets
+  Mirrors the IDF server: a single task per instance polls the listening
+  socket and all sessions, parses one request at a time and runs its handler
+  on that task. Persistent connections, chunked responses, the header/URI
+  size limits and the query helpers follow the IDF behaviour.
+  Detached servers (plant_shim_config()->httpd_detached) have no socket or
+  task; plant_httpd_dispatch() runs requests through them in-process.
+*/
+
+#include "esp_http_server.h"
+#include "plant_shim.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct shim_uri_handler {
+    std::string uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *r);
+    void *user_ctx;
+};
+
+struct shim_sess {
+    int fd;
+    std::string inbuf;
+    void *ctx;
+    httpd_free_ctx_fn_t free_ctx;
+    uint64_t lru;
+    bool close;
+    std::string *out;       // Response sink of a detached session, NULL on sockets
+};
+
+struct shim_server {
+    httpd_config_t config;
+    int listen_fd;
+    int ctrl[2];
+    std::thread task;
+    std::atomic<bool> stop;
+    std::vector<shim_uri_handler> handlers;
+    std::vector<shim_sess *> sessions;
+    uint64_t lru_counter;
+};
+
+struct shim_req_aux {
+    shim_server *sv;
+    shim_sess *sess;
+    std::vector<std::pair<std::string, std::string>> req_hdrs;
+    size_t remaining;
+    const char *status;
+    const char *content_type;
+    std::vector<std::pair<const char *, const char *>> resp_hdrs;
+    bool chunked;
+    bool version_10;
+    bool conn_close;
+};
+
+static shim_req_aux *req_aux(httpd_req_t *r){
+    return (shim_req_aux *)r->aux;
+}
+
+// Socket helpers
+
+static bool send_all(int fd, const struct iovec *iov, int cnt){
+    struct iovec v[8];
+    memcpy(v, iov, cnt * sizeof(*iov));
+    struct iovec *p = v;
+    while(cnt){
+        struct msghdr msg = {};
+        msg.msg_iov = p;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        while(cnt && (size_t)n >= p->iov_len){
+            n -= p->iov_len;
+            p++;
+            cnt--;
+        }
+        if(cnt){
+            p->iov_base = (char *)p->iov_base + n;
+            p->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static bool sess_send(shim_sess *s, const struct iovec *iov, int cnt){
+    if(s->out){
+        for(int i = 0; i < cnt; i++){
+            s->out->append((const char *)iov[i].iov_base, iov[i].iov_len);
+        }
+        return true;
+    }
+    return send_all(s->fd, iov, cnt);
+}
+
+static void sess_close(shim_server *sv, shim_sess *s){
+    if(s->free_ctx && s->ctx){
+        s->free_ctx(s->ctx);
+    } else if(s->ctx){
+        free(s->ctx);
+    }
+    if(s->fd < 0){
+        // Detached session, nothing to close
+    } else if(sv->config.close_fn){
+        sv->config.close_fn(sv, s->fd);
+    } else {
+        close(s->fd);
+    }
+    delete s;
+}
+
+// URI matching
+
+static bool uri_match_simple(const char *uri1, const char *uri2, size_t len2){
+    return strlen(uri1) == len2 && !strncmp(uri1, uri2, len2);
+}
+
+bool httpd_uri_match_wildcard(const char *tpl, const char *uri, size_t len){
+    const size_t tpl_len = strlen(tpl);
+    size_t exact_match_chars = tpl_len;
+
+    const char last = (char)(tpl_len > 0 ? tpl[tpl_len - 1] : 0);
+    const char prevlast = (char)(tpl_len > 1 ? tpl[tpl_len - 2] : 0);
+    const bool asterisk = last == '*' || (prevlast == '*' && last == '?');
+    const bool quest = last == '?' || (prevlast == '?' && last == '*');
+
+    if(exact_match_chars < (size_t)(asterisk + quest * 2)){
+        return false;
+    }
+    exact_match_chars -= asterisk + quest * 2;
+    if(len < exact_match_chars){
+        return false;
+    }
+    if(!quest){
+        if(!asterisk && len != exact_match_chars){
+            return false;
+        }
+        return strncmp(tpl, uri, exact_match_chars) == 0;
+    }
+    if(len > exact_match_chars && tpl[exact_match_chars] != uri[exact_match_chars]){
+        return false;
+    }
+    if(strncmp(tpl, uri, exact_match_chars) != 0){
+        return false;
+    }
+    return asterisk || len <= exact_match_chars + 1;
+}
+
+// Registration
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler){
+    shim_server *sv = (shim_server *)handle;
+    if(!sv || !uri_handler || !uri_handler->uri){
+        return ESP_ERR_INVALID_ARG;
+    }
+    for(const auto &h : sv->handlers){
+        if(h.method == uri_handler->method && h.uri == uri_handler->uri){
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    if(sv->handlers.size() >= sv->config.max_uri_handlers){
+        fprintf(stderr, "httpd: no slots left for registering handler %s\n", uri_handler->uri);
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    sv->handlers.push_back({uri_handler->uri, uri_handler->method, uri_handler->handler, uri_handler->user_ctx});
+    return ESP_OK;
+}
+
+esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle, const char *uri, httpd_method_t method){
+    shim_server *sv = (shim_server *)handle;
+    for(auto it = sv->handlers.begin(); it != sv->handlers.end(); ++it){
+        if(it->method == method && it->uri == uri){
+            sv->handlers.erase(it);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+void *httpd_get_global_user_ctx(httpd_handle_t handle){
+    return ((shim_server *)handle)->config.global_user_ctx;
+}
+
+// Request accessors
+
+static const char *query_start(httpd_req_t *r, size_t *len){
+    const char *q = strchr(r->uri, '?');
+    if(!q){
+        return NULL;
+    }
+    q++;
+    const char *end = strchr(q, '#');
+    *len = end ? (size_t)(end - q) : strlen(q);
+    return q;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r){
+    size_t len = 0;
+    return query_start(r, &len) ? len : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len){
+    if(!r || !buf){
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t len = 0;
+    const char *q = query_start(r, &len);
+    if(!q){
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t min_buf_len = len + 1;
+    size_t n = buf_len < min_buf_len ? buf_len : min_buf_len;
+    if(n){
+        memcpy(buf, q, n - 1);
+        buf[n - 1] = 0;
+    }
+    return buf_len < min_buf_len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char *qry_str, const char *key, char *val, size_t val_size){
+    if(qry_str == NULL || key == NULL || val == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char *qry_ptr = qry_str;
+    const size_t buf_len = val_size;
+
+    while(strlen(qry_ptr)){
+        const char *val_ptr = strchr(qry_ptr, '=');
+        if(!val_ptr){
+            break;
+        }
+        size_t offset = val_ptr - qry_ptr;
+        if((offset != strlen(key)) || strncasecmp(qry_ptr, key, offset)){
+            qry_ptr = strchr(val_ptr, '&');
+            if(!qry_ptr){
+                break;
+            }
+            qry_ptr++;
+            continue;
+        }
+        qry_ptr = strchr(++val_ptr, '&');
+        if(!qry_ptr){
+            qry_ptr = val_ptr + strlen(val_ptr);
+        }
+        val_size = qry_ptr - val_ptr + 1;
+        size_t n = val_size < buf_len ? val_size : buf_len;
+        if(n){
+            memcpy(val, val_ptr, n - 1);
+            val[n - 1] = 0;
+        }
+        if(buf_len < val_size){
+            return ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static const std::string *find_req_hdr(httpd_req_t *r, const char *field){
+    for(const auto &h : req_aux(r)->req_hdrs){
+        if(!strcasecmp(h.first.c_str(), field)){
+            return &h.second;
+        }
+    }
+    return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field){
+    const std::string *v = find_req_hdr(r, field);
+    return v ? v->size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size){
+    if(!r || !field || !val){
+        return ESP_ERR_INVALID_ARG;
+    }
+    const std::string *v = find_req_hdr(r, field);
+    if(!v){
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t n = v->size() + 1 < val_size ? v->size() + 1 : val_size;
+    if(n){
+        memcpy(val, v->data(), n - 1);
+        val[n - 1] = 0;
+    }
+    return val_size < v->size() + 1 ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len){
+    shim_req_aux *ra = req_aux(r);
+    if(!ra->remaining){
+        return 0;
+    }
+    if(buf_len > ra->remaining){
+        buf_len = ra->remaining;
+    }
+    std::string &in = ra->sess->inbuf;
+    if(!in.empty()){
+        size_t n = in.size() < buf_len ? in.size() : buf_len;
+        memcpy(buf, in.data(), n);
+        in.erase(0, n);
+        ra->remaining -= n;
+        return (int)n;
+    }
+    if(ra->sess->fd < 0){
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    ssize_t n;
+    do {
+        n = recv(ra->sess->fd, buf, buf_len, 0);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0){
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    ra->remaining -= n;
+    return (int)n;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r){
+    return r && r->aux ? req_aux(r)->sess->fd : -1;
+}
+
+// Responses
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status){
+    if(!r || !status){
+        return ESP_ERR_INVALID_ARG;
+    }
+    req_aux(r)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type){
+    if(!r || !type){
+        return ESP_ERR_INVALID_ARG;
+    }
+    req_aux(r)->content_type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value){
+    if(!r || !field || !value){
+        return ESP_ERR_INVALID_ARG;
+    }
+    shim_req_aux *ra = req_aux(r);
+    if(ra->resp_hdrs.size() >= ra->sv->config.max_resp_headers){
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    ra->resp_hdrs.emplace_back(field, value);
+    return ESP_OK;
+}
+
+static std::string build_head(shim_req_aux *ra, const char *length_line){
+    std::string h;
+    h.reserve(256);
+    h += "HTTP/1.1 ";
+    h += ra->status;
+    h += "\r\nContent-Type: ";
+    h += ra->content_type;
+    h += "\r\n";
+    h += length_line;
+    for(const auto &kv : ra->resp_hdrs){
+        h += kv.first;
+        h += ": ";
+        h += kv.second;
+        h += "\r\n";
+    }
+    h += "\r\n";
+    return h;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len){
+    if(!r){
+        return ESP_ERR_INVALID_ARG;
+    }
+    shim_req_aux *ra = req_aux(r);
+    if(buf_len == HTTPD_RESP_USE_STRLEN){
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    char cl[48];
+    snprintf(cl, sizeof(cl), "Content-Length: %d\r\n", (int)buf_len);
+    std::string head = build_head(ra, cl);
+    struct iovec iov[2] = {
+        { (void *)head.data(), head.size() },
+        { (void *)buf, buf ? (size_t)buf_len : 0 }
+    };
+    if(!sess_send(ra->sess, iov, 2)){
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len){
+    if(!r){
+        return ESP_ERR_INVALID_ARG;
+    }
+    shim_req_aux *ra = req_aux(r);
+    if(buf_len == HTTPD_RESP_USE_STRLEN){
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    std::string head;
+    if(!ra->chunked){
+        head = build_head(ra, "Transfer-Encoding: chunked\r\n");
+        ra->chunked = true;
+    }
+    char len_str[20];
+    snprintf(len_str, sizeof(len_str), "%lx\r\n", (long)buf_len);
+    struct iovec iov[4] = {
+        { (void *)head.data(), head.size() },
+        { len_str, strlen(len_str) },
+        { (void *)buf, buf ? (size_t)buf_len : 0 },
+        { (void *)"\r\n", 2 }
+    };
+    if(!sess_send(ra->sess, iov, 4)){
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *usr_msg){
+    const char *status;
+    const char *msg;
+    switch(error){
+        case HTTPD_501_METHOD_NOT_IMPLEMENTED: status = "501 Method Not Implemented"; msg = "Request method is not supported by server"; break;
+        case HTTPD_505_VERSION_NOT_SUPPORTED: status = "505 Version Not Supported"; msg = "HTTP version not supported by server"; break;
+        case HTTPD_400_BAD_REQUEST: status = "400 Bad Request"; msg = "Bad request syntax"; break;
+        case HTTPD_401_UNAUTHORIZED: status = "401 Unauthorized"; msg = "No permission -- see authorization schemes"; break;
+        case HTTPD_403_FORBIDDEN: status = "403 Forbidden"; msg = "Request forbidden -- authorization will not help"; break;
+        case HTTPD_404_NOT_FOUND: status = "404 Not Found"; msg = "Nothing matches the given URI"; break;
+        case HTTPD_405_METHOD_NOT_ALLOWED: status = "405 Method Not Allowed"; msg = "Specified method is invalid for this resource"; break;
+        case HTTPD_408_REQ_TIMEOUT: status = "408 Request Timeout"; msg = "Server closed this connection"; break;
+        case HTTPD_411_LENGTH_REQUIRED: status = "411 Length Required"; msg = "Client must specify Content-Length"; break;
+        case HTTPD_414_URI_TOO_LONG: status = "414 URI Too Long"; msg = "URI is too long"; break;
+        case HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE: status = "431 Request Header Fields Too Large"; msg = "Header fields are too long"; break;
+        default: status = "500 Internal Server Error"; msg = "Server has encountered an unexpected error"; break;
+    }
+    if(usr_msg){
+        msg = usr_msg;
+    }
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+    return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
+
+// Request processing
+
+static int parse_method(const char *m, size_t n){
+    static const struct { const char *name; int method; } methods[] = {
+        {"GET", HTTP_GET}, {"POST", HTTP_POST}, {"PUT", HTTP_PUT}, {"DELETE", HTTP_DELETE},
+        {"HEAD", HTTP_HEAD}, {"OPTIONS", HTTP_OPTIONS}, {"PATCH", HTTP_PATCH},
+    };
+    for(const auto &e : methods){
+        if(strlen(e.name) == n && !strncmp(m, e.name, n)){
+            return e.method;
+        }
+    }
+    return -1;
+}
+
+// Minimal request used to answer before a handler runs
+static void send_early_error(shim_server *sv, shim_sess *s, httpd_err_code_t code){
+    httpd_req_t req = {};
+    shim_req_aux aux = {};
+    aux.sv = sv;
+    aux.sess = s;
+    aux.status = HTTPD_200;
+    aux.content_type = HTTPD_TYPE_TEXT;
+    req.handle = sv;
+    req.aux = &aux;
+    httpd_resp_send_err(&req, code, NULL);
+}
+
+// Returns false when the session must be closed
+static bool process_request(shim_server *sv, shim_sess *s, size_t head_len){
+    const char *p = s->inbuf.data();
+    const char *end = p + head_len;
+
+    const char *line_end = (const char *)memmem(p, head_len, "\r\n", 2);
+    const char *sp1 = (const char *)memchr(p, ' ', line_end - p);
+    const char *sp2 = sp1 ? (const char *)memchr(sp1 + 1, ' ', line_end - sp1 - 1) : NULL;
+    if(!sp1 || !sp2 || strncmp(sp2 + 1, "HTTP/1.", 7)){
+        send_early_error(sv, s, HTTPD_400_BAD_REQUEST);
+        return false;
+    }
+    int method = parse_method(p, sp1 - p);
+    if(method < 0){
+        send_early_error(sv, s, HTTPD_501_METHOD_NOT_IMPLEMENTED);
+        return false;
+    }
+    size_t uri_len = sp2 - sp1 - 1;
+    if(uri_len > HTTPD_MAX_URI_LEN){
+        send_early_error(sv, s, HTTPD_414_URI_TOO_LONG);
+        return false;
+    }
+
+    httpd_req_t req = {};
+    shim_req_aux aux = {};
+    aux.sv = sv;
+    aux.sess = s;
+    aux.status = HTTPD_200;
+    aux.content_type = HTTPD_TYPE_TEXT;
+    aux.version_10 = sp2[8] == '0';
+    memcpy((char *)req.uri, sp1 + 1, uri_len);
+    ((char *)req.uri)[uri_len] = 0;
+
+    for(const char *l = line_end + 2; l < end - 2;){
+        const char *le = (const char *)memmem(l, end - l, "\r\n", 2);
+        const char *colon = (const char *)memchr(l, ':', le - l);
+        if(colon){
+            const char *v = colon + 1;
+            while(v < le && (*v == ' ' || *v == '\t')){
+                v++;
+            }
+            const char *ve = le;
+            while(ve > v && (ve[-1] == ' ' || ve[-1] == '\t')){
+                ve--;
+            }
+            aux.req_hdrs.emplace_back(std::string(l, colon - l), std::string(v, ve - v));
+        }
+        l = le + 2;
+    }
+    s->inbuf.erase(0, head_len);
+
+    req.handle = sv;
+    req.method = method;
+    req.aux = &aux;
+    req.sess_ctx = s->ctx;
+    req.free_ctx = s->free_ctx;
+    if(const std::string *cl = find_req_hdr(&req, "Content-Length")){
+        req.content_len = strtoul(cl->c_str(), NULL, 10);
+    }
+    aux.remaining = req.content_len;
+    if(const std::string *conn = find_req_hdr(&req, "Connection")){
+        aux.conn_close = !strcasecmp(conn->c_str(), "close");
+        if(aux.version_10 && !strcasecmp(conn->c_str(), "keep-alive")){
+            aux.version_10 = false;
+        }
+    }
+
+    size_t path_len = strcspn(req.uri, "?#");
+    const shim_uri_handler *match = NULL;
+    bool path_matched = false;
+    for(const auto &h : sv->handlers){
+        bool hit = sv->config.uri_match_fn
+            ? sv->config.uri_match_fn(h.uri.c_str(), req.uri, path_len)
+            : uri_match_simple(h.uri.c_str(), req.uri, path_len);
+        if(hit){
+            path_matched = true;
+            if(h.method == method){
+                match = &h;
+                break;
+            }
+        }
+    }
+
+    esp_err_t ret;
+    if(match){
+        req.user_ctx = match->user_ctx;
+        ret = match->handler(&req);
+    } else {
+        httpd_resp_send_err(&req, path_matched ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND, NULL);
+        ret = ESP_OK;
+    }
+
+    if(req.sess_ctx != s->ctx && s->ctx && !req.ignore_sess_ctx_changes){
+        if(s->free_ctx){
+            s->free_ctx(s->ctx);
+        } else {
+            free(s->ctx);
+        }
+    }
+    s->ctx = req.sess_ctx;
+    s->free_ctx = req.free_ctx;
+
+    if(ret != ESP_OK){
+        return false;
+    }
+
+    // Discard whatever body the handler did not read
+    char scratch[512];
+    while(aux.remaining){
+        int n = httpd_req_recv(&req, scratch, sizeof(scratch));
+        if(n <= 0){
+            return false;
+        }
+    }
+    return !aux.conn_close && !aux.version_10;
+}
+
+// Runs every complete request in inbuf; false when the session must be closed
+static bool sess_process(shim_server *sv, shim_sess *s){
+    for(;;){
+        size_t pos = s->inbuf.find("\r\n\r\n");
+        if(pos == std::string::npos){
+            if(s->inbuf.size() > HTTPD_MAX_REQ_HDR_LEN){
+                send_early_error(sv, s, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE);
+                return false;
+            }
+            return true;
+        }
+        if(pos + 4 > HTTPD_MAX_REQ_HDR_LEN){
+            send_early_error(sv, s, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE);
+            return false;
+        }
+        if(!process_request(sv, s, pos + 4)){
+            return false;
+        }
+    }
+}
+
+static bool sess_on_readable(shim_server *sv, shim_sess *s){
+    char buf[2048];
+    ssize_t n = recv(s->fd, buf, sizeof(buf), 0);
+    if(n <= 0){
+        return false;
+    }
+    s->inbuf.append(buf, n);
+    return sess_process(sv, s);
+}
+
+static void sess_accept(shim_server *sv){
+    int fd = accept(sv->listen_fd, NULL, NULL);
+    if(fd < 0){
+        return;
+    }
+    struct timeval rt = { sv->config.recv_wait_timeout, 0 };
+    struct timeval st = { sv->config.send_wait_timeout, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rt, sizeof(rt));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &st, sizeof(st));
+    if(sv->config.open_fn && sv->config.open_fn(sv, fd) != ESP_OK){
+        close(fd);
+        return;
+    }
+    shim_sess *s = new shim_sess();
+    s->fd = fd;
+    s->lru = ++sv->lru_counter;
+    sv->sessions.push_back(s);
+}
+
+static void server_task(shim_server *sv){
+    char name[16];
+    snprintf(name, sizeof(name), "httpd:%u", (unsigned)sv->config.server_port);
+    pthread_setname_np(pthread_self(), name);
+
+    std::vector<struct pollfd> fds;
+    while(!sv->stop.load()){
+        bool room = sv->sessions.size() < sv->config.max_open_sockets;
+        if(!room && sv->config.lru_purge_enable && !sv->sessions.empty()){
+            auto oldest = sv->sessions.begin();
+            for(auto it = sv->sessions.begin(); it != sv->sessions.end(); ++it){
+                if((*it)->lru < (*oldest)->lru){
+                    oldest = it;
+                }
+            }
+            sess_close(sv, *oldest);
+            sv->sessions.erase(oldest);
+            room = true;
+        }
+
+        fds.clear();
+        fds.push_back({ sv->ctrl[0], POLLIN, 0 });
+        fds.push_back({ room ? sv->listen_fd : -1, POLLIN, 0 });
+        for(shim_sess *s : sv->sessions){
+            fds.push_back({ s->fd, POLLIN, 0 });
+        }
+        if(poll(fds.data(), fds.size(), -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        if(fds[0].revents){
+            char c;
+            while(read(sv->ctrl[0], &c, 1) == 1){
+            }
+            continue;
+        }
+
+        // Sessions first, a new socket is picked up on the next pass
+        std::vector<shim_sess *> keep;
+        keep.reserve(sv->sessions.size());
+        for(size_t i = 0; i < sv->sessions.size(); i++){
+            shim_sess *s = sv->sessions[i];
+            if(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)){
+                s->lru = ++sv->lru_counter;
+                if(!sess_on_readable(sv, s)){
+                    sess_close(sv, s);
+                    continue;
+                }
+            }
+            keep.push_back(s);
+        }
+        sv->sessions.swap(keep);
+
+        if(fds[1].revents & POLLIN){
+            sess_accept(sv);
+        }
+    }
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config){
+    if(!handle || !config){
+        return ESP_ERR_INVALID_ARG;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    shim_server *sv = new shim_server();
+    sv->config = *config;
+    sv->stop = false;
+    sv->lru_counter = 0;
+    if(plant_shim_config()->httpd_detached){
+        sv->listen_fd = -1;
+        sv->ctrl[0] = sv->ctrl[1] = -1;
+        *handle = sv;
+        return ESP_OK;
+    }
+    uint16_t port = (uint16_t)(config->server_port + plant_shim_config()->port_offset);
+
+    sv->listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+    int off = 0, on = 1;
+    setsockopt(sv->listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(sv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if(sv->listen_fd < 0 ||
+       bind(sv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(sv->listen_fd, config->backlog_conn) < 0){
+        fprintf(stderr, "httpd: cannot listen on port %u: %s\n", port, strerror(errno));
+        if(sv->listen_fd >= 0){
+            close(sv->listen_fd);
+        }
+        delete sv;
+        return ESP_ERR_HTTPD_TASK;
+    }
+    if(pipe(sv->ctrl) < 0){
+        close(sv->listen_fd);
+        delete sv;
+        return ESP_ERR_HTTPD_TASK;
+    }
+    fcntl(sv->ctrl[0], F_SETFL, O_NONBLOCK);
+    sv->task = std::thread(server_task, sv);
+    *handle = sv;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle){
+    shim_server *sv = (shim_server *)handle;
+    if(!sv){
+        return ESP_ERR_INVALID_ARG;
+    }
+    sv->stop = true;
+    if(sv->ctrl[1] >= 0 && write(sv->ctrl[1], "x", 1) < 0){
+        // The task also notices stop on its next wakeup
+    }
+    if(sv->task.joinable()){
+        sv->task.join();
+    }
+    for(shim_sess *s : sv->sessions){
+        sess_close(sv, s);
+    }
+    if(sv->listen_fd >= 0){
+        close(sv->listen_fd);
+        close(sv->ctrl[0]);
+        close(sv->ctrl[1]);
+    }
+    if(sv->config.global_user_ctx_free_fn){
+        sv->config.global_user_ctx_free_fn(sv->config.global_user_ctx);
+    }
+    delete sv;
+    return ESP_OK;
+}
+
+bool plant_httpd_dispatch(httpd_handle_t handle, const char *data, size_t len, std::string *out){
+    shim_server *sv = (shim_server *)handle;
+    if(!sv || sv->listen_fd >= 0 || !out){
+        return false;
+    }
+    shim_sess *s = new shim_sess();
+    s->fd = -1;
+    s->out = out;
+    s->lru = ++sv->lru_counter;
+    s->inbuf.assign(data, len);
+    bool open = sess_process(sv, s);
+    sess_close(sv, s);
+    return open;
+}
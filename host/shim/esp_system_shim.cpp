@@ -0,0 +1,167 @@
+/*
+  Host shim - esp_timer, esp_log, esp_err and heap_caps
+*/
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "plant_shim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+static const auto boot_time = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time(void){
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - boot_time).count();
+}
+
+const char *esp_err_to_name(esp_err_t code){
+    switch(code){
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        default: return "ERROR";
+    }
+}
+
+// Logging
+
+static vprintf_like_t log_vprintf = vprintf;
+static esp_log_level_t log_level = ESP_LOG_INFO;
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func){
+    vprintf_like_t prev = log_vprintf;
+    log_vprintf = func;
+    return prev;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level){
+    (void)tag;
+    log_level = level;
+}
+
+uint32_t esp_log_timestamp(void){
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...){
+    (void)tag;
+    if(level > log_level){
+        return;
+    }
+    va_list ap;
+    va_start(ap, format);
+    log_vprintf(format, ap);
+    va_end(ap);
+}
+
+// Heap accounting, a size header precedes every block
+
+typedef struct {
+    size_t size;
+    uint32_t spiram;
+    uint32_t magic;
+} heap_hdr_t;
+
+#define HEAP_MAGIC 0x48454150u
+
+static std::atomic<size_t> used_internal(0);
+static std::atomic<size_t> used_spiram(0);
+static std::atomic<size_t> min_free_internal(SIZE_MAX);
+static std::atomic<size_t> min_free_spiram(SIZE_MAX);
+
+static size_t pool_total(bool spiram){
+    const plant_shim_config_t *cfg = plant_shim_config();
+    return spiram ? (cfg->psram ? cfg->psram_bytes : 0) : cfg->internal_heap_bytes;
+}
+
+static void track_low_water(bool spiram){
+    size_t free_now = pool_total(spiram) - (spiram ? used_spiram : used_internal).load();
+    std::atomic<size_t> &low = spiram ? min_free_spiram : min_free_internal;
+    size_t prev = low.load();
+    while(free_now < prev && !low.compare_exchange_weak(prev, free_now)){
+    }
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps){
+    bool spiram = (caps & MALLOC_CAP_SPIRAM) != 0;
+    std::atomic<size_t> &used = spiram ? used_spiram : used_internal;
+    if(used.load() + size > pool_total(spiram)){
+        return NULL;
+    }
+    heap_hdr_t *h = (heap_hdr_t *)malloc(sizeof(heap_hdr_t) + size);
+    if(!h){
+        return NULL;
+    }
+    h->size = size;
+    h->spiram = spiram;
+    h->magic = HEAP_MAGIC;
+    used += size;
+    track_low_water(spiram);
+    return h + 1;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps){
+    void *p = heap_caps_malloc(n * size, caps);
+    if(p){
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+void heap_caps_free(void *ptr){
+    if(!ptr){
+        return;
+    }
+    heap_hdr_t *h = (heap_hdr_t *)ptr - 1;
+    if(h->magic != HEAP_MAGIC){
+        abort();
+    }
+    (h->spiram ? used_spiram : used_internal) -= h->size;
+    h->magic = 0;
+    free(h);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps){
+    if(!ptr){
+        return heap_caps_malloc(size, caps);
+    }
+    heap_hdr_t *h = (heap_hdr_t *)ptr - 1;
+    void *n = heap_caps_malloc(size, caps);
+    if(!n){
+        return NULL;
+    }
+    memcpy(n, ptr, h->size < size ? h->size : size);
+    heap_caps_free(ptr);
+    return n;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps){
+    return pool_total((caps & MALLOC_CAP_SPIRAM) != 0);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps){
+    bool spiram = (caps & MALLOC_CAP_SPIRAM) != 0;
+    return pool_total(spiram) - (spiram ? used_spiram : used_internal).load();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps){
+    return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps){
+    bool spiram = (caps & MALLOC_CAP_SPIRAM) != 0;
+    size_t low = (spiram ? min_free_spiram : min_free_internal).load();
+    return low == SIZE_MAX ? pool_total(spiram) : low;
+}
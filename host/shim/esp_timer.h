@@ -0,0 +1,20 @@
+/*
+  Host shim - esp_timer.h
+  Microseconds since process start, like time since boot on the device.
+*/
+#ifndef HOST_SHIM_ESP_TIMER_H
+#define HOST_SHIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
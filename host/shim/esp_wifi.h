@@ -0,0 +1,7 @@
+/*
+  Host shim - esp_wifi.h
+*/
+#ifndef HOST_SHIM_ESP_WIFI_H
+#define HOST_SHIM_ESP_WIFI_H
+#include "esp_err.h"
+#endif
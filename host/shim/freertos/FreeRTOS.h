@@ -0,0 +1,28 @@
+/*
+  Host shim - freertos/FreeRTOS.h
+  Tasks map to detached std::threads, one tick is one millisecond.
+*/
+#ifndef HOST_SHIM_FREERTOS_H
+#define HOST_SHIM_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  1
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+#define pdFALSE  0
+#define pdTRUE   1
+#define pdPASS   pdTRUE
+#define pdFAIL   pdFALSE
+
+#define tskIDLE_PRIORITY  0
+#define tskNO_AFFINITY    0x7FFFFFFF
+
+#endif
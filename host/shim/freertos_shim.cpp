@@ -0,0 +1,244 @@
+/*
+  Host shim - FreeRTOS tasks, semaphores and queues on std::thread
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include <pthread.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct shim_task {
+    TaskFunction_t fn;
+    void *arg;
+    std::string name;
+    std::mutex lock;
+    std::condition_variable cv;
+    uint32_t notify = 0;
+};
+
+static thread_local shim_task *current_task = NULL;
+
+static std::chrono::steady_clock::time_point tick_origin = std::chrono::steady_clock::now();
+
+template<typename Pred>
+static bool wait_ticks(std::condition_variable &cv, std::unique_lock<std::mutex> &lk, TickType_t ticks, Pred pred){
+    if(ticks == portMAX_DELAY){
+        cv.wait(lk, pred);
+        return true;
+    }
+    return cv.wait_for(lk, std::chrono::milliseconds(ticks), pred);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core){
+    (void)stack_depth; (void)priority; (void)core;
+    shim_task *t = new shim_task();
+    t->fn = fn;
+    t->arg = arg;
+    t->name = name ? name : "task";
+    if(handle){
+        *handle = t;
+    }
+    std::thread th([t](){
+        current_task = t;
+        pthread_setname_np(pthread_self(), t->name.substr(0, 15).c_str());
+        t->fn(t->arg);
+    });
+    th.detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle){
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task){
+    // Only self-deletion can be emulated with threads
+    if(task == NULL || task == current_task){
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks){
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount(void){
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - tick_origin).count();
+}
+
+void vTaskDelayUntil(TickType_t *prev_wake, TickType_t increment){
+    *prev_wake += increment;
+    int32_t wait = (int32_t)(*prev_wake - xTaskGetTickCount());
+    if(wait > 0){
+        vTaskDelay(wait);
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void){
+    return current_task;
+}
+
+void xTaskNotifyGive(TaskHandle_t task){
+    if(!task){
+        return;
+    }
+    std::lock_guard<std::mutex> lk(task->lock);
+    task->notify++;
+    task->cv.notify_one();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks){
+    shim_task *t = current_task;
+    if(!t){
+        vTaskDelay(ticks == portMAX_DELAY ? 1 : ticks);
+        return 0;
+    }
+    std::unique_lock<std::mutex> lk(t->lock);
+    wait_ticks(t->cv, lk, ticks, [t]{ return t->notify > 0; });
+    uint32_t v = t->notify;
+    if(v){
+        t->notify = clear_on_exit ? 0 : v - 1;
+    }
+    return v;
+}
+
+// Semaphores
+
+struct shim_sem {
+    std::mutex lock;
+    std::condition_variable cv;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+static SemaphoreHandle_t sem_create(UBaseType_t max, UBaseType_t initial){
+    shim_sem *s = new shim_sem();
+    s->count = initial;
+    s->max = max;
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void){ return sem_create(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateBinary(void){ return sem_create(1, 0); }
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial){ return sem_create(max_count, initial); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks){
+    std::unique_lock<std::mutex> lk(s->lock);
+    if(!wait_ticks(s->cv, lk, ticks, [s]{ return s->count > 0; })){
+        return pdFALSE;
+    }
+    s->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s){
+    std::lock_guard<std::mutex> lk(s->lock);
+    if(s->count >= s->max){
+        return pdFALSE;
+    }
+    s->count++;
+    s->cv.notify_one();
+    return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s){
+    std::lock_guard<std::mutex> lk(s->lock);
+    return s->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s){
+    delete s;
+}
+
+// Queues
+
+struct shim_queue {
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size){
+    shim_queue *q = new shim_queue();
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+static BaseType_t queue_put(QueueHandle_t q, const void *item, TickType_t ticks, bool front){
+    std::unique_lock<std::mutex> lk(q->lock);
+    if(!wait_ticks(q->not_full, lk, ticks, [q]{ return q->items.size() < q->length; })){
+        return pdFALSE;
+    }
+    std::vector<uint8_t> v((const uint8_t *)item, (const uint8_t *)item + q->item_size);
+    if(front){
+        q->items.push_front(std::move(v));
+    } else {
+        q->items.push_back(std::move(v));
+    }
+    q->not_empty.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks){ return queue_put(q, item, ticks, false); }
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks){ return queue_put(q, item, ticks, true); }
+
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void *item){
+    std::lock_guard<std::mutex> lk(q->lock);
+    q->items.clear();
+    q->items.emplace_back((const uint8_t *)item, (const uint8_t *)item + q->item_size);
+    q->not_empty.notify_one();
+    return pdTRUE;
+}
+
+static BaseType_t queue_get(QueueHandle_t q, void *item, TickType_t ticks, bool remove){
+    std::unique_lock<std::mutex> lk(q->lock);
+    if(!wait_ticks(q->not_empty, lk, ticks, [q]{ return !q->items.empty(); })){
+        return pdFALSE;
+    }
+    memcpy(item, q->items.front().data(), q->item_size);
+    if(remove){
+        q->items.pop_front();
+        q->not_full.notify_one();
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks){ return queue_get(q, item, ticks, true); }
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks){ return queue_get(q, item, ticks, false); }
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q){
+    std::lock_guard<std::mutex> lk(q->lock);
+    return q->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q){
+    std::lock_guard<std::mutex> lk(q->lock);
+    return q->length - q->items.size();
+}
+
+BaseType_t xQueueReset(QueueHandle_t q){
+    std::lock_guard<std::mutex> lk(q->lock);
+    q->items.clear();
+    q->not_full.notify_all();
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t q){
+    delete q;
+}
@@ -0,0 +1,145 @@
+/*
+  Host shim - img_converters from esp32-camera
+*/
+
+#include "img_converters.h"
+#include "shim_jpeg.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Any supported raw format to packed R, G, B for the encoder
+static bool to_rgb(const uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format,
+                   std::vector<uint8_t> &rgb){
+    size_t n = (size_t)width * height;
+    rgb.resize(n * 3);
+    switch(format){
+        case PIXFORMAT_GRAYSCALE:
+            if(src_len < n) return false;
+            for(size_t i = 0; i < n; i++){
+                rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = src[i];
+            }
+            return true;
+        case PIXFORMAT_RGB565:
+            if(src_len < n * 2) return false;
+            for(size_t i = 0; i < n; i++){
+                uint16_t v = (src[i * 2] << 8) | src[i * 2 + 1];
+                rgb[i * 3 + 0] = (v >> 8) & 0xF8;
+                rgb[i * 3 + 1] = (v >> 3) & 0xFC;
+                rgb[i * 3 + 2] = (v << 3) & 0xF8;
+            }
+            return true;
+        case PIXFORMAT_RGB888:
+            if(src_len < n * 3) return false;
+            for(size_t i = 0; i < n; i++){
+                rgb[i * 3 + 0] = src[i * 3 + 2];
+                rgb[i * 3 + 1] = src[i * 3 + 1];
+                rgb[i * 3 + 2] = src[i * 3 + 0];
+            }
+            return true;
+        case PIXFORMAT_YUV422:
+            if(src_len < n * 2) return false;
+            for(size_t i = 0; i + 1 < n; i += 2){
+                const uint8_t *p = &src[i * 2];
+                int u = p[1] - 128, v = p[3] - 128;
+                for(int k = 0; k < 2; k++){
+                    int y = p[k * 2];
+                    int r = y + ((359 * v) >> 8);
+                    int g = y - ((88 * u + 183 * v) >> 8);
+                    int b = y + ((454 * u) >> 8);
+                    uint8_t *o = &rgb[(i + k) * 3];
+                    o[0] = r < 0 ? 0 : r > 255 ? 255 : r;
+                    o[1] = g < 0 ? 0 : g > 255 ? 255 : g;
+                    o[2] = b < 0 ? 0 : b > 255 ? 255 : b;
+                }
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool encode(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format,
+                   uint8_t quality, std::vector<uint8_t> &out){
+    if(format == PIXFORMAT_GRAYSCALE){
+        if(src_len < (size_t)width * height) return false;
+        return shim_jpeg_encode(src, width, height, 1, quality, out);
+    }
+    std::vector<uint8_t> rgb;
+    if(!to_rgb(src, src_len, width, height, format, rgb)){
+        return false;
+    }
+    return shim_jpeg_encode(rgb.data(), width, height, 3, quality, out);
+}
+
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg){
+    std::vector<uint8_t> out;
+    if(!encode(src, src_len, width, height, format, quality, out)){
+        return false;
+    }
+    // The device encoder flushes in small pieces, keep the callback granularity similar
+    const size_t piece = 1024;
+    for(size_t i = 0; i < out.size(); i += piece){
+        size_t n = out.size() - i < piece ? out.size() - i : piece;
+        if(cb(arg, i, out.data() + i, n) != n){
+            return false;
+        }
+    }
+    cb(arg, out.size(), NULL, 0);
+    return true;
+}
+
+bool frame2jpg_cb(camera_fb_t *fb, uint8_t quality, jpg_out_cb cb, void *arg){
+    return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+}
+
+bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t **out, size_t *out_len){
+    std::vector<uint8_t> jpg;
+    if(!encode(src, src_len, width, height, format, quality, jpg)){
+        return false;
+    }
+    *out = (uint8_t *)malloc(jpg.size());
+    if(!*out){
+        return false;
+    }
+    memcpy(*out, jpg.data(), jpg.size());
+    *out_len = jpg.size();
+    return true;
+}
+
+bool frame2jpg(camera_fb_t *fb, uint8_t quality, uint8_t **out, size_t *out_len){
+    return fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
+}
+
+bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint8_t *rgb_buf){
+    std::vector<uint8_t> rgb;
+    int w = 0, h = 0;
+    if(format != PIXFORMAT_JPEG || !shim_jpeg_decode(src_buf, src_len, 1, rgb, &w, &h)){
+        return false;
+    }
+    // Output is B, G, R like the device decoder
+    size_t n = (size_t)w * h;
+    for(size_t i = 0; i < n; i++){
+        rgb_buf[i * 3 + 0] = rgb[i * 3 + 2];
+        rgb_buf[i * 3 + 1] = rgb[i * 3 + 1];
+        rgb_buf[i * 3 + 2] = rgb[i * 3 + 0];
+    }
+    return true;
+}
+
+bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t *out, jpg_scale_t scale){
+    std::vector<uint8_t> rgb;
+    int w = 0, h = 0;
+    // The decoder scales while it decodes, as TJpgDec does on the device
+    if(scale > JPG_SCALE_MAX || !shim_jpeg_decode(src, src_len, 1 << scale, rgb, &w, &h)){
+        return false;
+    }
+    size_t n = (size_t)w * h;
+    for(size_t i = 0; i < n; i++){
+        const uint8_t *c = &rgb[i * 3];
+        uint16_t v = ((c[0] & 0xF8) << 8) | ((c[1] & 0xFC) << 3) | (c[2] >> 3);
+        out[i * 2] = v >> 8;
+        out[i * 2 + 1] = v & 0xFF;
+    }
+    return true;
+}
@@ -0,0 +1,369 @@
+/*
+  Host shim - esp-mqtt over POSIX sockets
+  Like the IDF client, each client has a task that connects, reads and
+  dispatches events, reconnecting after reconnect_timeout_ms when the link
+  drops; publishing writes straight to the socket from the caller. Speaks
+  MQTT 3.1.1: CONNECT with clean session and an optional last will, PUBLISH
+  at QoS 0/1 (MQTT_EVENT_PUBLISHED on PUBACK) and keepalive pings. There is
+  no outbox: a QoS 1 message not acknowledged before the link dropped is
+  the caller's to send again.
+
+  The board has no network here, so the broker in the sketch is not used:
+  clients connect to plant_shim_config()->mqtt_uri when one is set (e.g. a
+  local Mosquitto), and otherwise find the broker unreachable.
+*/
+
+#include "mqtt_client.h"
+#include "plant_shim.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define MQTT_CONNECT        0x10
+#define MQTT_CONNACK        0x20
+#define MQTT_PUBLISH        0x30
+#define MQTT_PUBACK         0x40
+#define MQTT_PINGREQ        0xC0
+#define MQTT_PINGRESP       0xD0
+#define MQTT_DISCONNECT     0xE0
+
+static const char *MQTT_EVENTS = "MQTT_EVENTS";
+
+struct esp_mqtt_client {
+    std::string uri, client_id, lwt_topic, lwt_msg;
+    int lwt_qos, lwt_retain;
+    int keepalive_s, reconnect_ms, network_ms;
+    bool auto_reconnect;
+    void *user_context;
+    esp_event_handler_t handler;
+    void *handler_arg;
+    int handler_event;
+
+    std::thread task;
+    std::mutex lock;                // Socket writes and the fields below
+    std::condition_variable wake;
+    int fd = -1;
+    bool connected = false;
+    bool stop = false;
+    uint16_t next_id = 0;
+};
+
+static void dispatch(esp_mqtt_client *c, esp_mqtt_event_id_t id, int msg_id){
+    if(!c->handler || (c->handler_event != MQTT_EVENT_ANY && c->handler_event != id)){
+        return;
+    }
+    esp_mqtt_event_t e;
+    memset(&e, 0, sizeof(e));
+    e.event_id = id;
+    e.client = c;
+    e.user_context = c->user_context;
+    e.msg_id = msg_id;
+    c->handler(c->handler_arg, MQTT_EVENTS, id, &e);
+}
+
+static void put_u16(std::string &s, uint16_t v){
+    s += (char)(v >> 8);
+    s += (char)(v & 0xFF);
+}
+
+static void put_str(std::string &s, const std::string &v){
+    put_u16(s, (uint16_t)v.size());
+    s += v;
+}
+
+static std::string packet(uint8_t type, const std::string &body){
+    std::string p(1, (char)type);
+    size_t n = body.size();
+    do {
+        uint8_t b = n % 128;
+        n /= 128;
+        p += (char)(n ? b | 0x80 : b);
+    } while(n);
+    return p + body;
+}
+
+static bool send_all(int fd, const std::string &p){
+    size_t off = 0;
+    while(off < p.size()){
+        ssize_t n = send(fd, p.data() + off, p.size() - off, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, uint8_t *buf, size_t len, int timeout_ms){
+    size_t off = 0;
+    while(off < len){
+        struct pollfd p = {fd, POLLIN, 0};
+        if(poll(&p, 1, timeout_ms) <= 0){
+            return false;
+        }
+        ssize_t n = recv(fd, buf + off, len - off, 0);
+        if(n <= 0){
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// One packet: type byte and body; false on a broken link or timeout
+static bool read_packet(int fd, uint8_t *type, std::string *body, int timeout_ms){
+    uint8_t b;
+    if(!recv_all(fd, type, 1, timeout_ms)){
+        return false;
+    }
+    size_t len = 0;
+    for(int shift = 0; ; shift += 7){
+        if(shift > 21 || !recv_all(fd, &b, 1, timeout_ms)){
+            return false;
+        }
+        len |= (size_t)(b & 0x7F) << shift;
+        if(!(b & 0x80)){
+            break;
+        }
+    }
+    body->resize(len);
+    return !len || recv_all(fd, (uint8_t *)&(*body)[0], len, timeout_ms);
+}
+
+static int open_socket(const std::string &uri, int timeout_ms){
+    std::string rest = uri.compare(0, 7, "mqtt://") ? uri : uri.substr(7);
+    std::string host = rest, port = "1883";
+    size_t colon = rest.rfind(':');
+    if(colon != std::string::npos){
+        host = rest.substr(0, colon);
+        port = rest.substr(colon + 1);
+    }
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0){
+        return -1;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if(fd >= 0){
+        struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(connect(fd, res->ai_addr, res->ai_addrlen) != 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static bool mqtt_connect(esp_mqtt_client *c, int fd){
+    std::string body;
+    put_str(body, "MQTT");
+    body += (char)4;
+    uint8_t flags = 0x02;
+    if(!c->lwt_topic.empty()){
+        flags |= 0x04 | (c->lwt_qos & 3) << 3 | (c->lwt_retain ? 0x20 : 0);
+    }
+    body += (char)flags;
+    put_u16(body, (uint16_t)c->keepalive_s);
+    put_str(body, c->client_id);
+    if(!c->lwt_topic.empty()){
+        put_str(body, c->lwt_topic);
+        put_str(body, c->lwt_msg);
+    }
+    uint8_t type;
+    std::string ack;
+    return send_all(fd, packet(MQTT_CONNECT, body)) && read_packet(fd, &type, &ack, c->network_ms) &&
+           type == MQTT_CONNACK && ack.size() == 2 && ack[1] == 0;
+}
+
+// Reads until the link breaks or the client stops, pinging when idle
+static void session(esp_mqtt_client *c, int fd){
+    auto last_sent = std::chrono::steady_clock::now();
+    bool ping_out = false;
+    for(;;){
+        {
+            std::lock_guard<std::mutex> lk(c->lock);
+            if(c->stop){
+                return;
+            }
+        }
+        uint8_t type;
+        std::string body;
+        struct pollfd p = {fd, POLLIN, 0};
+        int r = poll(&p, 1, 200);
+        if(r < 0 && errno != EINTR){
+            return;
+        }
+        if(r > 0){
+            if(!read_packet(fd, &type, &body, c->network_ms)){
+                return;
+            }
+            if((type & 0xF0) == MQTT_PUBACK && body.size() >= 2){
+                dispatch(c, MQTT_EVENT_PUBLISHED, ((uint8_t)body[0] << 8) | (uint8_t)body[1]);
+            } else if((type & 0xF0) == MQTT_PINGRESP){
+                ping_out = false;
+            }
+            continue;
+        }
+        // Half the keepalive without a ping answered: the broker is gone
+        auto idle = std::chrono::steady_clock::now() - last_sent;
+        if(idle > std::chrono::seconds(c->keepalive_s) / 2){
+            if(ping_out){
+                return;
+            }
+            std::lock_guard<std::mutex> lk(c->lock);
+            if(!send_all(fd, packet(MQTT_PINGREQ, ""))){
+                return;
+            }
+            ping_out = true;
+            last_sent = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+static void client_task(esp_mqtt_client *c){
+    pthread_setname_np(pthread_self(), "mqtt_task");
+    for(;;){
+        const char *uri = plant_shim_config()->mqtt_uri;
+        int fd = uri ? open_socket(uri, c->network_ms) : -1;
+        if(fd >= 0 && mqtt_connect(c, fd)){
+            {
+                std::lock_guard<std::mutex> lk(c->lock);
+                c->fd = fd;
+                c->connected = true;
+            }
+            dispatch(c, MQTT_EVENT_CONNECTED, 0);
+            session(c, fd);
+            {
+                std::lock_guard<std::mutex> lk(c->lock);
+                c->connected = false;
+                c->fd = -1;
+            }
+            close(fd);
+            dispatch(c, MQTT_EVENT_DISCONNECTED, 0);
+        } else {
+            if(fd >= 0){
+                close(fd);
+            }
+            dispatch(c, MQTT_EVENT_ERROR, 0);
+            dispatch(c, MQTT_EVENT_DISCONNECTED, 0);
+        }
+        std::unique_lock<std::mutex> lk(c->lock);
+        if(!c->auto_reconnect){
+            c->stop = true;
+        }
+        c->wake.wait_for(lk, std::chrono::milliseconds(c->reconnect_ms), [c]{ return c->stop; });
+        if(c->stop){
+            return;
+        }
+    }
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config){
+    esp_mqtt_client *c = new esp_mqtt_client();
+    c->uri = config->uri ? config->uri : "";
+    c->client_id = config->client_id ? config->client_id : "ESP32";
+    if(config->lwt_topic){
+        c->lwt_topic = config->lwt_topic;
+        c->lwt_msg = config->lwt_msg ? std::string(config->lwt_msg, config->lwt_msg_len ? config->lwt_msg_len
+                                                                                        : strlen(config->lwt_msg))
+                                     : "";
+    }
+    c->lwt_qos = config->lwt_qos;
+    c->lwt_retain = config->lwt_retain;
+    c->keepalive_s = config->keepalive > 0 ? config->keepalive : 120;
+    c->reconnect_ms = config->reconnect_timeout_ms > 0 ? config->reconnect_timeout_ms : 10000;
+    c->network_ms = config->network_timeout_ms > 0 ? config->network_timeout_ms : 10000;
+    c->auto_reconnect = !config->disable_auto_reconnect;
+    c->user_context = config->user_context;
+    c->handler = NULL;
+    return c;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_args){
+    client->handler = event_handler;
+    client->handler_arg = event_handler_args;
+    client->handler_event = event;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client){
+    if(client->task.joinable()){
+        return ESP_FAIL;
+    }
+    client->stop = false;
+    client->task = std::thread(client_task, client);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client){
+    if(!client->task.joinable()){
+        return ESP_FAIL;
+    }
+    {
+        std::lock_guard<std::mutex> lk(client->lock);
+        client->stop = true;
+        if(client->fd >= 0){
+            send_all(client->fd, packet(MQTT_DISCONNECT, ""));
+            shutdown(client->fd, SHUT_RDWR);
+        }
+    }
+    client->wake.notify_all();
+    client->task.join();
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client){
+    if(client->task.joinable()){
+        esp_mqtt_client_stop(client);
+    }
+    delete client;
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                            int len, int qos, int retain){
+    std::lock_guard<std::mutex> lk(client->lock);
+    if(!client->connected){
+        return -1;
+    }
+    int msg_id = 0;
+    std::string body;
+    put_str(body, topic);
+    if(qos > 0){
+        if(++client->next_id == 0){
+            client->next_id = 1;
+        }
+        msg_id = client->next_id;
+        put_u16(body, (uint16_t)msg_id);
+    }
+    body.append(data, len > 0 ? (size_t)len : strlen(data));
+    uint8_t type = MQTT_PUBLISH | (qos > 0 ? 1 : 0) << 1 | (retain ? 1 : 0);
+    if(!send_all(client->fd, packet(type, body))){
+        shutdown(client->fd, SHUT_RDWR);      // The task sees the link drop and reconnects
+        return -1;
+    }
+    return msg_id;
+}
@@ -0,0 +1,24 @@
+/*
+  Host shim - runtime knobs
+*/
+
+#include "plant_shim.h"
+
+static plant_shim_config_t shim_config = {
+    .port_offset = 8000,
+    .frames_dir = NULL,
+    .fps = 15.0f,
+    .sccb_write_us = 120,
+    .sim_speed = 1.0f,
+    .psram = true,
+    .psram_bytes = 4 * 1024 * 1024,
+    .internal_heap_bytes = 200 * 1024,
+    .seed = 1,
+    .httpd_detached = false,
+    .mqtt_uri = NULL,
+    .upload_url = NULL,
+};
+
+plant_shim_config_t *plant_shim_config(void){
+    return &shim_config;
+}
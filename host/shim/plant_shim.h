@@ -0,0 +1,34 @@
+/*
+  Host shim - runtime knobs for the emulated board
+  Set these before calling setup(); the shim reads them lazily.
+*/
+#ifndef HOST_SHIM_PLANT_SHIM_H
+#define HOST_SHIM_PLANT_SHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+typedef struct {
+    int port_offset;            // Added to every httpd server_port, so 80/81 become e.g. 8080/8081
+    const char *frames_dir;     // Directory of JPEGs replayed by the camera, synthetic scene when NULL
+    float fps;                  // Sensor frame rate
+    uint32_t sccb_write_us;     // Cost of one sensor register write
+    float sim_speed;            // Environment simulation time multiplier
+    bool psram;                 // psramFound()
+    size_t psram_bytes;
+    size_t internal_heap_bytes;
+    uint32_t seed;
+    bool httpd_detached;        // httpd_start() opens no socket and starts no task
+    const char *mqtt_uri;       // Broker the MQTT clients reach instead of the sketch's, none when NULL
+    const char *upload_url;     // Where HTTP client requests go instead of the sketch's URL, nowhere when NULL
+} plant_shim_config_t;
+
+plant_shim_config_t *plant_shim_config(void);
+
+// Runs raw request bytes through a detached server's parser and handlers on
+// the calling thread, as one connection; responses are appended to out.
+// Returns false if the server would have closed the connection.
+bool plant_httpd_dispatch(void *handle, const char *data, size_t len, std::string *out);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+  Host shim - libjpeg helpers
+*/
+
+#include "shim_jpeg.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <jpeglib.h>
+
+struct shim_jpeg_err {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void shim_jpeg_error_exit(j_common_ptr cinfo){
+    longjmp(((shim_jpeg_err *)cinfo->err)->jump, 1);
+}
+
+static void shim_jpeg_silent(j_common_ptr cinfo, int level){
+    (void)cinfo; (void)level;
+}
+
+bool shim_jpeg_decode(const uint8_t *src, size_t len, int scale_denom,
+                      std::vector<uint8_t> &rgb, int *width, int *height){
+    struct jpeg_decompress_struct cinfo;
+    shim_jpeg_err err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = shim_jpeg_error_exit;
+    err.mgr.emit_message = shim_jpeg_silent;
+    if(setjmp(err.jump)){
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, src, len);
+    if(jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK){
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale_denom;
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_start_decompress(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    rgb.resize((size_t)cinfo.output_width * cinfo.output_height * 3);
+    while(cinfo.output_scanline < cinfo.output_height){
+        JSAMPROW row = &rgb[(size_t)cinfo.output_scanline * cinfo.output_width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+bool shim_jpeg_encode(const uint8_t *pixels, int width, int height, int components,
+                      int quality, std::vector<uint8_t> &out){
+    struct jpeg_compress_struct cinfo;
+    shim_jpeg_err err;
+    unsigned char *mem = NULL;
+    unsigned long mem_len = 0;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = shim_jpeg_error_exit;
+    if(setjmp(err.jump)){
+        jpeg_destroy_compress(&cinfo);
+        free(mem);
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &mem, &mem_len);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = components;
+    cinfo.in_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < cinfo.image_height){
+        JSAMPROW row = (JSAMPROW)&pixels[(size_t)cinfo.next_scanline * width * components];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    out.assign(mem, mem + mem_len);
+    free(mem);
+    return true;
+}
+
+bool shim_jpeg_size(const uint8_t *src, size_t len, int *width, int *height){
+    if(len < 4 || src[0] != 0xFF || src[1] != 0xD8){
+        return false;
+    }
+    size_t i = 2;
+    while(i + 9 < len){
+        if(src[i] != 0xFF){
+            return false;
+        }
+        uint8_t marker = src[i + 1];
+        if(marker == 0xFF){
+            i++;
+            continue;
+        }
+        size_t seg = ((size_t)src[i + 2] << 8) | src[i + 3];
+        if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC){
+            *height = (src[i + 5] << 8) | src[i + 6];
+            *width = (src[i + 7] << 8) | src[i + 8];
+            return true;
+        }
+        i += 2 + seg;
+    }
+    return false;
+}
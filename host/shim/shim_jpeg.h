@@ -0,0 +1,22 @@
+/*
+  Host shim - libjpeg helpers shared by the camera and img_converters shims
+*/
+#ifndef HOST_SHIM_JPEG_H
+#define HOST_SHIM_JPEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Decode to packed RGB (R, G, B order). scale_denom is 1, 2, 4 or 8.
+bool shim_jpeg_decode(const uint8_t *src, size_t len, int scale_denom,
+                      std::vector<uint8_t> &rgb, int *width, int *height);
+
+// Encode packed RGB (components == 3) or grayscale (components == 1).
+bool shim_jpeg_encode(const uint8_t *pixels, int width, int height, int components,
+                      int quality, std::vector<uint8_t> &out);
+
+// Width/height from the SOF marker without decoding.
+bool shim_jpeg_size(const uint8_t *src, size_t len, int *width, int *height);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+  Host shim - simulated plant environment behind DHT and analogRead()
+  Diurnal temperature/humidity swing, soil that dries steadily and gets
+  watered every few (simulated) hours. plant_shim_config()->sim_speed
+  compresses time so dynamics show up in short runs.
+*/
+
+#include "Arduino.h"
+#include "DHT.h"
+#include "plant_shim.h"
+#include <mutex>
+#include <random>
+
+#define SIM_DAY_S          86400.0
+#define SIM_WATER_EVERY_S  (6 * 3600.0)
+#define SIM_WATER_RAMP_S   40.0
+#define SIM_DRY_PER_HOUR   3.0
+#define SIM_SOIL_WET       85.0
+#define SIM_SOIL_MIN       15.0
+
+static std::mutex sim_lock;
+
+static std::mt19937 &sim_rng(){
+    static std::mt19937 gen(plant_shim_config()->seed * 7919u + 17u);
+    return gen;
+}
+
+static double sim_noise(double sigma){
+    std::normal_distribution<double> d(0.0, sigma);
+    return d(sim_rng());
+}
+
+static double sim_seconds(){
+    return millis() / 1000.0 * plant_shim_config()->sim_speed;
+}
+
+static double sim_soil_percent(double t){
+    double cycle = fmod(t, SIM_WATER_EVERY_S);
+    double dried = SIM_DRY_PER_HOUR * (cycle - SIM_WATER_RAMP_S) / 3600.0;
+    if(cycle >= SIM_WATER_RAMP_S || t < SIM_WATER_EVERY_S){
+        return std::max(SIM_SOIL_MIN, SIM_SOIL_WET - std::max(0.0, dried));
+    }
+    // Watering: ramp up from where the previous cycle ended
+    double low = std::max(SIM_SOIL_MIN, SIM_SOIL_WET - SIM_DRY_PER_HOUR * (SIM_WATER_EVERY_S - SIM_WATER_RAMP_S) / 3600.0);
+    return low + (SIM_SOIL_WET - low) * (cycle / SIM_WATER_RAMP_S);
+}
+
+float DHT::readTemperature(bool fahrenheit, bool force){
+    (void)force;
+    std::lock_guard<std::mutex> lk(sim_lock);
+    if(sim_rng()() % 100 == 0){
+        return NAN;     // The real sensor misses a read now and then
+    }
+    double t = sim_seconds();
+    double c = 24.0 + 4.0 * sin(2 * M_PI * t / SIM_DAY_S) + sim_noise(0.08);
+    return (float)(fahrenheit ? c * 1.8 + 32 : c);
+}
+
+float DHT::readHumidity(bool force){
+    (void)force;
+    std::lock_guard<std::mutex> lk(sim_lock);
+    double t = sim_seconds();
+    return (float)(62.0 - 12.0 * sin(2 * M_PI * t / SIM_DAY_S) + sim_noise(0.4));
+}
+
+uint16_t analogRead(uint8_t pin){
+    (void)pin;
+    std::lock_guard<std::mutex> lk(sim_lock);
+    double pct = sim_soil_percent(sim_seconds()) + sim_noise(0.4);
+    double raw = 4095.0 - pct * 40.95;
+    return (uint16_t)constrain(raw, 0.0, 4095.0);
+}
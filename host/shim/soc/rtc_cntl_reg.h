@@ -0,0 +1,9 @@
+/*
+  Host shim - soc/rtc_cntl_reg.h
+*/
+#ifndef HOST_SHIM_RTC_CNTL_REG_H
+#define HOST_SHIM_RTC_CNTL_REG_H
+
+#define RTC_CNTL_BROWN_OUT_REG 0
+
+#endif
@@ -0,0 +1,10 @@
+/*
+  Host shim - soc/soc.h
+*/
+#ifndef HOST_SHIM_SOC_H
+#define HOST_SHIM_SOC_H
+
+#define WRITE_PERI_REG(addr, val) ((void)(addr), (void)(val))
+#define READ_PERI_REG(addr) ((void)(addr), 0u)
+
+#endif
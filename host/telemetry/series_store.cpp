@@ -0,0 +1,261 @@
+/*
+  Smart Plant Vision - columnar time series store
+*/
+
+#include "series_store.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define COLUMN_VERSION      1
+#define COLUMN_MIN_CAPACITY 4096
+#define MAGIC_TS            0x53544c50  // "PLTS"
+#define MAGIC_VAL           0x4c564c50  // "PLVL"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    uint32_t reserved;
+    uint64_t count;
+} column_header_t;
+
+series_column::~series_column(){
+    if(map_){
+        munmap(map_, map_len_);
+    }
+}
+
+bool series_column::map(uint64_t capacity){
+    size_t len = HEADER_SIZE + capacity * elem_size_;
+    int fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || ((size_t)st.st_size < len && ftruncate(fd, len) < 0)){
+        close(fd);
+        return false;
+    }
+    if((size_t)st.st_size > len){
+        len = st.st_size;
+        capacity = (len - HEADER_SIZE) / elem_size_;
+    }
+    void *m = map_ ? mremap(map_, map_len_, len, MREMAP_MAYMOVE) : mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(m == MAP_FAILED){
+        return false;
+    }
+    map_ = m;
+    map_len_ = len;
+    capacity_ = capacity;
+    return true;
+}
+
+bool series_column::open(const std::string &path, uint32_t elem_size, uint32_t magic){
+    path_ = path;
+    elem_size_ = elem_size;
+    if(!map(COLUMN_MIN_CAPACITY)){
+        return false;
+    }
+    column_header_t *h = (column_header_t *)map_;
+    if(h->magic == 0){
+        h->magic = magic;
+        h->version = COLUMN_VERSION;
+        h->elem_size = elem_size;
+        h->count = 0;
+    } else if(h->magic != magic || h->version != COLUMN_VERSION || h->elem_size != elem_size || h->count > capacity_){
+        fprintf(stderr, "series: %s is not a valid column file\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool series_column::reserve(uint64_t n){
+    if(n <= capacity_){
+        return true;
+    }
+    uint64_t cap = capacity_;
+    while(cap < n){
+        cap *= 2;
+    }
+    return map(cap);
+}
+
+void series_column::set_count(uint64_t n){
+    ((column_header_t *)map_)->count = n;
+}
+
+uint64_t series_column::count() const {
+    return ((const column_header_t *)map_)->count;
+}
+
+void series_column::sync(){
+    if(map_){
+        msync(map_, map_len_, MS_ASYNC);
+    }
+}
+
+bool series::open(const std::string &base){
+    if(!ts_.open(base + ".ts", sizeof(int64_t), MAGIC_TS) || !val_.open(base + ".val", sizeof(float), MAGIC_VAL)){
+        return false;
+    }
+    // After a crash between the two count updates the shorter column wins
+    n_ = std::min(ts_.count(), val_.count());
+    return true;
+}
+
+bool series::append(int64_t t_ms, float v){
+    if(!ts_.reserve(n_ + 1) || !val_.reserve(n_ + 1)){
+        return false;
+    }
+    // Keep the time column sorted even if the wall clock steps back
+    if(n_ && t_ms < ts()[n_ - 1]){
+        t_ms = ts()[n_ - 1];
+    }
+    ((int64_t *)ts_.data())[n_] = t_ms;
+    ((float *)val_.data())[n_] = v;
+    n_++;
+    val_.set_count(n_);
+    ts_.set_count(n_);
+    return true;
+}
+
+void series::sync(){
+    ts_.sync();
+    val_.sync();
+}
+
+void series::query(int64_t from_ms, int64_t to_ms, int64_t step_ms, size_t max_points,
+                   std::vector<series_bucket_t> *out) const {
+    out->clear();
+    if(!n_ || to_ms <= from_ms){
+        return;
+    }
+    const int64_t *t = ts();
+    const float *v = val();
+    size_t lo = std::lower_bound(t, t + n_, from_ms) - t;
+    size_t hi = std::lower_bound(t + lo, t + n_, to_ms) - t;
+
+    if(step_ms <= 0){
+        if(max_points && hi - lo > max_points){
+            lo = hi - max_points;
+        }
+        for(size_t i = lo; i < hi; i++){
+            series_bucket_t b = {t[i], isnan(v[i]) ? 0u : 1u, v[i], v[i], v[i]};
+            out->push_back(b);
+        }
+        return;
+    }
+
+    series_bucket_t cur = {0, 0, 0, 0, 0};
+    double sum = 0;
+    int64_t cur_start = INT64_MIN;
+    for(size_t i = lo; i < hi; i++){
+        int64_t start = from_ms + (t[i] - from_ms) / step_ms * step_ms;
+        if(start != cur_start){
+            if(cur.count){
+                cur.mean = (float)(sum / cur.count);
+                out->push_back(cur);
+                if(max_points && out->size() >= max_points){
+                    return;
+                }
+            }
+            cur_start = start;
+            cur.start_ms = start;
+            cur.count = 0;
+            sum = 0;
+        }
+        float x = v[i];
+        if(isnan(x)){
+            continue;
+        }
+        if(!cur.count){
+            cur.min = cur.max = x;
+        } else {
+            cur.min = std::min(cur.min, x);
+            cur.max = std::max(cur.max, x);
+        }
+        sum += x;
+        cur.count++;
+    }
+    if(cur.count){
+        cur.mean = (float)(sum / cur.count);
+        out->push_back(cur);
+    }
+}
+
+bool series_store::valid_name(const std::string &name){
+    if(name.empty() || name.size() > 64 || name[0] == '.'){
+        return false;
+    }
+    for(char c : name){
+        if(!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.'){
+            return false;
+        }
+    }
+    return true;
+}
+
+series *series_store::get(const std::string &device, const std::string &metric, bool create){
+    if(!valid_name(device) || !valid_name(metric)){
+        return NULL;
+    }
+    std::string key = device + "/" + metric;
+    auto it = open_.find(key);
+    if(it != open_.end()){
+        return it->second.get();
+    }
+    std::string dev_dir = dir_ + "/" + device;
+    std::string base = dev_dir + "/" + metric;
+    if(!create && access((base + ".ts").c_str(), F_OK) != 0){
+        return NULL;
+    }
+    if(mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST){
+        return NULL;
+    }
+    if(mkdir(dev_dir.c_str(), 0755) < 0 && errno != EEXIST){
+        return NULL;
+    }
+    std::unique_ptr<series> s(new series());
+    if(!s->open(base)){
+        return NULL;
+    }
+    series *r = s.get();
+    open_[key] = std::move(s);
+    return r;
+}
+
+std::vector<std::string> series_store::metrics(const std::string &device) const {
+    std::vector<std::string> names;
+    if(!valid_name(device)){
+        return names;
+    }
+    DIR *d = opendir((dir_ + "/" + device).c_str());
+    if(!d){
+        return names;
+    }
+    while(struct dirent *e = readdir(d)){
+        size_t len = strlen(e->d_name);
+        if(len > 3 && !strcmp(e->d_name + len - 3, ".ts")){
+            names.push_back(std::string(e->d_name, len - 3));
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void series_store::sync(){
+    for(auto &kv : open_){
+        kv.second->sync();
+    }
+}
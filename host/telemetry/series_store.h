@@ -0,0 +1,102 @@
+/*
+  Smart Plant Vision - columnar time series store
+
+  One series per (device, metric), stored as two memory-mapped column files
+  under <dir>/<device>/: <metric>.ts holds int64 timestamps (ms since the
+  epoch, never decreasing) and <metric>.val holds float32 values. Appends are
+  a store into the mapping plus a count bump in both file headers, so a sample
+  costs no syscall until a column has to grow (capacity doubles).
+
+  Range queries binary-search the timestamp column and fold the values into
+  fixed-width buckets (min/max/mean/count), which is how a chart asks for a
+  month of 10 s samples without shipping them all. NaN values (sensor read
+  failures) are stored but left out of the aggregates.
+
+  Not thread safe; the collector calls it from its event loop.
+*/
+#ifndef HOST_TELEMETRY_SERIES_STORE_H
+#define HOST_TELEMETRY_SERIES_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef struct {
+    int64_t start_ms;       // Bucket start; for raw queries the sample time
+    uint32_t count;         // Non-NaN samples
+    float min;
+    float max;
+    float mean;
+} series_bucket_t;
+
+// One mapped column: a 64 byte header followed by fixed-size elements
+class series_column {
+public:
+    ~series_column();
+
+    bool open(const std::string &path, uint32_t elem_size, uint32_t magic);
+    bool reserve(uint64_t n);
+    void set_count(uint64_t n);
+    void sync();
+
+    uint64_t count() const;
+    void *data() const { return (uint8_t *)map_ + HEADER_SIZE; }
+
+private:
+    static const size_t HEADER_SIZE = 64;
+
+    bool map(uint64_t capacity);
+
+    std::string path_;
+    void *map_ = NULL;
+    size_t map_len_ = 0;
+    uint64_t capacity_ = 0;
+    uint32_t elem_size_ = 0;
+};
+
+class series {
+public:
+    bool open(const std::string &base);
+    bool append(int64_t t_ms, float v);
+    void sync();
+
+    uint64_t size() const { return n_; }
+    int64_t last_ms() const { return n_ ? ts()[n_ - 1] : INT64_MIN; }
+
+    // Samples in [from_ms, to_ms). step_ms > 0 folds them into buckets of that
+    // width (empty buckets are omitted); 0 returns the raw samples, at most
+    // max_points of the newest.
+    void query(int64_t from_ms, int64_t to_ms, int64_t step_ms, size_t max_points,
+               std::vector<series_bucket_t> *out) const;
+
+private:
+    const int64_t *ts() const { return (const int64_t *)ts_.data(); }
+    const float *val() const { return (const float *)val_.data(); }
+
+    series_column ts_;
+    series_column val_;
+    uint64_t n_ = 0;
+};
+
+class series_store {
+public:
+    explicit series_store(const std::string &dir) : dir_(dir) {}
+
+    // Device and metric names become path components: [A-Za-z0-9_.-], no leading dot
+    static bool valid_name(const std::string &name);
+
+    // NULL when the name is invalid or the files cannot be opened
+    series *get(const std::string &device, const std::string &metric, bool create);
+
+    std::vector<std::string> metrics(const std::string &device) const;
+    void sync();
+
+private:
+    std::string dir_;
+    std::map<std::string, std::unique_ptr<series>> open_;
+};
+
+#endif
@@ -0,0 +1,898 @@
+/*
+  Smart Plant Vision - fleet telemetry collector
+
+  Polls /sensors on every device from one epoll loop and appends each numeric
+  field of the JSON (temperature, humidity, soilMoisture, timestamp, ...) to
+  a columnar series per device and metric (see telemetry/series_store.h).
+  Each device keeps one keep-alive connection, so a poll is a single small
+  request/response with no connect; polls are spread evenly over the
+  interval so the fleet is not hit in bursts. A device that is busy or down
+  only costs its own slot: the request times out and the next poll
+  reconnects.
+
+  A small HTTP API serves the stored data:
+    /devices                         poll state and latest values
+    /metrics?device=D                stored metric names
+    /query?device=D&metric=M[&from=MS&to=MS | &last=S][&step=MS][&points=N]
+  Without step, a step giving about 300 buckets is used; step=0 returns raw
+  samples.
+
+  Usage: plant_collector --devices fleet.txt --interval 10 --data ./telemetry
+         plant_collector --data ./telemetry --query greenhouse/temperature --last 86400
+  fleet.txt has one "name host[:port]" per line (# starts a comment).
+*/
+
+#include "http_response.h"
+#include "net_util.h"
+#include "series_store.h"
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#define DEFAULT_BUCKETS     300
+#define MAX_POINTS          20000
+#define MAX_BODY            4096
+#define CLIENT_MAX_REQUEST  8192
+
+enum { KIND_LISTEN = 1, KIND_DEVICE = 2, KIND_CLIENT = 3 };
+
+typedef struct {
+    std::vector<std::string> device_specs;
+    const char *devices_file;
+    double interval_s;
+    int timeout_ms;
+    std::string data_dir;
+    const char *listen_spec;
+    const char *query;
+    double last_s;
+    int64_t step_ms;
+    bool quiet;
+} collector_opts_t;
+
+typedef struct {
+    std::string name;
+    std::string host;
+    int port;
+    int fd;
+    bool connecting;
+    bool busy;
+    std::string out;
+    size_t out_off;
+    http_response resp;
+    std::string body;
+    int64_t sent_us;
+    int64_t deadline_us;
+    uint64_t ok;
+    uint64_t err_connect;
+    uint64_t err_timeout;
+    uint64_t err_http;
+    uint64_t err_io;
+    uint64_t overrun;           // Polls skipped because the previous one was still running
+    uint64_t connects;
+    int64_t last_ok_ms;         // Wall clock
+    uint32_t rtt_us;
+    std::vector<std::pair<std::string, double>> last_values;
+} device_t;
+
+typedef struct {
+    int fd;
+    std::string in;
+    std::string out;
+    size_t out_off;
+} client_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+static int64_t wall_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t ev_tag(int kind, size_t idx){
+    return ((uint64_t)kind << 32) | idx;
+}
+
+// "soilMoisture" -> "soil_moisture"
+static std::string metric_name(const std::string &key){
+    std::string out;
+    for(char c : key){
+        if(c >= 'A' && c <= 'Z'){
+            if(!out.empty()){
+                out += '_';
+            }
+            out += (char)(c - 'A' + 'a');
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Numeric members of a flat JSON object; null becomes NaN (a failed sensor
+// read), strings and nested values are skipped.
+static bool json_numbers(const std::string &s, std::vector<std::pair<std::string, double>> *out){
+    out->clear();
+    size_t i = s.find('{');
+    if(i == std::string::npos){
+        return false;
+    }
+    i++;
+    int depth = 1;
+    std::string key;
+    bool want_key = true;
+    while(i < s.size() && depth > 0){
+        char c = s[i];
+        if(c == '"'){
+            size_t j = i + 1;
+            std::string str;
+            while(j < s.size() && s[j] != '"'){
+                if(s[j] == '\\' && j + 1 < s.size()){
+                    j++;
+                }
+                str += s[j++];
+            }
+            if(j >= s.size()){
+                return false;
+            }
+            if(depth == 1 && want_key){
+                key = str;
+            }
+            i = j + 1;
+        } else if(c == ':'){
+            want_key = false;
+            i++;
+        } else if(c == ','){
+            want_key = true;
+            i++;
+        } else if(c == '{' || c == '['){
+            depth++;
+            i++;
+        } else if(c == '}' || c == ']'){
+            depth--;
+            i++;
+        } else if(depth == 1 && !want_key && (c == '-' || (c >= '0' && c <= '9'))){
+            char *end;
+            double v = strtod(s.c_str() + i, &end);
+            out->push_back(std::make_pair(key, v));
+            i = end - s.c_str();
+        } else if(depth == 1 && !want_key && !s.compare(i, 4, "null")){
+            out->push_back(std::make_pair(key, (double)NAN));
+            i += 4;
+        } else {
+            i++;
+        }
+    }
+    return depth == 0;
+}
+
+static std::string query_param(const std::string &query, const char *name){
+    size_t nl = strlen(name);
+    size_t pos = 0;
+    while(pos <= query.size()){
+        size_t amp = query.find('&', pos);
+        if(amp == std::string::npos){
+            amp = query.size();
+        }
+        if(amp - pos > nl && !query.compare(pos, nl, name) && query[pos + nl] == '='){
+            return query.substr(pos + nl + 1, amp - pos - nl - 1);
+        }
+        pos = amp + 1;
+    }
+    return std::string();
+}
+
+static void json_float(std::string *s, double v){
+    char buf[32];
+    if(isnan(v) || isinf(v)){
+        *s += "null";
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%.6g", v);
+    *s += buf;
+}
+
+// Shared by the HTTP API and --query. Returns false with *out set to an error message.
+static bool query_json(series_store &store, const std::string &device, const std::string &metric,
+                       int64_t from_ms, int64_t to_ms, int64_t step_ms, size_t points, std::string *out){
+    series *s = store.get(device, metric, false);
+    if(!s){
+        *out = "unknown device or metric";
+        return false;
+    }
+    if(to_ms <= from_ms){
+        *out = "empty range";
+        return false;
+    }
+    if(step_ms < 0){
+        step_ms = std::max<int64_t>((to_ms - from_ms) / DEFAULT_BUCKETS, 1);
+    }
+    std::vector<series_bucket_t> buckets;
+    s->query(from_ms, to_ms, step_ms, std::min<size_t>(points, MAX_POINTS), &buckets);
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"device\":\"%s\",\"metric\":\"%s\",\"from\":%lld,\"to\":%lld,\"step_ms\":%lld,\"points\":[",
+             device.c_str(), metric.c_str(), (long long)from_ms, (long long)to_ms, (long long)step_ms);
+    *out = buf;
+    out->reserve(out->size() + buckets.size() * 48);
+    for(size_t i = 0; i < buckets.size(); i++){
+        const series_bucket_t &b = buckets[i];
+        snprintf(buf, sizeof(buf), "%s[%lld,", i ? "," : "", (long long)b.start_ms);
+        *out += buf;
+        if(step_ms == 0){
+            json_float(out, b.mean);
+        } else {
+            // [start, min, mean, max, count]
+            json_float(out, b.min);
+            *out += ',';
+            json_float(out, b.mean);
+            *out += ',';
+            json_float(out, b.max);
+            snprintf(buf, sizeof(buf), ",%u", b.count);
+            *out += buf;
+        }
+        *out += ']';
+    }
+    *out += "]}";
+    return true;
+}
+
+class collector {
+public:
+    explicit collector(const collector_opts_t &o) : opts(o), store(o.data_dir) {}
+
+    bool add_device(const std::string &name, const std::string &spec);
+    bool load_devices(const char *path);
+    int run();
+
+private:
+    void device_connect(size_t idx, int64_t now);
+    void device_close(size_t idx, uint64_t *err);
+    void device_send(size_t idx, int64_t now);
+    void device_finish(size_t idx, int64_t now);
+    void device_event(size_t idx, uint32_t events, int64_t now);
+    void poll_due(int64_t now);
+    void check_timeouts(int64_t now);
+    void progress(int64_t now);
+
+    void client_accept();
+    void client_event(uint32_t id, uint32_t events);
+    void client_close(uint32_t id);
+    void client_request(client_t *c);
+    void client_reply(client_t *c, const char *status, const std::string &body);
+    std::string devices_json();
+
+    collector_opts_t opts;
+    series_store store;
+    int epfd = -1;
+    int listen_fd = -1;
+    int64_t interval_us = 0;
+    std::vector<std::unique_ptr<device_t>> devices;
+    std::priority_queue<std::pair<int64_t, size_t>, std::vector<std::pair<int64_t, size_t>>,
+                        std::greater<std::pair<int64_t, size_t>>> timers;
+    std::map<uint32_t, std::unique_ptr<client_t>> clients;
+    uint32_t next_client = 1;
+    uint64_t samples = 0;
+    uint64_t last_samples = 0;
+    int64_t last_progress = 0;
+    int64_t last_sync = 0;
+};
+
+bool collector::add_device(const std::string &name, const std::string &spec){
+    if(!series_store::valid_name(name)){
+        fprintf(stderr, "invalid device name '%s' (use letters, digits, '_', '-', '.')\n", name.c_str());
+        return false;
+    }
+    for(auto &d : devices){
+        if(d->name == name){
+            fprintf(stderr, "duplicate device name '%s'\n", name.c_str());
+            return false;
+        }
+    }
+    std::unique_ptr<device_t> d(new device_t());
+    d->name = name;
+    d->port = 80;
+    d->host = net_split_host(spec.c_str(), &d->port);
+    d->fd = -1;
+    d->last_ok_ms = -1;
+    d->out = "GET /sensors HTTP/1.1\r\nHost: " + d->host + "\r\nAccept: application/json\r\n\r\n";
+    device_t *dp = d.get();
+    d->resp.on_body = [dp](const char *data, size_t len){
+        if(dp->body.size() + len <= MAX_BODY){
+            dp->body.append(data, len);
+        }
+    };
+    devices.push_back(std::move(d));
+    return true;
+}
+
+bool collector::load_devices(const char *path){
+    FILE *f = fopen(path, "r");
+    if(!f){
+        perror(path);
+        return false;
+    }
+    char line[512];
+    int lineno = 0;
+    bool ok = true;
+    while(fgets(line, sizeof(line), f)){
+        lineno++;
+        char *hash = strchr(line, '#');
+        if(hash){
+            *hash = 0;
+        }
+        char name[128], addr[256];
+        int n = sscanf(line, "%127s %255s", name, addr);
+        if(n <= 0){
+            continue;
+        }
+        char *eq = strchr(name, '=');
+        if(n == 1 && eq){
+            *eq = 0;
+            snprintf(addr, sizeof(addr), "%s", eq + 1);
+        } else if(n == 1){
+            fprintf(stderr, "%s:%d: expected \"name host[:port]\"\n", path, lineno);
+            ok = false;
+            continue;
+        }
+        ok = add_device(name, addr) && ok;
+    }
+    fclose(f);
+    return ok;
+}
+
+static bool want_write(int epfd, int fd, uint64_t tag, bool write){
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP | (write ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.u64 = tag;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void collector::device_connect(size_t idx, int64_t now){
+    device_t *d = devices[idx].get();
+    d->fd = net_connect(d->host.c_str(), d->port, true);
+    if(d->fd < 0){
+        d->err_connect++;
+        return;
+    }
+    d->connects++;
+    d->connecting = true;
+    d->busy = true;
+    d->sent_us = now;
+    d->deadline_us = now + (int64_t)opts.timeout_ms * 1000;
+    struct epoll_event ev = {};
+    ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = ev_tag(KIND_DEVICE, idx);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, d->fd, &ev);
+}
+
+// Drops the connection; an in-flight poll is charged to *err
+void collector::device_close(size_t idx, uint64_t *err){
+    device_t *d = devices[idx].get();
+    if(d->fd >= 0){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, NULL);
+        close(d->fd);
+        d->fd = -1;
+    }
+    if(d->busy && err){
+        (*err)++;
+    }
+    d->busy = false;
+    d->connecting = false;
+}
+
+void collector::device_send(size_t idx, int64_t now){
+    device_t *d = devices[idx].get();
+    d->out_off = 0;
+    d->resp.reset();
+    d->body.clear();
+    d->busy = true;
+    d->sent_us = now;
+    d->deadline_us = now + (int64_t)opts.timeout_ms * 1000;
+    ssize_t n = send(d->fd, d->out.data(), d->out.size(), MSG_NOSIGNAL);
+    if(n < 0 && errno != EAGAIN && errno != EINTR){
+        device_close(idx, &d->err_io);
+        return;
+    }
+    d->out_off = n > 0 ? n : 0;
+    if(d->out_off < d->out.size()){
+        want_write(epfd, d->fd, ev_tag(KIND_DEVICE, idx), true);
+    }
+}
+
+void collector::device_finish(size_t idx, int64_t now){
+    device_t *d = devices[idx].get();
+    d->busy = false;
+    if(d->resp.status() != 200 || !json_numbers(d->body, &d->last_values)){
+        d->err_http++;
+    } else {
+        int64_t t = wall_ms();
+        for(auto &kv : d->last_values){
+            series *s = store.get(d->name, metric_name(kv.first), true);
+            if(s && s->append(t, (float)kv.second)){
+                samples++;
+            }
+        }
+        d->ok++;
+        d->last_ok_ms = t;
+        d->rtt_us = (uint32_t)std::min<int64_t>(now - d->sent_us, UINT32_MAX);
+    }
+    if(!d->resp.keep_alive()){
+        device_close(idx, NULL);
+    }
+}
+
+void collector::device_event(size_t idx, uint32_t events, int64_t now){
+    device_t *d = devices[idx].get();
+    if(d->fd < 0){
+        return;
+    }
+    if(d->connecting){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+            return;
+        }
+        if(net_connect_result(d->fd) != 0){
+            device_close(idx, &d->err_connect);
+            return;
+        }
+        d->connecting = false;
+        want_write(epfd, d->fd, ev_tag(KIND_DEVICE, idx), false);
+        device_send(idx, now);
+        return;
+    }
+    if(events & EPOLLOUT){
+        ssize_t n = send(d->fd, d->out.data() + d->out_off, d->out.size() - d->out_off, MSG_NOSIGNAL);
+        if(n < 0 && errno != EAGAIN && errno != EINTR){
+            device_close(idx, &d->err_io);
+            return;
+        }
+        d->out_off += n > 0 ? n : 0;
+        want_write(epfd, d->fd, ev_tag(KIND_DEVICE, idx), d->out_off < d->out.size());
+    }
+    if(!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        return;
+    }
+    char buf[4096];
+    for(;;){
+        ssize_t n = recv(d->fd, buf, sizeof(buf), 0);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                return;
+            }
+            device_close(idx, &d->err_io);
+            return;
+        }
+        if(n == 0){
+            if(d->busy && d->resp.feed_eof()){
+                device_finish(idx, now);
+            }
+            // Idle keep-alive connections get closed by the device; reconnect on the next poll
+            device_close(idx, &d->err_io);
+            return;
+        }
+        if(!d->busy || d->resp.feed(buf, n) < 0){
+            device_close(idx, &d->err_http);
+            return;
+        }
+        if(d->resp.done()){
+            device_finish(idx, now);
+            if(d->fd < 0){
+                return;
+            }
+        }
+    }
+}
+
+void collector::poll_due(int64_t now){
+    while(!timers.empty() && timers.top().first <= now){
+        size_t idx = timers.top().second;
+        int64_t due = timers.top().first;
+        timers.pop();
+        device_t *d = devices[idx].get();
+        // Fixed rate from the first slot, so the spread across the fleet holds
+        int64_t next = due + interval_us;
+        if(next <= now){
+            next = now + interval_us;
+        }
+        timers.push(std::make_pair(next, idx));
+        if(d->busy){
+            d->overrun++;
+            continue;
+        }
+        if(d->fd < 0){
+            device_connect(idx, now);
+        } else {
+            device_send(idx, now);
+        }
+    }
+}
+
+void collector::check_timeouts(int64_t now){
+    for(size_t i = 0; i < devices.size(); i++){
+        device_t *d = devices[i].get();
+        if(d->busy && now > d->deadline_us){
+            device_close(i, d->connecting ? &d->err_connect : &d->err_timeout);
+        }
+    }
+}
+
+void collector::progress(int64_t now){
+    if(opts.quiet || now - last_progress < 10000000){
+        return;
+    }
+    double dt = (now - last_progress) / 1e6;
+    size_t connected = 0, fresh = 0;
+    int64_t t = wall_ms();
+    for(auto &d : devices){
+        connected += d->fd >= 0 && !d->connecting;
+        fresh += d->last_ok_ms >= 0 && t - d->last_ok_ms < 3 * interval_us / 1000;
+    }
+    if(last_progress){
+        fprintf(stderr, "devices %zu, connected %zu, reporting %zu, %.0f samples/s\n",
+                devices.size(), connected, fresh, (samples - last_samples) / dt);
+    }
+    last_samples = samples;
+    last_progress = now;
+}
+
+std::string collector::devices_json(){
+    std::string s = "[";
+    char buf[512];
+    int64_t t = wall_ms();
+    for(size_t i = 0; i < devices.size(); i++){
+        device_t *d = devices[i].get();
+        snprintf(buf, sizeof(buf),
+                 "%s{\"name\":\"%s\",\"address\":\"%s:%d\",\"connected\":%s,\"ok\":%llu,"
+                 "\"err_connect\":%llu,\"err_timeout\":%llu,\"err_http\":%llu,\"err_io\":%llu,"
+                 "\"overrun\":%llu,\"connects\":%llu,\"rtt_ms\":%.1f,\"age_s\":",
+                 i ? "," : "", d->name.c_str(), d->host.c_str(), d->port, d->fd >= 0 && !d->connecting ? "true" : "false",
+                 (unsigned long long)d->ok, (unsigned long long)d->err_connect, (unsigned long long)d->err_timeout,
+                 (unsigned long long)d->err_http, (unsigned long long)d->err_io, (unsigned long long)d->overrun,
+                 (unsigned long long)d->connects, d->rtt_us / 1000.0);
+        s += buf;
+        if(d->last_ok_ms < 0){
+            s += "null";
+        } else {
+            json_float(&s, (t - d->last_ok_ms) / 1000.0);
+        }
+        s += ",\"values\":{";
+        for(size_t j = 0; j < d->last_values.size(); j++){
+            s += j ? ",\"" : "\"";
+            s += metric_name(d->last_values[j].first);
+            s += "\":";
+            json_float(&s, d->last_values[j].second);
+        }
+        s += "}}";
+    }
+    s += "]";
+    return s;
+}
+
+void collector::client_accept(){
+    for(;;){
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0){
+            return;
+        }
+        uint32_t id = next_client++;
+        std::unique_ptr<client_t> c(new client_t());
+        c->fd = fd;
+        c->out_off = 0;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = ev_tag(KIND_CLIENT, id);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        clients[id] = std::move(c);
+    }
+}
+
+void collector::client_close(uint32_t id){
+    auto it = clients.find(id);
+    if(it == clients.end()){
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, it->second->fd, NULL);
+    close(it->second->fd);
+    clients.erase(it);
+}
+
+void collector::client_reply(client_t *c, const char *status, const std::string &body){
+    char hdr[256];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                     "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+                     status, body.size());
+    c->out.assign(hdr, n);
+    c->out += body;
+    c->out_off = 0;
+}
+
+void collector::client_request(client_t *c){
+    size_t sp1 = c->in.find(' ');
+    size_t sp2 = sp1 == std::string::npos ? std::string::npos : c->in.find(' ', sp1 + 1);
+    if(sp2 == std::string::npos || c->in.compare(0, sp1, "GET")){
+        client_reply(c, "400 Bad Request", "{\"error\":\"bad request\"}");
+        return;
+    }
+    std::string target = c->in.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string path = target, query;
+    size_t q = target.find('?');
+    if(q != std::string::npos){
+        path = target.substr(0, q);
+        query = target.substr(q + 1);
+    }
+    if(path == "/devices"){
+        client_reply(c, "200 OK", devices_json());
+        return;
+    }
+    std::string device = query_param(query, "device");
+    if(path == "/metrics"){
+        std::string s = "[";
+        for(const std::string &m : store.metrics(device)){
+            s += s.size() > 1 ? ",\"" : "\"";
+            s += m + "\"";
+        }
+        client_reply(c, "200 OK", s + "]");
+        return;
+    }
+    if(path != "/query"){
+        client_reply(c, "404 Not Found", "{\"error\":\"not found\"}");
+        return;
+    }
+    int64_t to = wall_ms(), from;
+    std::string v = query_param(query, "to");
+    if(!v.empty()){
+        to = atoll(v.c_str());
+    }
+    v = query_param(query, "last");
+    if(!v.empty()){
+        from = to - (int64_t)(atof(v.c_str()) * 1000);
+    } else {
+        v = query_param(query, "from");
+        from = v.empty() ? to - 3600000 : atoll(v.c_str());
+    }
+    v = query_param(query, "step");
+    int64_t step = v.empty() ? -1 : atoll(v.c_str());
+    v = query_param(query, "points");
+    size_t points = v.empty() ? MAX_POINTS : strtoul(v.c_str(), NULL, 10);
+    std::string body;
+    if(!query_json(store, device, query_param(query, "metric"), from, to, step, points, &body)){
+        client_reply(c, "404 Not Found", "{\"error\":\"" + body + "\"}");
+        return;
+    }
+    client_reply(c, "200 OK", body);
+}
+
+void collector::client_event(uint32_t id, uint32_t events){
+    auto it = clients.find(id);
+    if(it == clients.end()){
+        return;
+    }
+    client_t *c = it->second.get();
+    if(c->out.empty() && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        char buf[2048];
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)){
+            client_close(id);
+            return;
+        }
+        if(n > 0){
+            c->in.append(buf, n);
+        }
+        if(c->in.find("\r\n\r\n") != std::string::npos){
+            client_request(c);
+        } else if(c->in.size() > CLIENT_MAX_REQUEST){
+            client_reply(c, "431 Request Header Fields Too Large", "{\"error\":\"request too large\"}");
+        }
+        if(c->out.empty()){
+            return;
+        }
+    }
+    while(c->out_off < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                want_write(epfd, c->fd, ev_tag(KIND_CLIENT, id), true);
+                return;
+            }
+            break;
+        }
+        c->out_off += n;
+    }
+    client_close(id);
+}
+
+int collector::run(){
+    interval_us = (int64_t)(opts.interval_s * 1e6);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(opts.listen_spec){
+        int port = 9100;
+        std::string addr = net_split_host(opts.listen_spec, &port);
+        listen_fd = net_listen(addr.empty() ? NULL : addr.c_str(), port, 128);
+        if(listen_fd < 0){
+            perror("listen");
+            return 1;
+        }
+        net_set_nonblock(listen_fd);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = ev_tag(KIND_LISTEN, 0);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    }
+
+    // Spread first polls evenly over one interval
+    int64_t now = net_now_us();
+    for(size_t i = 0; i < devices.size(); i++){
+        timers.push(std::make_pair(now + (int64_t)(interval_us * (double)i / devices.size()), i));
+    }
+    if(!opts.quiet){
+        fprintf(stderr, "plant_collector polling %zu device(s) every %.1f s into %s%s%s\n", devices.size(),
+                opts.interval_s, opts.data_dir.c_str(), opts.listen_spec ? ", API on " : "",
+                opts.listen_spec ? opts.listen_spec : "");
+    }
+    last_progress = last_sync = now;
+
+    std::vector<struct epoll_event> events(std::max<size_t>(256, std::min<size_t>(devices.size(), 4096)));
+    while(!interrupted){
+        now = net_now_us();
+        int64_t wake = now + 200000;
+        if(!timers.empty()){
+            wake = std::min(wake, timers.top().first);
+        }
+        int n = epoll_wait(epfd, events.data(), (int)events.size(), (int)std::max<int64_t>((wake - now + 999) / 1000, 0));
+        now = net_now_us();
+        for(int i = 0; i < n; i++){
+            uint64_t tag = events[i].data.u64;
+            int kind = (int)(tag >> 32);
+            uint32_t idx = (uint32_t)tag;
+            if(kind == KIND_LISTEN){
+                client_accept();
+            } else if(kind == KIND_DEVICE){
+                device_event(idx, events[i].events, now);
+            } else if(kind == KIND_CLIENT){
+                client_event(idx, events[i].events);
+            }
+        }
+        poll_due(now);
+        check_timeouts(now);
+        progress(now);
+        if(now - last_sync > 30000000){
+            store.sync();
+            last_sync = now;
+        }
+    }
+    store.sync();
+    for(size_t i = 0; i < devices.size(); i++){
+        device_close(i, NULL);
+    }
+    close(epfd);
+    return 0;
+}
+
+static void raise_fd_limit(void){
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max){
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --device NAME=HOST[:PORT]  device to poll, repeatable (default port 80)\n"
+            "  --devices FILE             read \"name host[:port]\" lines from FILE\n"
+            "  --interval S               seconds between polls of each device (default 10)\n"
+            "  --timeout MS               poll timeout (default 3000)\n"
+            "  --data DIR                 series directory (default ./telemetry)\n"
+            "  --listen ADDR:PORT         query API (default 127.0.0.1:9100, \"off\" to disable)\n"
+            "  --query DEVICE/METRIC      print a query result from DIR and exit\n"
+            "  --last S                   with --query: range ending now (default 3600)\n"
+            "  --step MS                  with --query: bucket width, 0 for raw samples\n"
+            "  --quiet                    no progress on stderr\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"device",   required_argument, NULL, 'd'},
+        {"devices",  required_argument, NULL, 'f'},
+        {"interval", required_argument, NULL, 'i'},
+        {"timeout",  required_argument, NULL, 't'},
+        {"data",     required_argument, NULL, 'D'},
+        {"listen",   required_argument, NULL, 'l'},
+        {"query",    required_argument, NULL, 'Q'},
+        {"last",     required_argument, NULL, 'L'},
+        {"step",     required_argument, NULL, 's'},
+        {"quiet",    no_argument,       NULL, 'q'},
+        {"help",     no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    collector_opts_t o;
+    o.devices_file = NULL;
+    o.interval_s = 10;
+    o.timeout_ms = 3000;
+    o.data_dir = "./telemetry";
+    o.listen_spec = "127.0.0.1:9100";
+    o.query = NULL;
+    o.last_s = 3600;
+    o.step_ms = -1;
+    o.quiet = false;
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "d:f:i:t:D:l:Q:L:s:qh", options, NULL)) != -1){
+        switch(opt){
+            case 'd': o.device_specs.push_back(optarg); break;
+            case 'f': o.devices_file = optarg; break;
+            case 'i': o.interval_s = std::max(0.1, atof(optarg)); break;
+            case 't': o.timeout_ms = std::max(1, atoi(optarg)); break;
+            case 'D': o.data_dir = optarg; break;
+            case 'l': o.listen_spec = strcmp(optarg, "off") ? optarg : NULL; break;
+            case 'Q': o.query = optarg; break;
+            case 'L': o.last_s = atof(optarg); break;
+            case 's': o.step_ms = atoll(optarg); break;
+            case 'q': o.quiet = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    if(o.query){
+        const char *slash = strchr(o.query, '/');
+        if(!slash){
+            fprintf(stderr, "--query expects DEVICE/METRIC\n");
+            return 2;
+        }
+        series_store store(o.data_dir);
+        int64_t to = wall_ms();
+        std::string out;
+        if(!query_json(store, std::string(o.query, slash - o.query), slash + 1, to - (int64_t)(o.last_s * 1000), to,
+                       o.step_ms, MAX_POINTS, &out)){
+            fprintf(stderr, "%s\n", out.c_str());
+            return 1;
+        }
+        printf("%s\n", out.c_str());
+        return 0;
+    }
+
+    std::unique_ptr<collector> c(new collector(o));
+    for(const std::string &spec : o.device_specs){
+        size_t eq = spec.find('=');
+        if(eq == std::string::npos || !c->add_device(spec.substr(0, eq), spec.substr(eq + 1))){
+            fprintf(stderr, "bad --device '%s', expected NAME=HOST[:PORT]\n", spec.c_str());
+            return 2;
+        }
+    }
+    if(o.devices_file && !c->load_devices(o.devices_file)){
+        return 2;
+    }
+    if(o.device_specs.empty() && !o.devices_file){
+        usage(argv[0]);
+        return 2;
+    }
+    raise_fd_limit();
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_sigint);
+    signal(SIGTERM, on_sigint);
+    return c->run();
+}
@@ -0,0 +1,707 @@
+/*
+  Smart Plant Vision - glass-to-glass latency probe
+
+  Turns on the firmware's latency mode (/control?var=latency&val=1), in which
+  every JPEG carries a COM segment with a sequence number, the frame's grab
+  time and the time the handler sent it, all on the device clock. The device
+  clock is mapped to ours by bracketing /clock requests (lowest round trip
+  wins) before and after the run, so drift is interpolated out.
+
+  Each link of camera -> :81/stream -> Flask predict() gets a distribution:
+
+    device     grab -> handler send (device clock only, exact)
+    network    handler send -> first byte of the part here
+    transfer   first -> last byte of the part
+    stream     grab -> whole frame received here
+    upload     POST to /predict -> response, minus the server's own time
+    inference  server time reported by predict() (decode, detect, classify)
+    predict    grab -> predict() result received here
+
+  The predict links are only measured with --predict; one request is in
+  flight at a time and it always takes the newest complete frame, the way a
+  live inference loop would. Results are printed as JSON on stdout.
+
+  Usage: plant_latency --host 192.168.1.50 --duration 30 --predict 127.0.0.1:5000
+*/
+
+#include "http_response.h"
+#include "mjpeg_parser.h"
+#include "net_util.h"
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define MARKER_LEN          30
+#define MAX_JSON            65536
+#define RECONNECT_US        1000000
+#define FORM_BOUNDARY       "plantlatency7d1f"
+
+enum { CONN_STREAM, CONN_PREDICT, CONN_COUNT };
+
+enum { L_DEVICE, L_NETWORK, L_TRANSFER, L_STREAM, L_UPLOAD, L_INFERENCE, L_PREDICT, L_COUNT };
+static const char *link_names[L_COUNT] = {"device", "network", "transfer", "stream", "upload", "inference", "predict"};
+
+typedef struct {
+    std::string host;
+    int port;
+    int stream_port;
+    std::string predict_host;
+    int predict_port;
+    std::string predict_path;
+    double duration_s;
+    int probes;
+    int timeout_ms;
+    bool quiet;
+} latency_opts_t;
+
+typedef struct {
+    int64_t local_us;       // Midpoint of the exchange on our clock
+    int64_t offset_us;      // Device clock minus ours
+    int64_t rtt_us;
+} clock_sample_t;
+
+typedef struct {
+    int64_t grab_dev;
+    int64_t send_dev;
+    int64_t first_us;
+    int64_t end_us;
+} frame_sample_t;
+
+typedef struct {
+    int64_t grab_dev;
+    int64_t post_us;
+    int64_t resp_us;
+    double server_ms;
+} predict_sample_t;
+
+typedef struct {
+    int fd;
+    bool connecting;
+    bool busy;
+    std::string out;
+    size_t out_off;
+    http_response resp;
+    std::string body;
+    int64_t deadline_us;
+    int64_t retry_at_us;
+} conn_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+static uint64_t get_be(const uint8_t *p, int n){
+    uint64_t v = 0;
+    for(int i = 0; i < n; i++){
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// One GET on a blocking keep-alive connection; t0/t1 bracket the exchange
+static bool blocking_get(int fd, const std::string &host, const char *path, std::string *body,
+                         int64_t *t0, int64_t *t1){
+    std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    http_response resp;
+    body->clear();
+    resp.on_body = [body](const char *data, size_t len){
+        if(body->size() + len <= MAX_JSON){
+            body->append(data, len);
+        }
+    };
+    *t0 = net_now_us();
+    if(send(fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size()){
+        return false;
+    }
+    char buf[4096];
+    while(!resp.done()){
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0){
+            return false;
+        }
+        if(resp.feed(buf, n) < 0){
+            return false;
+        }
+    }
+    *t1 = net_now_us();
+    return resp.status() == 200 && resp.keep_alive();
+}
+
+static int blocking_connect(const latency_opts_t &o){
+    int fd = net_connect(o.host.c_str(), o.port, false);
+    if(fd < 0){
+        return -1;
+    }
+    struct timeval tv = {o.timeout_ms / 1000, (o.timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    net_set_nodelay(fd);
+    return fd;
+}
+
+// Lowest round trip of n /clock probes; false if the device has no /clock
+static bool sync_clock(const latency_opts_t &o, clock_sample_t *best){
+    int fd = blocking_connect(o);
+    if(fd < 0){
+        return false;
+    }
+    best->rtt_us = INT64_MAX;
+    std::string body;
+    for(int i = 0; i < o.probes && !interrupted; i++){
+        int64_t t0, t1;
+        if(!blocking_get(fd, o.host, "/clock", &body, &t0, &t1)){
+            break;
+        }
+        const char *v = strstr(body.c_str(), "\"t_us\":");
+        if(!v){
+            break;
+        }
+        int64_t dev = strtoll(v + 7, NULL, 10);
+        if(t1 - t0 < best->rtt_us){
+            best->rtt_us = t1 - t0;
+            best->local_us = t0 + (t1 - t0) / 2;
+            best->offset_us = dev - best->local_us;
+        }
+    }
+    close(fd);
+    return best->rtt_us != INT64_MAX;
+}
+
+static bool set_latency_mode(const latency_opts_t &o, bool on){
+    int fd = blocking_connect(o);
+    if(fd < 0){
+        return false;
+    }
+    std::string body;
+    int64_t t0, t1;
+    bool ok = blocking_get(fd, o.host, on ? "/control?var=latency&val=1" : "/control?var=latency&val=0",
+                           &body, &t0, &t1);
+    close(fd);
+    return ok;
+}
+
+// Numeric value of "key": anywhere in a JSON body, NAN when absent
+static double json_number(const std::string &s, const char *key){
+    std::string k = std::string("\"") + key + "\"";
+    size_t pos = s.find(k);
+    if(pos == std::string::npos){
+        return NAN;
+    }
+    const char *p = s.c_str() + pos + k.size();
+    while(*p == ' ' || *p == ':'){
+        p++;
+    }
+    char *end;
+    double v = strtod(p, &end);
+    return end == p ? NAN : v;
+}
+
+static void print_dist(FILE *f, const char *name, std::vector<int64_t> &v){
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for(int64_t x : v){
+        sum += x;
+    }
+    auto pct = [&v](double p){
+        if(v.empty()){
+            return 0.0;
+        }
+        size_t idx = (size_t)ceil(p * v.size());
+        idx = idx ? idx - 1 : 0;
+        return v[std::min(idx, v.size() - 1)] / 1000.0;
+    };
+    fprintf(f, "\"%s\":{\"count\":%zu,\"mean\":%.3f,\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+            name, v.size(), v.empty() ? 0.0 : sum / v.size() / 1000.0, v.empty() ? 0.0 : v.front() / 1000.0,
+            pct(0.50), pct(0.90), pct(0.99), v.empty() ? 0.0 : v.back() / 1000.0);
+}
+
+class latency_probe {
+public:
+    explicit latency_probe(const latency_opts_t &o) : opts(o) {}
+
+    int run();
+
+private:
+    void conn_open(int k, int64_t now);
+    void conn_close(int k, int64_t now);
+    void conn_event(int k, uint32_t events, int64_t now);
+    void predict_start(int64_t now);
+    void predict_done(int64_t now);
+    bool stream_accept();
+    int64_t to_local(int64_t dev_us) const;
+    void report(FILE *f, double elapsed_s);
+
+    static int on_part_begin(void *user, const mjpeg_part_t *part);
+    static int on_part_data(void *user, const uint8_t *data, size_t len);
+    static int on_part_end(void *user, const mjpeg_part_t *part);
+
+    latency_opts_t opts;
+    int epfd = -1;
+    conn_t conns[CONN_COUNT];
+    mjpeg_parser_t parser;
+    bool parser_ready = false;
+    clock_sample_t sync_start, sync_end;
+    bool have_end_sync = false;
+
+    // Part being received
+    uint8_t marker[MARKER_LEN];
+    size_t marker_len = 0;
+    int64_t part_first_us = 0;
+    std::string part;
+    bool keep_part = false;
+
+    // Newest complete frame, waiting for the predict connection
+    std::string ready_frame;
+    int64_t ready_grab_dev = 0;
+    int64_t predict_grab_dev = 0;
+    int64_t predict_post_us = 0;
+
+    std::vector<frame_sample_t> frames;
+    std::vector<predict_sample_t> predicts;
+    uint64_t unmarked = 0;
+    uint64_t errors = 0;
+    uint64_t predict_errors = 0;
+};
+
+int latency_probe::on_part_begin(void *user, const mjpeg_part_t *part){
+    latency_probe *p = (latency_probe *)user;
+    p->marker_len = 0;
+    p->part_first_us = 0;
+    p->part.clear();
+    p->keep_part = p->opts.predict_port > 0;
+    if(p->keep_part && part->content_length > 0){
+        p->part.reserve(part->content_length);
+    }
+    return 0;
+}
+
+int latency_probe::on_part_data(void *user, const uint8_t *data, size_t len){
+    latency_probe *p = (latency_probe *)user;
+    if(!p->part_first_us){
+        p->part_first_us = net_now_us();
+    }
+    if(p->marker_len < MARKER_LEN){
+        size_t n = std::min(len, (size_t)MARKER_LEN - p->marker_len);
+        memcpy(p->marker + p->marker_len, data, n);
+        p->marker_len += n;
+    }
+    if(p->keep_part){
+        p->part.append((const char *)data, len);
+    }
+    return 0;
+}
+
+int latency_probe::on_part_end(void *user, const mjpeg_part_t *part){
+    (void)part;
+    latency_probe *p = (latency_probe *)user;
+    static const uint8_t head[] = {0xFF, 0xD8, 0xFF, 0xFE, 0x00, 0x1A, 'P', 'L', 'A', 'T'};
+    if(p->marker_len < MARKER_LEN || memcmp(p->marker, head, sizeof(head))){
+        p->unmarked++;
+        return 0;
+    }
+    frame_sample_t s;
+    s.grab_dev = (int64_t)get_be(p->marker + 14, 8);
+    s.send_dev = (int64_t)get_be(p->marker + 22, 8);
+    s.first_us = p->part_first_us;
+    s.end_us = net_now_us();
+    p->frames.push_back(s);
+    if(p->keep_part){
+        p->ready_frame.swap(p->part);
+        p->ready_grab_dev = s.grab_dev;
+    }
+    return 0;
+}
+
+// Device time to ours, with the offset drifting linearly between the two syncs
+int64_t latency_probe::to_local(int64_t dev_us) const {
+    int64_t off = sync_start.offset_us;
+    if(have_end_sync && sync_end.local_us > sync_start.local_us){
+        double slope = (double)(sync_end.offset_us - sync_start.offset_us) / (sync_end.local_us - sync_start.local_us);
+        off += (int64_t)(slope * (dev_us - sync_start.offset_us - sync_start.local_us));
+    }
+    return dev_us - off;
+}
+
+bool latency_probe::stream_accept(){
+    const http_response &resp = conns[CONN_STREAM].resp;
+    const std::string *ct = resp.header("Content-Type");
+    char b[MJPEG_MAX_BOUNDARY + 1];
+    if(resp.status() != 200 || !ct || !mjpeg_boundary_from_content_type(ct->c_str(), b, sizeof(b))){
+        return false;
+    }
+    mjpeg_callbacks_t cb = {on_part_begin, on_part_data, on_part_end};
+    mjpeg_parser_init(&parser, b, &cb, this);
+    parser_ready = true;
+    return true;
+}
+
+void latency_probe::conn_open(int k, int64_t now){
+    conn_t *c = &conns[k];
+    c->fd = k == CONN_STREAM ? net_connect(opts.host.c_str(), opts.stream_port, true)
+                             : net_connect(opts.predict_host.c_str(), opts.predict_port, true);
+    if(c->fd < 0){
+        c->retry_at_us = now + RECONNECT_US;
+        k == CONN_STREAM ? errors++ : predict_errors++;
+        return;
+    }
+    net_set_nodelay(c->fd);
+    c->connecting = true;
+    c->out_off = 0;
+    c->resp.reset();
+    c->body.clear();
+    c->deadline_us = k == CONN_STREAM ? now + (int64_t)opts.timeout_ms * 1000 : INT64_MAX;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.u32 = k;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+void latency_probe::conn_close(int k, int64_t now){
+    conn_t *c = &conns[k];
+    if(c->fd >= 0){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->connecting = c->busy = false;
+    c->retry_at_us = now + RECONNECT_US;
+    if(k == CONN_STREAM){
+        parser_ready = false;
+    }
+}
+
+// POSTs the newest frame as a multipart form, the way the dashboard uploads
+void latency_probe::predict_start(int64_t now){
+    conn_t *c = &conns[CONN_PREDICT];
+    std::string head = "--" FORM_BOUNDARY "\r\n"
+                       "Content-Disposition: form-data; name=\"images\"; filename=\"frame.jpg\"\r\n"
+                       "Content-Type: image/jpeg\r\n\r\n";
+    const char *tail = "\r\n--" FORM_BOUNDARY "--\r\n";
+    size_t body_len = head.size() + ready_frame.size() + strlen(tail);
+    char req[512];
+    snprintf(req, sizeof(req),
+             "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: multipart/form-data; boundary=" FORM_BOUNDARY "\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+             opts.predict_path.c_str(), opts.predict_host.c_str(), body_len);
+    c->out.assign(req);
+    c->out += head;
+    c->out += ready_frame;
+    c->out += tail;
+    ready_frame.clear();
+    predict_grab_dev = ready_grab_dev;
+    predict_post_us = now;
+    conn_open(CONN_PREDICT, now);
+    if(c->fd >= 0){
+        c->busy = true;
+        c->deadline_us = now + (int64_t)opts.timeout_ms * 1000;
+    }
+}
+
+void latency_probe::predict_done(int64_t now){
+    conn_t *c = &conns[CONN_PREDICT];
+    double server_ms = json_number(c->body, "total_ms");
+    if(c->resp.status() != 200 || isnan(server_ms)){
+        if(!predict_errors++ && !opts.quiet){
+            fprintf(stderr, "predict: HTTP %d without timing (is app.py up to date?)\n", c->resp.status());
+        }
+    } else {
+        predict_sample_t s = {predict_grab_dev, predict_post_us, now, server_ms};
+        predicts.push_back(s);
+    }
+    conn_close(CONN_PREDICT, now);
+    c->retry_at_us = now;
+}
+
+void latency_probe::conn_event(int k, uint32_t events, int64_t now){
+    conn_t *c = &conns[k];
+    if(c->fd < 0){
+        return;
+    }
+    if(c->connecting){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+            return;
+        }
+        if(net_connect_result(c->fd) != 0){
+            k == CONN_STREAM ? errors++ : predict_errors++;
+            conn_close(k, now);
+            return;
+        }
+        c->connecting = false;
+        if(k == CONN_STREAM){
+            c->out = "GET /stream HTTP/1.1\r\nHost: " + opts.host + "\r\n\r\n";
+            c->busy = true;
+            c->deadline_us = INT64_MAX;
+        }
+    }
+    if(events & EPOLLOUT && c->out_off < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0 && errno != EAGAIN && errno != EINTR){
+            k == CONN_STREAM ? errors++ : predict_errors++;
+            conn_close(k, now);
+            return;
+        }
+        c->out_off += n > 0 ? n : 0;
+        if(c->out_off == c->out.size()){
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u32 = k;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+    }
+    if(!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        return;
+    }
+    char buf[65536];
+    for(;;){
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                return;
+            }
+            k == CONN_STREAM ? errors++ : predict_errors++;
+            conn_close(k, now);
+            return;
+        }
+        if(n == 0){
+            if(k == CONN_PREDICT && c->busy && c->resp.feed_eof()){
+                predict_done(now);
+                return;
+            }
+            if(k == CONN_STREAM){
+                fprintf(stderr, "/stream closed by device, reconnecting\n");
+            }
+            k == CONN_STREAM ? errors++ : predict_errors++;
+            conn_close(k, now);
+            return;
+        }
+        if(!c->busy || c->resp.feed(buf, n) < 0){
+            k == CONN_STREAM ? errors++ : predict_errors++;
+            conn_close(k, now);
+            return;
+        }
+        if(k == CONN_STREAM && c->resp.headers_done() && !parser_ready && !stream_accept()){
+            fprintf(stderr, "/stream: HTTP %d without a multipart boundary\n", c->resp.status());
+            interrupted = 1;
+            return;
+        }
+        if(c->resp.done()){
+            if(k == CONN_PREDICT){
+                predict_done(now);
+            } else {
+                conn_close(k, now);
+            }
+            return;
+        }
+    }
+}
+
+void latency_probe::report(FILE *f, double elapsed_s){
+    std::vector<int64_t> d[L_COUNT];
+    for(const frame_sample_t &s : frames){
+        int64_t grab = to_local(s.grab_dev);
+        d[L_DEVICE].push_back(s.send_dev - s.grab_dev);
+        d[L_NETWORK].push_back(s.first_us - to_local(s.send_dev));
+        d[L_TRANSFER].push_back(s.end_us - s.first_us);
+        d[L_STREAM].push_back(s.end_us - grab);
+    }
+    for(const predict_sample_t &s : predicts){
+        int64_t server_us = (int64_t)(s.server_ms * 1000);
+        d[L_UPLOAD].push_back(s.resp_us - s.post_us - server_us);
+        d[L_INFERENCE].push_back(server_us);
+        d[L_PREDICT].push_back(s.resp_us - to_local(s.grab_dev));
+    }
+    double drift_ppm = 0;
+    if(have_end_sync && sync_end.local_us > sync_start.local_us){
+        drift_ppm = (double)(sync_end.offset_us - sync_start.offset_us) / (sync_end.local_us - sync_start.local_us) * 1e6;
+    }
+    fprintf(f, "{\"duration_s\":%.3f,\"frames\":%zu,\"unmarked_frames\":%llu,\"stream_errors\":%llu,"
+               "\"predicts\":%zu,\"predict_errors\":%llu,",
+            elapsed_s, frames.size(), (unsigned long long)unmarked, (unsigned long long)errors, predicts.size(),
+            (unsigned long long)predict_errors);
+    fprintf(f, "\"clock\":{\"rtt_ms\":%.3f,\"uncertainty_ms\":%.3f,\"drift_ppm\":%.1f},",
+            sync_start.rtt_us / 1000.0, (have_end_sync ? std::max(sync_start.rtt_us, sync_end.rtt_us)
+                                                       : sync_start.rtt_us) / 2000.0, drift_ppm);
+    fprintf(f, "\"latency_ms\":{");
+    for(int l = 0; l < L_COUNT; l++){
+        print_dist(f, link_names[l], d[l]);
+        fputc(l + 1 < L_COUNT ? ',' : '}', f);
+    }
+    fprintf(f, "}\n");
+}
+
+int latency_probe::run(){
+    if(!sync_clock(opts, &sync_start)){
+        fprintf(stderr, "%s:%d: no /clock endpoint; the firmware needs latency mode support\n", opts.host.c_str(),
+                opts.port);
+        return 1;
+    }
+    if(!set_latency_mode(opts, true)){
+        fprintf(stderr, "%s:%d: could not enable latency mode\n", opts.host.c_str(), opts.port);
+        return 1;
+    }
+    if(!opts.quiet){
+        fprintf(stderr, "clock offset %+.3f ms (rtt %.3f ms), latency mode on\n", sync_start.offset_us / 1000.0,
+                sync_start.rtt_us / 1000.0);
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    for(int k = 0; k < CONN_COUNT; k++){
+        conns[k].fd = -1;
+        conns[k].retry_at_us = 0;
+        conns[k].connecting = conns[k].busy = false;
+    }
+    conn_t *sc = &conns[CONN_STREAM];
+    sc->resp.on_body = [this](const char *data, size_t len){
+        if(parser_ready || stream_accept()){
+            mjpeg_parser_feed(&parser, (const uint8_t *)data, len);
+        }
+    };
+    conn_t *pc = &conns[CONN_PREDICT];
+    pc->resp.on_body = [pc](const char *data, size_t len){
+        if(pc->body.size() + len <= MAX_JSON){
+            pc->body.append(data, len);
+        }
+    };
+
+    int64_t t0 = net_now_us();
+    int64_t end = t0 + (int64_t)(opts.duration_s * 1e6);
+    int64_t last_progress = t0;
+    struct epoll_event events[8];
+    while(!interrupted){
+        int64_t now = net_now_us();
+        if(now >= end){
+            break;
+        }
+        if(sc->fd < 0 && now >= sc->retry_at_us){
+            conn_open(CONN_STREAM, now);
+        } else if(sc->fd >= 0 && sc->connecting && now > sc->deadline_us){
+            fprintf(stderr, "/stream: connect timed out\n");
+            errors++;
+            conn_close(CONN_STREAM, now);
+        }
+        if(opts.predict_port > 0){
+            if(pc->fd < 0 && !ready_frame.empty() && now >= pc->retry_at_us){
+                predict_start(now);
+            } else if(pc->fd >= 0 && now > pc->deadline_us){
+                fprintf(stderr, "predict: timed out\n");
+                predict_errors++;
+                conn_close(CONN_PREDICT, now);
+            }
+        }
+        if(!opts.quiet && now - last_progress >= 5000000){
+            fprintf(stderr, "%.0fs: %zu frames, %zu predictions\n", (now - t0) / 1e6, frames.size(), predicts.size());
+            last_progress = now;
+        }
+        int n = epoll_wait(epfd, events, 8, 100);
+        now = net_now_us();
+        for(int i = 0; i < n; i++){
+            conn_event((int)events[i].data.u32, events[i].events, now);
+        }
+    }
+    double elapsed_s = (net_now_us() - t0) / 1e6;
+    for(int k = 0; k < CONN_COUNT; k++){
+        conn_close(k, net_now_us());
+    }
+    close(epfd);
+
+    have_end_sync = sync_clock(opts, &sync_end);
+    if(!set_latency_mode(opts, false)){
+        fprintf(stderr, "could not turn latency mode off again\n");
+    }
+    report(stdout, elapsed_s);
+    return frames.empty() ? 1 : 0;
+}
+
+// "host[:port][/path]" for the Flask app, path defaulting to /predict
+static void parse_predict(const char *spec, latency_opts_t *o){
+    std::string s = spec;
+    if(!s.compare(0, 7, "http://")){
+        s.erase(0, 7);
+    }
+    size_t slash = s.find('/');
+    o->predict_path = slash == std::string::npos ? "/predict" : s.substr(slash);
+    o->predict_port = 5000;
+    o->predict_host = net_split_host(s.substr(0, slash).c_str(), &o->predict_port);
+}
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --host H[:P]          device address (default 127.0.0.1:8080)\n"
+            "  --port P              HTTP port (default 8080; use 80 for a real device)\n"
+            "  --stream-port P       stream port (default port + 1)\n"
+            "  --duration S          seconds to measure (default 30)\n"
+            "  --predict H[:P][/PATH]  also POST frames to the Flask app (default port 5000, /predict)\n"
+            "  --probes N            /clock round trips per clock sync (default 32)\n"
+            "  --timeout MS          connect and predict timeout (default 30000)\n"
+            "  --quiet               no progress on stderr\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"host",        required_argument, NULL, 'H'},
+        {"port",        required_argument, NULL, 'p'},
+        {"stream-port", required_argument, NULL, 's'},
+        {"duration",    required_argument, NULL, 'd'},
+        {"predict",     required_argument, NULL, 'P'},
+        {"probes",      required_argument, NULL, 'n'},
+        {"timeout",     required_argument, NULL, 't'},
+        {"quiet",       no_argument,       NULL, 'q'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    latency_opts_t o;
+    o.host = "127.0.0.1";
+    o.port = 8080;
+    o.stream_port = 0;
+    o.predict_port = 0;
+    o.duration_s = 30;
+    o.probes = 32;
+    o.timeout_ms = 30000;
+    o.quiet = false;
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "H:p:s:d:P:n:t:qh", options, NULL)) != -1){
+        switch(opt){
+            case 'H': o.host = net_split_host(optarg, &o.port); break;
+            case 'p': o.port = atoi(optarg); break;
+            case 's': o.stream_port = atoi(optarg); break;
+            case 'd': o.duration_s = atof(optarg); break;
+            case 'P': parse_predict(optarg, &o); break;
+            case 'n': o.probes = std::max(1, atoi(optarg)); break;
+            case 't': o.timeout_ms = std::max(1, atoi(optarg)); break;
+            case 'q': o.quiet = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if(optind != argc || o.duration_s <= 0){
+        usage(argv[0]);
+        return 2;
+    }
+    if(!o.stream_port){
+        o.stream_port = o.port + 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_sigint);
+    signal(SIGTERM, on_sigint);
+
+    std::unique_ptr<latency_probe> p(new latency_probe(o));
+    return p->run();
+}
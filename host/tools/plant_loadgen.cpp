@@ -0,0 +1,745 @@
+/*
+  Smart Plant Vision - HTTP load generator
+
+  Drives a device (or plant_host) from a single epoll loop: N concurrent
+  /stream viewers plus open-loop request traffic on /capture, /sensors and
+  /control at fixed rates. Request latency is measured from the time each
+  request was scheduled, so a server that stalls is charged for the queueing
+  it causes (service time from the actual send is reported alongside).
+  Each stream is run through the multipart parser to get per-viewer fps.
+
+  Results are printed as JSON on stdout; progress goes to stderr.
+
+  Usage: plant_loadgen --host 192.168.1.50 --duration 30 --viewers 2 \
+                       --capture-rate 2 --sensors-rate 5 --control-rate 1
+*/
+
+#include "http_response.h"
+#include "mjpeg_parser.h"
+#include "net_util.h"
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum { EP_CAPTURE, EP_SENSORS, EP_CONTROL, EP_COUNT };
+static const char *ep_names[EP_COUNT] = {"capture", "sensors", "control"};
+
+enum { KIND_REQUEST = 1, KIND_VIEWER = 2 };
+
+typedef struct {
+    std::string host;
+    int port;
+    int stream_port;
+    double duration_s;
+    int viewers;
+    double rate[EP_COUNT];
+    int conns;
+    int timeout_ms;
+    std::vector<std::string> controls;
+    const char *out_path;
+    bool quiet;
+} loadgen_opts_t;
+
+typedef struct {
+    uint64_t scheduled;
+    uint64_t ok;
+    uint64_t skipped;        // Dropped because the backlog exceeded the timeout
+    uint64_t err_connect;
+    uint64_t err_timeout;
+    uint64_t err_http;
+    uint64_t err_io;
+    uint64_t bytes;
+    std::vector<uint32_t> latency_us;
+    std::vector<uint32_t> service_us;
+} endpoint_stats_t;
+
+typedef struct {
+    int fd;
+    int ep;
+    bool connecting;
+    bool busy;
+    std::string out;
+    size_t out_off;
+    http_response resp;
+    int64_t intended_us;
+    int64_t sent_us;
+    int64_t deadline_us;
+    int64_t retry_at_us;
+} req_conn_t;
+
+typedef struct {
+    int fd;
+    bool connecting;
+    bool sent;
+    bool failed;
+    std::string out;
+    size_t out_off;
+    http_response resp;
+    mjpeg_parser_t mp;
+    bool mp_ready;
+    int64_t start_us;
+    int64_t first_frame_us;
+    int64_t last_frame_us;
+    uint64_t frames;
+    uint64_t bytes;
+    std::vector<uint32_t> gaps_us;
+    std::string error;
+} viewer_t;
+
+static int viewer_on_frame(void *user, const mjpeg_part_t *part){
+    (void)part;
+    viewer_t *v = (viewer_t *)user;
+    int64_t t = net_now_us();
+    if(v->frames == 0){
+        v->first_frame_us = t;
+    } else {
+        v->gaps_us.push_back((uint32_t)(t - v->last_frame_us));
+    }
+    v->last_frame_us = t;
+    v->frames++;
+    return 0;
+}
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+static uint64_t ev_tag(int kind, size_t idx){
+    return ((uint64_t)kind << 32) | idx;
+}
+
+static double pct_ms(std::vector<uint32_t> &v, double p){
+    if(v.empty()){
+        return 0;
+    }
+    size_t idx = (size_t)ceil(p * v.size());
+    idx = idx ? idx - 1 : 0;
+    if(idx >= v.size()){
+        idx = v.size() - 1;
+    }
+    return v[idx] / 1000.0;
+}
+
+static void print_dist(FILE *f, const char *name, std::vector<uint32_t> &v){
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for(uint32_t x : v){
+        sum += x;
+    }
+    fprintf(f, "\"%s\":{\"count\":%zu,\"mean\":%.3f,\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}",
+            name, v.size(), v.empty() ? 0.0 : sum / v.size() / 1000.0,
+            pct_ms(v, 0.50), pct_ms(v, 0.99), pct_ms(v, 0.999), v.empty() ? 0.0 : v.back() / 1000.0);
+}
+
+static std::string json_escape(const std::string &s){
+    std::string o;
+    for(char c : s){
+        if(c == '"' || c == '\\'){
+            o += '\\';
+        }
+        o += (c >= 0x20) ? c : ' ';
+    }
+    return o;
+}
+
+class loadgen {
+public:
+    explicit loadgen(const loadgen_opts_t &o) : opts(o) {}
+
+    int run();
+
+private:
+    void req_open(size_t idx, int64_t now);
+    void req_close(size_t idx, int64_t now, uint64_t *err);
+    void req_dispatch(size_t idx, int64_t now);
+    void req_on_event(size_t idx, uint32_t events, int64_t now);
+    void req_finish(size_t idx, int64_t now);
+    bool req_flush(req_conn_t *c);
+
+    void viewer_open(size_t idx, int64_t now);
+    void viewer_fail(size_t idx, const char *why);
+    void viewer_on_event(size_t idx, uint32_t events, int64_t now);
+
+    void schedule(int64_t now);
+    void check_timeouts(int64_t now);
+    void progress(int64_t now);
+    void report(FILE *f, double elapsed_s);
+
+    loadgen_opts_t opts;
+    int epfd;
+    std::vector<std::unique_ptr<req_conn_t>> reqs;
+    std::vector<std::unique_ptr<viewer_t>> viewers;
+    endpoint_stats_t stats[EP_COUNT];
+    std::deque<int64_t> backlog[EP_COUNT];
+    int64_t next_due[EP_COUNT];
+    size_t control_next = 0;
+    int64_t last_progress = 0;
+    uint64_t last_bytes = 0;
+};
+
+static bool want_write(int epfd, int fd, uint64_t tag, bool write){
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP | (write ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.u64 = tag;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void loadgen::req_open(size_t idx, int64_t now){
+    req_conn_t *c = reqs[idx].get();
+    c->fd = net_connect(opts.host.c_str(), opts.port, true);
+    if(c->fd < 0){
+        stats[c->ep].err_connect++;
+        c->retry_at_us = now + 200000;
+        return;
+    }
+    c->connecting = true;
+    c->busy = false;
+    c->sent_us = now;
+    c->resp.reset();
+    struct epoll_event ev = {};
+    ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = ev_tag(KIND_REQUEST, idx);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+// Drops the connection; an in-flight request is charged to *err
+void loadgen::req_close(size_t idx, int64_t now, uint64_t *err){
+    req_conn_t *c = reqs[idx].get();
+    if(c->fd >= 0){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+    if(c->busy && err){
+        (*err)++;
+    }
+    c->busy = false;
+    c->connecting = false;
+    c->retry_at_us = now + 50000;
+}
+
+bool loadgen::req_flush(req_conn_t *c){
+    while(c->out_off < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                return true;
+            }
+            return false;
+        }
+        c->out_off += n;
+    }
+    return true;
+}
+
+void loadgen::req_dispatch(size_t idx, int64_t now){
+    req_conn_t *c = reqs[idx].get();
+    if(c->fd < 0 || c->connecting || c->busy || backlog[c->ep].empty()){
+        return;
+    }
+    c->intended_us = backlog[c->ep].front();
+    backlog[c->ep].pop_front();
+
+    std::string path;
+    switch(c->ep){
+        case EP_CAPTURE: path = "/capture"; break;
+        case EP_SENSORS: path = "/sensors"; break;
+        default:
+            path = "/control?" + opts.controls[control_next++ % opts.controls.size()];
+            break;
+    }
+    c->out = "GET " + path + " HTTP/1.1\r\nHost: " + opts.host + "\r\nAccept: */*\r\n\r\n";
+    c->out_off = 0;
+    c->resp.reset();
+    c->busy = true;
+    c->sent_us = now;
+    c->deadline_us = now + (int64_t)opts.timeout_ms * 1000;
+    if(!req_flush(c)){
+        req_close(idx, now, &stats[c->ep].err_io);
+        return;
+    }
+    want_write(epfd, c->fd, ev_tag(KIND_REQUEST, idx), c->out_off < c->out.size());
+}
+
+void loadgen::req_finish(size_t idx, int64_t now){
+    req_conn_t *c = reqs[idx].get();
+    endpoint_stats_t &st = stats[c->ep];
+    st.bytes += c->resp.body_bytes();
+    if(c->resp.status() >= 200 && c->resp.status() < 300){
+        st.ok++;
+        st.latency_us.push_back((uint32_t)std::min<int64_t>(now - c->intended_us, UINT32_MAX));
+        st.service_us.push_back((uint32_t)std::min<int64_t>(now - c->sent_us, UINT32_MAX));
+    } else {
+        st.err_http++;
+    }
+    c->busy = false;
+    if(!c->resp.keep_alive()){
+        req_close(idx, now, NULL);
+        c->retry_at_us = now;
+        return;
+    }
+    c->resp.reset();
+    req_dispatch(idx, now);
+}
+
+void loadgen::req_on_event(size_t idx, uint32_t events, int64_t now){
+    req_conn_t *c = reqs[idx].get();
+    if(c->fd < 0){
+        return;
+    }
+    if(c->connecting){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+            return;
+        }
+        if(net_connect_result(c->fd) != 0){
+            stats[c->ep].err_connect++;
+            req_close(idx, now, NULL);
+            c->retry_at_us = now + 200000;
+            return;
+        }
+        c->connecting = false;
+        want_write(epfd, c->fd, ev_tag(KIND_REQUEST, idx), false);
+        req_dispatch(idx, now);
+        return;
+    }
+    if(events & EPOLLOUT){
+        if(!req_flush(c)){
+            req_close(idx, now, &stats[c->ep].err_io);
+            return;
+        }
+        want_write(epfd, c->fd, ev_tag(KIND_REQUEST, idx), c->out_off < c->out.size());
+    }
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+        char buf[65536];
+        for(;;){
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            if(n < 0){
+                if(errno == EAGAIN || errno == EINTR){
+                    return;
+                }
+                req_close(idx, now, &stats[c->ep].err_io);
+                return;
+            }
+            if(n == 0){
+                if(c->busy && c->resp.feed_eof()){
+                    req_finish(idx, now);
+                }
+                req_close(idx, now, &stats[c->ep].err_io);
+                c->retry_at_us = now;
+                return;
+            }
+            if(!c->busy){
+                // Unsolicited bytes, the server is confused
+                req_close(idx, now, &stats[c->ep].err_io);
+                return;
+            }
+            if(c->resp.feed(buf, n) < 0){
+                req_close(idx, now, &stats[c->ep].err_http);
+                return;
+            }
+            if(c->resp.done()){
+                req_finish(idx, now);
+                if(c->fd < 0){
+                    return;
+                }
+            }
+        }
+    }
+}
+
+void loadgen::viewer_fail(size_t idx, const char *why){
+    viewer_t *v = viewers[idx].get();
+    if(v->fd >= 0){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, v->fd, NULL);
+        close(v->fd);
+        v->fd = -1;
+    }
+    if(!v->failed){
+        v->failed = true;
+        v->error = why;
+    }
+}
+
+void loadgen::viewer_open(size_t idx, int64_t now){
+    viewer_t *v = viewers[idx].get();
+    v->start_us = now;
+    v->fd = net_connect(opts.host.c_str(), opts.stream_port, true);
+    if(v->fd < 0){
+        viewer_fail(idx, strerror(errno));
+        return;
+    }
+    v->connecting = true;
+    v->out = "GET /stream HTTP/1.1\r\nHost: " + opts.host + "\r\nAccept: */*\r\n\r\n";
+    v->out_off = 0;
+    v->resp.on_body = [v](const char *data, size_t len){
+        if(!v->mp_ready){
+            const std::string *ct = v->resp.header("Content-Type");
+            char b[MJPEG_MAX_BOUNDARY + 1];
+            if(v->resp.status() != 200 || !ct || !mjpeg_boundary_from_content_type(ct->c_str(), b, sizeof(b))){
+                return;
+            }
+            mjpeg_callbacks_t cb = {};
+            cb.on_part_end = viewer_on_frame;
+            mjpeg_parser_init(&v->mp, b, &cb, v);
+            v->mp_ready = true;
+        }
+        v->bytes += len;
+        mjpeg_parser_feed(&v->mp, (const uint8_t *)data, len);
+    };
+    struct epoll_event ev = {};
+    ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = ev_tag(KIND_VIEWER, idx);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, v->fd, &ev);
+}
+
+void loadgen::viewer_on_event(size_t idx, uint32_t events, int64_t now){
+    (void)now;
+    viewer_t *v = viewers[idx].get();
+    if(v->fd < 0){
+        return;
+    }
+    if(v->connecting){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+            return;
+        }
+        int err = net_connect_result(v->fd);
+        if(err){
+            viewer_fail(idx, strerror(err));
+            return;
+        }
+        v->connecting = false;
+    }
+    if(!v->sent){
+        ssize_t n = send(v->fd, v->out.data() + v->out_off, v->out.size() - v->out_off, MSG_NOSIGNAL);
+        if(n < 0 && errno != EAGAIN){
+            viewer_fail(idx, strerror(errno));
+            return;
+        }
+        if(n > 0){
+            v->out_off += n;
+        }
+        v->sent = v->out_off == v->out.size();
+        want_write(epfd, v->fd, ev_tag(KIND_VIEWER, idx), !v->sent);
+    }
+    if(!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        return;
+    }
+    char buf[65536];
+    for(;;){
+        ssize_t n = recv(v->fd, buf, sizeof(buf), 0);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                return;
+            }
+            viewer_fail(idx, strerror(errno));
+            return;
+        }
+        if(n == 0){
+            viewer_fail(idx, "closed by server");
+            return;
+        }
+        if(v->resp.feed(buf, n) < 0){
+            viewer_fail(idx, "malformed response");
+            return;
+        }
+        if(v->resp.headers_done() && !v->mp_ready){
+            viewer_fail(idx, "not a multipart stream");
+            return;
+        }
+        if(v->resp.done()){
+            viewer_fail(idx, "stream ended");
+            return;
+        }
+    }
+}
+
+void loadgen::schedule(int64_t now){
+    for(int ep = 0; ep < EP_COUNT; ep++){
+        if(opts.rate[ep] <= 0){
+            continue;
+        }
+        int64_t interval = (int64_t)(1e6 / opts.rate[ep]);
+        while(next_due[ep] <= now){
+            backlog[ep].push_back(next_due[ep]);
+            stats[ep].scheduled++;
+            next_due[ep] += interval;
+        }
+        // Anything queued longer than the timeout would only measure the timeout
+        while(!backlog[ep].empty() && now - backlog[ep].front() > (int64_t)opts.timeout_ms * 1000){
+            backlog[ep].pop_front();
+            stats[ep].skipped++;
+        }
+    }
+    for(size_t i = 0; i < reqs.size(); i++){
+        req_conn_t *c = reqs[i].get();
+        if(c->fd < 0 && now >= c->retry_at_us){
+            req_open(i, now);
+        }
+        req_dispatch(i, now);
+    }
+}
+
+void loadgen::check_timeouts(int64_t now){
+    for(size_t i = 0; i < reqs.size(); i++){
+        req_conn_t *c = reqs[i].get();
+        if(c->fd >= 0 && c->busy && now > c->deadline_us){
+            req_close(i, now, &stats[c->ep].err_timeout);
+        } else if(c->fd >= 0 && c->connecting && now - c->sent_us > (int64_t)opts.timeout_ms * 1000){
+            stats[c->ep].err_connect++;
+            req_close(i, now, NULL);
+        }
+    }
+}
+
+void loadgen::progress(int64_t now){
+    if(opts.quiet || now - last_progress < 1000000){
+        return;
+    }
+    uint64_t bytes = 0, frames = 0;
+    for(auto &v : viewers){
+        bytes += v->bytes;
+        frames += v->frames;
+    }
+    for(int ep = 0; ep < EP_COUNT; ep++){
+        bytes += stats[ep].bytes;
+    }
+    double dt = last_progress ? (now - last_progress) / 1e6 : 1.0;
+    fprintf(stderr, "frames %llu  capture %llu/%llu  sensors %llu/%llu  control %llu/%llu  %.1f KB/s\n",
+            (unsigned long long)frames,
+            (unsigned long long)stats[EP_CAPTURE].ok, (unsigned long long)stats[EP_CAPTURE].scheduled,
+            (unsigned long long)stats[EP_SENSORS].ok, (unsigned long long)stats[EP_SENSORS].scheduled,
+            (unsigned long long)stats[EP_CONTROL].ok, (unsigned long long)stats[EP_CONTROL].scheduled,
+            (bytes - last_bytes) / 1024.0 / dt);
+    last_bytes = bytes;
+    last_progress = now;
+}
+
+void loadgen::report(FILE *f, double elapsed_s){
+    fprintf(f, "{\"target\":\"%s\",\"port\":%d,\"stream_port\":%d,\"duration_s\":%.3f,",
+            json_escape(opts.host).c_str(), opts.port, opts.stream_port, elapsed_s);
+    fprintf(f, "\"endpoints\":{");
+    for(int ep = 0; ep < EP_COUNT; ep++){
+        endpoint_stats_t &s = stats[ep];
+        fprintf(f, "%s\"%s\":{\"rate\":%.3f,\"scheduled\":%llu,\"ok\":%llu,\"skipped\":%llu,"
+                   "\"errors\":{\"connect\":%llu,\"timeout\":%llu,\"http\":%llu,\"io\":%llu},"
+                   "\"bytes\":%llu,\"bytes_per_s\":%.1f,\"achieved_rps\":%.3f,",
+                ep ? "," : "", ep_names[ep], opts.rate[ep],
+                (unsigned long long)s.scheduled, (unsigned long long)s.ok, (unsigned long long)s.skipped,
+                (unsigned long long)s.err_connect, (unsigned long long)s.err_timeout,
+                (unsigned long long)s.err_http, (unsigned long long)s.err_io,
+                (unsigned long long)s.bytes, s.bytes / elapsed_s, s.ok / elapsed_s);
+        print_dist(f, "latency_ms", s.latency_us);
+        fputc(',', f);
+        print_dist(f, "service_ms", s.service_us);
+        fputc('}', f);
+    }
+    fprintf(f, "},\"stream\":{\"viewers\":%d,", opts.viewers);
+
+    uint64_t frames = 0, bytes = 0;
+    int receiving = 0, failed = 0;
+    double fps_min = 0, fps_max = 0, fps_sum = 0;
+    std::vector<uint32_t> all_gaps;
+    for(size_t i = 0; i < viewers.size(); i++){
+        viewer_t *v = viewers[i].get();
+        double fps = v->frames > 1 ? (v->frames - 1) / ((v->last_frame_us - v->first_frame_us) / 1e6) : 0;
+        frames += v->frames;
+        bytes += v->bytes;
+        receiving += v->frames > 0;
+        failed += v->failed;
+        fps_sum += fps;
+        fps_min = i == 0 ? fps : std::min(fps_min, fps);
+        fps_max = std::max(fps_max, fps);
+        all_gaps.insert(all_gaps.end(), v->gaps_us.begin(), v->gaps_us.end());
+    }
+    fprintf(f, "\"receiving\":%d,\"failed\":%d,\"frames\":%llu,\"bytes\":%llu,\"bytes_per_s\":%.1f,"
+               "\"fps\":{\"min\":%.2f,\"mean\":%.2f,\"max\":%.2f,\"total\":%.2f},",
+            receiving, failed, (unsigned long long)frames, (unsigned long long)bytes, bytes / elapsed_s,
+            fps_min, viewers.empty() ? 0.0 : fps_sum / viewers.size(), fps_max, fps_sum);
+    print_dist(f, "frame_gap_ms", all_gaps);
+    fprintf(f, ",\"clients\":[");
+    for(size_t i = 0; i < viewers.size(); i++){
+        viewer_t *v = viewers[i].get();
+        double fps = v->frames > 1 ? (v->frames - 1) / ((v->last_frame_us - v->first_frame_us) / 1e6) : 0;
+        fprintf(f, "%s{\"frames\":%llu,\"bytes\":%llu,\"fps\":%.2f,\"first_frame_ms\":%.1f,",
+                i ? "," : "", (unsigned long long)v->frames, (unsigned long long)v->bytes, fps,
+                v->frames ? (v->first_frame_us - v->start_us) / 1000.0 : -1.0);
+        print_dist(f, "gap_ms", v->gaps_us);
+        fprintf(f, ",\"error\":\"%s\"}", json_escape(v->error).c_str());
+    }
+    fprintf(f, "]}}\n");
+}
+
+int loadgen::run(){
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0){
+        perror("epoll_create1");
+        return 1;
+    }
+    int64_t start = net_now_us();
+    for(int ep = 0; ep < EP_COUNT; ep++){
+        next_due[ep] = start;
+        if(opts.rate[ep] <= 0){
+            continue;
+        }
+        for(int k = 0; k < opts.conns; k++){
+            std::unique_ptr<req_conn_t> c(new req_conn_t());
+            c->fd = -1;
+            c->ep = ep;
+            c->retry_at_us = start;
+            reqs.push_back(std::move(c));
+        }
+    }
+    for(int i = 0; i < opts.viewers; i++){
+        std::unique_ptr<viewer_t> v(new viewer_t());
+        v->fd = -1;
+        viewers.push_back(std::move(v));
+        viewer_open(viewers.size() - 1, start);
+    }
+
+    int64_t end = start + (int64_t)(opts.duration_s * 1e6);
+    struct epoll_event events[64];
+    int64_t now = start;
+    while(!interrupted && now < end){
+        schedule(now);
+        int64_t wake = end;
+        for(int ep = 0; ep < EP_COUNT; ep++){
+            if(opts.rate[ep] > 0){
+                wake = std::min(wake, next_due[ep]);
+            }
+        }
+        int timeout = (int)std::max<int64_t>(0, std::min<int64_t>((wake - now + 999) / 1000, 100));
+        int n = epoll_wait(epfd, events, 64, timeout);
+        now = net_now_us();
+        for(int i = 0; i < n; i++){
+            uint64_t tag = events[i].data.u64;
+            size_t idx = (size_t)(tag & 0xFFFFFFFF);
+            if((tag >> 32) == KIND_REQUEST){
+                req_on_event(idx, events[i].events, now);
+            } else {
+                viewer_on_event(idx, events[i].events, now);
+            }
+        }
+        check_timeouts(now);
+        progress(now);
+    }
+    double elapsed = (now - start) / 1e6;
+
+    FILE *f = stdout;
+    if(opts.out_path && !(f = fopen(opts.out_path, "w"))){
+        perror(opts.out_path);
+        return 1;
+    }
+    report(f, elapsed > 0 ? elapsed : 1e-6);
+    if(f != stdout){
+        fclose(f);
+    }
+    for(auto &c : reqs){
+        if(c->fd >= 0){
+            close(c->fd);
+        }
+    }
+    for(auto &v : viewers){
+        if(v->fd >= 0){
+            close(v->fd);
+        }
+    }
+    close(epfd);
+    return 0;
+}
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --host H[:P]         device address (default 127.0.0.1:8080)\n"
+            "  --port P             HTTP port (default 8080; use 80 for a real device)\n"
+            "  --stream-port P      stream port (default port + 1)\n"
+            "  --duration S         seconds to run (default 10)\n"
+            "  --viewers N          concurrent /stream clients (default 1)\n"
+            "  --capture-rate R     /capture requests per second (default 0)\n"
+            "  --sensors-rate R     /sensors requests per second (default 0)\n"
+            "  --control-rate R     /control requests per second (default 0)\n"
+            "  --control Q          query for /control, repeatable, rotated (default var=quality&val=10)\n"
+            "  --conns N            keep-alive connections per request endpoint (default 1)\n"
+            "  --timeout MS         request timeout (default 5000)\n"
+            "  --out FILE           write the JSON report to FILE instead of stdout\n"
+            "  --quiet              no progress on stderr\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"host",         required_argument, NULL, 'H'},
+        {"port",         required_argument, NULL, 'p'},
+        {"stream-port",  required_argument, NULL, 's'},
+        {"duration",     required_argument, NULL, 'd'},
+        {"viewers",      required_argument, NULL, 'v'},
+        {"capture-rate", required_argument, NULL, 'C'},
+        {"sensors-rate", required_argument, NULL, 'S'},
+        {"control-rate", required_argument, NULL, 'R'},
+        {"control",      required_argument, NULL, 'c'},
+        {"conns",        required_argument, NULL, 'n'},
+        {"timeout",      required_argument, NULL, 't'},
+        {"out",          required_argument, NULL, 'o'},
+        {"quiet",        no_argument,       NULL, 'q'},
+        {"help",         no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    loadgen_opts_t o;
+    o.host = "127.0.0.1";
+    o.port = 8080;
+    o.stream_port = 0;
+    o.duration_s = 10;
+    o.viewers = 1;
+    o.rate[EP_CAPTURE] = o.rate[EP_SENSORS] = o.rate[EP_CONTROL] = 0;
+    o.conns = 1;
+    o.timeout_ms = 5000;
+    o.out_path = NULL;
+    o.quiet = false;
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "H:p:s:d:v:C:S:R:c:n:t:o:qh", options, NULL)) != -1){
+        switch(opt){
+            case 'H': o.host = net_split_host(optarg, &o.port); break;
+            case 'p': o.port = atoi(optarg); break;
+            case 's': o.stream_port = atoi(optarg); break;
+            case 'd': o.duration_s = atof(optarg); break;
+            case 'v': o.viewers = atoi(optarg); break;
+            case 'C': o.rate[EP_CAPTURE] = atof(optarg); break;
+            case 'S': o.rate[EP_SENSORS] = atof(optarg); break;
+            case 'R': o.rate[EP_CONTROL] = atof(optarg); break;
+            case 'c': o.controls.push_back(optarg); break;
+            case 'n': o.conns = std::max(1, atoi(optarg)); break;
+            case 't': o.timeout_ms = std::max(1, atoi(optarg)); break;
+            case 'o': o.out_path = optarg; break;
+            case 'q': o.quiet = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if(!o.stream_port){
+        o.stream_port = o.port + 1;
+    }
+    if(o.controls.empty()){
+        o.controls.push_back("var=quality&val=10");
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_sigint);
+
+    std::unique_ptr<loadgen> lg(new loadgen(o));
+    return lg->run();
+}
@@ -0,0 +1,907 @@
+/*
+  Smart Plant Vision - MJPEG fan-out proxy
+
+  Keeps one upstream /stream connection per device and re-serves the frames
+  to any number of viewers, so device load does not grow with the audience.
+
+  Upstream bytes are received into large refcounted slabs. A JPEG that
+  arrives contiguously (the device sends each frame as a single chunk)
+  becomes a frame that points into the slab instead of being copied, and
+  viewers writev() straight from it. A slab is freed once the last frame
+  referring to it has been sent.
+
+  Each viewer always gets the newest frame when its socket can take more,
+  optionally capped with ?fps=N; a slow viewer skips frames instead of
+  building a backlog. /<device>/capture answers from the latest frame.
+
+  Usage: plant_proxy --listen 0.0.0.0:9000 --device cam1=192.168.1.50:81 \
+                     --device cam2=192.168.1.51:81
+  Endpoints: /<device>/stream[?fps=N], /<device>/capture, /status
+*/
+
+#include "http_response.h"
+#include "mjpeg_parser.h"
+#include "net_util.h"
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#define SLAB_SIZE           (4 * 1024 * 1024)
+#define SLAB_MIN_FREE       (512 * 1024)   // Start a new slab below this much room
+#define RECV_MAX            (256 * 1024)
+#define UPSTREAM_STALL_US   5000000
+#define VIEWER_STALL_US     30000000
+#define MAX_FRAME           (8 * 1024 * 1024)
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+
+struct slab_t {
+    std::unique_ptr<uint8_t[]> buf;
+    size_t used;
+};
+typedef std::shared_ptr<slab_t> slab_ref;
+
+struct frame_t {
+    slab_ref slab;                // Frame bytes live in the slab when set
+    std::vector<uint8_t> owned;   // Otherwise here
+    const uint8_t *data;
+    size_t len;
+    uint64_t seq;
+    int64_t arrival_us;
+};
+typedef std::shared_ptr<const frame_t> frame_ref;
+
+static slab_ref slab_new(void){
+    slab_ref s = std::make_shared<slab_t>();
+    s->buf.reset(new uint8_t[SLAB_SIZE]);
+    s->used = 0;
+    return s;
+}
+
+// Splits a multipart/x-mixed-replace body into frames. Part data that stays
+// contiguous in the current slab is tracked in place; anything else (a chunk
+// boundary inside the frame, a slab change, bytes the parser held back while
+// looking for a boundary) is copied.
+class part_splitter {
+public:
+    typedef std::function<void(frame_ref)> frame_cb_t;
+
+    void reset(const std::string &boundary){
+        mjpeg_callbacks_t cb = {};
+        cb.on_part_begin = on_begin;
+        cb.on_part_data = on_data;
+        cb.on_part_end = on_end;
+        mjpeg_parser_init(&parser_, boundary.c_str(), &cb, this);
+        clear_body();
+    }
+
+    // data points into slab
+    void feed(const slab_ref &slab, const uint8_t *data, size_t len){
+        cur_slab_ = &slab;
+        cur_begin_ = data;
+        cur_end_ = data + len;
+        mjpeg_parser_feed(&parser_, data, len);
+        cur_slab_ = NULL;
+    }
+
+    // Bytes of a body in progress that sit in an old slab, to move on slab change
+    bool body_in_slab(const uint8_t **ptr, size_t *len) const {
+        if(!body_ptr_){
+            return false;
+        }
+        *ptr = body_ptr_;
+        *len = got_;
+        return true;
+    }
+
+    void rebase(const slab_ref &slab, const uint8_t *ptr){
+        body_slab_ = slab;
+        body_ptr_ = ptr;
+    }
+
+    uint64_t resyncs() const {
+        return parser_.stats.resyncs;
+    }
+
+    frame_cb_t on_frame;
+    uint64_t frames = 0;
+    uint64_t copied = 0;
+
+private:
+    static int on_begin(void *user, const mjpeg_part_t *part);
+    static int on_data(void *user, const uint8_t *data, size_t len);
+    static int on_end(void *user, const mjpeg_part_t *part);
+
+    void clear_body(){
+        body_ptr_ = NULL;
+        body_slab_.reset();
+        owned_.clear();
+        got_ = 0;
+        oversize_ = false;
+    }
+
+    mjpeg_parser_t parser_;
+    const slab_ref *cur_slab_ = NULL;
+    const uint8_t *cur_begin_ = NULL, *cur_end_ = NULL;
+    const uint8_t *body_ptr_ = NULL;
+    slab_ref body_slab_;
+    std::vector<uint8_t> owned_;
+    size_t got_ = 0;
+    bool oversize_ = false;
+};
+
+int part_splitter::on_begin(void *user, const mjpeg_part_t *part){
+    (void)part;
+    ((part_splitter *)user)->clear_body();
+    return 0;
+}
+
+int part_splitter::on_data(void *user, const uint8_t *data, size_t len){
+    part_splitter *s = (part_splitter *)user;
+    if(s->oversize_){
+        return 0;
+    }
+    bool in_slab = s->cur_slab_ && data >= s->cur_begin_ && data + len <= s->cur_end_;
+    if(!s->got_ && s->owned_.empty() && in_slab){
+        s->body_ptr_ = data;
+        s->body_slab_ = *s->cur_slab_;
+    } else if(s->body_ptr_ && (!in_slab || s->body_slab_ != *s->cur_slab_ || s->body_ptr_ + s->got_ != data)){
+        s->owned_.assign(s->body_ptr_, s->body_ptr_ + s->got_);
+        s->body_ptr_ = NULL;
+        s->body_slab_.reset();
+    }
+    if(!s->body_ptr_){
+        s->owned_.insert(s->owned_.end(), data, data + len);
+    }
+    s->got_ += len;
+    if(s->got_ > MAX_FRAME){
+        s->clear_body();
+        s->oversize_ = true;
+    }
+    return 0;
+}
+
+int part_splitter::on_end(void *user, const mjpeg_part_t *part){
+    (void)part;
+    part_splitter *s = (part_splitter *)user;
+    if(s->oversize_ || !s->got_){
+        s->clear_body();
+        return 0;
+    }
+    std::shared_ptr<frame_t> f = std::make_shared<frame_t>();
+    if(s->body_ptr_){
+        f->slab = s->body_slab_;
+        f->data = s->body_ptr_;
+    } else {
+        f->owned.swap(s->owned_);
+        f->data = f->owned.data();
+        s->copied++;
+    }
+    f->len = s->got_;
+    f->seq = ++s->frames;
+    f->arrival_us = net_now_us();
+    s->clear_body();
+    if(s->on_frame){
+        s->on_frame(f);
+    }
+    return 0;
+}
+
+// Connections
+
+enum conn_kind_t { CONN_LISTEN, CONN_UPSTREAM, CONN_CLIENT };
+
+struct device_t;
+
+struct out_item_t {
+    std::string head;
+    frame_ref frame;
+    const char *tail;
+    size_t tail_len;
+    size_t off;
+};
+
+struct client_t {
+    int fd;
+    uint64_t id;
+    std::string in;
+    bool streaming;
+    bool close_after;
+    device_t *dev;
+    int64_t min_interval_us;
+    int64_t last_send_us;
+    int64_t last_progress_us;
+    uint64_t last_seq;
+    bool sending;
+    bool want_write;
+    bool timer_armed;
+    out_item_t out;
+    uint64_t frames_sent;
+    uint64_t frames_skipped;
+};
+
+struct device_t {
+    std::string name;
+    std::string host;
+    int port;
+    int fd;
+    bool connecting;
+    bool streaming;
+    std::string req;
+    size_t req_off;
+    http_response resp;
+    part_splitter splitter;
+    slab_ref slab;
+    frame_ref latest;
+    std::vector<client_t *> viewers;
+    int64_t last_rx_us;
+    int64_t retry_at_us;
+    int64_t backoff_us;
+    uint64_t reconnects;
+    uint64_t bytes;
+    double frame_dt;
+};
+
+struct tag_t {
+    conn_kind_t kind;
+    void *ptr;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+class proxy {
+public:
+    bool add_device(const char *spec);
+    int run(const char *listen_spec);
+
+private:
+    void upstream_connect(device_t *d, int64_t now);
+    bool upstream_accept(device_t *d);
+    void upstream_drop(device_t *d, int64_t now, const char *why);
+    void upstream_event(device_t *d, uint32_t events, int64_t now);
+    void on_frame(device_t *d, frame_ref f);
+
+    void client_accept(int64_t now);
+    void client_close(client_t *c);
+    void client_event(client_t *c, uint32_t events, int64_t now);
+    void client_request(client_t *c, int64_t now);
+    void client_send_simple(client_t *c, const char *status, const char *type, const std::string &body);
+    void client_pump(client_t *c, int64_t now);
+    bool client_flush(client_t *c, int64_t now);
+    void client_set_write(client_t *c, bool on);
+
+    std::string status_json(int64_t now);
+
+    int epfd = -1;
+    int listen_fd = -1;
+    tag_t listen_tag = {CONN_LISTEN, NULL};
+    std::vector<std::unique_ptr<device_t>> devices;
+    std::map<client_t *, std::unique_ptr<client_t>> clients;
+    std::map<void *, std::unique_ptr<tag_t>> tags;
+    typedef std::pair<int64_t, uint64_t> pace_timer_t;
+    std::priority_queue<pace_timer_t, std::vector<pace_timer_t>, std::greater<pace_timer_t>> timers;
+    std::map<uint64_t, client_t *> by_id;
+    uint64_t next_id = 1;
+    uint64_t frames_out = 0;
+    uint64_t bytes_out = 0;
+};
+
+static const char stream_tail[] = "\r\n--" PART_BOUNDARY "\r\n";
+
+bool proxy::add_device(const char *spec){
+    const char *eq = strchr(spec, '=');
+    if(!eq || eq == spec){
+        return false;
+    }
+    std::unique_ptr<device_t> d(new device_t());
+    d->name.assign(spec, eq - spec);
+    d->port = 81;
+    d->host = net_split_host(eq + 1, &d->port);
+    d->fd = -1;
+    d->connecting = d->streaming = false;
+    d->backoff_us = 500000;
+    d->retry_at_us = 0;
+    d->reconnects = d->bytes = 0;
+    d->frame_dt = 0;
+    d->last_rx_us = 0;
+    device_t *dp = d.get();
+    d->splitter.on_frame = [this, dp](frame_ref f){ on_frame(dp, f); };
+    devices.push_back(std::move(d));
+    return true;
+}
+
+void proxy::upstream_connect(device_t *d, int64_t now){
+    d->fd = net_connect(d->host.c_str(), d->port, true);
+    if(d->fd < 0){
+        d->retry_at_us = now + d->backoff_us;
+        d->backoff_us = std::min<int64_t>(d->backoff_us * 2, 10000000);
+        return;
+    }
+    d->connecting = true;
+    d->streaming = false;
+    d->req = "GET /stream HTTP/1.1\r\nHost: " + d->host + "\r\n\r\n";
+    d->req_off = 0;
+    d->resp.reset();
+    d->last_rx_us = now;
+    d->resp.on_body = [this, d](const char *data, size_t len){
+        if(!d->streaming && !upstream_accept(d)){
+            return;
+        }
+        d->splitter.feed(d->slab, (const uint8_t *)data, len);
+    };
+    std::unique_ptr<tag_t> &t = tags[d];
+    if(!t){
+        t.reset(new tag_t{CONN_UPSTREAM, d});
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = t.get();
+    epoll_ctl(epfd, EPOLL_CTL_ADD, d->fd, &ev);
+}
+
+// Checks the response head and arms the splitter with its boundary
+bool proxy::upstream_accept(device_t *d){
+    const std::string *ct = d->resp.header("Content-Type");
+    std::string b = ct ? http_response::header_param(*ct, "boundary") : std::string();
+    if(d->resp.status() != 200 || b.empty()){
+        return false;
+    }
+    d->splitter.reset(b);
+    d->streaming = true;
+    return true;
+}
+
+void proxy::upstream_drop(device_t *d, int64_t now, const char *why){
+    if(d->fd >= 0){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, NULL);
+        close(d->fd);
+        d->fd = -1;
+    }
+    fprintf(stderr, "[%s] upstream %s, retrying in %lld ms\n", d->name.c_str(), why, (long long)(d->backoff_us / 1000));
+    d->connecting = d->streaming = false;
+    d->reconnects++;
+    d->retry_at_us = now + d->backoff_us;
+    d->backoff_us = std::min<int64_t>(d->backoff_us * 2, 10000000);
+    // Keep the current slab only if frames still point into it
+    d->slab.reset();
+}
+
+void proxy::upstream_event(device_t *d, uint32_t events, int64_t now){
+    if(d->connecting){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+            return;
+        }
+        int err = net_connect_result(d->fd);
+        if(err){
+            upstream_drop(d, now, strerror(err));
+            return;
+        }
+        d->connecting = false;
+    }
+    if(d->req_off < d->req.size()){
+        ssize_t n = send(d->fd, d->req.data() + d->req_off, d->req.size() - d->req_off, MSG_NOSIGNAL);
+        if(n < 0 && errno != EAGAIN){
+            upstream_drop(d, now, strerror(errno));
+            return;
+        }
+        if(n > 0){
+            d->req_off += n;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | (d->req_off < d->req.size() ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.ptr = tags[d].get();
+        epoll_ctl(epfd, EPOLL_CTL_MOD, d->fd, &ev);
+    }
+    if(!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        return;
+    }
+    for(;;){
+        if(!d->slab || SLAB_SIZE - d->slab->used < SLAB_MIN_FREE){
+            slab_ref fresh = slab_new();
+            const uint8_t *ptr;
+            size_t len;
+            if(d->slab && d->splitter.body_in_slab(&ptr, &len) && len <= SLAB_SIZE - SLAB_MIN_FREE){
+                memcpy(fresh->buf.get(), ptr, len);
+                fresh->used = len;
+                d->splitter.rebase(fresh, fresh->buf.get());
+            }
+            d->slab = fresh;
+        }
+        uint8_t *dst = d->slab->buf.get() + d->slab->used;
+        size_t room = std::min<size_t>(SLAB_SIZE - d->slab->used, RECV_MAX);
+        ssize_t n = recv(d->fd, dst, room, 0);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                return;
+            }
+            upstream_drop(d, now, strerror(errno));
+            return;
+        }
+        if(n == 0){
+            upstream_drop(d, now, "closed");
+            return;
+        }
+        d->slab->used += n;
+        d->bytes += n;
+        d->last_rx_us = now;
+        if(d->resp.feed((const char *)dst, n) < 0){
+            upstream_drop(d, now, "sent a malformed response");
+            return;
+        }
+        if(d->resp.headers_done() && !d->streaming && !upstream_accept(d)){
+            upstream_drop(d, now, "is not serving a multipart stream");
+            return;
+        }
+        if(d->resp.done()){
+            upstream_drop(d, now, "ended the stream");
+            return;
+        }
+    }
+}
+
+void proxy::on_frame(device_t *d, frame_ref f){
+    if(d->latest){
+        double dt = (f->arrival_us - d->latest->arrival_us) / 1e6;
+        // Average the interval, not its inverse, so back-to-back frames don't dominate
+        d->frame_dt = d->frame_dt > 0 ? d->frame_dt * 0.9 + dt * 0.1 : dt;
+    }
+    d->latest = f;
+    d->backoff_us = 500000;
+    int64_t now = f->arrival_us;
+    // A failed write closes the viewer and edits d->viewers, so walk a copy
+    std::vector<client_t *> viewers = d->viewers;
+    for(client_t *c : viewers){
+        if(clients.count(c) && !c->sending && !c->timer_armed){
+            client_pump(c, now);
+        }
+    }
+}
+
+void proxy::client_set_write(client_t *c, bool on){
+    if(c->want_write == on){
+        return;
+    }
+    c->want_write = on;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP | (on ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = tags[c].get();
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+void proxy::client_accept(int64_t now){
+    for(;;){
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0){
+            return;
+        }
+        net_set_nodelay(fd);
+        std::unique_ptr<client_t> c(new client_t());
+        c->fd = fd;
+        c->id = next_id++;
+        c->streaming = c->close_after = c->sending = c->want_write = c->timer_armed = false;
+        c->dev = NULL;
+        c->min_interval_us = 0;
+        c->last_send_us = 0;
+        c->last_progress_us = now;
+        c->last_seq = 0;
+        c->frames_sent = c->frames_skipped = 0;
+        client_t *cp = c.get();
+        tags[cp].reset(new tag_t{CONN_CLIENT, cp});
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = tags[cp].get();
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        by_id[cp->id] = cp;
+        clients[cp] = std::move(c);
+    }
+}
+
+void proxy::client_close(client_t *c){
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if(c->dev){
+        auto &v = c->dev->viewers;
+        v.erase(std::remove(v.begin(), v.end(), c), v.end());
+    }
+    by_id.erase(c->id);
+    tags.erase(c);
+    clients.erase(c);
+}
+
+// Writes as much of the current item as the socket takes. Returns false when
+// the client went away (and has been closed).
+bool proxy::client_flush(client_t *c, int64_t now){
+    out_item_t &o = c->out;
+    size_t hl = o.head.size(), fl = o.frame ? o.frame->len : 0, tl = o.tail_len;
+    while(o.off < hl + fl + tl){
+        const void *base[3] = {o.head.data(), fl ? o.frame->data : NULL, o.tail};
+        size_t lens[3] = {hl, fl, tl};
+        struct iovec iov[3];
+        int cnt = 0;
+        size_t off = o.off;
+        for(int i = 0; i < 3; i++){
+            if(off >= lens[i]){
+                off -= lens[i];
+                continue;
+            }
+            iov[cnt].iov_base = (void *)((const uint8_t *)base[i] + off);
+            iov[cnt++].iov_len = lens[i] - off;
+            off = 0;
+        }
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                client_set_write(c, true);
+                return true;
+            }
+            client_close(c);
+            return false;
+        }
+        o.off += n;
+        bytes_out += n;
+        c->last_progress_us = now;
+    }
+    // Item complete
+    c->sending = false;
+    o.frame.reset();
+    o.head.clear();
+    client_set_write(c, false);
+    if(c->close_after){
+        shutdown(c->fd, SHUT_WR);
+        client_close(c);
+        return false;
+    }
+    return true;
+}
+
+// Starts the newest frame on a streaming client if pacing allows
+void proxy::client_pump(client_t *c, int64_t now){
+    device_t *d = c->dev;
+    if(c->sending || !d || !d->latest || d->latest->seq == c->last_seq){
+        return;
+    }
+    if(c->min_interval_us && now - c->last_send_us < c->min_interval_us){
+        if(!c->timer_armed){
+            c->timer_armed = true;
+            timers.push(pace_timer_t(c->last_send_us + c->min_interval_us, c->id));
+        }
+        return;
+    }
+    frame_ref f = d->latest;
+    if(c->last_seq && f->seq > c->last_seq + 1){
+        c->frames_skipped += f->seq - c->last_seq - 1;
+    }
+    c->last_seq = f->seq;
+    c->last_send_us = now;
+    c->frames_sent++;
+    frames_out++;
+
+    char hdr[96];
+    int n = snprintf(hdr, sizeof(hdr), "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", f->len);
+    c->out.head.assign(hdr, n);
+    c->out.frame = f;
+    c->out.tail = stream_tail;
+    c->out.tail_len = sizeof(stream_tail) - 1;
+    c->out.off = 0;
+    c->sending = true;
+    client_flush(c, now);
+}
+
+void proxy::client_send_simple(client_t *c, const char *status, const char *type, const std::string &body){
+    char hdr[256];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                     "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+                     status, type, body.size());
+    c->out.head.assign(hdr, n);
+    c->out.head += body;
+    c->out.frame.reset();
+    c->out.tail = NULL;
+    c->out.tail_len = 0;
+    c->out.off = 0;
+    c->close_after = true;
+    c->sending = true;
+    client_flush(c, net_now_us());
+}
+
+std::string proxy::status_json(int64_t now){
+    std::string s = "{\"devices\":[";
+    char buf[512];
+    for(size_t i = 0; i < devices.size(); i++){
+        device_t *d = devices[i].get();
+        snprintf(buf, sizeof(buf),
+                 "%s{\"name\":\"%s\",\"upstream\":\"%s:%d\",\"connected\":%s,\"fps\":%.2f,"
+                 "\"frames\":%llu,\"copied_frames\":%llu,\"resyncs\":%llu,\"bytes\":%llu,"
+                 "\"reconnects\":%llu,\"viewers\":%zu,\"frame_age_ms\":%lld}",
+                 i ? "," : "", d->name.c_str(), d->host.c_str(), d->port, d->streaming ? "true" : "false",
+                 d->frame_dt > 0 ? 1.0 / d->frame_dt : 0.0, (unsigned long long)d->splitter.frames, (unsigned long long)d->splitter.copied,
+                 (unsigned long long)d->splitter.resyncs(), (unsigned long long)d->bytes,
+                 (unsigned long long)d->reconnects, d->viewers.size(),
+                 d->latest ? (long long)((now - d->latest->arrival_us) / 1000) : -1LL);
+        s += buf;
+    }
+    uint64_t skipped = 0;
+    size_t viewers = 0;
+    for(auto &kv : clients){
+        skipped += kv.first->frames_skipped;
+        viewers += kv.first->streaming;
+    }
+    snprintf(buf, sizeof(buf), "],\"viewers\":%zu,\"frames_out\":%llu,\"frames_skipped\":%llu,\"bytes_out\":%llu}",
+             viewers, (unsigned long long)frames_out, (unsigned long long)skipped, (unsigned long long)bytes_out);
+    s += buf;
+    return s;
+}
+
+void proxy::client_request(client_t *c, int64_t now){
+    size_t sp1 = c->in.find(' ');
+    size_t sp2 = sp1 == std::string::npos ? std::string::npos : c->in.find(' ', sp1 + 1);
+    if(sp2 == std::string::npos){
+        client_send_simple(c, "400 Bad Request", "text/plain", "Bad Request");
+        return;
+    }
+    std::string method = c->in.substr(0, sp1);
+    std::string target = c->in.substr(sp1 + 1, sp2 - sp1 - 1);
+    if(method != "GET"){
+        client_send_simple(c, "405 Method Not Allowed", "text/plain", "Method Not Allowed");
+        return;
+    }
+    std::string path = target, query;
+    size_t q = target.find('?');
+    if(q != std::string::npos){
+        path = target.substr(0, q);
+        query = target.substr(q + 1);
+    }
+    if(path == "/status"){
+        client_send_simple(c, "200 OK", "application/json", status_json(now));
+        return;
+    }
+
+    // /<device>/<action>, or /<action> when only one device is configured
+    device_t *d = NULL;
+    std::string action;
+    size_t slash = path.find('/', 1);
+    if(slash != std::string::npos){
+        std::string name = path.substr(1, slash - 1);
+        for(auto &dev : devices){
+            if(dev->name == name){
+                d = dev.get();
+            }
+        }
+        action = path.substr(slash);
+    } else if(devices.size() == 1){
+        d = devices[0].get();
+        action = path;
+    }
+    if(!d){
+        client_send_simple(c, "404 Not Found", "text/plain", "Unknown device");
+        return;
+    }
+    if(action == "/capture"){
+        if(!d->latest){
+            client_send_simple(c, "503 Service Unavailable", "text/plain", "No frame yet");
+            return;
+        }
+        char hdr[256];
+        int n = snprintf(hdr, sizeof(hdr),
+                         "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n"
+                         "Content-Disposition: inline; filename=capture.jpg\r\n"
+                         "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+                         d->latest->len);
+        c->out.head.assign(hdr, n);
+        c->out.frame = d->latest;
+        c->out.tail = NULL;
+        c->out.tail_len = 0;
+        c->out.off = 0;
+        c->close_after = true;
+        c->sending = true;
+        client_flush(c, now);
+        return;
+    }
+    if(action != "/stream"){
+        client_send_simple(c, "404 Not Found", "text/plain", "Not Found");
+        return;
+    }
+
+    size_t fp = query.find("fps=");
+    if(fp != std::string::npos && (fp == 0 || query[fp - 1] == '&')){
+        double fps = atof(query.c_str() + fp + 4);
+        c->min_interval_us = fps > 0 ? (int64_t)(1e6 / fps) : 0;
+    }
+    c->streaming = true;
+    c->dev = d;
+    d->viewers.push_back(c);
+    c->out.head = "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+                  "Access-Control-Allow-Origin: *\r\n"
+                  "Cache-Control: no-cache\r\n"
+                  "Connection: close\r\n\r\n";
+    c->out.frame.reset();
+    c->out.tail = NULL;
+    c->out.tail_len = 0;
+    c->out.off = 0;
+    c->sending = true;
+    if(client_flush(c, now)){
+        client_pump(c, now);
+    }
+}
+
+void proxy::client_event(client_t *c, uint32_t events, int64_t now){
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+        char buf[4096];
+        for(;;){
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            if(n < 0){
+                if(errno == EAGAIN || errno == EINTR){
+                    break;
+                }
+                client_close(c);
+                return;
+            }
+            if(n == 0){
+                client_close(c);
+                return;
+            }
+            if(c->streaming || c->close_after){
+                continue;   // Ignore anything after the request
+            }
+            c->in.append(buf, n);
+            if(c->in.find("\r\n\r\n") != std::string::npos){
+                client_request(c, now);
+                if(!clients.count(c)){
+                    return;
+                }
+            } else if(c->in.size() > 8192){
+                client_send_simple(c, "431 Request Header Fields Too Large", "text/plain", "Header too large");
+                return;
+            }
+        }
+    }
+    if(events & EPOLLOUT && c->sending){
+        if(!client_flush(c, now)){
+            return;
+        }
+        if(c->streaming){
+            client_pump(c, now);
+        }
+    }
+}
+
+int proxy::run(const char *listen_spec){
+    int port = 9000;
+    std::string addr = net_split_host(listen_spec, &port);
+    listen_fd = net_listen(addr.empty() ? NULL : addr.c_str(), port, 128);
+    if(listen_fd < 0){
+        perror("listen");
+        return 1;
+    }
+    net_set_nonblock(listen_fd);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    fprintf(stderr, "plant_proxy listening on %s:%d for %zu device(s)\n", addr.c_str(), port, devices.size());
+
+    struct epoll_event events[128];
+    while(!interrupted){
+        int64_t now = net_now_us();
+        int64_t wake = now + 1000000;
+        for(auto &d : devices){
+            if(d->fd < 0){
+                if(now >= d->retry_at_us){
+                    upstream_connect(d.get(), now);
+                } else {
+                    wake = std::min(wake, d->retry_at_us);
+                }
+            } else if(now - d->last_rx_us > UPSTREAM_STALL_US){
+                upstream_drop(d.get(), now, "stalled");
+            }
+        }
+        if(!timers.empty()){
+            wake = std::min(wake, timers.top().first);
+        }
+        int timeout = (int)std::max<int64_t>(0, (wake - now + 999) / 1000);
+        int n = epoll_wait(epfd, events, 128, timeout);
+        now = net_now_us();
+        for(int i = 0; i < n; i++){
+            tag_t *t = (tag_t *)events[i].data.ptr;
+            switch(t->kind){
+                case CONN_LISTEN:
+                    client_accept(now);
+                    break;
+                case CONN_UPSTREAM:
+                    upstream_event((device_t *)t->ptr, events[i].events, now);
+                    break;
+                case CONN_CLIENT:
+                    if(clients.count((client_t *)t->ptr)){
+                        client_event((client_t *)t->ptr, events[i].events, now);
+                    }
+                    break;
+            }
+        }
+        while(!timers.empty() && timers.top().first <= now){
+            uint64_t id = timers.top().second;
+            timers.pop();
+            auto it = by_id.find(id);
+            if(it != by_id.end()){
+                it->second->timer_armed = false;
+                client_pump(it->second, now);
+            }
+        }
+        // Viewers that stopped reading would pin old slabs forever
+        std::vector<client_t *> stalled;
+        for(auto &kv : clients){
+            if(kv.first->sending && now - kv.first->last_progress_us > VIEWER_STALL_US){
+                stalled.push_back(kv.first);
+            }
+        }
+        for(client_t *c : stalled){
+            client_close(c);
+        }
+    }
+    return 0;
+}
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s --device NAME=HOST[:PORT] [--device ...] [--listen ADDR:PORT]\n"
+            "  --device NAME=HOST[:PORT]  upstream stream server (port defaults to 81), repeatable\n"
+            "  --listen ADDR:PORT         where viewers connect (default 0.0.0.0:9000)\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"listen", required_argument, NULL, 'l'},
+        {"help",   no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    std::unique_ptr<proxy> px(new proxy());
+    const char *listen_spec = "0.0.0.0:9000";
+    int opt, ndev = 0;
+    while((opt = getopt_long(argc, argv, "d:l:h", options, NULL)) != -1){
+        switch(opt){
+            case 'd':
+                if(!px->add_device(optarg)){
+                    fprintf(stderr, "bad --device '%s', expected NAME=HOST[:PORT]\n", optarg);
+                    return 2;
+                }
+                ndev++;
+                break;
+            case 'l': listen_spec = optarg; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if(!ndev){
+        usage(argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_sigint);
+    signal(SIGTERM, on_sigint);
+    return px->run(listen_spec);
+}
@@ -0,0 +1,494 @@
+/*
+  Smart Plant Vision - stream recorder
+
+  Records a device's /stream frames and periodic /sensors readings, with
+  their arrival times, into one indexed capture file (capture/capture_file.h)
+  that plant_replay serves back as a fake device. /status is recorded once at
+  the start so the replay reports the same camera settings.
+
+  Frames are written as they complete; a dropped or stalled stream is
+  reconnected and the gap simply shows in the timestamps. A run that gets no
+  frame at all fails with the stream's last error and leaves no capture: the
+  device serves one /stream client, so another one (plant_proxy, a browser)
+  holding it keeps the request waiting.
+
+  Usage: plant_record --host 192.168.1.50 --duration 300 --out greenhouse.cap
+*/
+
+#include "capture_file.h"
+#include "http_response.h"
+#include "mjpeg_parser.h"
+#include "net_util.h"
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define MAX_JSON            16384
+#define RECONNECT_US        1000000
+
+enum { CONN_STREAM, CONN_API, CONN_COUNT };
+
+typedef struct {
+    std::string host;
+    int port;
+    int stream_port;
+    double duration_s;
+    double sensors_interval_s;
+    int timeout_ms;
+    const char *out_path;
+    bool quiet;
+} record_opts_t;
+
+typedef struct {
+    int fd;
+    bool connecting;
+    bool busy;
+    std::string out;
+    size_t out_off;
+    http_response resp;
+    std::string body;
+    const char *path;
+    int64_t deadline_us;
+    int64_t retry_at_us;
+} conn_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+class recorder {
+public:
+    explicit recorder(const record_opts_t &o) : opts(o) {}
+
+    int run();
+
+private:
+    void conn_open(int k, int64_t now);
+    void conn_close(int k, int64_t now);
+    void conn_request(int k, const char *path, int64_t now);
+    void conn_event(int k, uint32_t events, int64_t now);
+    void api_done(int64_t now);
+    bool stream_accept();
+    void stream_failed(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    static int on_part_begin(void *user, const mjpeg_part_t *part);
+    static int on_part_data(void *user, const uint8_t *data, size_t len);
+    static int on_part_end(void *user, const mjpeg_part_t *part);
+
+    record_opts_t opts;
+    int epfd = -1;
+    conn_t conns[CONN_COUNT];
+    capture_writer writer;
+    int64_t t0 = 0;
+    mjpeg_parser_t parser;
+    bool parser_ready = false;
+    std::vector<uint8_t> frame;
+    bool have_status = false;
+    int64_t next_sensors_us = 0;
+    uint64_t frames = 0;
+    uint64_t sensors = 0;
+    uint64_t errors = 0;
+    char stream_error[160] = "";
+};
+
+// Keeps why the stream last failed, for a run that ends without frames
+void recorder::stream_failed(const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(stream_error, sizeof(stream_error), fmt, ap);
+    va_end(ap);
+}
+
+int recorder::on_part_begin(void *user, const mjpeg_part_t *part){
+    recorder *r = (recorder *)user;
+    r->frame.clear();
+    if(part->content_length > 0){
+        r->frame.reserve(part->content_length);
+    }
+    return 0;
+}
+
+int recorder::on_part_data(void *user, const uint8_t *data, size_t len){
+    recorder *r = (recorder *)user;
+    r->frame.insert(r->frame.end(), data, data + len);
+    return 0;
+}
+
+int recorder::on_part_end(void *user, const mjpeg_part_t *part){
+    (void)part;
+    recorder *r = (recorder *)user;
+    if(r->frame.empty()){
+        return 0;
+    }
+    if(!r->writer.write(CAPTURE_FRAME, net_now_us() - r->t0, r->frame.data(), r->frame.size())){
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+        interrupted = 1;
+        return 1;
+    }
+    r->frames++;
+    // Stalled once no frame follows within the timeout
+    r->conns[CONN_STREAM].deadline_us = net_now_us() + (int64_t)r->opts.timeout_ms * 1000;
+    return 0;
+}
+
+// Arms the parser from the /stream response head
+bool recorder::stream_accept(){
+    const http_response &resp = conns[CONN_STREAM].resp;
+    const std::string *ct = resp.header("Content-Type");
+    char b[MJPEG_MAX_BOUNDARY + 1];
+    if(resp.status() != 200 || !ct || !mjpeg_boundary_from_content_type(ct->c_str(), b, sizeof(b))){
+        return false;
+    }
+    mjpeg_callbacks_t cb = {on_part_begin, on_part_data, on_part_end};
+    mjpeg_parser_init(&parser, b, &cb, this);
+    parser_ready = true;
+    return true;
+}
+
+void recorder::conn_open(int k, int64_t now){
+    conn_t *c = &conns[k];
+    c->fd = net_connect(opts.host.c_str(), k == CONN_STREAM ? opts.stream_port : opts.port, true);
+    if(c->fd < 0){
+        c->retry_at_us = now + RECONNECT_US;
+        errors++;
+        if(k == CONN_STREAM){
+            stream_failed("cannot connect to %s:%d", opts.host.c_str(), opts.stream_port);
+        }
+        return;
+    }
+    c->connecting = true;
+    c->busy = false;
+    c->deadline_us = now + (int64_t)opts.timeout_ms * 1000;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.u32 = k;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+void recorder::conn_close(int k, int64_t now){
+    conn_t *c = &conns[k];
+    if(c->fd >= 0){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->connecting = c->busy = false;
+    c->retry_at_us = now + RECONNECT_US;
+    if(k == CONN_STREAM){
+        parser_ready = false;
+    }
+}
+
+void recorder::conn_request(int k, const char *path, int64_t now){
+    conn_t *c = &conns[k];
+    c->path = path;
+    c->out = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + opts.host + "\r\n\r\n";
+    c->out_off = 0;
+    c->resp.reset();
+    c->body.clear();
+    c->busy = true;
+    c->deadline_us = now + (int64_t)opts.timeout_ms * 1000;     // For the stream, until its first frame
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.u32 = k;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+void recorder::api_done(int64_t now){
+    conn_t *c = &conns[CONN_API];
+    c->busy = false;
+    if(c->resp.status() == 200 && !c->body.empty()){
+        bool status = !strcmp(c->path, "/status");
+        writer.write(status ? CAPTURE_STATUS : CAPTURE_SENSORS, now - t0, c->body.data(), c->body.size());
+        if(status){
+            have_status = true;
+        } else {
+            sensors++;
+        }
+    } else {
+        errors++;
+    }
+    if(!c->resp.keep_alive()){
+        conn_close(CONN_API, now);
+        c->retry_at_us = now;
+    }
+}
+
+void recorder::conn_event(int k, uint32_t events, int64_t now){
+    conn_t *c = &conns[k];
+    if(c->fd < 0){
+        return;
+    }
+    if(c->connecting){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+            return;
+        }
+        int err = net_connect_result(c->fd);
+        if(err != 0){
+            errors++;
+            if(k == CONN_STREAM){
+                stream_failed("connecting to %s:%d: %s", opts.host.c_str(), opts.stream_port, strerror(err));
+            }
+            conn_close(k, now);
+            return;
+        }
+        c->connecting = false;
+        if(k == CONN_STREAM){
+            conn_request(k, "/stream", now);
+        } else {
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u32 = k;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+        return;
+    }
+    if(events & EPOLLOUT && c->out_off < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0 && errno != EAGAIN && errno != EINTR){
+            errors++;
+            conn_close(k, now);
+            return;
+        }
+        c->out_off += n > 0 ? n : 0;
+        if(c->out_off == c->out.size()){
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u32 = k;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+    }
+    if(!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        return;
+    }
+    char buf[65536];
+    for(;;){
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                return;
+            }
+            errors++;
+            conn_close(k, now);
+            return;
+        }
+        if(n == 0){
+            if(k == CONN_API && c->busy && c->resp.feed_eof()){
+                api_done(now);
+            } else if(k == CONN_STREAM || c->busy){
+                fprintf(stderr, "%s closed by device, reconnecting\n", k == CONN_STREAM ? "/stream" : c->path);
+                errors++;
+                if(k == CONN_STREAM){
+                    stream_failed("the device closed /stream");
+                }
+            }
+            conn_close(k, now);
+            return;
+        }
+        if(!c->busy || c->resp.feed(buf, n) < 0){
+            errors++;
+            if(k == CONN_STREAM){
+                stream_failed("malformed HTTP response to /stream");
+            }
+            conn_close(k, now);
+            return;
+        }
+        if(k == CONN_STREAM && c->resp.headers_done() && !parser_ready && !stream_accept()){
+            fprintf(stderr, "/stream: HTTP %d without a multipart boundary\n", c->resp.status());
+            stream_failed("HTTP %d without a multipart boundary", c->resp.status());
+            interrupted = 1;
+            return;
+        }
+        if(c->resp.done()){
+            if(k == CONN_API){
+                api_done(now);
+                if(c->fd < 0){
+                    return;
+                }
+            } else {
+                conn_close(k, now);
+                return;
+            }
+        }
+    }
+}
+
+int recorder::run(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    char source[64];
+    snprintf(source, sizeof(source), "%s:%d", opts.host.c_str(), opts.port);
+    if(!writer.open(opts.out_path, source, (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000)){
+        perror(opts.out_path);
+        return 1;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    for(int k = 0; k < CONN_COUNT; k++){
+        conns[k].fd = -1;
+        conns[k].retry_at_us = 0;
+    }
+    conn_t *sc = &conns[CONN_STREAM];
+    sc->resp.on_body = [this](const char *data, size_t len){
+        if(parser_ready || stream_accept()){
+            mjpeg_parser_feed(&parser, (const uint8_t *)data, len);
+        }
+    };
+    conn_t *ac = &conns[CONN_API];
+    ac->resp.on_body = [ac](const char *data, size_t len){
+        if(ac->body.size() + len <= MAX_JSON){
+            ac->body.append(data, len);
+        }
+    };
+
+    t0 = net_now_us();
+    int64_t end = opts.duration_s > 0 ? t0 + (int64_t)(opts.duration_s * 1e6) : INT64_MAX;
+    int64_t last_progress = t0;
+    struct epoll_event events[8];
+    while(!interrupted){
+        int64_t now = net_now_us();
+        if(now >= end){
+            break;
+        }
+        for(int k = 0; k < CONN_COUNT; k++){
+            conn_t *c = &conns[k];
+            if(k == CONN_API && opts.sensors_interval_s <= 0 && have_status){
+                continue;
+            }
+            if(c->fd < 0 && now >= c->retry_at_us){
+                conn_open(k, now);
+            } else if(c->fd >= 0 && (c->connecting || c->busy) && now > c->deadline_us){
+                fprintf(stderr, "%s timed out\n", k == CONN_STREAM ? "/stream" : "API request");
+                errors++;
+                if(k == CONN_STREAM && c->connecting){
+                    stream_failed("connecting to %s:%d timed out", opts.host.c_str(), opts.stream_port);
+                } else if(k == CONN_STREAM && !c->resp.headers_done()){
+                    stream_failed("no reply to /stream within %d ms; another client (plant_proxy, a browser) "
+                                  "may hold the device's only stream", opts.timeout_ms);
+                } else if(k == CONN_STREAM){
+                    stream_failed("no frame within %d ms", opts.timeout_ms);
+                }
+                conn_close(k, now);
+            }
+        }
+        if(ac->fd >= 0 && !ac->connecting && !ac->busy){
+            if(!have_status){
+                conn_request(CONN_API, "/status", now);
+            } else if(opts.sensors_interval_s > 0 && now >= next_sensors_us){
+                conn_request(CONN_API, "/sensors", now);
+                next_sensors_us = std::max(next_sensors_us + (int64_t)(opts.sensors_interval_s * 1e6), now);
+            }
+        }
+        if(!opts.quiet && now - last_progress >= 5000000){
+            fprintf(stderr, "%.0fs: %llu frames, %llu sensor readings, %.1f MB, %llu errors\n", (now - t0) / 1e6,
+                    (unsigned long long)frames, (unsigned long long)sensors, writer.bytes() / 1e6,
+                    (unsigned long long)errors);
+            last_progress = now;
+        }
+        int n = epoll_wait(epfd, events, 8, 100);
+        now = net_now_us();
+        for(int i = 0; i < n; i++){
+            conn_event((int)events[i].data.u32, events[i].events, now);
+        }
+    }
+    for(int k = 0; k < CONN_COUNT; k++){
+        conn_close(k, net_now_us());
+    }
+    close(epfd);
+    if(!writer.close()){
+        fprintf(stderr, "%s: write failed\n", opts.out_path);
+        return 1;
+    }
+    if(!frames){
+        // A capture without frames would replay as a device whose stream shows nothing
+        fprintf(stderr, "no /stream frames in %.1f s: %s; %s removed\n", (net_now_us() - t0) / 1e6,
+                stream_error[0] ? stream_error : "the stream sent none", opts.out_path);
+        unlink(opts.out_path);
+        return 1;
+    }
+    fprintf(stderr, "recorded %llu frames and %llu sensor readings over %.1f s into %s (%.1f MB)\n",
+            (unsigned long long)frames, (unsigned long long)sensors, (net_now_us() - t0) / 1e6, opts.out_path,
+            writer.bytes() / 1e6);
+    return 0;
+}
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s --out FILE [options]\n"
+            "  --host H[:P]          device address (default 127.0.0.1:8080)\n"
+            "  --port P              HTTP port (default 8080; use 80 for a real device)\n"
+            "  --stream-port P       stream port (default port + 1)\n"
+            "  --duration S          seconds to record, 0 until Ctrl-C (default 0)\n"
+            "  --sensors-interval S  seconds between /sensors reads, 0 to skip (default 1)\n"
+            "  --timeout MS          request timeout (default 5000)\n"
+            "  --out FILE            capture file to write\n"
+            "  --quiet               no progress on stderr\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"host",             required_argument, NULL, 'H'},
+        {"port",             required_argument, NULL, 'p'},
+        {"stream-port",      required_argument, NULL, 's'},
+        {"duration",         required_argument, NULL, 'd'},
+        {"sensors-interval", required_argument, NULL, 'i'},
+        {"timeout",          required_argument, NULL, 't'},
+        {"out",              required_argument, NULL, 'o'},
+        {"quiet",            no_argument,       NULL, 'q'},
+        {"help",             no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    record_opts_t o;
+    o.host = "127.0.0.1";
+    o.port = 8080;
+    o.stream_port = 0;
+    o.duration_s = 0;
+    o.sensors_interval_s = 1;
+    o.timeout_ms = 5000;
+    o.out_path = NULL;
+    o.quiet = false;
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "H:p:s:d:i:t:o:qh", options, NULL)) != -1){
+        switch(opt){
+            case 'H': o.host = net_split_host(optarg, &o.port); break;
+            case 'p': o.port = atoi(optarg); break;
+            case 's': o.stream_port = atoi(optarg); break;
+            case 'd': o.duration_s = atof(optarg); break;
+            case 'i': o.sensors_interval_s = atof(optarg); break;
+            case 't': o.timeout_ms = std::max(1, atoi(optarg)); break;
+            case 'o': o.out_path = optarg; break;
+            case 'q': o.quiet = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if(!o.out_path){
+        usage(argv[0]);
+        return 2;
+    }
+    if(!o.stream_port){
+        o.stream_port = o.port + 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_sigint);
+    signal(SIGTERM, on_sigint);
+
+    std::unique_ptr<recorder> r(new recorder(o));
+    return r->run();
+}
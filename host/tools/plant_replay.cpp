@@ -0,0 +1,276 @@
+/*
+  Smart Plant Vision - capture replay
+
+  Serves a plant_record capture file as a fake device: the same endpoints,
+  ports and framing as the firmware, through the same esp_http_server shim
+  plant_host uses (so connection limits and chunked encoding match too).
+
+    :80 /capture   frame at the current replay position
+    :80 /sensors   sensor reading at the current replay position
+    :80 /status    the /status recorded at the start of the capture
+    :80 /control   accepted and ignored, so clients that tune the camera work
+    :80 /replay    replay position and file statistics
+    :81 /stream    every viewer gets the whole recording from its first frame,
+                   paced by the original timestamps divided by --speed
+
+  With --speed 0 nothing is paced: /stream sends frames back to back and
+  each /capture or /sensors request returns the next record in order, so a
+  benchmark sees exactly the same input sequence on every run.
+
+  Usage: plant_replay greenhouse.cap [--speed 4] [--loop] [--port-offset 8000]
+*/
+
+#include "capture_file.h"
+#include "esp_http_server.h"
+#include "net_util.h"
+#include "plant_shim.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+
+static capture_reader capture;
+static const char *capture_path;
+static double speed = 1;
+static bool loop_replay = false;
+static int64_t replay_start_us;
+static std::atomic<uint64_t> cursor[4];
+static std::atomic<uint64_t> frames_out(0);
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+// Replay time in capture microseconds, -1 once a non-looping replay has ended
+static int64_t replay_position(int64_t since_us){
+    int64_t pos = (int64_t)((net_now_us() - since_us) * speed);
+    int64_t len = capture.duration_us() + 1;
+    if(loop_replay){
+        return pos % len;
+    }
+    return pos < len ? pos : -1;
+}
+
+// The record an unpaced endpoint returns next, or the one at the replay position
+static const capture_entry_t *current(uint32_t type){
+    const std::vector<capture_entry_t> &v = capture.entries(type);
+    if(v.empty()){
+        return NULL;
+    }
+    if(speed <= 0){
+        uint64_t i = cursor[type]++;
+        return &v[loop_replay ? i % v.size() : std::min<uint64_t>(i, v.size() - 1)];
+    }
+    int64_t pos = replay_position(replay_start_us);
+    const capture_entry_t *e = capture.at(type, pos < 0 ? capture.duration_us() : pos);
+    return e ? e : &v.front();
+}
+
+static void sleep_until_us(int64_t t){
+    int64_t d = t - net_now_us();
+    if(d > 0){
+        struct timespec ts = {(time_t)(d / 1000000), (long)(d % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static esp_err_t capture_handler(httpd_req_t *req){
+    const capture_entry_t *e = current(CAPTURE_FRAME);
+    if(!e){
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, (const char *)capture.payload(*e), e->len);
+}
+
+static esp_err_t sensors_handler(httpd_req_t *req){
+    const capture_entry_t *e = current(CAPTURE_SENSORS);
+    if(!e){
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, (const char *)capture.payload(*e), e->len);
+}
+
+static esp_err_t status_handler(httpd_req_t *req){
+    const std::vector<capture_entry_t> &v = capture.entries(CAPTURE_STATUS);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if(v.empty()){
+        return httpd_resp_send(req, "{}", 2);
+    }
+    return httpd_resp_send(req, (const char *)capture.payload(v.front()), v.front().len);
+}
+
+static esp_err_t cmd_handler(httpd_req_t *req){
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t replay_handler(httpd_req_t *req){
+    char json[512];
+    int64_t pos = speed > 0 ? replay_position(replay_start_us) : -1;
+    int n = snprintf(json, sizeof(json),
+                     "{\"file\":\"%s\",\"source\":\"%s\",\"recorded_at_ms\":%lld,\"duration_s\":%.3f,"
+                     "\"frames\":%zu,\"sensors\":%zu,\"speed\":%g,\"loop\":%s,\"position_s\":%.3f,"
+                     "\"recovered\":%s,\"frames_out\":%llu}",
+                     capture_path, capture.source().c_str(), (long long)capture.start_unix_ms(),
+                     capture.duration_us() / 1e6, capture.entries(CAPTURE_FRAME).size(),
+                     capture.entries(CAPTURE_SENSORS).size(), speed, loop_replay ? "true" : "false",
+                     pos < 0 ? -1.0 : pos / 1e6, capture.recovered() ? "true" : "false",
+                     (unsigned long long)frames_out.load());
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, n);
+}
+
+static esp_err_t stream_handler(httpd_req_t *req){
+    const std::vector<capture_entry_t> &v = capture.entries(CAPTURE_FRAME);
+    char part_buf[64];
+    esp_err_t res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+    if(res != ESP_OK){
+        return res;
+    }
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if(v.empty()){
+        return httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    // Pace against this viewer's own start so every viewer sees the same timeline
+    int64_t t_first = v.front().t_us;
+    int64_t span = v.back().t_us - t_first;
+    int64_t lap_us = span + (v.size() > 1 ? span / (int64_t)(v.size() - 1) : 100000);
+    int64_t start = net_now_us();
+    for(uint64_t lap = 0; res == ESP_OK && !interrupted; lap++){
+        for(size_t i = 0; i < v.size() && res == ESP_OK && !interrupted; i++){
+            if(speed > 0){
+                sleep_until_us(start + (int64_t)((lap * lap_us + v[i].t_us - t_first) / speed));
+            }
+            size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, v[i].len);
+            res = httpd_resp_send_chunk(req, part_buf, hlen);
+            if(res == ESP_OK){
+                res = httpd_resp_send_chunk(req, (const char *)capture.payload(v[i]), v[i].len);
+            }
+            if(res == ESP_OK){
+                res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+            }
+            if(res == ESP_OK){
+                frames_out++;
+            }
+        }
+        if(!loop_replay){
+            break;
+        }
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+
+static bool start_servers(void){
+    httpd_handle_t camera_httpd = NULL, stream_httpd = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    httpd_uri_t capture_uri = { .uri = "/capture", .method = HTTP_GET, .handler = capture_handler, .user_ctx = NULL };
+    httpd_uri_t sensors_uri = { .uri = "/sensors", .method = HTTP_GET, .handler = sensors_handler, .user_ctx = NULL };
+    httpd_uri_t status_uri  = { .uri = "/status",  .method = HTTP_GET, .handler = status_handler,  .user_ctx = NULL };
+    httpd_uri_t cmd_uri     = { .uri = "/control", .method = HTTP_GET, .handler = cmd_handler,     .user_ctx = NULL };
+    httpd_uri_t replay_uri  = { .uri = "/replay",  .method = HTTP_GET, .handler = replay_handler,  .user_ctx = NULL };
+    httpd_uri_t stream_uri  = { .uri = "/stream",  .method = HTTP_GET, .handler = stream_handler,  .user_ctx = NULL };
+
+    if(httpd_start(&camera_httpd, &config) != ESP_OK){
+        return false;
+    }
+    httpd_register_uri_handler(camera_httpd, &capture_uri);
+    httpd_register_uri_handler(camera_httpd, &sensors_uri);
+    httpd_register_uri_handler(camera_httpd, &status_uri);
+    httpd_register_uri_handler(camera_httpd, &cmd_uri);
+    httpd_register_uri_handler(camera_httpd, &replay_uri);
+
+    config.server_port += 1;
+    config.ctrl_port += 1;
+    if(httpd_start(&stream_httpd, &config) != ESP_OK){
+        return false;
+    }
+    httpd_register_uri_handler(stream_httpd, &stream_uri);
+    return true;
+}
+
+static void usage(const char *argv0){
+    fprintf(stderr,
+            "usage: %s FILE [options]\n"
+            "  --speed X         playback speed, 0 for as fast as possible (default 1)\n"
+            "  --loop            start over at the end instead of stopping\n"
+            "  --port-offset N   added to ports 80/81 (default 8000, like plant_host)\n",
+            argv0);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"speed",       required_argument, NULL, 's'},
+        {"loop",        no_argument,       NULL, 'l'},
+        {"port-offset", required_argument, NULL, 'p'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    plant_shim_config_t *cfg = plant_shim_config();
+    int opt;
+    while((opt = getopt_long(argc, argv, "s:lp:h", options, NULL)) != -1){
+        switch(opt){
+            case 's': speed = atof(optarg); break;
+            case 'l': loop_replay = true; break;
+            case 'p': cfg->port_offset = atoi(optarg); break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if(optind != argc - 1 || speed < 0){
+        usage(argv[0]);
+        return 2;
+    }
+    capture_path = argv[optind];
+    if(!capture.open(capture_path)){
+        fprintf(stderr, "%s: not a capture file\n", capture_path);
+        return 1;
+    }
+    printf("%s: %zu frames, %zu sensor readings, %.1f s from %s%s\n", capture_path,
+           capture.entries(CAPTURE_FRAME).size(), capture.entries(CAPTURE_SENSORS).size(),
+           capture.duration_us() / 1e6, capture.source().c_str(), capture.recovered() ? " (index rebuilt)" : "");
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_sigint);
+    signal(SIGTERM, on_sigint);
+    replay_start_us = net_now_us();
+    if(!start_servers()){
+        fprintf(stderr, "could not start the HTTP servers\n");
+        return 1;
+    }
+    char rate[32];
+    snprintf(rate, sizeof(rate), speed > 0 ? "%gx speed" : "max speed", speed);
+    printf("replaying at %s on ports %d/%d\n", rate, 80 + cfg->port_offset, 81 + cfg->port_offset);
+    fflush(stdout);
+    while(!interrupted){
+        pause();
+    }
+    return 0;
+}
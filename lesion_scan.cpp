@@ -0,0 +1,236 @@
+/*
+  Smart Plant Vision - Lesion Scan
+  Pixels are classed on hue, saturation and value in integers. Whether a
+  lesion pixel is enclosed by leaf comes from four linear passes (left,
+  right, up, down) that track the nearest leaf pixel, so the scan stays
+  O(pixels) however many blobs there are.
+*/
+
+#include "lesion_scan.h"
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "plant_log.h"
+
+#define LEAF        1
+#define LESION      2
+#define LEFT        4         // Leaf within reach on that side
+#define RIGHT       8
+#define UP          16
+#define DOWN        32
+#define ENCLOSED    (LEFT | RIGHT | UP | DOWN)
+#define VISITED     64
+
+// Scan state and the previous result, under scan_lock
+static SemaphoreHandle_t scan_lock = NULL;
+static uint8_t *decoded = NULL;               // RGB565
+static uint8_t *cls = NULL;
+static uint16_t *fill = NULL;                 // Flood fill stack; the column passes borrow it first
+static size_t scan_cap = 0;                   // Pixels the buffers hold
+static lesion_result_t last;
+static size_t last_len = 0;                   // Frame the previous result is for: 0 for none
+static uint16_t last_fw = 0, last_fh = 0;
+
+static std::atomic<uint32_t> stat_scans(0);
+static std::atomic<uint32_t> stat_cached(0);
+static std::atomic<uint32_t> stat_clean(0);
+static std::atomic<uint32_t> stat_failed(0);
+static std::atomic<uint32_t> stat_last_ms(0);
+
+bool lesion_init(void){
+    if(!scan_lock){
+        scan_lock = xSemaphoreCreateMutex();
+    }
+    return scan_lock != NULL;
+}
+
+static bool reserve(size_t n){
+    if(n <= scan_cap){
+        return true;
+    }
+    heap_caps_free(decoded);
+    heap_caps_free(cls);
+    heap_caps_free(fill);
+    decoded = (uint8_t *)heap_caps_malloc(n * 2, MALLOC_CAP_SPIRAM);
+    cls = (uint8_t *)heap_caps_malloc(n, MALLOC_CAP_SPIRAM);
+    fill = (uint16_t *)heap_caps_malloc(n * 2, MALLOC_CAP_SPIRAM);
+    if(!decoded || !cls || !fill){
+        heap_caps_free(decoded);
+        heap_caps_free(cls);
+        heap_caps_free(fill);
+        decoded = cls = NULL;
+        fill = NULL;
+        scan_cap = 0;
+        PLOG_LIMITED(PLOG_ERROR, 2, "No memory for a %u pixel lesion scan", (unsigned)n);
+        return false;
+    }
+    scan_cap = n;
+    return true;
+}
+
+static uint8_t classify(uint16_t v){
+    int r = (v >> 8) & 0xF8, g = (v >> 3) & 0xFC, b = (v << 3) & 0xF8;
+    int hi = std::max(r, std::max(g, b)), lo = std::min(r, std::min(g, b));
+    int d = hi - lo;
+    if(hi < LESION_MIN_VALUE || d * 255 < LESION_MIN_SAT * hi){
+        return 0;
+    }
+    int hue;
+    if(hi == r){
+        hue = 60 * (g - b) / d;
+    } else if(hi == g){
+        hue = 120 + 60 * (b - r) / d;
+    } else {
+        hue = 240 + 60 * (r - g) / d;
+    }
+    if(hue >= LESION_HUE_MIN && hue <= LESION_HUE_MAX){
+        return LESION;
+    }
+    return hue > LESION_HUE_MAX && hue <= LEAF_HUE_MAX ? LEAF : 0;
+}
+
+// Marks the sides of each lesion pixel that have leaf within reach
+static void enclose(uint16_t w, uint16_t h, int reach){
+    for(int y = 0; y < h; y++){
+        uint8_t *row = &cls[(size_t)y * w];
+        int seen = -reach - 1;
+        for(int x = 0; x < w; x++){
+            if(row[x] & LEAF) seen = x;
+            else if((row[x] & LESION) && x - seen <= reach) row[x] |= LEFT;
+        }
+        seen = w + reach;
+        for(int x = w - 1; x >= 0; x--){
+            if(row[x] & LEAF) seen = x;
+            else if((row[x] & LESION) && seen - x <= reach) row[x] |= RIGHT;
+        }
+    }
+    uint16_t *seen = fill;
+    for(int x = 0; x < w; x++) seen[x] = 0xFFFF;
+    for(int y = 0; y < h; y++){
+        uint8_t *row = &cls[(size_t)y * w];
+        for(int x = 0; x < w; x++){
+            if(row[x] & LEAF) seen[x] = y;
+            else if((row[x] & LESION) && seen[x] != 0xFFFF && y - seen[x] <= reach) row[x] |= UP;
+        }
+    }
+    for(int x = 0; x < w; x++) seen[x] = 0xFFFF;
+    for(int y = h - 1; y >= 0; y--){
+        uint8_t *row = &cls[(size_t)y * w];
+        for(int x = 0; x < w; x++){
+            if(row[x] & LEAF) seen[x] = y;
+            else if((row[x] & LESION) && seen[x] != 0xFFFF && seen[x] - y <= reach) row[x] |= DOWN;
+        }
+    }
+}
+
+static bool is_lesion(uint8_t c){
+    return (c & (LESION | ENCLOSED | VISITED)) == (LESION | ENCLOSED);
+}
+
+static void find_blobs(uint16_t w, uint16_t h, lesion_result_t *r){
+    size_t n = (size_t)w * h;
+    for(size_t i = 0; i < n; i++){
+        if(!is_lesion(cls[i])){
+            continue;
+        }
+        uint32_t area = 0;
+        size_t top = 0;
+        fill[top++] = (uint16_t)i;
+        cls[i] |= VISITED;
+        while(top){
+            uint16_t p = fill[--top];
+            uint16_t x = p % w, y = p / w;
+            area++;
+            if(x > 0 && is_lesion(cls[p - 1])){ cls[p - 1] |= VISITED; fill[top++] = p - 1; }
+            if(x + 1 < w && is_lesion(cls[p + 1])){ cls[p + 1] |= VISITED; fill[top++] = p + 1; }
+            if(y > 0 && is_lesion(cls[p - w])){ cls[p - w] |= VISITED; fill[top++] = p - w; }
+            if(y + 1 < h && is_lesion(cls[p + w])){ cls[p + w] |= VISITED; fill[top++] = p + w; }
+        }
+        if(area >= LESION_MIN_AREA){
+            r->blobs++;
+            r->lesion_px += area;
+            r->largest_px = std::max(r->largest_px, area);
+        }
+    }
+}
+
+static bool scan(const camera_fb_t *fb, uint32_t seq, lesion_result_t *r){
+    int scale = JPG_SCALE_NONE;
+    while(scale < JPG_SCALE_MAX && (size_t)(fb->width >> scale) * (fb->height >> scale) > LESION_MAX_PIXELS){
+        scale++;
+    }
+    uint16_t w = fb->width >> scale, h = fb->height >> scale;
+    size_t n = (size_t)w * h;
+    if(!n || n > LESION_MAX_PIXELS || !reserve(n) ||
+       !jpg2rgb565(fb->buf, fb->len, decoded, (jpg_scale_t)scale)){
+        return false;
+    }
+    memset(r, 0, sizeof(*r));
+    r->seq = seq;
+    r->width = w;
+    r->height = h;
+    for(size_t i = 0; i < n; i++){
+        cls[i] = classify((decoded[i * 2] << 8) | decoded[i * 2 + 1]);
+        r->leaf_px += cls[i] == LEAF;
+    }
+    enclose(w, h, w / LESION_REACH_DIV);
+    find_blobs(w, h, r);
+    uint32_t tissue = r->leaf_px + r->lesion_px;
+    r->leaf_pm = (uint16_t)(tissue * 1000 / n);
+    r->lesion_pm = tissue ? (uint16_t)((uint64_t)r->lesion_px * 1000 / tissue) : 0;
+    // A point for each 3 per mille of the leaf lesioned and five for each blob
+    r->score = r->blobs ? (uint8_t)std::min(100, r->lesion_pm / 3 + 5 * r->blobs) : 0;
+    return true;
+}
+
+bool lesion_scan(const camera_fb_t *fb, uint32_t seq, lesion_result_t *out){
+    if(!scan_lock || fb->format != PIXFORMAT_JPEG){
+        return false;
+    }
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    bool ok = true;
+    // Sequence numbers are per camera mode, so the frame size and length tell the modes apart
+    if(last_len == fb->len && last.seq == seq && last_fw == fb->width && last_fh == fb->height){
+        stat_cached++;
+    } else {
+        int64_t start = esp_timer_get_time();
+        ok = scan(fb, seq, &last);
+        last_len = ok ? fb->len : 0;
+        last_fw = fb->width;
+        last_fh = fb->height;
+        if(ok){
+            last.scan_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+            stat_scans++;
+            stat_clean += last.blobs == 0;
+            stat_last_ms.store(last.scan_ms);
+        } else {
+            stat_failed++;
+            PLOG_LIMITED(PLOG_WARN, 4, "Lesion scan of a %ux%u frame failed", fb->width, fb->height);
+        }
+    }
+    if(ok){
+        *out = last;
+    }
+    xSemaphoreGive(scan_lock);
+    return ok;
+}
+
+int lesion_json(const lesion_result_t *r, char *buf, size_t len){
+    return snprintf(buf, len, "\"score\":%u,\"blobs\":%u,\"leaf_pm\":%u,\"lesion_pm\":%u,\"largest_px\":%u,"
+                    "\"scan\":\"%ux%u\",\"ms\":%u",
+                    r->score, r->blobs, r->leaf_pm, r->lesion_pm, r->largest_px, r->width, r->height, r->scan_ms);
+}
+
+void lesion_get_stats(lesion_stats_t *out){
+    out->scans = stat_scans.load();
+    out->cached = stat_cached.load();
+    out->clean = stat_clean.load();
+    out->failed = stat_failed.load();
+    out->last_ms = stat_last_ms.load();
+}
@@ -0,0 +1,62 @@
+/*
+  Smart Plant Vision - Lesion Scan
+  Disease triage on the ESP32: most of the classes the server tells apart
+  (leaf spot, rust, blight, nutrient deficiency) begin as brown or yellow
+  patches on green leaf. The scan decodes a frame at reduced scale, marks
+  the green leaf pixels and the brown/yellow ones, and groups the brown/yellow
+  pixels that lie on a leaf into blobs. Soil and pots are brown too; a pixel
+  only counts when there is leaf on all four sides of it.
+
+  A frame without lesion blobs is "clean", and a client can skip sending it
+  to the classifier.
+*/
+
+#ifndef LESION_SCAN_H
+#define LESION_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_camera.h"
+
+#define LESION_MAX_PIXELS   0xFFFF  // Decode scale is raised until the scan fits (XGA: 256x192)
+#define LESION_MIN_SAT      64      // Saturation (0-255) below this is neither leaf nor lesion: gray, glare
+#define LESION_MIN_VALUE    48      // Darker pixels are shadow, or an insect, not tissue
+#define LESION_HUE_MIN      12      // Lesion hues in degrees: brown, orange, yellow
+#define LESION_HUE_MAX      66
+#define LEAF_HUE_MAX        170     // Leaf hues run from LESION_HUE_MAX up to this
+#define LESION_REACH_DIV    4       // Leaf within 1/4 of the scan width on each side encloses a pixel
+#define LESION_MIN_AREA     3       // Scan pixels in the smallest blob counted
+
+typedef struct {
+    uint32_t seq;             // Frame the result is for
+    uint16_t width, height;   // Scan size
+    uint32_t leaf_px;         // Green leaf pixels
+    uint32_t lesion_px;       // Lesion pixels in counted blobs
+    uint16_t blobs;
+    uint32_t largest_px;      // Largest blob
+    uint16_t leaf_pm;         // Leaf and lesion share of the picture, per mille
+    uint16_t lesion_pm;       // Lesion share of the leaf, per mille
+    uint8_t score;            // 0 clean, up to 100
+    uint32_t scan_ms;
+} lesion_result_t;
+
+typedef struct {
+    uint32_t scans;
+    uint32_t cached;          // Answered from the previous scan of the same frame
+    uint32_t clean;
+    uint32_t failed;
+    uint32_t last_ms;
+} lesion_stats_t;
+
+bool lesion_init(void);
+
+// Scans a JPEG frame; a frame scanned just before (same seq) is not scanned
+// again. False for other formats and when the decode fails.
+bool lesion_scan(const camera_fb_t *fb, uint32_t seq, lesion_result_t *out);
+
+// Prints the result as JSON members, without braces; returns the length
+int lesion_json(const lesion_result_t *r, char *buf, size_t len);
+
+void lesion_get_stats(lesion_stats_t *out);
+
+#endif
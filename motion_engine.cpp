@@ -0,0 +1,335 @@
+/*
+  Smart Plant Vision - Motion Engine
+  The preview tap copies at most MOTION_FPS frames a second into a buffer
+  of its own and wakes the task, skipping frames while the task is still
+  busy with the last one, so a client only ever pays for a memcpy. The task
+  decodes the copy at 1/8 scale (DC coefficients only) and does the rest in
+  integers: the background is kept in 8.8 fixed point, moving pixels are
+  labelled by an iterative 4-connected flood fill.
+*/
+
+#include "motion_engine.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include "camera_modes.h"
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "plant_events.h"
+#include "plant_log.h"
+
+#define MOTION_WARMUP   3     // Samples the background settles for after a (re)start
+#define MOTION_FPS_WINDOW_MS 3000
+#define MOVING          1
+#define VISITED         2
+
+typedef struct {
+    uint16_t x0, y0, x1, y1;
+    uint16_t area;
+} blob_t;
+
+static TaskHandle_t motion_task = NULL;
+static std::atomic<bool> enabled(true);
+static std::atomic<bool> still_on(false);
+static std::atomic<int64_t> last_tap_us(0);
+static std::atomic<int64_t> next_sample_us(0);
+
+// Frame copy the tap hands over, under tap_lock
+static SemaphoreHandle_t tap_lock = NULL;
+static uint8_t *tap_buf = NULL;
+static size_t tap_cap = 0, tap_len = 0;
+static bool tap_full = false;
+static uint32_t tap_seq = 0;
+static uint16_t tap_w = 0, tap_h = 0;
+
+// Analysis state, task only
+static uint16_t sw = 0, sh = 0;               // Sample size
+static uint8_t *decoded = NULL;               // RGB565
+static uint8_t *gray = NULL;
+static uint16_t *background = NULL;           // 8.8 fixed point
+static uint8_t *mask = NULL;                  // MOVING, then VISITED once in a blob
+static uint16_t *fill = NULL;                 // Flood fill stack
+static int warmup = 0;
+static int64_t last_event_us = 0, last_still_us = 0;
+
+static std::atomic<uint32_t> stat_samples(0);
+static std::atomic<uint32_t> stat_events(0);
+static std::atomic<uint32_t> stat_stills(0);
+static std::atomic<uint32_t> stat_resets(0);
+static std::atomic<uint32_t> stat_own(0);
+static std::atomic<uint32_t> stat_last_ms(0);
+static std::atomic<uint32_t> fps_x10(0);
+
+static bool grow(uint8_t **buf, size_t *cap, size_t need){
+    if(need <= *cap){
+        return true;
+    }
+    uint8_t *b = (uint8_t *)heap_caps_realloc(*buf, need, MALLOC_CAP_SPIRAM);
+    if(!b){
+        return false;
+    }
+    *buf = b;
+    *cap = need;
+    return true;
+}
+
+static void motion_tap(const camera_fb_t *fb, const cam_frame_info_t *info){
+    if(xTaskGetCurrentTaskHandle() == motion_task){
+        return;               // A frame the engine fetched itself
+    }
+    int64_t now = esp_timer_get_time();
+    last_tap_us.store(now);
+    if(!enabled.load() || fb->format != PIXFORMAT_JPEG || now < next_sample_us.load() ||
+       xSemaphoreTake(tap_lock, 0) != pdTRUE){
+        return;
+    }
+    if(!tap_full && grow(&tap_buf, &tap_cap, fb->len)){
+        memcpy(tap_buf, fb->buf, fb->len);
+        tap_len = fb->len;
+        tap_seq = info->seq;
+        tap_w = fb->width;
+        tap_h = fb->height;
+        tap_full = true;
+        // Due times run on from the last one, so a stream a little faster than
+        // MOTION_FPS still gets sampled at MOTION_FPS rather than every other frame
+        int64_t period = 1000000 / MOTION_FPS;
+        next_sample_us.store(std::max(next_sample_us.load() + period, now - period / 2));
+        xTaskNotifyGive(motion_task);
+    }
+    xSemaphoreGive(tap_lock);
+}
+
+static bool size_for(uint16_t w, uint16_t h){
+    heap_caps_free(decoded);
+    heap_caps_free(gray);
+    heap_caps_free(background);
+    heap_caps_free(mask);
+    heap_caps_free(fill);
+    decoded = gray = mask = NULL;
+    background = fill = NULL;
+    sw = sh = 0;
+    size_t n = (size_t)w * h;
+    if(n > 0xFFFF){
+        return false;         // Pixel indexes are 16 bit; UXGA samples are 200x150
+    }
+    decoded = (uint8_t *)heap_caps_malloc(n * 2, MALLOC_CAP_SPIRAM);
+    gray = (uint8_t *)heap_caps_malloc(n, MALLOC_CAP_SPIRAM);
+    background = (uint16_t *)heap_caps_malloc(n * 2, MALLOC_CAP_SPIRAM);
+    mask = (uint8_t *)heap_caps_malloc(n, MALLOC_CAP_SPIRAM);
+    fill = (uint16_t *)heap_caps_malloc(n * 2, MALLOC_CAP_SPIRAM);
+    if(!decoded || !gray || !background || !mask || !fill){
+        PLOG_LIMITED(PLOG_ERROR, 2, "No memory for %ux%u motion samples", w, h);
+        return false;
+    }
+    sw = w;
+    sh = h;
+    warmup = 0;
+    return true;
+}
+
+// JPEG to the gray sample; the background starts over when the size changed
+static bool to_gray(const uint8_t *jpg, size_t len, uint16_t fw, uint16_t fh){
+    uint16_t w = fw / 8, h = fh / 8;
+    if(!w || !h || ((w != sw || h != sh) && !size_for(w, h))){
+        return false;
+    }
+    if(!jpg2rgb565(jpg, len, decoded, JPG_SCALE_8X)){
+        return false;
+    }
+    size_t n = (size_t)w * h;
+    for(size_t i = 0; i < n; i++){
+        uint16_t v = (decoded[i * 2] << 8) | decoded[i * 2 + 1];
+        int r = (v >> 8) & 0xF8, g = (v >> 3) & 0xFC, b = (v << 3) & 0xF8;
+        gray[i] = (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+    }
+    return true;
+}
+
+// Labels the moving pixels and returns the largest blob of pest size, and how many there were
+static int find_blobs(blob_t *largest, int *moving){
+    size_t n = (size_t)sw * sh;
+    int count = 0;
+    *moving = 0;
+    for(size_t i = 0; i < n; i++){
+        int d = (int)gray[i] - (background[i] >> 8);
+        bool m = d > MOTION_THRESHOLD || d < -MOTION_THRESHOLD;
+        mask[i] = m ? MOVING : 0;
+        *moving += m;
+        background[i] += ((int)(gray[i] << 8) - (int)background[i]) >> MOTION_ALPHA_SHIFT;
+    }
+    if(*moving * MOTION_SCENE_SHARE > (int)n){
+        return 0;
+    }
+    memset(largest, 0, sizeof(*largest));
+    for(size_t i = 0; i < n; i++){
+        if(mask[i] != MOVING){
+            continue;
+        }
+        blob_t b = {(uint16_t)(i % sw), (uint16_t)(i / sw), (uint16_t)(i % sw), (uint16_t)(i / sw), 0};
+        size_t top = 0;
+        fill[top++] = (uint16_t)i;
+        mask[i] = VISITED;
+        while(top){
+            uint16_t p = fill[--top];
+            uint16_t x = p % sw, y = p / sw;
+            b.area++;
+            if(x < b.x0) b.x0 = x;
+            if(x > b.x1) b.x1 = x;
+            if(y < b.y0) b.y0 = y;
+            if(y > b.y1) b.y1 = y;
+            // Each pixel is pushed once, when it is marked, so the stack never outgrows the picture
+            if(x > 0 && mask[p - 1] == MOVING){ mask[p - 1] = VISITED; fill[top++] = p - 1; }
+            if(x + 1 < sw && mask[p + 1] == MOVING){ mask[p + 1] = VISITED; fill[top++] = p + 1; }
+            if(y > 0 && mask[p - sw] == MOVING){ mask[p - sw] = VISITED; fill[top++] = p - sw; }
+            if(y + 1 < sh && mask[p + sw] == MOVING){ mask[p + sw] = VISITED; fill[top++] = p + sw; }
+        }
+        if(b.area >= MOTION_MIN_AREA && b.area * MOTION_MAX_SHARE <= n){
+            count++;
+            if(b.area > largest->area){
+                *largest = b;
+            }
+        }
+    }
+    return count;
+}
+
+static void analyse(uint32_t seq){
+    if(warmup < MOTION_WARMUP){
+        size_t n = (size_t)sw * sh;
+        for(size_t i = 0; i < n; i++){
+            background[i] = warmup ? background[i] + (((int)(gray[i] << 8) - (int)background[i]) >> 1) : gray[i] << 8;
+        }
+        warmup++;
+        return;
+    }
+    blob_t b;
+    int moving;
+    int blobs = find_blobs(&b, &moving);
+    if(moving * MOTION_SCENE_SHARE > sw * sh){
+        warmup = 0;
+        stat_resets++;
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if(!blobs || now - last_event_us < (int64_t)MOTION_EVENT_MS * 1000){
+        return;
+    }
+    last_event_us = now;
+    bool still = false;
+    if(still_on.load() && now - last_still_us >= (int64_t)MOTION_STILL_MS * 1000){
+        last_still_us = now;
+        still = pev_still_capture();
+        stat_stills += still;
+    }
+    // Box in preview pixels: each sample pixel is an 8x8 block
+    uint32_t id = pev_emit("motion", "\"seq\":%u,\"blobs\":%d,\"x\":%u,\"y\":%u,\"w\":%u,\"h\":%u,\"area\":%u,\"still\":%u",
+                           seq, blobs, b.x0 * 8, b.y0 * 8, (b.x1 - b.x0 + 1) * 8, (b.y1 - b.y0 + 1) * 8,
+                           b.area * 64, still ? 1 : 0);
+    if(still){
+        pev_still_attach(id);
+    }
+    stat_events++;
+}
+
+// One sample: the tap's copy when a client is fetching preview frames, else a frame of its own
+static bool sample(uint32_t *seq, int64_t *start){
+    // While the tap feeds the engine wait for it; otherwise only until the next sample is due
+    int64_t now = esp_timer_get_time();
+    bool tapped = now - last_tap_us.load() < (int64_t)MOTION_IDLE_MS * 1000;
+    int64_t due = next_sample_us.load() - now;
+    uint32_t wait_ms = tapped ? MOTION_IDLE_MS : (due > 0 ? (uint32_t)(due / 1000) : 0);
+    if(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms)) > 0){
+        *start = esp_timer_get_time();
+        xSemaphoreTake(tap_lock, portMAX_DELAY);
+        bool ok = tap_full && to_gray(tap_buf, tap_len, tap_w, tap_h);
+        *seq = tap_seq;
+        tap_full = false;
+        xSemaphoreGive(tap_lock);
+        return ok;
+    }
+    if(esp_timer_get_time() - last_tap_us.load() < (int64_t)MOTION_IDLE_MS * 1000){
+        return false;
+    }
+    // Never a frame a client is waiting for: one that comes along during the grab gets it
+    cam_frame_info_t fi;
+    camera_fb_t *fb = cam_modes_fb_get_idle(&fi);
+    *start = esp_timer_get_time();
+    next_sample_us.store(*start + 1000000 / MOTION_FPS);     // Paced like the tap
+    if(!fb){
+        return false;
+    }
+    bool ok = fb->format == PIXFORMAT_JPEG && to_gray(fb->buf, fb->len, fb->width, fb->height);
+    cam_modes_fb_return(fb);
+    *seq = fi.seq;
+    stat_own++;
+    return ok;
+}
+
+static void motion_task_fn(void *arg){
+    int64_t window_start = esp_timer_get_time();
+    uint32_t window_samples = 0;
+    for(;;){
+        if(!enabled.load()){
+            vTaskDelay(pdMS_TO_TICKS(200));
+            continue;
+        }
+        uint32_t seq = 0;
+        int64_t start = 0;
+        if(!sample(&seq, &start)){
+            continue;
+        }
+        analyse(seq);
+        int64_t now = esp_timer_get_time();
+        stat_samples++;
+        stat_last_ms.store((uint32_t)((now - start) / 1000));
+        window_samples++;
+        if(now - window_start >= (int64_t)MOTION_FPS_WINDOW_MS * 1000){
+            fps_x10.store((uint32_t)(window_samples * 10000000LL / (now - window_start)));
+            window_start = now;
+            window_samples = 0;
+        }
+    }
+}
+
+bool motion_init(void){
+    tap_lock = xSemaphoreCreateMutex();
+    if(!tap_lock ||
+       xTaskCreate(motion_task_fn, "motion", 4096, NULL, tskIDLE_PRIORITY + 1, &motion_task) != pdPASS){
+        return false;
+    }
+    cam_modes_set_preview_tap(motion_tap);
+    return true;
+}
+
+void motion_enable(bool on){
+    enabled.store(on);
+}
+
+bool motion_enabled(void){
+    return enabled.load();
+}
+
+void motion_set_still(bool on){
+    still_on.store(on);
+}
+
+bool motion_still_enabled(void){
+    return still_on.load();
+}
+
+void motion_get_stats(motion_stats_t *out){
+    out->samples = stat_samples.load();
+    out->events = stat_events.load();
+    out->stills = stat_stills.load();
+    out->resets = stat_resets.load();
+    out->own_frames = stat_own.load();
+    out->last_ms = stat_last_ms.load();
+    out->fps = fps_x10.load() / 10.0f;
+    out->width = sw;
+    out->height = sh;
+}
@@ -0,0 +1,56 @@
+/*
+  Smart Plant Vision - Motion Engine
+  Watches a tiny grayscale copy of the preview (1/8 scale, 128x96 at XGA)
+  many times a second for small, fast movement: insects and pests that the
+  analysis cadence would miss. Each sample is compared with a running
+  average background; the pixels that differ are grouped into blobs, and
+  the blobs of pest size become "motion" events on the event channel, with
+  their bounding box in preview pixels. An event can also take a full
+  resolution still.
+
+  The engine looks at the frames the preview clients are fetching anyway,
+  so a running stream keeps its frame rate; it fetches frames itself only
+  while nobody else does.
+*/
+
+#ifndef MOTION_ENGINE_H
+#define MOTION_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MOTION_FPS          12    // Samples per second at most
+#define MOTION_IDLE_MS      300   // No preview frame for this long: the engine fetches its own
+#define MOTION_ALPHA_SHIFT  4     // The background moves 1/16 of the way to each sample
+#define MOTION_THRESHOLD    24    // Gray levels away from the background that count as moving
+#define MOTION_MIN_AREA     2     // Sample pixels in the smallest blob reported
+#define MOTION_MAX_SHARE    8     // Blobs over 1/8 of the picture are a leaf swaying or a light, not a pest
+#define MOTION_SCENE_SHARE  3     // Over 1/3 of the picture moving: exposure or framesize changed, start over
+#define MOTION_EVENT_MS     250   // Closest two motion events
+#define MOTION_STILL_MS     5000  // Closest two stills taken for events
+
+typedef struct {
+    uint32_t samples;
+    uint32_t events;
+    uint32_t stills;
+    uint32_t resets;          // Background restarted after a scene change
+    uint32_t own_frames;      // Samples the engine had to fetch itself
+    uint32_t last_ms;         // Decode and analysis of the latest sample
+    float fps;                // Samples per second over the last few seconds
+    uint16_t width, height;   // Sample size
+} motion_stats_t;
+
+// Installs the preview tap and starts the task; call after cam_modes_init()
+// and pev_init()
+bool motion_init(void);
+
+void motion_enable(bool on);
+bool motion_enabled(void);
+
+// Take a full resolution still with motion events, see pev_still_capture()
+void motion_set_still(bool on);
+bool motion_still_enabled(void);
+
+void motion_get_stats(motion_stats_t *out);
+
+#endif
@@ -0,0 +1,383 @@
+/*
+  Smart Plant Vision - MQTT Telemetry
+  The queue is a ring of fixed slots. A slot is queued, in flight (sent,
+  waiting for its PUBACK) or acknowledged; the oldest slots leave the ring
+  once acknowledged, so acks that come back out of order are fine. The MQTT
+  client's event handler only records what happened (acks go through a
+  FreeRTOS queue); the telemetry task does the rest, and never holds the
+  queue lock while publishing.
+*/
+
+#include "mqtt_telemetry.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "plant_events.h"
+#include "plant_log.h"
+
+#define TOPIC_SENSORS   0
+#define TOPIC_EVENTS    1
+#define TOPIC_LEN       64
+#define ACK_QUEUE_LEN   (TELEMETRY_WINDOW * 4)
+#define TASK_TICK_MS    100
+#define EVENT_HEAD_MAX  32      // {"seq":N,"events":...}
+
+typedef enum {
+    SLOT_QUEUED,
+    SLOT_INFLIGHT,
+    SLOT_ACKED,
+} slot_state_t;
+
+typedef struct {
+    uint32_t seq;             // The message's, which tells a slot reused after a drop apart
+    uint8_t topic;
+    uint8_t state;
+    bool sent;                // Sent before: sending it again is a resend
+    int msg_id;               // Of the PUBLISH in flight, -1 while it is being sent
+    uint16_t len;
+    char data[TELEMETRY_MSG_MAX];
+} slot_t;
+
+static esp_mqtt_client_handle_t client = NULL;
+static char topics[2][TOPIC_LEN];
+static char status_topic[TOPIC_LEN];
+static QueueHandle_t acks = NULL;             // PUBACKed message ids, from the MQTT task
+static std::atomic<bool> connected(false);
+static std::atomic<uint32_t> drops(0);        // Connections lost; the task requeues what was in flight
+
+// Queue, batch and message counter, under queue_lock
+static SemaphoreHandle_t queue_lock = NULL;
+static slot_t *slots = NULL;
+static uint32_t tail = 0, count = 0;          // Oldest slot and how many are used
+static uint32_t inflight = 0;
+static uint32_t msg_seq = 0;
+static struct {
+    int n;
+    uint32_t t_ms[TELEMETRY_BATCH];
+    uint32_t interval[TELEMETRY_BATCH];
+    float temp[TELEMETRY_BATCH], hum[TELEMETRY_BATCH], soil[TELEMETRY_BATCH];
+} batch;
+static char batch_buf[TELEMETRY_MSG_MAX];     // A message being made
+
+// Task only
+static char send_buf[TELEMETRY_MSG_MAX];
+static char event_buf[TELEMETRY_MSG_MAX];
+static plant_event_t held;                    // Read from the channel, did not fit the last message
+static bool have_held = false;
+static uint32_t event_cursor = 0;
+
+static std::atomic<uint32_t> stat_connects(0);
+static std::atomic<uint32_t> stat_queued(0);
+static std::atomic<uint32_t> stat_acked(0);
+static std::atomic<uint32_t> stat_resent(0);
+static std::atomic<uint32_t> stat_dropped(0);
+
+static void enqueue_locked(uint8_t topic, const char *data, size_t len){
+    if(count == TELEMETRY_SLOTS){
+        slot_t *old = &slots[tail];
+        if(old->state == SLOT_INFLIGHT){
+            inflight--;
+        }
+        tail = (tail + 1) % TELEMETRY_SLOTS;
+        count--;
+        stat_dropped++;
+    }
+    slot_t *s = &slots[(tail + count) % TELEMETRY_SLOTS];
+    s->seq = msg_seq;
+    s->topic = topic;
+    s->state = SLOT_QUEUED;
+    s->sent = false;
+    s->msg_id = -1;
+    s->len = (uint16_t)len;
+    memcpy(s->data, data, len);
+    count++;
+    stat_queued++;
+}
+
+// Appends to a message; false once it would not fit
+static bool add(char *buf, size_t *len, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static bool add(char *buf, size_t *len, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, TELEMETRY_MSG_MAX - *len, fmt, ap);
+    va_end(ap);
+    if(n < 0 || *len + n >= TELEMETRY_MSG_MAX){
+        buf[*len] = 0;
+        return false;
+    }
+    *len += n;
+    return true;
+}
+
+static void add_column(char *buf, size_t *len, const char *name, const float *v, int n){
+    add(buf, len, ",\"%s\":[", name);
+    for(int i = 0; i < n; i++){
+        if(isnan(v[i])) add(buf, len, "%snull", i ? "," : "");
+        else add(buf, len, "%s%.1f", i ? "," : "", v[i]);
+    }
+    add(buf, len, "]");
+}
+
+// A full batch is at most a few hundred bytes, well inside TELEMETRY_MSG_MAX
+static void flush_batch_locked(void){
+    if(!batch.n){
+        return;
+    }
+    size_t len = 0;
+    msg_seq++;
+    add(batch_buf, &len, "{\"seq\":%u,\"t0\":%u,\"dt\":[", msg_seq, batch.t_ms[0]);
+    for(int i = 0; i < batch.n; i++){
+        add(batch_buf, &len, "%s%u", i ? "," : "", batch.t_ms[i] - batch.t_ms[0]);
+    }
+    add(batch_buf, &len, "]");
+    add_column(batch_buf, &len, "temp", batch.temp, batch.n);
+    add_column(batch_buf, &len, "hum", batch.hum, batch.n);
+    add_column(batch_buf, &len, "soil", batch.soil, batch.n);
+    add(batch_buf, &len, ",\"int\":[");
+    for(int i = 0; i < batch.n; i++){
+        add(batch_buf, &len, "%s%u", i ? "," : "", batch.interval[i]);
+    }
+    add(batch_buf, &len, "]}");
+    enqueue_locked(TOPIC_SENSORS, batch_buf, len);
+    batch.n = 0;
+}
+
+void telemetry_sample(float temperature, float humidity, float soil, uint32_t interval_ms){
+    if(!queue_lock){
+        return;
+    }
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    int i = batch.n++;
+    batch.t_ms[i] = (uint32_t)(esp_timer_get_time() / 1000);
+    batch.temp[i] = temperature;
+    batch.hum[i] = humidity;
+    batch.soil[i] = soil;
+    batch.interval[i] = interval_ms;
+    if(batch.n == TELEMETRY_BATCH){
+        flush_batch_locked();
+    }
+    xSemaphoreGive(queue_lock);
+}
+
+// Packs what the event channel has into messages. The list is built first
+// and wrapped under the lock, where the message gets its seq.
+static void collect_events(void){
+    const size_t room = TELEMETRY_MSG_MAX - EVENT_HEAD_MAX;
+    for(;;){
+        size_t len = 1;
+        int n = 0;
+        event_buf[0] = '[';
+        while(n < TELEMETRY_EVENTS && (have_held || pev_next(&event_cursor, &held))){
+            have_held = true;
+            size_t mark = len;
+            if(n) event_buf[len++] = ',';
+            int m = pev_json(&held, event_buf + len, room - len);
+            if(m < 0 || len + m + 1 >= room){
+                len = mark;
+                break;                // Goes first in the next message
+            }
+            len += m;
+            have_held = false;
+            n++;
+        }
+        if(!n){
+            return;
+        }
+        event_buf[len++] = ']';
+        event_buf[len] = 0;
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+        msg_seq++;
+        int m = snprintf(batch_buf, TELEMETRY_MSG_MAX, "{\"seq\":%u,\"events\":%s}", msg_seq, event_buf);
+        enqueue_locked(TOPIC_EVENTS, batch_buf, m);
+        xSemaphoreGive(queue_lock);
+    }
+}
+
+static void ack_locked(int msg_id){
+    for(uint32_t i = 0; i < count; i++){
+        slot_t *s = &slots[(tail + i) % TELEMETRY_SLOTS];
+        if(s->state == SLOT_INFLIGHT && s->msg_id == msg_id){
+            s->state = SLOT_ACKED;
+            inflight--;
+            stat_acked++;
+            break;
+        }
+    }
+    while(count && slots[tail].state == SLOT_ACKED){
+        tail = (tail + 1) % TELEMETRY_SLOTS;
+        count--;
+    }
+}
+
+static void requeue_locked(void){
+    for(uint32_t i = 0; i < count; i++){
+        slot_t *s = &slots[(tail + i) % TELEMETRY_SLOTS];
+        if(s->state == SLOT_INFLIGHT){
+            s->state = SLOT_QUEUED;
+        }
+    }
+    inflight = 0;
+}
+
+// Sends the oldest queued message; false when there was none, the window
+// is full or the send failed
+static bool send_next(void){
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    slot_t *s = NULL;
+    for(uint32_t i = 0; i < count && !s && inflight < TELEMETRY_WINDOW; i++){
+        slot_t *c = &slots[(tail + i) % TELEMETRY_SLOTS];
+        if(c->state == SLOT_QUEUED){
+            s = c;
+        }
+    }
+    if(!s){
+        xSemaphoreGive(queue_lock);
+        return false;
+    }
+    uint32_t seq = s->seq;
+    uint8_t topic = s->topic;
+    size_t len = s->len;
+    bool again = s->sent;
+    memcpy(send_buf, s->data, len);
+    s->state = SLOT_INFLIGHT;
+    s->msg_id = -1;
+    s->sent = true;
+    inflight++;
+    xSemaphoreGive(queue_lock);
+
+    int id = esp_mqtt_client_publish(client, topics[topic], send_buf, len, 1, 0);
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    if(s->seq == seq && s->state == SLOT_INFLIGHT){         // Not dropped while it was being sent
+        if(id < 0){
+            s->state = SLOT_QUEUED;
+            inflight--;
+        } else {
+            s->msg_id = id;
+        }
+    }
+    xSemaphoreGive(queue_lock);
+    if(id >= 0 && again){
+        stat_resent++;
+    }
+    return id >= 0;
+}
+
+static void telemetry_task(void *arg){
+    uint32_t seen_drops = 0;
+    float tokens = TELEMETRY_WINDOW;
+    int64_t last_us = esp_timer_get_time();
+    for(;;){
+        int msg_id;
+        bool got = xQueueReceive(acks, &msg_id, pdMS_TO_TICKS(TASK_TICK_MS)) == pdTRUE;
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+        while(got){
+            ack_locked(msg_id);
+            got = xQueueReceive(acks, &msg_id, 0) == pdTRUE;
+        }
+        if(drops.load() != seen_drops){
+            seen_drops = drops.load();
+            requeue_locked();
+        }
+        int64_t now = esp_timer_get_time();
+        if(batch.n && (uint32_t)(now / 1000) - batch.t_ms[0] >= TELEMETRY_BATCH_MS){
+            flush_batch_locked();
+        }
+        xSemaphoreGive(queue_lock);
+
+        collect_events();
+
+        tokens += (now - last_us) * TELEMETRY_DRAIN_PER_S / 1e6f;
+        tokens = tokens > TELEMETRY_WINDOW ? TELEMETRY_WINDOW : tokens;
+        last_us = now;
+        while(connected.load() && tokens >= 1 && send_next()){
+            tokens -= 1;
+        }
+    }
+}
+
+static void mqtt_event(void *arg, esp_event_base_t base, int32_t event_id, void *event_data){
+    esp_mqtt_event_handle_t e = (esp_mqtt_event_handle_t)event_data;
+    switch(event_id){
+        case MQTT_EVENT_CONNECTED:
+            stat_connects++;
+            connected.store(true);
+            esp_mqtt_client_publish(e->client, status_topic, "online", 0, 1, 1);
+            PLOGI("MQTT connected");
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            if(connected.exchange(false)){
+                drops++;
+                PLOGW("MQTT disconnected");
+            } else {
+                PLOG_LIMITED(PLOG_WARN, 3, "MQTT broker unreachable, telemetry is queued");
+            }
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            xQueueSend(acks, &e->msg_id, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+bool telemetry_start(const char *uri, const char *prefix){
+    if(!uri || !uri[0] || client){
+        return false;
+    }
+    snprintf(topics[TOPIC_SENSORS], TOPIC_LEN, "%s/sensors", prefix);
+    snprintf(topics[TOPIC_EVENTS], TOPIC_LEN, "%s/events", prefix);
+    snprintf(status_topic, TOPIC_LEN, "%s/status", prefix);
+    queue_lock = xSemaphoreCreateMutex();
+    acks = xQueueCreate(ACK_QUEUE_LEN, sizeof(int));
+    slots = (slot_t *)heap_caps_malloc(sizeof(slot_t) * TELEMETRY_SLOTS, MALLOC_CAP_SPIRAM);
+    if(!queue_lock || !acks || !slots){
+        PLOGE("No memory for the telemetry queue");
+        return false;
+    }
+
+    esp_mqtt_client_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.uri = uri;
+    cfg.client_id = prefix;
+    cfg.lwt_topic = status_topic;
+    cfg.lwt_msg = "offline";
+    cfg.lwt_qos = 1;
+    cfg.lwt_retain = 1;
+    cfg.keepalive = TELEMETRY_KEEPALIVE_S;
+    client = esp_mqtt_client_init(&cfg);
+    if(!client){
+        return false;
+    }
+    esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event, NULL);
+    if(xTaskCreate(telemetry_task, "telemetry", 4096, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS){
+        return false;
+    }
+    return esp_mqtt_client_start(client) == ESP_OK;
+}
+
+void telemetry_get_stats(telemetry_stats_t *out){
+    out->connected = connected.load();
+    out->connects = stat_connects.load();
+    out->queued = stat_queued.load();
+    out->acked = stat_acked.load();
+    out->resent = stat_resent.load();
+    out->dropped = stat_dropped.load();
+    if(queue_lock){
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+        out->depth = count;
+        out->inflight = inflight;
+        xSemaphoreGive(queue_lock);
+    } else {
+        out->depth = out->inflight = 0;
+    }
+}
@@ -0,0 +1,60 @@
+/*
+  Smart Plant Vision - MQTT Telemetry
+  Pushes the sensor readings and the event channel to an MQTT broker, so a
+  fleet is not polled one /sensors request at a time. Topics, under the
+  device's prefix:
+
+    <prefix>/sensors  a batch of readings, as columns:
+                      {"seq":N,"t0":ms since boot,"dt":[ms after t0,..],
+                       "temp":[..],"hum":[..],"soil":[..],"int":[interval ms,..]}
+                      (null for a failed reading)
+    <prefix>/events   {"seq":N,"events":[{"id":..,"t_ms":..,"type":"motion",..},..]}
+    <prefix>/status   "online", retained; the broker swaps in "offline" when
+                      the device drops off (last will)
+
+  Messages wait in a queue in PSRAM and leave it when the broker has
+  acknowledged them (QoS 1), with at most TELEMETRY_WINDOW unacknowledged
+  at a time and at most TELEMETRY_DRAIN_PER_S sent a second, so a backlog
+  drains at a steady pace after a reconnect. While the broker is out of
+  reach the queue fills up and then drops its oldest messages.
+
+  A message whose ack was lost with the connection is sent again, so a
+  consumer may see one twice: seq counts the messages of both topics and
+  starts again from 1 after a reboot, when t0 starts again too.
+*/
+
+#ifndef MQTT_TELEMETRY_H
+#define MQTT_TELEMETRY_H
+
+#include <stdint.h>
+
+#define TELEMETRY_BATCH         10      // Readings per sensors message
+#define TELEMETRY_BATCH_MS      120000  // A batch goes out when its first reading is this old, full or not
+#define TELEMETRY_EVENTS        8       // Events per events message at most
+#define TELEMETRY_SLOTS         64      // Queue length in messages
+#define TELEMETRY_MSG_MAX       1024    // Longest message
+#define TELEMETRY_WINDOW        4       // Sent and not yet acknowledged, at most
+#define TELEMETRY_DRAIN_PER_S   10      // Messages sent per second, at most
+#define TELEMETRY_KEEPALIVE_S   30
+
+typedef struct {
+    bool connected;
+    uint32_t connects;
+    uint32_t queued;          // Messages made
+    uint32_t acked;
+    uint32_t resent;          // Sent again after a connection dropped before the ack
+    uint32_t dropped;         // Pushed out of a full queue
+    uint32_t depth;           // In the queue now, sent or not
+    uint32_t inflight;
+} telemetry_stats_t;
+
+// Starts the client and the task; uri is "mqtt://host:port" and prefix the
+// device's topic prefix ("plants/bench-1"). An empty uri leaves it off.
+bool telemetry_start(const char *uri, const char *prefix);
+
+// Queues a reading for the next batch; NAN for a failed one
+void telemetry_sample(float temperature, float humidity, float soil, uint32_t interval_ms);
+
+void telemetry_get_stats(telemetry_stats_t *out);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+  Smart Plant Vision - detection annotation
+*/
+
+#include "annotate.h"
+#include <stdio.h>
+#include <string.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+bool glyph_atlas_load(glyph_atlas_t *atlas, const char *font_path, int pixel_size, char *err, size_t err_len){
+    FT_Library lib;
+    FT_Face face;
+    if(FT_Init_FreeType(&lib)){
+        snprintf(err, err_len, "FreeType did not start");
+        return false;
+    }
+    if(FT_New_Face(lib, font_path, 0, &face)){
+        snprintf(err, err_len, "cannot load font %s", font_path);
+        FT_Done_FreeType(lib);
+        return false;
+    }
+    if(FT_Set_Pixel_Sizes(face, 0, pixel_size)){
+        snprintf(err, err_len, "font %s has no %d pixel size", font_path, pixel_size);
+        FT_Done_Face(face);
+        FT_Done_FreeType(lib);
+        return false;
+    }
+
+    // First pass places the glyphs side by side, the second copies their bitmaps
+    atlas->width = 0;
+    atlas->height = 1;
+    atlas->ascender = (int)((face->size->metrics.ascender + 63) >> 6);
+    for(int pass = 0; pass < 2; pass++){
+        int x = 0;
+        for(int i = 0; i < GLYPH_COUNT; i++){
+            glyph_t *g = &atlas->glyphs[i];
+            if(FT_Load_Char(face, GLYPH_FIRST + i, FT_LOAD_RENDER)){
+                memset(g, 0, sizeof(*g));
+                continue;
+            }
+            FT_GlyphSlot slot = face->glyph;
+            const FT_Bitmap *bm = &slot->bitmap;
+            if(pass == 0){
+                g->x = x;
+                g->width = (int)bm->width;
+                g->height = (int)bm->rows;
+                g->left = slot->bitmap_left;
+                g->top = slot->bitmap_top;
+                g->advance = (int)((slot->advance.x + 32) >> 6);
+                atlas->height = g->height > atlas->height ? g->height : atlas->height;
+            } else {
+                for(int y = 0; y < g->height; y++){
+                    memcpy(&atlas->coverage[(size_t)y * atlas->width + g->x], bm->buffer + (ptrdiff_t)y * bm->pitch, g->width);
+                }
+            }
+            x += (int)bm->width;
+        }
+        if(pass == 0){
+            atlas->width = x;
+            atlas->coverage.assign((size_t)atlas->width * atlas->height, 0);
+        }
+    }
+    FT_Done_Face(face);
+    FT_Done_FreeType(lib);
+    return true;
+}
+
+// Next code point of a UTF-8 string, '?' for anything the atlas lacks or can't be decoded
+static const glyph_t *next_glyph(const glyph_atlas_t *atlas, const char **s){
+    const uint8_t *p = (const uint8_t *)*s;
+    unsigned cp = *p++;
+    if(cp >= 0x80){
+        if((cp & 0xe0) == 0xc0 && (*p & 0xc0) == 0x80){
+            cp = ((cp & 0x1f) << 6) | (*p++ & 0x3f);
+        } else {
+            cp = '?';
+        }
+        while((*p & 0xc0) == 0x80){
+            cp = '?';
+            p++;
+        }
+    }
+    *s = (const char *)p;
+    if(cp < GLYPH_FIRST || cp >= GLYPH_FIRST + GLYPH_COUNT){
+        cp = '?';
+    }
+    return &atlas->glyphs[cp - GLYPH_FIRST];
+}
+
+void glyph_atlas_measure(const glyph_atlas_t *atlas, const char *text, int *width, int *height){
+    int pen = 0, w = 0, h = 0;
+    while(*text){
+        const glyph_t *g = next_glyph(atlas, &text);
+        if(g->width){
+            int right = pen + g->left + g->width;
+            int bottom = atlas->ascender - g->top + g->height;
+            w = right > w ? right : w;
+            h = bottom > h ? bottom : h;
+        }
+        pen += g->advance;
+    }
+    *width = w;
+    *height = h;
+}
+
+static void fill_rect(canvas_t *img, int x1, int y1, int x2, int y2, color_t c){
+    x1 = x1 < 0 ? 0 : x1;
+    y1 = y1 < 0 ? 0 : y1;
+    x2 = x2 >= img->width ? img->width - 1 : x2;
+    y2 = y2 >= img->height ? img->height - 1 : y2;
+    for(int y = y1; y <= y2; y++){
+        uint8_t *p = img->rgb + (size_t)y * img->stride + (size_t)x1 * 3;
+        for(int x = x1; x <= x2; x++, p += 3){
+            p[0] = c.r;
+            p[1] = c.g;
+            p[2] = c.b;
+        }
+    }
+}
+
+static inline uint8_t blend(uint8_t bg, uint8_t fg, unsigned a){
+    return (uint8_t)((bg * (255 - a) + fg * a + 127) / 255);
+}
+
+static void draw_text(const glyph_atlas_t *atlas, canvas_t *img, int x, int y, const char *text, color_t c){
+    int baseline = y + atlas->ascender;
+    while(*text){
+        const glyph_t *g = next_glyph(atlas, &text);
+        int gx = x + g->left, gy = baseline - g->top;
+        for(int row = 0; row < g->height; row++){
+            int py = gy + row;
+            if(py < 0 || py >= img->height){
+                continue;
+            }
+            const uint8_t *cov = &atlas->coverage[(size_t)row * atlas->width + g->x];
+            uint8_t *p = img->rgb + (size_t)py * img->stride;
+            for(int col = 0; col < g->width; col++){
+                int px = gx + col;
+                unsigned a = cov[col];
+                if(a && px >= 0 && px < img->width){
+                    uint8_t *d = p + (size_t)px * 3;
+                    d[0] = blend(d[0], c.r, a);
+                    d[1] = blend(d[1], c.g, a);
+                    d[2] = blend(d[2], c.b, a);
+                }
+            }
+        }
+        x += g->advance;
+    }
+}
+
+void annotate_draw(const glyph_atlas_t *atlas, canvas_t *img, const annotation_t *items, size_t n,
+                   int line_width, int pad){
+    for(size_t i = 0; i < n; i++){
+        const annotation_t *a = &items[i];
+        if(a->x2 < a->x1 || a->y2 < a->y1){
+            continue;
+        }
+        // Outline drawn inward from the edges
+        int w = line_width;
+        fill_rect(img, a->x1, a->y1, a->x2, a->y1 + w - 1, a->color);
+        fill_rect(img, a->x1, a->y2 - w + 1, a->x2, a->y2, a->color);
+        fill_rect(img, a->x1, a->y1, a->x1 + w - 1, a->y2, a->color);
+        fill_rect(img, a->x2 - w + 1, a->y1, a->x2, a->y2, a->color);
+
+        // Tab sitting on the box's top edge, cut off at the image's top
+        int text_w, text_h;
+        glyph_atlas_measure(atlas, a->text, &text_w, &text_h);
+        int top = a->y1 - text_h - pad * 2;
+        fill_rect(img, a->x1, top < 0 ? 0 : top, a->x1 + text_w + pad * 2, a->y1, a->color);
+        draw_text(atlas, img, a->x1 + pad, a->y1 - text_h - pad, a->text, a->text_color);
+    }
+}
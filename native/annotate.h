@@ -0,0 +1,62 @@
+/*
+  Smart Plant Vision - detection annotation
+
+  Draws each detection's box and its label (a filled tab on top of the box
+  with the text in it) straight onto the RGB pixels, the way app.py's
+  draw_box_and_label() lays them out with PIL. The font is rasterized once
+  with FreeType into a glyph atlas, U+0020 to U+00FF; drawing text is then
+  only blending atlas coverage into the tab. Characters past U+00FF show
+  as '?'.
+*/
+#ifndef NATIVE_ANNOTATE_H
+#define NATIVE_ANNOTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define GLYPH_FIRST     0x20
+#define GLYPH_COUNT     (0x100 - GLYPH_FIRST)
+
+typedef struct {
+    uint8_t *rgb;               // Interleaved R,G,B, drawn on in place
+    int width, height;
+    size_t stride;              // Bytes per row
+} canvas_t;
+
+typedef struct {
+    uint8_t r, g, b;
+} color_t;
+
+typedef struct {
+    int x1, y1, x2, y2;         // Pixels, edges inclusive as PIL's rectangle()
+    const char *text;           // UTF-8
+    color_t color;              // Box and tab
+    color_t text_color;
+} annotation_t;
+
+typedef struct {
+    int x;                      // Column of the bitmap in the atlas
+    int width, height;
+    int left, top;              // Bitmap's offset right of the pen and up from the baseline
+    int advance;
+} glyph_t;
+
+typedef struct {
+    std::vector<uint8_t> coverage;  // height rows of width 8-bit coverage
+    int width, height;
+    int ascender;               // Pixels from the top of a line to its baseline
+    glyph_t glyphs[GLYPH_COUNT];
+} glyph_atlas_t;
+
+// Rasterizes the font at pixel_size (as PIL's ImageFont.truetype(path, size))
+bool glyph_atlas_load(glyph_atlas_t *atlas, const char *font_path, int pixel_size, char *err, size_t err_len);
+
+// Extent of the text's ink from the top left of its line, as PIL's textbbox((0, 0), ...)[2:]
+void glyph_atlas_measure(const glyph_atlas_t *atlas, const char *text, int *width, int *height);
+
+// Draws all the annotations in order; anything off the canvas is clipped
+void annotate_draw(const glyph_atlas_t *atlas, canvas_t *img, const annotation_t *items, size_t n,
+                   int line_width, int pad);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+  Smart Plant Vision - scaled JPEG decode
+*/
+
+#include "jpeg_decode.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+
+struct decode_err {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+    char *msg;
+    size_t msg_len;
+};
+
+static void decode_error_exit(j_common_ptr cinfo){
+    decode_err *e = (decode_err *)cinfo->err;
+    char text[JMSG_LENGTH_MAX];
+    e->mgr.format_message(cinfo, text);
+    snprintf(e->msg, e->msg_len, "%s", text);
+    longjmp(e->jump, 1);
+}
+
+static void decode_silent(j_common_ptr cinfo, int level){
+    (void)cinfo; (void)level;
+}
+
+bool jpeg_read_size(const uint8_t *data, size_t len, int *width, int *height){
+    struct jpeg_decompress_struct cinfo;
+    decode_err err;
+    char msg[JMSG_LENGTH_MAX];
+    err.msg = msg;
+    err.msg_len = sizeof(msg);
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = decode_error_exit;
+    err.mgr.emit_message = decode_silent;
+    if(setjmp(err.jump)){
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, len);
+    bool ok = jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK;
+    *width = cinfo.image_width;
+    *height = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    return ok;
+}
+
+// libjpeg rounds scaled sizes up
+static int scaled(int v, int scale){
+    return (v + scale - 1) / scale;
+}
+
+int jpeg_pick_scale(int width, int height, int min_width, int min_height){
+    if(min_width <= 0 && min_height <= 0){
+        return 1;
+    }
+    for(int scale = 8; scale > 1; scale /= 2){
+        if(scaled(width, scale) >= min_width && scaled(height, scale) >= min_height){
+            return scale;
+        }
+    }
+    return 1;
+}
+
+bool jpeg_decode_scaled(const uint8_t *data, size_t len, int min_width, int min_height,
+                        const jpeg_region_t *region, jpeg_image_t *out, char *msg, size_t msg_len){
+    struct jpeg_decompress_struct cinfo;
+    decode_err err;
+    uint8_t *volatile rgb = NULL;     // volatile: still read after a longjmp
+    uint8_t *volatile row = NULL;
+    err.msg = msg;
+    err.msg_len = msg_len;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = decode_error_exit;
+    err.mgr.emit_message = decode_silent;
+    if(setjmp(err.jump)){
+        jpeg_destroy_decompress(&cinfo);
+        free(rgb);
+        free(row);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, len);
+    if(jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK){
+        snprintf(msg, msg_len, "no JPEG image");
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_region_t r = {0, 0, (int)cinfo.image_width, (int)cinfo.image_height};
+    if(region){
+        r.x1 = region->x1 < 0 ? 0 : region->x1;
+        r.y1 = region->y1 < 0 ? 0 : region->y1;
+        r.x2 = region->x2 > r.x2 ? r.x2 : region->x2;
+        r.y2 = region->y2 > r.y2 ? r.y2 : region->y2;
+        if(r.x2 <= r.x1 || r.y2 <= r.y1){
+            snprintf(msg, msg_len, "region outside the %ux%u image", cinfo.image_width, cinfo.image_height);
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+    }
+    int scale = jpeg_pick_scale(r.x2 - r.x1, r.y2 - r.y1, min_width, min_height);
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+
+    // The region in scaled pixels, grown to whole pixels
+    int x0 = r.x1 / scale, y0 = r.y1 / scale;
+    int x1 = scaled(r.x2, scale), y1 = scaled(r.y2, scale);
+    x1 = x1 > (int)cinfo.output_width ? (int)cinfo.output_width : x1;
+    y1 = y1 > (int)cinfo.output_height ? (int)cinfo.output_height : y1;
+    int w = x1 - x0, h = y1 - y0;
+
+    // Columns start on an iMCU boundary, so the decoded rows may begin left of x0
+    JDIMENSION crop_x = x0, crop_w = w;
+    if(w < (int)cinfo.output_width){
+        jpeg_crop_scanline(&cinfo, &crop_x, &crop_w);
+    } else {
+        crop_x = 0;
+        crop_w = cinfo.output_width;
+    }
+    size_t skip = (size_t)(x0 - crop_x) * 3;
+    rgb = (uint8_t *)malloc((size_t)w * h * 3);
+    bool staged = skip || crop_w != (JDIMENSION)w;
+    row = staged ? (uint8_t *)malloc((size_t)crop_w * 3) : NULL;
+    if(!rgb || (staged && !row)){
+        snprintf(msg, msg_len, "out of memory for a %dx%d image", w, h);
+        jpeg_destroy_decompress(&cinfo);
+        free(rgb);
+        free(row);
+        return false;
+    }
+    if(y0){
+        jpeg_skip_scanlines(&cinfo, y0);
+    }
+    for(int y = 0; y < h; y++){
+        JSAMPROW dst = staged ? row : rgb + (size_t)y * w * 3;
+        jpeg_read_scanlines(&cinfo, &dst, 1);
+        if(staged){
+            memcpy(rgb + (size_t)y * w * 3, row + skip, (size_t)w * 3);
+        }
+    }
+    if(cinfo.output_scanline < cinfo.output_height){
+        jpeg_abort_decompress(&cinfo);      // Rows below the region are not needed
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+
+    out->rgb = rgb;
+    out->width = w;
+    out->height = h;
+    out->scale = scale;
+    out->x = x0;
+    out->y = y0;
+    return true;
+}
+
+void jpeg_image_free(jpeg_image_t *img){
+    free(img->rgb);
+    img->rgb = NULL;
+}
@@ -0,0 +1,49 @@
+/*
+  Smart Plant Vision - scaled JPEG decode
+
+  The models need far fewer pixels than a camera still has: YOLO looks at
+  640 pixels on the long side, the classifier at 224x224 crops. libjpeg-turbo
+  can leave out the high frequencies while decoding (DCT-domain scaling, 1/2,
+  1/4 or 1/8), which costs a fraction of a full decode plus a resize. The
+  decoder picks the smallest of those scales at which the image, or a region
+  of it, still measures at least the size asked for.
+
+  A region is decoded by skipping the rows above it and the iMCU columns to
+  its left (jpeg_skip_scanlines / jpeg_crop_scanline) and stopping after
+  its last row.
+*/
+#ifndef NATIVE_JPEG_DECODE_H
+#define NATIVE_JPEG_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JPEG_ERR_MAX    200     // Room for a decode error message
+
+typedef struct {
+    int x1, y1, x2, y2;         // Full resolution pixels, x2/y2 exclusive
+} jpeg_region_t;
+
+typedef struct {
+    uint8_t *rgb;               // Packed R,G,B rows, malloc()ed; jpeg_image_free() releases it
+    int width, height;
+    int scale;                  // 1, 2, 4 or 8: full resolution pixels per decoded pixel
+    int x, y;                   // Top left of the pixels in the scaled image
+} jpeg_image_t;
+
+// Size from the frame header, without decoding
+bool jpeg_read_size(const uint8_t *data, size_t len, int *width, int *height);
+
+// Largest reduction (8, 4, 2 or 1) that keeps width x height at least
+// min_width x min_height; 1 when neither minimum is given (both 0)
+int jpeg_pick_scale(int width, int height, int min_width, int min_height);
+
+// Decodes region (the whole image when NULL, clipped to it otherwise) at the
+// scale jpeg_pick_scale() gives for the region's size. On failure returns
+// false with a message in err.
+bool jpeg_decode_scaled(const uint8_t *data, size_t len, int min_width, int min_height,
+                        const jpeg_region_t *region, jpeg_image_t *out, char *err, size_t err_len);
+
+void jpeg_image_free(jpeg_image_t *img);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+  Smart Plant Vision - JPEG encode
+*/
+
+#include "jpeg_encode.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <jpeglib.h>
+
+struct encode_err {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+    char *msg;
+    size_t msg_len;
+};
+
+static void encode_error_exit(j_common_ptr cinfo){
+    encode_err *e = (encode_err *)cinfo->err;
+    char text[JMSG_LENGTH_MAX];
+    e->mgr.format_message(cinfo, text);
+    snprintf(e->msg, e->msg_len, "%s", text);
+    longjmp(e->jump, 1);
+}
+
+static void encode_silent(j_common_ptr cinfo, int level){
+    (void)cinfo; (void)level;
+}
+
+bool jpeg_encode_rgb(const uint8_t *rgb, int width, int height, size_t stride, int quality,
+                     uint8_t **out, size_t *out_len, char *msg, size_t msg_len){
+    struct jpeg_compress_struct cinfo;
+    encode_err err;
+    unsigned char *buf = NULL;      // Owned by jpeg_mem_dest() until it returns
+    unsigned long len = 0;
+    err.msg = msg;
+    err.msg_len = msg_len;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = encode_error_exit;
+    err.mgr.emit_message = encode_silent;
+    if(setjmp(err.jump)){
+        jpeg_destroy_compress(&cinfo);
+        free(buf);
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &len);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < cinfo.image_height){
+        JSAMPROW row = (JSAMPROW)(rgb + (size_t)cinfo.next_scanline * stride);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    *out = buf;
+    *out_len = len;
+    return true;
+}
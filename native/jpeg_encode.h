@@ -0,0 +1,18 @@
+/*
+  Smart Plant Vision - JPEG encode
+
+  Compresses RGB pixels in place of a PIL save: libjpeg-turbo's SIMD
+  color conversion and DCT, 4:2:0 chroma, no extra Huffman pass, straight
+  from the caller's rows into one memory buffer.
+*/
+#ifndef NATIVE_JPEG_ENCODE_H
+#define NATIVE_JPEG_ENCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// *out is malloc()ed, free() it. On failure returns false with a message in err.
+bool jpeg_encode_rgb(const uint8_t *rgb, int width, int height, size_t stride, int quality,
+                     uint8_t **out, size_t *out_len, char *err, size_t err_len);
+
+#endif
@@ -0,0 +1,524 @@
+/*
+  Smart Plant Vision - plant_native, the Flask app's native image paths
+  CPython extension (no pybind11 or numpy needed to build it). Images and
+  output buffers go through the buffer protocol, so numpy arrays, PIL
+  images via np.asarray(), torch CPU tensors via .numpy(), bytearrays and
+  memoryviews all work without copies. The GIL is released while the work
+  runs.
+
+    preprocess(image, boxes, out, size=224, mean=IMAGENET, std=IMAGENET, threads=0) -> n
+        image  H x W x 3 uint8 (rows may be padded)
+        boxes  sequence of (x1, y1, x2, y2), truncated to int as PIL's crop()
+        out    writable float32 C-contiguous buffer of at least n x 3 x size x size
+
+    jpeg_size(data) -> (width, height)
+
+    decode_jpeg(data, min_width=0, min_height=0, region=None) -> JpegImage
+        Decodes at the coarsest of 1/8, 1/4, 1/2 and full scale that keeps the
+        image, or region (x1, y1, x2, y2 in full resolution pixels), at least
+        min_width x min_height, at full scale when neither is given. A JpegImage is an H x W x 3 uint8 buffer
+        (np.asarray() and preprocess() take it as it is) with width,
+        height, scale (full resolution pixels per pixel) and x, y (where its
+        top left pixel lies in the scaled image).
+
+    Annotator(font, size=18)
+        Rasterizes a TrueType font once.
+      .draw(image, annotations, line_width=3, pad=4)
+        Draws ((x1, y1, x2, y2), text, (r, g, b), (r, g, b) text) boxes and
+        labels onto a writable H x W x 3 uint8 image.
+      .text_size(text) -> (width, height)
+
+    encode_jpeg(image, quality=95) -> bytes
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "annotate.h"
+#include "jpeg_decode.h"
+#include "jpeg_encode.h"
+#include "preprocess.h"
+
+#define MAX_SIZE    4096    // Largest square the classifier input may be
+
+static const float imagenet_mean[3] = {0.485f, 0.456f, 0.406f};
+static const float imagenet_std[3] = {0.229f, 0.224f, 0.225f};
+
+// Releases a Py_buffer when it goes out of scope
+struct buffer_guard {
+    Py_buffer view;
+    bool held = false;
+    ~buffer_guard(){
+        if(held){
+            PyBuffer_Release(&view);
+        }
+    }
+    bool get(PyObject *obj, int flags){
+        held = PyObject_GetBuffer(obj, &view, flags) == 0;
+        return held;
+    }
+};
+
+static bool format_is(const Py_buffer *b, char code){
+    const char *f = b->format ? b->format : "B";
+    if(*f == '@' || *f == '=' || *f == '<'){
+        f++;
+    }
+    return f[0] == code && f[1] == 0;
+}
+
+// An H x W x 3 uint8 buffer with contiguous pixels; flags may add PyBUF_WRITABLE
+static bool get_rgb(PyObject *obj, buffer_guard *g, rgb_image_t *img, int flags = 0){
+    if(!g->get(obj, PyBUF_STRIDES | PyBUF_FORMAT | flags)){
+        return false;
+    }
+    const Py_buffer *b = &g->view;
+    if(b->ndim != 3 || b->shape[2] != 3 || b->itemsize != 1 || !format_is(b, 'B') ||
+       b->strides[2] != 1 || b->strides[1] != 3 || b->strides[0] < b->shape[1] * 3){
+        PyErr_SetString(PyExc_ValueError, "image must be an H x W x 3 uint8 array with contiguous rows");
+        return false;
+    }
+    img->rgb = (const uint8_t *)b->buf;
+    img->height = (int)b->shape[0];
+    img->width = (int)b->shape[1];
+    img->stride = (size_t)b->strides[0];
+    return true;
+}
+
+static bool get_triple(PyObject *obj, const float *dflt, float out[3], const char *name){
+    if(!obj || obj == Py_None){
+        memcpy(out, dflt, sizeof(float) * 3);
+        return true;
+    }
+    PyObject *seq = PySequence_Fast(obj, name);
+    if(!seq){
+        return false;
+    }
+    bool ok = PySequence_Fast_GET_SIZE(seq) == 3;
+    for(int i = 0; ok && i < 3; i++){
+        out[i] = (float)PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+        ok = !PyErr_Occurred();
+    }
+    Py_DECREF(seq);
+    if(!ok && !PyErr_Occurred()){
+        PyErr_Format(PyExc_ValueError, "%s must be three numbers", name);
+    }
+    return ok;
+}
+
+// (x1, y1, x2, y2) boxes, clipped to the image
+static bool get_boxes(PyObject *obj, int width, int height, std::vector<crop_box_t> *out){
+    PyObject *seq = PySequence_Fast(obj, "boxes must be a sequence of (x1, y1, x2, y2)");
+    if(!seq){
+        return false;
+    }
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    out->resize(n);
+    bool ok = true;
+    for(Py_ssize_t i = 0; ok && i < n; i++){
+        PyObject *box = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i), "each box must be (x1, y1, x2, y2)");
+        if(!box){
+            ok = false;
+            break;
+        }
+        double v[4];
+        ok = PySequence_Fast_GET_SIZE(box) == 4;
+        for(int j = 0; ok && j < 4; j++){
+            v[j] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(box, j));
+            ok = !PyErr_Occurred() && v[j] > -1e9 && v[j] < 1e9;
+        }
+        Py_DECREF(box);
+        crop_box_t *b = &(*out)[i];
+        if(ok){
+            b->x1 = (int)v[0];
+            b->y1 = (int)v[1];
+            b->x2 = (int)v[2];
+            b->y2 = (int)v[3];
+            ok = crop_box_clip(b, width, height);
+        }
+        if(!ok && !PyErr_Occurred()){
+            PyErr_Format(PyExc_ValueError, "box %zd is not four numbers covering part of the image", i);
+        }
+    }
+    Py_DECREF(seq);
+    return ok;
+}
+
+static PyObject *py_preprocess(PyObject *, PyObject *args, PyObject *kwargs){
+    static const char *kwlist[] = {"image", "boxes", "out", "size", "mean", "std", "threads", NULL};
+    PyObject *image, *boxes, *out, *mean_obj = NULL, *std_obj = NULL;
+    int size = 224, threads = 0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|iOOi", (char **)kwlist,
+                                    &image, &boxes, &out, &size, &mean_obj, &std_obj, &threads)){
+        return NULL;
+    }
+    if(size < 1 || size > MAX_SIZE){
+        return PyErr_Format(PyExc_ValueError, "size must be 1 to %d", MAX_SIZE);
+    }
+    float mean[3], std[3];
+    if(!get_triple(mean_obj, imagenet_mean, mean, "mean") || !get_triple(std_obj, imagenet_std, std, "std")){
+        return NULL;
+    }
+    if(std[0] == 0 || std[1] == 0 || std[2] == 0){
+        return PyErr_Format(PyExc_ValueError, "std must not be 0");
+    }
+    buffer_guard img_buf, out_buf;
+    rgb_image_t img;
+    std::vector<crop_box_t> crops;
+    if(!get_rgb(image, &img_buf, &img) || !get_boxes(boxes, img.width, img.height, &crops)){
+        return NULL;
+    }
+    if(!out_buf.get(out, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)){
+        return NULL;
+    }
+    size_t need = crops.size() * 3 * (size_t)size * size * sizeof(float);
+    if(!format_is(&out_buf.view, 'f') || (size_t)out_buf.view.len < need){
+        return PyErr_Format(PyExc_ValueError, "out must be a float32 buffer of at least %zu x 3 x %d x %d",
+                            crops.size(), size, size);
+    }
+    Py_BEGIN_ALLOW_THREADS
+    preprocess_crops(&img, crops.data(), crops.size(), size, mean, std, (float *)out_buf.view.buf, threads);
+    Py_END_ALLOW_THREADS
+    return PyLong_FromSize_t(crops.size());
+}
+
+typedef struct {
+    PyObject_HEAD
+    jpeg_image_t img;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} jpeg_image_object;
+
+static PyObject *jpeg_image_type;
+
+static void jpeg_image_dealloc(PyObject *self){
+    PyTypeObject *type = Py_TYPE(self);
+    jpeg_image_free(&((jpeg_image_object *)self)->img);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+// The pixels are packed, so every consumer gets them in place
+static int jpeg_image_getbuffer(PyObject *self, Py_buffer *view, int flags){
+    jpeg_image_object *o = (jpeg_image_object *)self;
+    view->obj = self;
+    Py_INCREF(self);
+    view->buf = o->img.rgb;
+    view->len = o->shape[0] * o->strides[0];
+    view->readonly = 0;
+    view->itemsize = 1;
+    view->format = flags & PyBUF_FORMAT ? (char *)"B" : NULL;
+    view->ndim = flags & PyBUF_ND ? 3 : 1;
+    view->shape = flags & PyBUF_ND ? o->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? o->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyMemberDef jpeg_image_members[] = {
+    {"width", T_INT, offsetof(jpeg_image_object, img.width), READONLY, "Pixels across"},
+    {"height", T_INT, offsetof(jpeg_image_object, img.height), READONLY, "Pixels down"},
+    {"scale", T_INT, offsetof(jpeg_image_object, img.scale), READONLY, "Full resolution pixels per pixel"},
+    {"x", T_INT, offsetof(jpeg_image_object, img.x), READONLY, "Left edge in the scaled image"},
+    {"y", T_INT, offsetof(jpeg_image_object, img.y), READONLY, "Top edge in the scaled image"},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyType_Slot jpeg_image_slots[] = {
+    {Py_tp_dealloc, (void *)jpeg_image_dealloc},
+    {Py_tp_members, jpeg_image_members},
+    {Py_tp_doc, (void *)"Decoded JPEG pixels, an H x W x 3 uint8 buffer"},
+    {Py_bf_getbuffer, (void *)jpeg_image_getbuffer},
+    {0, NULL}
+};
+
+static PyType_Spec jpeg_image_spec = {
+    "plant_native.JpegImage", sizeof(jpeg_image_object), 0, Py_TPFLAGS_DEFAULT, jpeg_image_slots
+};
+
+static PyObject *py_jpeg_size(PyObject *, PyObject *data){
+    buffer_guard buf;
+    if(!buf.get(data, PyBUF_SIMPLE)){
+        return NULL;
+    }
+    int width, height;
+    if(!jpeg_read_size((const uint8_t *)buf.view.buf, buf.view.len, &width, &height)){
+        return PyErr_Format(PyExc_ValueError, "no JPEG header");
+    }
+    return Py_BuildValue("(ii)", width, height);
+}
+
+static PyObject *py_decode_jpeg(PyObject *, PyObject *args, PyObject *kwargs){
+    static const char *kwlist[] = {"data", "min_width", "min_height", "region", NULL};
+    PyObject *data, *region_obj = NULL;
+    int min_width = 0, min_height = 0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iiO", (char **)kwlist,
+                                    &data, &min_width, &min_height, &region_obj)){
+        return NULL;
+    }
+    jpeg_region_t region, *rp = NULL;
+    if(region_obj && region_obj != Py_None){
+        PyObject *t = PySequence_Tuple(region_obj);
+        bool ok = t && PyArg_ParseTuple(t, "iiii;region must be (x1, y1, x2, y2)",
+                                        &region.x1, &region.y1, &region.x2, &region.y2);
+        Py_XDECREF(t);
+        if(!ok){
+            return NULL;
+        }
+        rp = &region;
+    }
+    buffer_guard buf;
+    if(!buf.get(data, PyBUF_SIMPLE)){
+        return NULL;
+    }
+    jpeg_image_t img;
+    char err[JPEG_ERR_MAX];
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = jpeg_decode_scaled((const uint8_t *)buf.view.buf, buf.view.len, min_width, min_height, rp,
+                            &img, err, sizeof(err));
+    Py_END_ALLOW_THREADS
+    if(!ok){
+        return PyErr_Format(PyExc_ValueError, "JPEG decode failed: %s", err);
+    }
+    PyTypeObject *type = (PyTypeObject *)jpeg_image_type;
+    jpeg_image_object *o = (jpeg_image_object *)type->tp_alloc(type, 0);
+    if(!o){
+        jpeg_image_free(&img);
+        return NULL;
+    }
+    o->img = img;
+    o->shape[0] = img.height;
+    o->shape[1] = img.width;
+    o->shape[2] = 3;
+    o->strides[0] = (Py_ssize_t)img.width * 3;
+    o->strides[1] = 3;
+    o->strides[2] = 1;
+    return (PyObject *)o;
+}
+
+typedef struct {
+    PyObject_HEAD
+    glyph_atlas_t *atlas;
+} annotator_object;
+
+static PyObject *annotator_new(PyTypeObject *type, PyObject *args, PyObject *kwargs){
+    static const char *kwlist[] = {"font", "size", NULL};
+    PyObject *path;
+    int size = 18;
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|i", (char **)kwlist, PyUnicode_FSConverter, &path, &size)){
+        return NULL;
+    }
+    if(size < 1 || size > 1000){
+        Py_DECREF(path);
+        return PyErr_Format(PyExc_ValueError, "size must be 1 to 1000 pixels");
+    }
+    glyph_atlas_t *atlas = new glyph_atlas_t();
+    char err[256];
+    bool ok = glyph_atlas_load(atlas, PyBytes_AS_STRING(path), size, err, sizeof(err));
+    Py_DECREF(path);
+    if(!ok){
+        delete atlas;
+        return PyErr_Format(PyExc_OSError, "%s", err);
+    }
+    annotator_object *o = (annotator_object *)type->tp_alloc(type, 0);
+    if(!o){
+        delete atlas;
+        return NULL;
+    }
+    o->atlas = atlas;
+    return (PyObject *)o;
+}
+
+static void annotator_dealloc(PyObject *self){
+    PyTypeObject *type = Py_TYPE(self);
+    delete ((annotator_object *)self)->atlas;
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static bool get_color(PyObject *obj, color_t *c){
+    PyObject *t = PySequence_Tuple(obj);
+    bool ok = t && PyArg_ParseTuple(t, "bbb;colors must be (r, g, b), 0 to 255", &c->r, &c->g, &c->b);
+    Py_XDECREF(t);
+    return ok;
+}
+
+// ((x1, y1, x2, y2), text, color, text_color); text points into the str, which seq keeps alive
+static bool get_annotation(PyObject *obj, annotation_t *a, Py_ssize_t i){
+    PyObject *item = PySequence_Fast(obj, "each annotation must be (box, text, color, text_color)");
+    if(!item){
+        return false;
+    }
+    bool ok = PySequence_Fast_GET_SIZE(item) == 4;
+    PyObject *box = ok ? PySequence_Fast(PySequence_Fast_GET_ITEM(item, 0), "box must be (x1, y1, x2, y2)") : NULL;
+    ok = box && PySequence_Fast_GET_SIZE(box) == 4;
+    double v[4];
+    for(int j = 0; ok && j < 4; j++){
+        v[j] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(box, j));
+        ok = !PyErr_Occurred() && v[j] > -1e9 && v[j] < 1e9;
+    }
+    Py_XDECREF(box);
+    if(ok){
+        a->x1 = (int)v[0];
+        a->y1 = (int)v[1];
+        a->x2 = (int)v[2];
+        a->y2 = (int)v[3];
+        PyObject *text = PySequence_Fast_GET_ITEM(item, 1);
+        a->text = PyUnicode_Check(text) ? PyUnicode_AsUTF8(text) : NULL;
+        ok = a->text && get_color(PySequence_Fast_GET_ITEM(item, 2), &a->color) &&
+             get_color(PySequence_Fast_GET_ITEM(item, 3), &a->text_color);
+    }
+    Py_DECREF(item);
+    if(!ok && !PyErr_Occurred()){
+        PyErr_Format(PyExc_ValueError, "annotation %zd is not ((x1, y1, x2, y2), text, color, text_color)", i);
+    }
+    return ok;
+}
+
+static PyObject *annotator_draw(PyObject *self, PyObject *args, PyObject *kwargs){
+    static const char *kwlist[] = {"image", "annotations", "line_width", "pad", NULL};
+    PyObject *image, *annotations;
+    int line_width = 3, pad = 4;
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ii", (char **)kwlist, &image, &annotations, &line_width, &pad)){
+        return NULL;
+    }
+    if(line_width < 1 || pad < 0){
+        return PyErr_Format(PyExc_ValueError, "line_width must be at least 1 and pad not negative");
+    }
+    buffer_guard img_buf;
+    rgb_image_t img;
+    if(!get_rgb(image, &img_buf, &img, PyBUF_WRITABLE)){
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast(annotations, "annotations must be a sequence");
+    if(!seq){
+        return NULL;
+    }
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    std::vector<annotation_t> items(n);
+    for(Py_ssize_t i = 0; i < n; i++){
+        if(!get_annotation(PySequence_Fast_GET_ITEM(seq, i), &items[i], i)){
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+    canvas_t canvas = {(uint8_t *)img.rgb, img.width, img.height, img.stride};
+    const glyph_atlas_t *atlas = ((annotator_object *)self)->atlas;
+    Py_BEGIN_ALLOW_THREADS
+    annotate_draw(atlas, &canvas, items.data(), items.size(), line_width, pad);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+}
+
+static PyObject *annotator_text_size(PyObject *self, PyObject *text){
+    const char *s = PyUnicode_AsUTF8(text);
+    if(!s){
+        return NULL;
+    }
+    int width, height;
+    glyph_atlas_measure(((annotator_object *)self)->atlas, s, &width, &height);
+    return Py_BuildValue("(ii)", width, height);
+}
+
+static PyMethodDef annotator_methods[] = {
+    {"draw", (PyCFunction)(void (*)(void))annotator_draw, METH_VARARGS | METH_KEYWORDS,
+     "draw(image, annotations, line_width=3, pad=4)\n"
+     "Draws ((x1, y1, x2, y2), text, (r, g, b), (r, g, b)) boxes with their labels\n"
+     "onto a writable H x W x 3 uint8 image, as app.py's draw_box_and_label()."},
+    {"text_size", annotator_text_size, METH_O,
+     "text_size(text) -> (width, height)\nExtent of the text's ink from the top left of its line."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyType_Slot annotator_slots[] = {
+    {Py_tp_new, (void *)annotator_new},
+    {Py_tp_dealloc, (void *)annotator_dealloc},
+    {Py_tp_methods, annotator_methods},
+    {Py_tp_doc, (void *)"Annotator(font, size=18): boxes and labels drawn from a glyph atlas"},
+    {0, NULL}
+};
+
+static PyType_Spec annotator_spec = {
+    "plant_native.Annotator", sizeof(annotator_object), 0, Py_TPFLAGS_DEFAULT, annotator_slots
+};
+
+static PyObject *py_encode_jpeg(PyObject *, PyObject *args, PyObject *kwargs){
+    static const char *kwlist[] = {"image", "quality", NULL};
+    PyObject *image;
+    int quality = 95;
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", (char **)kwlist, &image, &quality)){
+        return NULL;
+    }
+    if(quality < 1 || quality > 100){
+        return PyErr_Format(PyExc_ValueError, "quality must be 1 to 100");
+    }
+    buffer_guard img_buf;
+    rgb_image_t img;
+    if(!get_rgb(image, &img_buf, &img)){
+        return NULL;
+    }
+    if(img.width < 1 || img.height < 1){
+        return PyErr_Format(PyExc_ValueError, "image is empty");
+    }
+    uint8_t *jpg;
+    size_t len;
+    char err[JPEG_ERR_MAX];
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = jpeg_encode_rgb(img.rgb, img.width, img.height, img.stride, quality, &jpg, &len, err, sizeof(err));
+    Py_END_ALLOW_THREADS
+    if(!ok){
+        return PyErr_Format(PyExc_ValueError, "JPEG encode failed: %s", err);
+    }
+    PyObject *bytes = PyBytes_FromStringAndSize((const char *)jpg, (Py_ssize_t)len);
+    free(jpg);
+    return bytes;
+}
+
+static PyMethodDef methods[] = {
+    {"preprocess", (PyCFunction)(void (*)(void))py_preprocess, METH_VARARGS | METH_KEYWORDS,
+     "preprocess(image, boxes, out, size=224, mean=None, std=None, threads=0) -> n\n"
+     "Crops, resizes (bilinear) and normalizes each box of an H x W x 3 uint8 image\n"
+     "into out as n x 3 x size x size float32. mean/std default to ImageNet's."},
+    {"jpeg_size", py_jpeg_size, METH_O,
+     "jpeg_size(data) -> (width, height)\nSize from the JPEG's frame header."},
+    {"decode_jpeg", (PyCFunction)(void (*)(void))py_decode_jpeg, METH_VARARGS | METH_KEYWORDS,
+     "decode_jpeg(data, min_width=0, min_height=0, region=None) -> JpegImage\n"
+     "Decodes at the coarsest DCT scale (1/8 to 1) that keeps the image, or region\n"
+     "(x1, y1, x2, y2), at least min_width x min_height; full scale without them."},
+    {"encode_jpeg", (PyCFunction)(void (*)(void))py_encode_jpeg, METH_VARARGS | METH_KEYWORDS,
+     "encode_jpeg(image, quality=95) -> bytes\nCompresses an H x W x 3 uint8 image."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "plant_native", "Smart Plant Vision native image paths", -1, methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_plant_native(void){
+    PyObject *m = PyModule_Create(&module);
+    if(!m){
+        return NULL;
+    }
+    jpeg_image_type = PyType_FromSpec(&jpeg_image_spec);
+    if(!jpeg_image_type || PyModule_AddObjectRef(m, "JpegImage", jpeg_image_type) < 0){
+        Py_DECREF(m);
+        return NULL;
+    }
+    PyObject *annotator_type = PyType_FromSpec(&annotator_spec);
+    int added = annotator_type ? PyModule_AddObjectRef(m, "Annotator", annotator_type) : -1;
+    Py_XDECREF(annotator_type);
+    if(added < 0){
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
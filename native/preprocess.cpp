@@ -0,0 +1,205 @@
+/*
+  Smart Plant Vision - classifier input preprocessing
+*/
+
+#include "preprocess.h"
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+typedef struct {
+    std::vector<int> start;     // First source pixel of each output pixel
+    std::vector<int> count;     // Source pixels it takes
+    std::vector<float> weight;  // ksize per output pixel, normalized
+    int ksize;
+} taps_t;
+
+// Triangle filter stretched by the scale when shrinking, with PIL's
+// rounding of the window so results line up with Image.resize(BILINEAR)
+static void make_taps(int in, int out, taps_t *t){
+    double scale = (double)in / out;
+    double support = scale > 1 ? scale : 1;
+    t->ksize = (int)ceil(support) * 2 + 1;
+    t->start.resize(out);
+    t->count.resize(out);
+    t->weight.assign((size_t)out * t->ksize, 0.0f);
+    for(int i = 0; i < out; i++){
+        double center = (i + 0.5) * scale;
+        int lo = (int)(center - support + 0.5);
+        int hi = (int)(center + support + 0.5);
+        lo = lo < 0 ? 0 : lo;
+        hi = hi > in ? in : hi;
+        float *w = &t->weight[(size_t)i * t->ksize];
+        double total = 0;
+        for(int x = lo; x < hi; x++){
+            double d = fabs((x - center + 0.5) / support);
+            w[x - lo] = d < 1 ? (float)(1 - d) : 0.0f;
+            total += w[x - lo];
+        }
+        for(int x = 0; x < hi - lo && total > 0; x++){
+            w[x] = (float)(w[x] / total);
+        }
+        t->start[i] = lo;
+        t->count[i] = hi - lo;
+    }
+}
+
+// dst[i] = sum over t of w[t] * rows[t][i]
+typedef void (*row_sum_fn)(const uint8_t *const *rows, const float *w, int k, int n, float *dst);
+
+static void row_sum_scalar(const uint8_t *const *rows, const float *w, int k, int n, float *dst){
+    for(int i = 0; i < n; i++){
+        float acc = 0;
+        for(int t = 0; t < k; t++){
+            acc += w[t] * rows[t][i];
+        }
+        dst[i] = acc;
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2,fma")))
+static void row_sum_avx2(const uint8_t *const *rows, const float *w, int k, int n, float *dst){
+    int i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m256 lo = _mm256_setzero_ps(), hi = _mm256_setzero_ps();
+        for(int t = 0; t < k; t++){
+            __m128i b = _mm_loadu_si128((const __m128i *)(rows[t] + i));
+            __m256 wt = _mm256_set1_ps(w[t]);
+            lo = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)), wt, lo);
+            hi = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))), wt, hi);
+        }
+        _mm256_storeu_ps(dst + i, lo);
+        _mm256_storeu_ps(dst + i + 8, hi);
+    }
+    for(; i < n; i++){
+        float acc = 0;
+        for(int t = 0; t < k; t++){
+            acc += w[t] * rows[t][i];
+        }
+        dst[i] = acc;
+    }
+}
+#elif defined(__ARM_NEON)
+static void row_sum_neon(const uint8_t *const *rows, const float *w, int k, int n, float *dst){
+    int i = 0;
+    for(; i + 8 <= n; i += 8){
+        float32x4_t lo = vdupq_n_f32(0), hi = vdupq_n_f32(0);
+        for(int t = 0; t < k; t++){
+            uint16x8_t v = vmovl_u8(vld1_u8(rows[t] + i));
+            lo = vmlaq_n_f32(lo, vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), w[t]);
+            hi = vmlaq_n_f32(hi, vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), w[t]);
+        }
+        vst1q_f32(dst + i, lo);
+        vst1q_f32(dst + i + 4, hi);
+    }
+    for(; i < n; i++){
+        float acc = 0;
+        for(int t = 0; t < k; t++){
+            acc += w[t] * rows[t][i];
+        }
+        dst[i] = acc;
+    }
+}
+#endif
+
+static row_sum_fn pick_row_sum(void){
+#ifdef HAVE_AVX2_KERNEL
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        return row_sum_avx2;
+    }
+    return row_sum_scalar;
+#elif defined(__ARM_NEON)
+    return row_sum_neon;
+#else
+    return row_sum_scalar;
+#endif
+}
+
+bool crop_box_clip(crop_box_t *box, int width, int height){
+    box->x1 = box->x1 < 0 ? 0 : box->x1;
+    box->y1 = box->y1 < 0 ? 0 : box->y1;
+    box->x2 = box->x2 > width ? width : box->x2;
+    box->y2 = box->y2 > height ? height : box->y2;
+    return box->x2 > box->x1 && box->y2 > box->y1;
+}
+
+typedef struct {
+    const rgb_image_t *img;
+    int size;
+    float scale[3], offset[3];  // Normalization folded into v * scale + offset
+    row_sum_fn row_sum;
+} job_t;
+
+static void crop_one(const job_t *job, const crop_box_t *box, float *out,
+                     std::vector<float> *row, std::vector<const uint8_t *> *rows){
+    int size = job->size;
+    int cw = box->x2 - box->x1, ch = box->y2 - box->y1;
+    taps_t tx, ty;
+    make_taps(cw, size, &tx);
+    make_taps(ch, size, &ty);
+    row->resize((size_t)cw * 3);
+    rows->resize(ty.ksize);
+    const uint8_t *base = job->img->rgb + (size_t)box->x1 * 3;
+    float *planes[3] = {out, out + (size_t)size * size, out + (size_t)2 * size * size};
+    for(int y = 0; y < size; y++){
+        for(int t = 0; t < ty.count[y]; t++){
+            (*rows)[t] = base + (size_t)(box->y1 + ty.start[y] + t) * job->img->stride;
+        }
+        job->row_sum(rows->data(), &ty.weight[(size_t)y * ty.ksize], ty.count[y], cw * 3, row->data());
+        for(int x = 0; x < size; x++){
+            const float *w = &tx.weight[(size_t)x * tx.ksize];
+            const float *s = row->data() + (size_t)tx.start[x] * 3;
+            float r = 0, g = 0, b = 0;
+            for(int t = 0; t < tx.count[x]; t++, s += 3){
+                r += w[t] * s[0];
+                g += w[t] * s[1];
+                b += w[t] * s[2];
+            }
+            planes[0][(size_t)y * size + x] = r * job->scale[0] + job->offset[0];
+            planes[1][(size_t)y * size + x] = g * job->scale[1] + job->offset[1];
+            planes[2][(size_t)y * size + x] = b * job->scale[2] + job->offset[2];
+        }
+    }
+}
+
+void preprocess_crops(const rgb_image_t *img, const crop_box_t *boxes, size_t n, int size,
+                      const float mean[3], const float std[3], float *out, int threads){
+    static const row_sum_fn row_sum = pick_row_sum();
+    job_t job;
+    job.img = img;
+    job.size = size;
+    job.row_sum = row_sum;
+    for(int c = 0; c < 3; c++){
+        job.scale[c] = 1.0f / (255.0f * std[c]);
+        job.offset[c] = -mean[c] / std[c];
+    }
+    size_t per_crop = (size_t)3 * size * size;
+
+    std::atomic<size_t> next(0);
+    auto worker = [&](){
+        std::vector<float> row;
+        std::vector<const uint8_t *> rows;
+        for(size_t i; (i = next++) < n;){
+            crop_one(&job, &boxes[i], out + i * per_crop, &row, &rows);
+        }
+    };
+    size_t want = threads > 0 ? (size_t)threads : std::thread::hardware_concurrency();
+    want = want > n ? n : want;
+    std::vector<std::thread> pool;
+    for(size_t t = 1; t < want; t++){
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto &t : pool){
+        t.join();
+    }
+}
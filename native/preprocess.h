@@ -0,0 +1,40 @@
+/*
+  Smart Plant Vision - classifier input preprocessing
+
+  Crops boxes out of an RGB image, resizes each crop to size x size and
+  writes it normalized ((v / 255 - mean) / std) as CHW float32 into its
+  slot of one batch buffer, N x 3 x size x size, ready to be the input
+  tensor. The resize is bilinear with the filter widened by the scale
+  factor when shrinking, as PIL's BILINEAR (what torchvision's Resize
+  applied to the training images), so it doesn't alias on large crops.
+
+  The filter is separable: each output row is first the weighted sum of
+  source rows over the crop's width (AVX2 or NEON, the bulk of the work
+  when shrinking), then filtered across and normalized into the three
+  planes. Crops are spread over threads, one crop per thread at a time.
+*/
+#ifndef NATIVE_PREPROCESS_H
+#define NATIVE_PREPROCESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int x1, y1, x2, y2;         // Pixels, x2/y2 exclusive, as PIL's crop()
+} crop_box_t;
+
+typedef struct {
+    const uint8_t *rgb;         // Interleaved R,G,B
+    int width, height;
+    size_t stride;              // Bytes per row
+} rgb_image_t;
+
+// Clips the box to the image; false when nothing is left of it
+bool crop_box_clip(crop_box_t *box, int width, int height);
+
+// Boxes must have been clipped. out holds n * 3 * size * size floats.
+// threads 0 picks one per core, never more than there are boxes.
+void preprocess_crops(const rgb_image_t *img, const crop_box_t *boxes, size_t n, int size,
+                      const float mean[3], const float std[3], float *out, int threads);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+  Smart Plant Vision - Raw Pixel Capture
+  JPEG frames are decoded once into a buffer sized for the output format and
+  converted in place, front to back: the RGB565 decode sits at the end of
+  the buffer when each output pixel is wider than its source.
+*/
+
+#include "pixel_capture.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "plant_log.h"
+
+static const uint8_t pix_bpp[] = {0, 1, 2, 3};
+
+pix_format_t pix_format_from_name(const char *name){
+    if(!strcmp(name, "gray")) return PIX_GRAY;
+    if(!strcmp(name, "rgb565")) return PIX_RGB565;
+    if(!strcmp(name, "rgb888")) return PIX_RGB888;
+    return (pix_format_t)0;
+}
+
+bool pix_valid_scale(int scale){
+    return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
+
+static int scale_shift(int scale){
+    return scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+}
+
+static inline uint8_t luma(int r, int g, int b){
+    return (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+}
+
+static inline void put_px(uint8_t *o, pix_format_t f, int r, int g, int b){
+    switch(f){
+        case PIX_GRAY:
+            o[0] = luma(r, g, b);
+            break;
+        case PIX_RGB565: {
+            uint16_t v = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+            o[0] = v >> 8;
+            o[1] = v & 0xFF;
+            break;
+        }
+        default:
+            o[0] = r;
+            o[1] = g;
+            o[2] = b;
+            break;
+    }
+}
+
+// RGB565 to 8 bits per channel, low bits filled from the high ones so white stays 255
+static inline void unpack565(const uint8_t *p, int *r, int *g, int *b){
+    uint16_t v = (p[0] << 8) | p[1];
+    int r5 = v >> 11, g6 = (v >> 5) & 0x3F, b5 = v & 0x1F;
+    *r = (r5 << 3) | (r5 >> 2);
+    *g = (g6 << 2) | (g6 >> 4);
+    *b = (b5 << 3) | (b5 >> 2);
+}
+
+static void put_head(uint8_t *h, pix_format_t f, int scale, uint16_t w, uint16_t ht, uint32_t seq){
+    uint32_t stride = (uint32_t)w * pix_bpp[f];
+    h[0] = 'P';
+    h[1] = 'X';
+    h[2] = f;
+    h[3] = scale;
+    h[4] = w & 0xFF;  h[5] = w >> 8;
+    h[6] = ht & 0xFF; h[7] = ht >> 8;
+    for(int i = 0; i < 4; i++){
+        h[8 + i] = (stride >> (8 * i)) & 0xFF;
+        h[12 + i] = (seq >> (8 * i)) & 0xFF;
+    }
+}
+
+static bool send_all(const uint8_t *head, const uint8_t *px, size_t len, jpg_out_cb cb, void *arg){
+    return cb(arg, 0, head, PIX_HEAD) == PIX_HEAD && cb(arg, PIX_HEAD, px, len) == len;
+}
+
+static bool send_jpeg_frame(camera_fb_t *fb, pix_format_t f, int scale, uint32_t seq, jpg_out_cb cb, void *arg){
+    uint16_t w = fb->width / scale, h = fb->height / scale;
+    size_t n = (size_t)w * h;
+    size_t bpp = pix_bpp[f];
+    size_t cap = n * (bpp > 2 ? bpp : 2);
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(cap, MALLOC_CAP_SPIRAM);
+    if(!buf){
+        PLOG_LIMITED(PLOG_ERROR, 2, "No memory for %ux%u raw pixels", w, h);
+        return false;
+    }
+    uint8_t *decoded = buf + cap - n * 2;
+    if(!jpg2rgb565(fb->buf, fb->len, decoded, (jpg_scale_t)scale_shift(scale))){
+        heap_caps_free(buf);
+        return false;
+    }
+    if(f != PIX_RGB565){
+        // Pixel i is written at or before where it was read, never past an unread one
+        for(size_t i = 0; i < n; i++){
+            int r, g, b;
+            unpack565(decoded + i * 2, &r, &g, &b);
+            put_px(buf + i * bpp, f, r, g, b);
+        }
+    }
+    uint8_t head[PIX_HEAD];
+    put_head(head, f, scale, w, h, seq);
+    bool ok = send_all(head, buf, n * bpp, cb, arg);
+    heap_caps_free(buf);
+    return ok;
+}
+
+// Raw sensor formats, subsampled by taking every scale-th pixel
+static bool send_raw_frame(camera_fb_t *fb, pix_format_t f, int scale, uint32_t seq, jpg_out_cb cb, void *arg){
+    int in_bpp = fb->format == PIXFORMAT_GRAYSCALE ? 1 : fb->format == PIXFORMAT_RGB565 ? 2 :
+                 fb->format == PIXFORMAT_RGB888 ? 3 : 0;
+    if(!in_bpp || fb->len < (size_t)fb->width * fb->height * in_bpp){
+        return false;
+    }
+    uint16_t w = fb->width / scale, h = fb->height / scale;
+    size_t bpp = pix_bpp[f];
+    uint8_t *buf = (uint8_t *)heap_caps_malloc((size_t)w * h * bpp, MALLOC_CAP_SPIRAM);
+    if(!buf){
+        PLOG_LIMITED(PLOG_ERROR, 2, "No memory for %ux%u raw pixels", w, h);
+        return false;
+    }
+    uint8_t *o = buf;
+    for(int y = 0; y < h; y++){
+        const uint8_t *row = fb->buf + (size_t)y * scale * fb->width * in_bpp;
+        for(int x = 0; x < w; x++, o += bpp){
+            const uint8_t *p = row + (size_t)x * scale * in_bpp;
+            int r, g, b;
+            if(in_bpp == 1){
+                r = g = b = p[0];
+            } else if(in_bpp == 2){
+                unpack565(p, &r, &g, &b);
+            } else {
+                r = p[2]; g = p[1]; b = p[0];   // The driver stores RGB888 as B, G, R
+            }
+            put_px(o, f, r, g, b);
+        }
+    }
+    uint8_t head[PIX_HEAD];
+    put_head(head, f, scale, w, h, seq);
+    bool ok = send_all(head, buf, (size_t)w * h * bpp, cb, arg);
+    heap_caps_free(buf);
+    return ok;
+}
+
+bool pix_send(camera_fb_t *fb, pix_format_t format, int scale, uint32_t seq, jpg_out_cb cb, void *arg){
+    if(format < PIX_GRAY || format > PIX_RGB888 || !pix_valid_scale(scale) || !(fb->width / scale) ||
+       !(fb->height / scale)){
+        return false;
+    }
+    if(fb->format == PIXFORMAT_JPEG){
+        return send_jpeg_frame(fb, format, scale, seq, cb, arg);
+    }
+    return send_raw_frame(fb, format, scale, seq, cb, arg);
+}
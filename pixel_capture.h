@@ -0,0 +1,46 @@
+/*
+  Smart Plant Vision - Raw Pixel Capture
+  Frames as uncompressed pixels for analysis clients, so they don't have to
+  decode a JPEG per frame. The sensor's own raw formats are converted and
+  subsampled directly; JPEG frames go through the decoder's scaled RGB565
+  output, so their channels carry 5 to 6 bits whatever the format asked for.
+
+  The body starts with a 16 byte header, little-endian:
+    0   'P' 'X'
+    2   u8  format: 1 gray, 2 rgb565 (big-endian, as the camera sends it),
+            3 rgb888 (R, G, B)
+    3   u8  scale the frame was reduced by
+    4   u16 width, u16 height
+    8   u32 stride (bytes per row)
+    12  u32 frame sequence number
+  followed by height rows of stride bytes.
+*/
+
+#ifndef PIXEL_CAPTURE_H
+#define PIXEL_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_camera.h"
+#include "img_converters.h"
+
+#define PIX_HEAD 16
+
+typedef enum {
+    PIX_GRAY = 1,
+    PIX_RGB565 = 2,
+    PIX_RGB888 = 3,
+} pix_format_t;
+
+// "gray", "rgb565" or "rgb888"; 0 for anything else
+pix_format_t pix_format_from_name(const char *name);
+
+// True for the scales pix_send() takes: 1, 2, 4, 8
+bool pix_valid_scale(int scale);
+
+// Converts fb and passes the header and pixels to cb, the way frame2jpg_cb()
+// passes JPEG data. False when the frame's format can't be converted or
+// there isn't memory for it.
+bool pix_send(camera_fb_t *fb, pix_format_t format, int scale, uint32_t seq, jpg_out_cb cb, void *arg);
+
+#endif
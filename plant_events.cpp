@@ -0,0 +1,171 @@
+/*
+  Smart Plant Vision - Event Channel
+  Event id N lives in slot N % PEV_RING; a slot is overwritten once the ring
+  comes round, which a reader sees as a jump in the ids it gets.
+*/
+
+#include "plant_events.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "camera_modes.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static SemaphoreHandle_t events_lock = NULL;
+static plant_event_t ring[PEV_RING];         // Under events_lock
+static uint32_t last_id = 0;
+
+// Event still: header and JPEG in one allocation
+struct pev_still {
+    int refs;                 // Under still_lock; the latest still holds one
+    uint32_t event;
+    size_t len;
+    uint8_t *buf;             // Just past the header
+};
+
+static SemaphoreHandle_t still_lock = NULL;
+static pev_still_t *still = NULL;            // Latest, under still_lock
+
+bool pev_init(void){
+    if(!events_lock){
+        events_lock = xSemaphoreCreateMutex();
+    }
+    if(!still_lock){
+        still_lock = xSemaphoreCreateMutex();
+    }
+    return events_lock && still_lock;
+}
+
+uint32_t pev_emit(const char *type, const char *fmt, ...){
+    if(!events_lock){
+        return 0;
+    }
+    xSemaphoreTake(events_lock, portMAX_DELAY);
+    plant_event_t *e = &ring[++last_id % PEV_RING];
+    e->id = last_id;
+    e->t_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    strncpy(e->type, type, sizeof(e->type) - 1);
+    e->type[sizeof(e->type) - 1] = 0;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(e->data, sizeof(e->data), fmt, ap);
+    va_end(ap);
+    if(n >= (int)sizeof(e->data)){
+        e->data[0] = 0;       // Cut JSON is worse than none
+    }
+    uint32_t id = e->id;
+    xSemaphoreGive(events_lock);
+    return id;
+}
+
+bool pev_next(uint32_t *cursor, plant_event_t *out){
+    if(!events_lock){
+        return false;
+    }
+    bool found = false;
+    xSemaphoreTake(events_lock, portMAX_DELAY);
+    uint32_t id = *cursor + 1;
+    if(last_id >= PEV_RING && id <= last_id - PEV_RING){
+        id = last_id - PEV_RING + 1;          // The ones before were overwritten
+    }
+    if(id <= last_id){
+        *out = ring[id % PEV_RING];
+        *cursor = id;
+        found = true;
+    }
+    xSemaphoreGive(events_lock);
+    return found;
+}
+
+uint32_t pev_last_id(void){
+    if(!events_lock){
+        return 0;
+    }
+    xSemaphoreTake(events_lock, portMAX_DELAY);
+    uint32_t id = last_id;
+    xSemaphoreGive(events_lock);
+    return id;
+}
+
+int pev_json(const plant_event_t *e, char *buf, size_t len){
+    return snprintf(buf, len, "{\"id\":%u,\"t_ms\":%u,\"type\":\"%s\"%s%s}",
+                    e->id, e->t_ms, e->type, e->data[0] ? "," : "", e->data);
+}
+
+// Drops a reference; still_lock held. Returns the still to free once the lock is given back.
+static pev_still_t *still_unref(pev_still_t *st){
+    return st && --st->refs == 0 ? st : NULL;
+}
+
+bool pev_still_capture(void){
+    if(!still_lock){
+        return false;
+    }
+    cam_frame_info_t fi;
+    camera_fb_t *fb = cam_modes_fb_get(CAM_MODE_STILL, &fi);
+    if(!fb){
+        return false;
+    }
+    // Copied and the frame buffer returned before still_lock, which readers only hold briefly
+    pev_still_t *st = NULL;
+    if(fb->format == PIXFORMAT_JPEG){
+        st = (pev_still_t *)heap_caps_malloc(sizeof(pev_still_t) + fb->len, MALLOC_CAP_SPIRAM);
+    }
+    if(st){
+        st->refs = 1;
+        st->event = 0;
+        st->len = fb->len;
+        st->buf = (uint8_t *)(st + 1);
+        memcpy(st->buf, fb->buf, fb->len);
+    }
+    cam_modes_fb_return(fb);
+    if(!st){
+        return false;
+    }
+    xSemaphoreTake(still_lock, portMAX_DELAY);
+    pev_still_t *old = still_unref(still);
+    still = st;
+    xSemaphoreGive(still_lock);
+    heap_caps_free(old);
+    return true;
+}
+
+void pev_still_attach(uint32_t id){
+    if(!still_lock){
+        return;
+    }
+    xSemaphoreTake(still_lock, portMAX_DELAY);
+    if(still){
+        still->event = id;
+    }
+    xSemaphoreGive(still_lock);
+}
+
+pev_still_t *pev_still_get(const uint8_t **buf, size_t *len, uint32_t *event_id){
+    if(!still_lock){
+        return NULL;
+    }
+    xSemaphoreTake(still_lock, portMAX_DELAY);
+    pev_still_t *st = still && still->event ? still : NULL;
+    if(st){
+        st->refs++;
+        *buf = st->buf;
+        *len = st->len;
+        *event_id = st->event;
+    }
+    xSemaphoreGive(still_lock);
+    return st;
+}
+
+void pev_still_release(pev_still_t *st){
+    if(!st){
+        return;
+    }
+    xSemaphoreTake(still_lock, portMAX_DELAY);
+    pev_still_t *done = still_unref(st);
+    xSemaphoreGive(still_lock);
+    heap_caps_free(done);
+}
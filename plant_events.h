@@ -0,0 +1,57 @@
+/*
+  Smart Plant Vision - Event Channel
+  Things the device noticed on its own (motion in the picture, a change in
+  the soil), kept in a small ring for clients to poll from /events. Each
+  event has an id that only grows, so a client asks for the ones after the
+  last id it saw and can tell from a gap that it polled too slowly.
+*/
+
+#ifndef PLANT_EVENTS_H
+#define PLANT_EVENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PEV_RING      64
+#define PEV_TYPE_LEN  12
+#define PEV_DATA_LEN  120
+
+typedef struct {
+    uint32_t id;              // From 1
+    uint32_t t_ms;            // Milliseconds since boot
+    char type[PEV_TYPE_LEN];  // "motion", "watered", ...
+    char data[PEV_DATA_LEN];  // The type's JSON members, without braces
+} plant_event_t;
+
+bool pev_init(void);
+
+// Records an event; fmt and what follows print its JSON members. Returns its id.
+uint32_t pev_emit(const char *type, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Copies the oldest event still held with an id after *cursor and moves the
+// cursor to it; false when there is none
+bool pev_next(uint32_t *cursor, plant_event_t *out);
+
+// Id of the newest event, 0 before the first
+uint32_t pev_last_id(void);
+
+// Prints the event as a JSON object; returns the length, or at least len if it did not fit
+int pev_json(const plant_event_t *e, char *buf, size_t len);
+
+// Event still: a full resolution frame taken for an event, served at
+// /events/still. Only the latest one is kept. pev_still_capture() takes it
+// (before the event is emitted, so the event can say whether it has one)
+// and pev_still_attach() gives it the event's id; until then it is not served.
+// A capture copies the frame into a new buffer and swaps it in; a reader
+// holds a reference to the one it got, so a slow client neither holds up a
+// capture nor sees its buffer change, and the last release frees it.
+typedef struct pev_still pev_still_t;
+
+bool pev_still_capture(void);
+void pev_still_attach(uint32_t id);
+
+// The latest attached still, referenced until pev_still_release(): NULL when there is none
+pev_still_t *pev_still_get(const uint8_t **buf, size_t *len, uint32_t *event_id);
+void pev_still_release(pev_still_t *still);
+
+#endif
@@ -0,0 +1,322 @@
+/*
+  Smart Plant Vision - Asynchronous Logger
+  Bounded multi-producer ring (per-slot sequence numbers, no locks) drained by
+  a single low-priority task.
+*/
+
+#include "plant_log.h"
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define PLOG_DRAIN_IDLE_MS 20
+
+typedef struct {
+    std::atomic<uint32_t> seq;
+    uint32_t ms;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t len;
+    const char *fmt;                        // Deferred record when non-NULL
+    union {
+        char text[PLOG_LINE_MAX];
+        plog_arg_t args[PLOG_MAX_ARGS];
+    };
+} plog_slot_t;
+
+std::atomic<int> plog_level(PLOG_INFO);
+
+static plog_slot_t *slots = NULL;
+static uint32_t slot_mask = 0;
+static std::atomic<uint32_t> enqueue_pos(0);
+static std::atomic<uint32_t> dequeue_pos(0); // Advanced by the drain task only
+
+static std::atomic<uint32_t> stat_written(0);
+static std::atomic<uint32_t> stat_dropped(0);
+static std::atomic<uint32_t> stat_suppressed(0);
+static std::atomic<uint32_t> stat_truncated(0);
+static std::atomic<uint32_t> stat_high_water(0);
+
+static const char level_chars[] = "EWID";
+
+// Reserve a slot, or NULL when the ring is full
+static plog_slot_t *plog_claim(uint32_t *pos_out){
+    uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for(;;){
+        plog_slot_t *slot = &slots[pos & slot_mask];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t dif = (int32_t)(seq - pos);
+        if(dif == 0){
+            if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                *pos_out = pos;
+                return slot;
+            }
+        } else if(dif < 0){
+            stat_dropped.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void plog_commit(plog_slot_t *slot, uint32_t pos){
+    slot->seq.store(pos + 1, std::memory_order_release);
+    stat_written.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t pending = pos + 1 - dequeue_pos.load(std::memory_order_relaxed);
+    uint32_t hw = stat_high_water.load(std::memory_order_relaxed);
+    while(pending > hw && pending <= slot_mask + 1 &&
+          !stat_high_water.compare_exchange_weak(hw, pending, std::memory_order_relaxed)){
+    }
+}
+
+static void plog_vformat(plog_level_t level, uint32_t suppressed, const char *fmt, va_list ap){
+    if(!slots){
+        // Not initialised yet, write through
+        char line[PLOG_LINE_MAX];
+        vsnprintf(line, sizeof(line), fmt, ap);
+        Serial.println(line);
+        return;
+    }
+    uint32_t pos;
+    plog_slot_t *slot = plog_claim(&pos);
+    if(!slot){
+        return;
+    }
+    slot->ms = millis();
+    slot->level = level;
+    slot->fmt = NULL;
+    slot->nargs = 0;
+
+    int n = vsnprintf(slot->text, PLOG_LINE_MAX, fmt, ap);
+    if(n < 0){
+        n = 0;
+    }
+    size_t len = (size_t)n < PLOG_LINE_MAX ? (size_t)n : PLOG_LINE_MAX - 1;
+    if((size_t)n >= PLOG_LINE_MAX){
+        stat_truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+    // IDF log lines arrive with their own newline
+    while(len && (slot->text[len - 1] == '\n' || slot->text[len - 1] == '\r')){
+        len--;
+    }
+    if(suppressed && len < PLOG_LINE_MAX - 1){
+        int m = snprintf(slot->text + len, PLOG_LINE_MAX - len, " [+%u suppressed]", (unsigned)suppressed);
+        len += (size_t)m < PLOG_LINE_MAX - len ? (size_t)m : PLOG_LINE_MAX - len - 1;
+    }
+    slot->text[len] = 0;
+    slot->len = len;
+    plog_commit(slot, pos);
+}
+
+void plog_vwrite(plog_level_t level, uint32_t suppressed, const char *fmt, va_list ap){
+    plog_vformat(level, suppressed, fmt, ap);
+}
+
+void plog_write(plog_level_t level, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    plog_vformat(level, 0, fmt, ap);
+    va_end(ap);
+}
+
+void plog_write_limited(plog_level_t level, uint32_t suppressed, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    plog_vformat(level, suppressed, fmt, ap);
+    va_end(ap);
+}
+
+void plog_record(plog_level_t level, const char *fmt, const plog_arg_t *args, uint8_t nargs){
+    if(!slots){
+        return;
+    }
+    uint32_t pos;
+    plog_slot_t *slot = plog_claim(&pos);
+    if(!slot){
+        return;
+    }
+    slot->ms = millis();
+    slot->level = level;
+    slot->fmt = fmt;
+    slot->nargs = nargs;
+    slot->len = 0;
+    memcpy(slot->args, args, nargs * sizeof(plog_arg_t));
+    plog_commit(slot, pos);
+}
+
+bool plog_limit_allow(plog_limit_t *lim, uint32_t per_sec, uint32_t *suppressed){
+    uint32_t now = millis();
+    uint32_t start = lim->window_ms.load(std::memory_order_relaxed);
+    if(now - start >= 1000){
+        if(lim->window_ms.compare_exchange_strong(start, now, std::memory_order_relaxed)){
+            lim->count.store(0, std::memory_order_relaxed);
+        }
+    }
+    if(lim->count.fetch_add(1, std::memory_order_relaxed) < per_sec){
+        *suppressed = lim->suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    lim->suppressed.fetch_add(1, std::memory_order_relaxed);
+    stat_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// Expand a deferred record: each conversion is handed to snprintf on its own
+// with the length modifier rewritten to match the recorded argument type.
+static size_t plog_expand(char *out, size_t cap, const char *fmt, const plog_arg_t *args, uint8_t nargs){
+    size_t len = 0;
+    uint8_t next = 0;
+    const char *p = fmt;
+    while(*p && len + 1 < cap){
+        if(*p != '%'){
+            out[len++] = *p++;
+            continue;
+        }
+        if(p[1] == '%'){
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        char spec[24];
+        size_t sl = 0;
+        spec[sl++] = *p++;
+        while(*p && strchr("-+ #0123456789.", *p) && sl < sizeof(spec) - 4){
+            spec[sl++] = *p++;
+        }
+        while(*p && strchr("hlLqjzt", *p)){
+            p++;
+        }
+        char conv = *p ? *p++ : 0;
+        if(!conv || next >= nargs){
+            break;
+        }
+        const plog_arg_t *a = &args[next++];
+        int n = 0;
+        switch(conv){
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                if(conv != 'c'){
+                    spec[sl++] = 'l';
+                    spec[sl++] = 'l';
+                }
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                if(conv == 'c'){
+                    n = snprintf(out + len, cap - len, spec, (int)a->i);
+                } else if(a->type == PLOG_ARG_DOUBLE){
+                    n = snprintf(out + len, cap - len, spec, (long long)a->d);
+                } else {
+                    n = snprintf(out + len, cap - len, spec, a->i);
+                }
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                n = snprintf(out + len, cap - len, spec,
+                             a->type == PLOG_ARG_DOUBLE ? a->d :
+                             a->type == PLOG_ARG_INT ? (double)a->i : (double)a->u);
+                break;
+            case 's':
+                spec[sl++] = 's';
+                spec[sl] = 0;
+                n = snprintf(out + len, cap - len, spec, a->type == PLOG_ARG_STR && a->s ? a->s : "(?)");
+                break;
+            default:
+                n = snprintf(out + len, cap - len, "%p", a->p);
+                break;
+        }
+        if(n > 0){
+            len += (size_t)n < cap - len ? (size_t)n : cap - len - 1;
+        }
+    }
+    out[len] = 0;
+    return len;
+}
+
+static void plog_drain_task(void *arg){
+    char line[PLOG_LINE_MAX + 48];
+    uint32_t reported_drops = 0;
+    for(;;){
+        uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        plog_slot_t *slot = &slots[pos & slot_mask];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        if(seq != pos + 1){
+            uint32_t drops = stat_dropped.load(std::memory_order_relaxed);
+            if(drops != reported_drops){
+                int n = snprintf(line, sizeof(line), "[plog] %u lines dropped\n", (unsigned)(drops - reported_drops));
+                Serial.write((const uint8_t *)line, n);
+                reported_drops = drops;
+            }
+            vTaskDelay(pdMS_TO_TICKS(PLOG_DRAIN_IDLE_MS));
+            continue;
+        }
+
+        int n = snprintf(line, sizeof(line), "[%6u.%03u] %c ",
+                         (unsigned)(slot->ms / 1000), (unsigned)(slot->ms % 1000),
+                         level_chars[slot->level & 3]);
+        if(slot->fmt){
+            n += plog_expand(line + n, sizeof(line) - n - 1, slot->fmt, slot->args, slot->nargs);
+        } else {
+            memcpy(line + n, slot->text, slot->len);
+            n += slot->len;
+        }
+        slot->seq.store(pos + slot_mask + 1, std::memory_order_release);
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+
+        line[n++] = '\n';
+        Serial.write((const uint8_t *)line, n);
+    }
+}
+
+// ESP-IDF log hook, keeps ESP_LOGx callers off the UART as well
+static int plog_idf_vprintf(const char *fmt, va_list ap){
+    if(plog_enabled(PLOG_INFO)){
+        plog_vformat(PLOG_INFO, 0, fmt, ap);
+    }
+    return 0;
+}
+
+bool plog_init(plog_level_t level, size_t count){
+    if(slots){
+        plog_set_level(level);
+        return true;
+    }
+    size_t n = 8;
+    while(n < count){
+        n <<= 1;
+    }
+    plog_slot_t *ring = (plog_slot_t *)calloc(n, sizeof(plog_slot_t));
+    if(!ring){
+        return false;
+    }
+    for(size_t i = 0; i < n; i++){
+        ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    slot_mask = n - 1;
+    slots = ring;
+    plog_set_level(level);
+
+    if(xTaskCreate(plog_drain_task, "plog", 3072, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS){
+        slots = NULL;
+        free(ring);
+        return false;
+    }
+    esp_log_set_vprintf(plog_idf_vprintf);
+    return true;
+}
+
+void plog_set_level(plog_level_t level){
+    plog_level.store(level, std::memory_order_relaxed);
+}
+
+void plog_get_stats(plog_stats_t *out){
+    out->written = stat_written.load(std::memory_order_relaxed);
+    out->dropped = stat_dropped.load(std::memory_order_relaxed);
+    out->suppressed = stat_suppressed.load(std::memory_order_relaxed);
+    out->truncated = stat_truncated.load(std::memory_order_relaxed);
+    out->high_water = stat_high_water.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,131 @@
+/*
+  Smart Plant Vision - Asynchronous Logger
+  Hot paths format into a lock-free ring; a low-priority task drains it to Serial.
+
+  PLOGE/PLOGW/PLOGI/PLOGD take printf-style arguments. Building with
+  -DPLOG_DEFERRED=1 switches them to binary mode: only the format pointer and
+  raw arguments are recorded and the drain task does the formatting. In that
+  mode every %s argument must point at storage that outlives the call.
+*/
+
+#ifndef PLANT_LOG_H
+#define PLANT_LOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#ifndef PLOG_DEFERRED
+#define PLOG_DEFERRED 0
+#endif
+
+#define PLOG_LINE_MAX 112   // Text bytes per ring slot, longer lines are truncated
+#define PLOG_MAX_ARGS 6     // Arguments per deferred record
+
+typedef enum {
+    PLOG_ERROR = 0,
+    PLOG_WARN,
+    PLOG_INFO,
+    PLOG_DEBUG
+} plog_level_t;
+
+typedef enum {
+    PLOG_ARG_INT = 0,
+    PLOG_ARG_UINT,
+    PLOG_ARG_DOUBLE,
+    PLOG_ARG_STR,
+    PLOG_ARG_PTR
+} plog_arg_type_t;
+
+typedef struct {
+    uint8_t type;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const char *s;
+        const void *p;
+    };
+} plog_arg_t;
+
+typedef struct {
+    uint32_t written;      // Records accepted into the ring
+    uint32_t dropped;      // Records lost because the ring was full
+    uint32_t suppressed;   // Records rejected by a rate limit
+    uint32_t truncated;    // Text records cut at PLOG_LINE_MAX
+    uint32_t high_water;   // Most slots ever pending at once
+} plog_stats_t;
+
+// Per call-site limiter state, see PLOG_LIMITED
+typedef struct {
+    std::atomic<uint32_t> window_ms;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+} plog_limit_t;
+
+// Allocates the ring (slots is rounded up to a power of two) and starts the drain task.
+// Also routes ESP-IDF log output through the ring.
+bool plog_init(plog_level_t level, size_t slots);
+void plog_set_level(plog_level_t level);
+void plog_get_stats(plog_stats_t *out);
+
+extern std::atomic<int> plog_level;
+static inline bool plog_enabled(plog_level_t level){
+    return (int)level <= plog_level.load(std::memory_order_relaxed);
+}
+
+void plog_write(plog_level_t level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void plog_vwrite(plog_level_t level, uint32_t suppressed, const char *fmt, va_list ap);
+void plog_record(plog_level_t level, const char *fmt, const plog_arg_t *args, uint8_t nargs);
+
+// Returns true when the call site may log; *suppressed receives the number of
+// calls dropped since the last one that was allowed.
+bool plog_limit_allow(plog_limit_t *lim, uint32_t per_sec, uint32_t *suppressed);
+void plog_write_limited(plog_level_t level, uint32_t suppressed, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Deferred argument packing
+static inline plog_arg_t plog_arg_i(long long v){ plog_arg_t a; a.type = PLOG_ARG_INT; a.i = v; return a; }
+static inline plog_arg_t plog_arg_u(unsigned long long v){ plog_arg_t a; a.type = PLOG_ARG_UINT; a.u = v; return a; }
+static inline plog_arg_t plog_arg(int v){ return plog_arg_i(v); }
+static inline plog_arg_t plog_arg(long v){ return plog_arg_i(v); }
+static inline plog_arg_t plog_arg(long long v){ return plog_arg_i(v); }
+static inline plog_arg_t plog_arg(unsigned v){ return plog_arg_u(v); }
+static inline plog_arg_t plog_arg(unsigned long v){ return plog_arg_u(v); }
+static inline plog_arg_t plog_arg(unsigned long long v){ return plog_arg_u(v); }
+static inline plog_arg_t plog_arg(double v){ plog_arg_t a; a.type = PLOG_ARG_DOUBLE; a.d = v; return a; }
+static inline plog_arg_t plog_arg(const char *v){ plog_arg_t a; a.type = PLOG_ARG_STR; a.s = v; return a; }
+static inline plog_arg_t plog_arg(const void *v){ plog_arg_t a; a.type = PLOG_ARG_PTR; a.p = v; return a; }
+
+template<typename... A>
+static inline void plog_deferred(plog_level_t level, const char *fmt, A... args){
+    static_assert(sizeof...(A) <= PLOG_MAX_ARGS, "too many deferred log arguments");
+    const plog_arg_t packed[sizeof...(A) + 1] = { plog_arg(args)... };
+    plog_record(level, fmt, packed, sizeof...(A));
+}
+
+#if PLOG_DEFERRED
+#define PLOG_EMIT(level, fmt, ...) plog_deferred(level, fmt, ##__VA_ARGS__)
+#else
+#define PLOG_EMIT(level, fmt, ...) plog_write(level, fmt, ##__VA_ARGS__)
+#endif
+
+#define PLOG(level, fmt, ...) do { \
+    if (plog_enabled(level)) PLOG_EMIT(level, fmt, ##__VA_ARGS__); \
+} while (0)
+
+#define PLOGE(fmt, ...) PLOG(PLOG_ERROR, fmt, ##__VA_ARGS__)
+#define PLOGW(fmt, ...) PLOG(PLOG_WARN, fmt, ##__VA_ARGS__)
+#define PLOGI(fmt, ...) PLOG(PLOG_INFO, fmt, ##__VA_ARGS__)
+#define PLOGD(fmt, ...) PLOG(PLOG_DEBUG, fmt, ##__VA_ARGS__)
+
+// At most per_sec lines per second from this call site; the next line that
+// gets through reports how many were suppressed.
+#define PLOG_LIMITED(level, per_sec, fmt, ...) do { \
+    static plog_limit_t _plog_lim; \
+    uint32_t _plog_sup; \
+    if (plog_enabled(level) && plog_limit_allow(&_plog_lim, (per_sec), &_plog_sup)) \
+        plog_write_limited(level, _plog_sup, fmt, ##__VA_ARGS__); \
+} while (0)
+
+#endif
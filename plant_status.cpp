@@ -0,0 +1,44 @@
+/*
+  Smart Plant Vision - /status Reply
+*/
+
+#include "plant_status.h"
+#include <stdio.h>
+
+int status_format(const status_field_t *fields, size_t n, char *buf, size_t len){
+    char *p = buf;
+    char *end = buf + len;
+    if(len < 3){
+        return -1;
+    }
+    *p++ = '{';
+    for(size_t i = 0; i < n; i++){
+        const status_field_t *f = &fields[i];
+        const char *sep = i + 1 < n ? "," : "";
+        int w;
+        switch(f->kind){
+        case STATUS_U64:
+            w = snprintf(p, end - p, "\"%s\":%llu%s", f->key, (unsigned long long)f->u64, sep);
+            break;
+        case STATUS_I32:
+            w = snprintf(p, end - p, "\"%s\":%d%s", f->key, (int)f->i32, sep);
+            break;
+        case STATUS_F32:
+            w = snprintf(p, end - p, "\"%s\":%.1f%s", f->key, (double)f->f32, sep);
+            break;
+        default:
+            w = snprintf(p, end - p, "\"%s\":%u%s", f->key, (unsigned)f->u32, sep);
+            break;
+        }
+        if(w < 0 || w >= end - p){
+            return -1;
+        }
+        p += w;
+    }
+    if(end - p < 2){
+        return -1;
+    }
+    *p++ = '}';
+    *p = 0;
+    return (int)(p - buf);
+}
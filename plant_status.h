@@ -0,0 +1,49 @@
+/*
+  Smart Plant Vision - /status Reply
+  status_handler builds its reply in two steps: status_collect() takes a
+  snapshot of every field as key, kind and value, then status_format()
+  writes them out as one flat JSON object with bounded writes. A reply that
+  would not fit is reported, never cut short or written past the buffer.
+
+  STATUS_JSON_MAX holds every field at its widest (10 digits for a
+  counter, 20 for the 64-bit byte counts, a float at -FLT_MAX), so a
+  device that runs long enough still gets its reply out; the fuzz target
+  formats such a snapshot to keep that true as fields are added.
+*/
+
+#ifndef PLANT_STATUS_H
+#define PLANT_STATUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATUS_FIELDS_MAX   64      // Fields a snapshot can hold
+#define STATUS_JSON_MAX     1536    // Reply buffer; the widest reply is 1212 bytes
+
+typedef enum {
+    STATUS_U32,
+    STATUS_U64,
+    STATUS_I32,
+    STATUS_F32,                     // Written with one decimal
+} status_kind_t;
+
+typedef struct {
+    const char *key;
+    status_kind_t kind;
+    union {
+        uint32_t u32;
+        uint64_t u64;
+        int32_t i32;
+        float f32;
+    };
+} status_field_t;
+
+// Snapshot of the device, in reply order; returns the number of fields.
+// Defined in esp32_camera_server.cpp, next to the settings it reports.
+size_t status_collect(status_field_t *fields, size_t max);
+
+// Writes the fields as {"key":value,...}; returns the length, or -1 when
+// the object doesn't fit in len bytes with its terminating NUL
+int status_format(const status_field_t *fields, size_t n, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+  Smart Plant Vision - Adaptive Sensor Rate
+  Updated from the loop task; the bounds are set from the web server's.
+*/
+
+#include "sensor_rate.h"
+#include <math.h>
+#include <atomic>
+
+static std::atomic<uint32_t> min_ms(SENSOR_MIN_MS);
+static std::atomic<uint32_t> max_ms(SENSOR_MAX_MS);
+static std::atomic<uint32_t> interval_ms(SENSOR_START_MS);
+
+// The previous good reading of each signal, NAN before the first
+static float last[3] = {NAN, NAN, NAN};
+static const float steps[3] = {SENSOR_STEP_TEMP, SENSOR_STEP_HUM, SENSOR_STEP_SOIL};
+
+uint32_t sensor_rate_update(float temperature, float humidity, float soil){
+    const float now[3] = {temperature, humidity, soil};
+    float moved = 0;                          // Largest change, in steps
+    for(int i = 0; i < 3; i++){
+        if(isnan(now[i])){
+            continue;
+        }
+        if(!isnan(last[i])){
+            moved = fmaxf(moved, fabsf(now[i] - last[i]) / steps[i]);
+        }
+        last[i] = now[i];
+    }
+
+    uint32_t lo = min_ms.load(), hi = max_ms.load();
+    uint32_t next = interval_ms.load();
+    if(moved >= SENSOR_JUMP_STEPS){
+        next = lo;
+    } else if(moved >= 1){
+        next /= 2;
+    } else {
+        next += next / 2;
+    }
+    next = next < lo ? lo : next > hi ? hi : next;
+    interval_ms.store(next);
+    return next;
+}
+
+bool sensor_rate_set_bounds(uint32_t lo, uint32_t hi){
+    if(lo < 100 || lo > hi || hi > SENSOR_LIMIT_MS){
+        return false;
+    }
+    min_ms.store(lo);
+    max_ms.store(hi);
+    return true;
+}
+
+uint32_t sensor_rate_min(void){
+    return min_ms.load();
+}
+
+uint32_t sensor_rate_max(void){
+    return max_ms.load();
+}
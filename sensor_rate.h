@@ -0,0 +1,40 @@
+/*
+  Smart Plant Vision - Adaptive Sensor Rate
+  Picks the interval to the next sensor reading from how the readings move.
+  Each reading's change from the one before is measured in steps, a change
+  per signal that matters (SENSOR_STEP_*); the largest of the three decides:
+
+  - SENSOR_JUMP_STEPS or more: something is happening (a watering, the sun
+    on the pot), read again after the shortest interval
+  - a step or more: halve the interval
+  - less: lengthen it by half
+
+  So a steady trend is read about once per step it moves, flat signals at
+  night end up at the longest interval and the first reading of a watering
+  brings it down to the shortest. A step is well above the sensors' noise,
+  so noise alone lets the interval grow.
+*/
+
+#ifndef SENSOR_RATE_H
+#define SENSOR_RATE_H
+
+#include <stdint.h>
+
+#define SENSOR_MIN_MS       1000    // Default bounds of the interval
+#define SENSOR_MAX_MS       60000
+#define SENSOR_START_MS     5000
+#define SENSOR_LIMIT_MS     3600000 // Longest bound that can be set
+#define SENSOR_STEP_TEMP    0.3f    // Degrees C
+#define SENSOR_STEP_HUM     1.5f    // Percent relative humidity
+#define SENSOR_STEP_SOIL    1.5f    // Percent soil moisture
+#define SENSOR_JUMP_STEPS   3
+
+// Takes a reading (NAN for a failed one) and returns the interval to the next, in ms
+uint32_t sensor_rate_update(float temperature, float humidity, float soil);
+
+// Interval bounds; false unless 100 <= min_ms <= max_ms <= SENSOR_LIMIT_MS
+bool sensor_rate_set_bounds(uint32_t min_ms, uint32_t max_ms);
+uint32_t sensor_rate_min(void);
+uint32_t sensor_rate_max(void);
+
+#endif
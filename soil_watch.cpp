@@ -0,0 +1,101 @@
+/*
+  Smart Plant Vision - Soil Watch
+  Runs in the loop task from readSensors(); the state below is that task's.
+*/
+
+#include "soil_watch.h"
+#include <atomic>
+#include "plant_events.h"
+#include "plant_log.h"
+
+static std::atomic<bool> still_on(false);
+
+static int ref_samples = 0;           // Samples in the reference so far
+static float ref = 0;                 // Reference level
+static float ref_t_ms = 0;            // Mean time of its samples
+static float wetter = 0, drier = 0;   // CUSUM sums
+static bool rising = false;           // Watered, the level is still going up
+static float peak = 0;
+static bool dry_reported = false;
+
+static void restart(void){
+    ref_samples = 0;
+    wetter = drier = 0;
+}
+
+static bool take_still(void){
+    return still_on.load() && pev_still_capture();
+}
+
+static soil_change_t watered(float pct){
+    bool still = take_still();
+    uint32_t id = pev_emit("watered", "\"soil\":%.1f,\"from\":%.1f,\"still\":%u", pct, ref, still ? 1 : 0);
+    if(still){
+        pev_still_attach(id);
+    }
+    PLOGI("Soil watered: %.1f%% -> %.1f%%", ref, pct);
+    rising = true;
+    peak = pct;
+    dry_reported = false;
+    return SOIL_WATERED;
+}
+
+soil_change_t soil_watch_sample(float pct, uint32_t t_ms){
+    if(rising){
+        if(pct > peak){
+            peak = pct;
+            return SOIL_STEADY;
+        }
+        rising = false;
+        restart();
+    }
+    if(ref_samples < SOIL_REF_SAMPLES){
+        // A watering while the reference is being taken: the sum would be past its limit in one sample
+        if(ref_samples && pct - ref > SOIL_SLACK_PCT + SOIL_WATER_LIMIT){
+            return watered(pct);
+        }
+        if(!ref_samples){
+            ref = ref_t_ms = 0;
+        }
+        ref_samples++;
+        ref += (pct - ref) / ref_samples;
+        ref_t_ms += (t_ms - ref_t_ms) / ref_samples;
+        return SOIL_STEADY;
+    }
+
+    wetter = wetter + pct - ref - SOIL_SLACK_PCT;
+    wetter = wetter > 0 ? wetter : 0;
+    drier = drier + ref - pct - SOIL_SLACK_PCT;
+    drier = drier > 0 ? drier : 0;
+
+    if(wetter > SOIL_WATER_LIMIT){
+        return watered(pct);
+    }
+    if(drier > SOIL_DRY_LIMIT){
+        // The reference follows the level down, so a watering is measured from where the soil is now
+        restart();
+        if(dry_reported){
+            return SOIL_STEADY;
+        }
+        float hours = (t_ms - ref_t_ms) / 3600000.0f;
+        float rate = hours > 0 ? (ref - pct) / hours : 0;
+        bool still = take_still();
+        uint32_t id = pev_emit("drying", "\"soil\":%.1f,\"from\":%.1f,\"per_hour\":%.2f,\"still\":%u",
+                               pct, ref, rate, still ? 1 : 0);
+        if(still){
+            pev_still_attach(id);
+        }
+        PLOGI("Soil drying: %.1f%% -> %.1f%% (%.2f%%/h)", ref, pct, rate);
+        dry_reported = true;
+        return SOIL_DRYING;
+    }
+    return SOIL_STEADY;
+}
+
+void soil_watch_set_still(bool on){
+    still_on.store(on);
+}
+
+bool soil_watch_still_enabled(void){
+    return still_on.load();
+}
@@ -0,0 +1,42 @@
+/*
+  Smart Plant Vision - Soil Watch
+  Notices watering and drying on the soil moisture series as each sample is
+  read, so there is no history for a client to scan. Two CUSUM sums, one
+  each way, collect how far the samples stray from a reference level beyond
+  a slack for noise; when one passes its limit the soil has changed:
+
+  - "watered": the soil got wetter. A watering is a step of tens of percent,
+    so this fires on the first sample after it
+  - "drying": the soil has been getting drier since the reference was taken,
+    reported once per drying spell with the rate
+
+  The reference is taken again each time the drier sum passes its limit, and
+  after a watering once the level stops rising.
+  State is a few numbers; each sample costs the same.
+*/
+
+#ifndef SOIL_WATCH_H
+#define SOIL_WATCH_H
+
+#include <stdint.h>
+
+#define SOIL_REF_SAMPLES    8       // Samples averaged into the reference level
+#define SOIL_SLACK_PCT      1.0f    // Percentage points from the reference that are noise
+#define SOIL_WATER_LIMIT    4.0f    // Sum above the reference, in percentage points, that means watered
+#define SOIL_DRY_LIMIT      4.0f    // Sum below it that means drying
+
+typedef enum {
+    SOIL_STEADY,
+    SOIL_WATERED,
+    SOIL_DRYING,
+} soil_change_t;
+
+// Feeds one sample (soil moisture in percent, unrounded) taken at t_ms;
+// emits the event and returns what changed, if anything
+soil_change_t soil_watch_sample(float pct, uint32_t t_ms);
+
+// Take a full resolution still with soil events, see pev_still_capture()
+void soil_watch_set_still(bool on);
+bool soil_watch_still_enabled(void);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+  Smart Plant Vision - Tile Diff Stream
+  Change detection runs on the 1/8 scale decode, which only needs each 8x8
+  block's DC coefficient: four averages per tile, cheap enough for every
+  frame and blind to the pixel noise a sensor adds. The full decode is only
+  done for frames that have tiles to send. A tile's reference is what the
+  viewer was last sent for it, so a slow drift is sent once it adds up.
+*/
+
+#include "tile_stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "camera_modes.h"
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "plant_log.h"
+
+#define TILE_HEAD       12
+#define TILE_ATLAS_COLS 32     // 512 pixels wide
+#define TILE_KEY_SHARE  4      // A keyframe instead once more than 1 / 4 of the tiles changed
+
+struct tile_stream {
+    uint16_t width, height;
+    int cols, rows;           // Tile grid
+    int bw, bh;               // 8x8 block grid
+    uint8_t *dc_ref;          // RGB565 block means the viewer has
+    uint8_t *dc_cur;          // ... and the ones in this frame
+    uint8_t *pixels;          // Full decode, RGB565
+    uint8_t *atlas;           // Changed tiles side by side, RGB565
+    uint8_t *head;            // Header and tile list
+    uint8_t *out;             // Atlas JPEG
+    size_t out_cap, out_len;
+    int64_t key_us;           // Last keyframe, 0 for none yet
+    camera_fb_t *fb;          // Held while a keyframe is sent
+};
+
+static std::atomic<uint32_t> stat_keys(0);
+static std::atomic<uint32_t> stat_updates(0);
+static std::atomic<uint32_t> stat_unchanged(0);
+static std::atomic<uint32_t> stat_tiles(0);
+static std::atomic<uint64_t> stat_bytes(0);
+static std::atomic<uint64_t> stat_frame_bytes(0);
+
+static void free_buffers(tile_stream_t *t){
+    heap_caps_free(t->dc_ref);
+    heap_caps_free(t->dc_cur);
+    heap_caps_free(t->pixels);
+    heap_caps_free(t->atlas);
+    heap_caps_free(t->head);
+    t->dc_ref = t->dc_cur = t->pixels = t->atlas = t->head = NULL;
+    t->width = t->height = 0;
+}
+
+// Buffers for one frame size; the largest atlas is the most tiles sent
+// without a keyframe
+static bool size_for(tile_stream_t *t, uint16_t width, uint16_t height){
+    free_buffers(t);
+    t->cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+    t->rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    t->bw = width / 8;
+    t->bh = height / 8;
+    int max_tiles = t->cols * t->rows / TILE_KEY_SHARE;
+    if(!max_tiles){
+        max_tiles = 1;
+    }
+    int atlas_rows = (max_tiles + TILE_ATLAS_COLS - 1) / TILE_ATLAS_COLS;
+    t->dc_ref = (uint8_t *)heap_caps_malloc((size_t)t->bw * t->bh * 2, MALLOC_CAP_SPIRAM);
+    t->dc_cur = (uint8_t *)heap_caps_malloc((size_t)t->bw * t->bh * 2, MALLOC_CAP_SPIRAM);
+    t->pixels = (uint8_t *)heap_caps_malloc((size_t)width * height * 2, MALLOC_CAP_SPIRAM);
+    t->atlas = (uint8_t *)heap_caps_malloc((size_t)TILE_ATLAS_COLS * TILE_SIZE * atlas_rows * TILE_SIZE * 2,
+                                           MALLOC_CAP_SPIRAM);
+    t->head = (uint8_t *)heap_caps_malloc(TILE_HEAD + (size_t)t->cols * t->rows * 2, MALLOC_CAP_SPIRAM);
+    if(!t->dc_ref || !t->dc_cur || !t->pixels || !t->atlas || !t->head){
+        PLOG_LIMITED(PLOG_ERROR, 2, "No memory for tile diffs at %ux%u", width, height);
+        free_buffers(t);
+        return false;
+    }
+    t->width = width;
+    t->height = height;
+    t->key_us = 0;
+    return true;
+}
+
+tile_stream_t *tile_stream_new(void){
+    return (tile_stream_t *)calloc(1, sizeof(tile_stream_t));
+}
+
+void tile_stream_free(tile_stream_t *t){
+    if(!t){
+        return;
+    }
+    if(t->fb){
+        cam_modes_fb_return(t->fb);
+    }
+    free_buffers(t);
+    heap_caps_free(t->out);
+    free(t);
+}
+
+static bool block_changed(const uint8_t *a, const uint8_t *b){
+    uint16_t va = (a[0] << 8) | a[1], vb = (b[0] << 8) | b[1];
+    int dr = (int)((va >> 8) & 0xF8) - (int)((vb >> 8) & 0xF8);
+    int dg = (int)((va >> 3) & 0xFC) - (int)((vb >> 3) & 0xFC);
+    int db = (int)((va << 3) & 0xF8) - (int)((vb << 3) & 0xF8);
+    return abs(dr) > TILE_THRESHOLD || abs(dg) > TILE_THRESHOLD || abs(db) > TILE_THRESHOLD;
+}
+
+// Tiles whose blocks moved away from the reference, listed in the header; returns the count
+static int changed_tiles(tile_stream_t *t){
+    uint8_t *list = t->head + TILE_HEAD;
+    int n = 0;
+    for(int ty = 0; ty < t->rows; ty++){
+        for(int tx = 0; tx < t->cols; tx++){
+            bool changed = false;
+            for(int by = ty * 2; by < ty * 2 + 2 && by < t->bh && !changed; by++){
+                for(int bx = tx * 2; bx < tx * 2 + 2 && bx < t->bw && !changed; bx++){
+                    size_t i = ((size_t)by * t->bw + bx) * 2;
+                    changed = block_changed(t->dc_ref + i, t->dc_cur + i);
+                }
+            }
+            if(changed){
+                uint16_t idx = ty * t->cols + tx;
+                list[n * 2] = idx & 0xFF;
+                list[n * 2 + 1] = idx >> 8;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+static void put_head(tile_stream_t *t, uint8_t type, int count){
+    uint8_t *h = t->head;
+    h[0] = 'P';
+    h[1] = 'T';
+    h[2] = type;
+    h[3] = TILE_SIZE;
+    h[4] = t->width & 0xFF;  h[5] = t->width >> 8;
+    h[6] = t->height & 0xFF; h[7] = t->height >> 8;
+    h[8] = count & 0xFF;     h[9] = count >> 8;
+    h[10] = TILE_ATLAS_COLS; h[11] = 0;
+}
+
+static size_t tile_write(void *arg, size_t index, const void *data, size_t len){
+    tile_stream_t *t = (tile_stream_t *)arg;
+    if(!len){
+        return 0;
+    }
+    if(index + len > t->out_cap){
+        size_t cap = t->out_cap ? t->out_cap : 8192;
+        while(cap < index + len){
+            cap *= 2;
+        }
+        uint8_t *b = (uint8_t *)heap_caps_realloc(t->out, cap, MALLOC_CAP_SPIRAM);
+        if(!b){
+            return 0;
+        }
+        t->out = b;
+        t->out_cap = cap;
+    }
+    memcpy(t->out + index, data, len);
+    t->out_len = index + len;
+    return len;
+}
+
+// Copies the listed tiles into the atlas and encodes it; the edge tiles of
+// a frame that isn't a multiple of 16 high are padded with black
+static bool encode_atlas(tile_stream_t *t, int count){
+    const uint8_t *list = t->head + TILE_HEAD;
+    int atlas_w = TILE_ATLAS_COLS * TILE_SIZE;
+    int atlas_rows = (count + TILE_ATLAS_COLS - 1) / TILE_ATLAS_COLS;
+    int atlas_h = atlas_rows * TILE_SIZE;
+    memset(t->atlas, 0, (size_t)atlas_w * atlas_h * 2);
+    for(int i = 0; i < count; i++){
+        int idx = list[i * 2] | (list[i * 2 + 1] << 8);
+        int sx = (idx % t->cols) * TILE_SIZE, sy = (idx / t->cols) * TILE_SIZE;
+        int dx = (i % TILE_ATLAS_COLS) * TILE_SIZE, dy = (i / TILE_ATLAS_COLS) * TILE_SIZE;
+        int w = t->width - sx < TILE_SIZE ? t->width - sx : TILE_SIZE;
+        for(int y = 0; y < TILE_SIZE && sy + y < t->height; y++){
+            memcpy(t->atlas + ((size_t)(dy + y) * atlas_w + dx) * 2,
+                   t->pixels + ((size_t)(sy + y) * t->width + sx) * 2, w * 2);
+        }
+        // The viewer has this tile now
+        for(int by = sy / 8; by < sy / 8 + 2 && by < t->bh; by++){
+            memcpy(t->dc_ref + ((size_t)by * t->bw + sx / 8) * 2, t->dc_cur + ((size_t)by * t->bw + sx / 8) * 2,
+                   (sx / 8 + 1 < t->bw ? 2 : 1) * 2);
+        }
+    }
+    t->out_len = 0;
+    return fmt2jpg_cb(t->atlas, (size_t)atlas_w * atlas_h * 2, atlas_w, atlas_h, PIXFORMAT_RGB565,
+                      TILE_QUALITY, tile_write, t);
+}
+
+bool tile_stream_next(tile_stream_t *t, tile_update_t *u){
+    for(;;){
+        cam_frame_info_t fi;
+        camera_fb_t *fb = cam_modes_fb_get(CAM_MODE_PREVIEW, &fi);
+        if(!fb){
+            return false;
+        }
+        if(fb->format != PIXFORMAT_JPEG ||
+           ((fb->width != t->width || fb->height != t->height) && !size_for(t, fb->width, fb->height)) ||
+           !jpg2rgb565(fb->buf, fb->len, t->dc_cur, JPG_SCALE_8X)){
+            cam_modes_fb_return(fb);
+            return false;
+        }
+        stat_frame_bytes += fb->len;
+        int64_t now = esp_timer_get_time();
+        int total = t->cols * t->rows;
+        int count = changed_tiles(t);
+        u->seq = fi.seq;
+        u->grab_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        u->head = t->head;
+
+        if(!t->key_us || now - t->key_us >= (int64_t)TILE_KEY_MS * 1000 || count * TILE_KEY_SHARE > total){
+            memcpy(t->dc_ref, t->dc_cur, (size_t)t->bw * t->bh * 2);
+            put_head(t, 0, 0);
+            t->key_us = now;
+            t->fb = fb;
+            u->key = true;
+            u->head_len = TILE_HEAD;
+            u->jpg = fb->buf;
+            u->jpg_len = fb->len;
+            stat_keys++;
+            stat_bytes += TILE_HEAD + fb->len;
+            return true;
+        }
+        if(!count){
+            cam_modes_fb_return(fb);
+            stat_unchanged++;
+            continue;
+        }
+
+        bool decoded = jpg2rgb565(fb->buf, fb->len, t->pixels, JPG_SCALE_NONE);
+        cam_modes_fb_return(fb);
+        if(!decoded || !encode_atlas(t, count)){
+            PLOG_LIMITED(PLOG_WARN, 2, "Tile update for frame %u failed", fi.seq);
+            return false;
+        }
+        put_head(t, 1, count);
+        u->key = false;
+        u->head_len = TILE_HEAD + (size_t)count * 2;
+        u->jpg = t->out;
+        u->jpg_len = t->out_len;
+        stat_updates++;
+        stat_tiles += count;
+        stat_bytes += u->head_len + u->jpg_len;
+        return true;
+    }
+}
+
+void tile_stream_done(tile_stream_t *t, tile_update_t *u){
+    if(u->key && t->fb){
+        cam_modes_fb_return(t->fb);
+        t->fb = NULL;
+    }
+}
+
+void tile_get_stats(tile_stats_t *out){
+    out->keys = stat_keys.load();
+    out->updates = stat_updates.load();
+    out->unchanged = stat_unchanged.load();
+    out->tiles = stat_tiles.load();
+    out->bytes = stat_bytes.load();
+    out->frame_bytes = stat_frame_bytes.load();
+}
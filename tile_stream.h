@@ -0,0 +1,65 @@
+/*
+  Smart Plant Vision - Tile Diff Stream
+  For a mostly still scene: each preview frame is split into 16x16 tiles
+  (whole JPEG MCUs at 4:2:0 and 4:2:2) and only the tiles that changed since
+  the viewer last got them are sent, packed side by side into one small JPEG
+  with a list of where they go. A keyframe (the camera's own JPEG) starts
+  the stream and follows every TILE_KEY_MS, after a framesize change, and
+  whenever so much changed that the frame itself is cheaper.
+
+  Each update goes out as one binary part, little-endian:
+    0   'P' 'T'
+    2   u8  type: 0 keyframe, 1 tiles
+    3   u8  tile size (16)
+    4   u16 frame width, u16 frame height
+    8   u16 tile count N, u16 atlas columns
+    12  N x u16 tile index, row-major over ceil(width / 16) columns
+        then the JPEG: the whole frame, or the atlas with tile i at
+        column i % atlas columns, row i / atlas columns
+*/
+
+#ifndef TILE_STREAM_H
+#define TILE_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_SIZE       16
+#define TILE_KEY_MS     10000  // Longest run of tile updates between keyframes
+#define TILE_THRESHOLD  12     // Change in an 8x8 block's mean R, G or B that makes its tile stale
+#define TILE_QUALITY    75     // Atlas JPEG quality, 1 to 100
+
+typedef struct tile_stream tile_stream_t;
+
+typedef struct {
+    bool key;
+    uint32_t seq;             // Preview frame it came from
+    int64_t grab_us;
+    const uint8_t *head;      // Header and tile list
+    size_t head_len;
+    const uint8_t *jpg;       // Frame or atlas
+    size_t jpg_len;
+} tile_update_t;
+
+typedef struct {
+    uint32_t keys;
+    uint32_t updates;         // Frames sent as tiles
+    uint32_t unchanged;       // Frames with nothing to send
+    uint32_t tiles;           // Tiles sent in those updates
+    uint64_t bytes;           // Parts sent, headers included
+    uint64_t frame_bytes;     // What sending every frame whole would have taken
+} tile_stats_t;
+
+// One per viewer; NULL when out of memory
+tile_stream_t *tile_stream_new(void);
+void tile_stream_free(tile_stream_t *t);
+
+// Waits for the next preview frame that has something to send and fills in
+// the update; false when no frame could be had or it couldn't be decoded.
+// Pass the update to tile_stream_done() once it is sent.
+bool tile_stream_next(tile_stream_t *t, tile_update_t *u);
+void tile_stream_done(tile_stream_t *t, tile_update_t *u);
+
+void tile_get_stats(tile_stats_t *out);
+
+#endif